@@ -4,6 +4,7 @@
 #include "common.h"
 #include <hash_map>
 #include <vector>
+#include <xmmintrin.h>
 #include "helpers.h"
 #include "OptionManager.h"
 #include "Logger.h"
@@ -141,6 +142,42 @@ typedef struct BSPTreeInfo_t {
 #define BSP_FILEIDSTRING "BSPTREE"
 #define BSP_FILEIDSTRINGLEN strlen(BSP_FILEIDSTRING)
 
+// binned SAH: nodes smaller than this are binned by one thread
+#define SAH_PARALLEL_BINNING 65536
+// binned SAH: subtrees are handed to threads once they are at most this large
+#define SAH_MIN_JOB_SIZE 1024
+
+/**
+ * Per-triangle data for the binned SAH, gathered once before subdivision so that
+ * the recursion does not touch the vertex cache.
+ */
+typedef struct SAHTriInfo_t {
+	__m128 min;
+	__m128 max;
+	__m128 centroid;
+} SAHTriInfo;
+
+typedef struct SAHBin_t {
+	__m128 min;
+	__m128 max;
+	int count;
+} SAHBin;
+
+// subtree of the binned SAH which is built by one thread
+typedef struct SAHJob_t {
+	unsigned int left, right;
+	unsigned int myIndex, nextIndex;
+	int depth;
+} SAHJob;
+
+// statistics of a binned SAH subtree, merged into treeStats
+typedef struct SAHBuildStats_t {
+	int numLeafs;
+	unsigned int sumDepth;
+	unsigned int sumTris;
+	int maxDepth;
+} SAHBuildStats;
+
 #define BSP_STACKPADDING (48 - 8*sizeof(float) - sizeof(BSPArrayTreeNodePtr))
 
 #define TEST_TYPE 7
@@ -198,6 +235,7 @@ public:
 		subdivisionMode = BSP_SUBDIVISIONMODE_NORMAL;
 		minvals = NULL;
 		maxvals = NULL;
+		sahTriInfos = NULL;
 
 //		testFile = fopen(testFileName, "w");
 		numCase1 = 0;
@@ -248,6 +286,7 @@ public:
 		subdivisionMode = BSP_SUBDIVISIONMODE_NORMAL;
 		minvals = NULL;
 		maxvals = NULL;
+		sahTriInfos = NULL;
 
 //		testFile = fopen(testFileName, "w");
 		numCase1 = 0;
@@ -367,6 +406,22 @@ public:
 	};
 	bool SubdivideSAH(TriangleIndexList *triIDs, unsigned int left, unsigned int right, unsigned int myIndex, unsigned int nextIndex, int depth);
 	bool SubdivideSAHSingle(TriangleIndexList *triIDs, unsigned int left, unsigned int right, unsigned int myIndex, unsigned int nextIndex, int depth);
+
+	/**
+	 * Binned SAH (SAH_NUM_BINS bins per axis). Node offsets are derived from triangle
+	 * counts (a subtree of n triangles has 2n-1 nodes and its leaves start at index
+	 * left), so that subtrees can be built in any order. If jobs is given, subtrees
+	 * of at most jobSize triangles are not built but appended to it.
+	 */
+	void SubdivideSAHBinned(TriangleIndexList *triIDs, unsigned int left, unsigned int right, unsigned int myIndex, unsigned int nextIndex, int depth, SAHBuildStats &stats, std::vector<SAHJob> *jobs, unsigned int jobSize);
+	void boundSAHCentroids(const TriangleIndexList *triIDs, unsigned int left, unsigned int right, __m128 &cmin, __m128 &cmax);
+	void binSAHTriangles(const TriangleIndexList *triIDs, unsigned int left, unsigned int right, const __m128 &cmin, const __m128 &scale, SAHBin bins[3][SAH_NUM_BINS]);
+	void boundSAHTriangles(const TriangleIndexList *triIDs, unsigned int left, unsigned int right, Vector3 &min, Vector3 &max);
+
+	/**
+	 * SAH cost of the built tree, relative to the root surface area
+	 */
+	float computeSAHCost();
 //	bool Subdivide(TriangleIndexList *triIDs, TriangleIndexList *subTriIDs, unsigned int left, unsigned int right, unsigned int myIndex = 0, unsigned int nextIndex = 1);
 
 	/**
@@ -402,6 +457,7 @@ public:
 	int            *indexlists;		 // array containing all triangle index lists after construction	
 	Vector3		   *minvals,		 // list of min/max values of all tris, used for balancing
 				   *maxvals;
+	SAHTriInfo	   *sahTriInfos;	 // bounds and centroids of all tris, used for binned SAH
 	unsigned int	treeID;			 // unique ID for this tree, used for filenames
 
 
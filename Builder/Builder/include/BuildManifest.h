@@ -0,0 +1,110 @@
+#ifndef BUILD_MANIFEST_H
+#define BUILD_MANIFEST_H
+/********************************************************************
+	file base:	BuildManifest
+	file ext:	h
+
+	comment:	Records of the completed build stages in an output
+				directory. A stage has a key, hashed from its inputs,
+				options and the keys of the stages it depends on, and
+				the size and content hash of each output file. A stage
+				is skipped only if the key matches and all outputs are
+				intact, so that stale or truncated files of a crashed
+				run are never reused.
+				Changes are appended to the manifest as a journal, it
+				is rewritten as a whole only when it is loaded.
+*********************************************************************/
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdio.h>
+
+class BuildManifest
+{
+public:
+	typedef unsigned __int64 Hash;
+
+	enum
+	{
+		VERSION = 2
+	};
+
+	static const Hash HASH_SEED = 0xcbf29ce484222325ULL;
+
+	BuildManifest(const std::string &fileName);
+
+	// reads the manifest and compacts its journal, returns false if there is none (nothing is up to date then)
+	bool load();
+
+	// writes to a temporary file first, a crash never leaves a partial manifest
+	bool save();
+
+	/**
+	* Content hash of an input file. The hash is cached in the manifest with
+	* size and modification time of the file, unchanged inputs are not read again.
+	*/
+	Hash hashInput(const std::string &fileName);
+
+	/**
+	* True if the stage was completed with the same key and its outputs are intact.
+	* Outputs with the recorded size and modification time are not read, the others
+	* are hashed.
+	*/
+	bool isUpToDate(const char *stageName, Hash key);
+
+	// hashes the outputs and records the stage, the record is appended to the manifest
+	void commit(const char *stageName, Hash key, const std::vector<std::string> &outputs);
+
+	// removes the record before a stage rewrites its outputs, or all records starting with the name
+	void invalidate(const char *stageName, bool isPrefix = false);
+
+	static Hash hashData(const void *data, size_t size, Hash seed = HASH_SEED);
+	static Hash hashString(const char *str, Hash seed = HASH_SEED);
+	// returns 0 if the file cannot be read
+	static Hash hashFile(const std::string &fileName, __int64 *size = NULL);
+
+	template <class T>
+	static Hash hashValue(const T &value, Hash seed = HASH_SEED)
+	{
+		return hashData(&value, sizeof(T), seed);
+	}
+
+protected:
+	typedef struct Output_t {
+		std::string fileName;
+		__int64 size;
+		__int64 modifiedTime;
+		Hash hash;
+	} Output;
+
+	typedef struct Stage_t {
+		Hash key;
+		std::vector<Output> outputs;
+	} Stage;
+
+	typedef struct Input_t {
+		__int64 size;
+		__int64 modifiedTime;
+		Hash hash;
+	} Input;
+
+	typedef std::map<std::string, Stage> StageMap;
+	typedef std::map<std::string, Input> InputMap;
+
+	std::string m_fileName;
+	StageMap m_stages;
+	InputMap m_inputs;
+	bool m_hasFile;		// the manifest exists with a valid header, records can be appended
+
+	bool saveUnlocked();
+
+	// append records to the manifest, called in the critical section
+	FILE *openJournal();
+	void closeJournal(FILE *fp);
+
+	static void writeInput(FILE *fp, const std::string &fileName, const Input &input);
+	static void writeStage(FILE *fp, const std::string &stageName, const Stage &stage);
+};
+
+#endif
\ No newline at end of file
@@ -13,12 +13,6 @@ public:
 	int *verts;				// vertex indices
 };
 
-typedef struct FaceStr_t
-{
-	int n;
-	std::string *f;
-} FaceStr;
-
 class Material
 {
 public:
@@ -35,6 +35,9 @@ public:
 	static TCReturnType convert(const char *filePath);
 	static TCReturnType convert(const char *filePath, GeomType from, GeomType to, int cluster = -1);
 	static TCReturnType convertCluster(const char *filePath);
+
+	// write vertex_pos.ooc and vertex_attrib.ooc from a GPU converted vertex.ooc
+	static TCReturnType splitVert(const char *filePath);
 };
 
 #endif
\ No newline at end of file
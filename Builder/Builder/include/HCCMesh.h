@@ -15,6 +15,11 @@
 #define MAX_SIZE_TEMPLATE 15
 #define DEPTH_TEMPLATE 4
 #define MAX_NUM_TEMPLATES 26
+// a shape of the top DEPTH_TEMPLATE-1 levels with its leading bit needs 8 bits
+#define NUM_TEMPLATE_SHAPES 256
+
+// number of clusters compressed in parallel before they are written in order
+#define CLUSTER_BATCH_SIZE 1024
 
 #define BIT_MASK_16 0xFFFF
 #define BIT_MASK_14 0x3FFF
@@ -181,6 +186,8 @@ protected :
 	} TemplateTable, *TemplateTablePtr;
 
 	int numTemplates;
+	// template index by shape of a subtree, -1 if no template has the shape
+	int templateByShape[NUM_TEMPLATE_SHAPES];
 
 	class TreeStat {
 	public :
@@ -222,6 +229,16 @@ protected :
 	typedef stdext::hash_set<unsigned int> ProcessedClusters;
 	ProcessedClusters processedClusters;
 
+	// root of a cluster found by the traversal, clusters are compressed after it
+	typedef struct ClusterJob_t {
+		unsigned int nodeIndex;
+		int numNodes;
+	} ClusterJob;
+	vector<ClusterJob> clusterJobs;
+
+	// last compressed cluster as it is stored in the cluster file
+	vector<unsigned char> clusterData;
+
 #ifdef USE_LOD
 	OOCFile64<LODNode> *LODs;
 	vector<LODNode> highLOD;
@@ -345,7 +362,10 @@ protected :
 #endif
 
 	int convertHCCMesh(unsigned int nodeIndex, int &numNodes, VertexHash &v, int depth, unsigned int parentIndex, int type);
-	unsigned int makeCluster(unsigned int nodeIndex, int numNodes, unsigned int parentIndex, int type);
+	unsigned int addCluster(unsigned int nodeIndex, int numNodes);
+	int compressClusters();
+	void initWorker(const HCCMesh &master);
+	unsigned int makeCluster(unsigned int nodeIndex, int numNodes);
 
 	int convertHCCMesh2(unsigned int nodeIndex, VertexSet &vs);
 	int makeCluster2(unsigned int nodeIndex);
@@ -372,6 +392,10 @@ protected :
 
 	int findCorrIndex(unsigned int startIndexS, unsigned int startIndexT, TREE_CLASS t[], unsigned int map[]);
 
+	int getTreeShape(unsigned int startIndex, int depth, int shape, TREE_CLASS t[] = NULL);
+	void initTemplateShapes();
+	int findTemplate(unsigned int startIndex);
+
 	unsigned int CGETLEFTCHILD(CTREE_CLASS* node, TravStat &ts, unsigned int &minBB);
 	unsigned int CGETRIGHTCHILD(CTREE_CLASS* node, TravStat &ts, unsigned int &maxBB);
 	TREE_CLASS* CGETNODE(unsigned int index, TravStat &ts, unsigned int minBB, unsigned int maxBB);
@@ -173,6 +173,10 @@ public:
 	int getNrVertices();
 	/// return the number of faces
 	int getNrFaces();
+	/// return the number of elements from the header, keeps the read position
+	int getNrElements(const char *elemName) const;
+	/// return the current position in the file, 0 if unknown (e.g. gzipped)
+	__int64 getFilePosition() const;
 };
 
 /** reads from a ply file*/
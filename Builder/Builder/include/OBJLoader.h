@@ -6,6 +6,8 @@
 	author:		Tae-Joon Kim (tjkim.kaist@gmail.com)
 	
 	comment:	OBJLoader class, load WaveFrontOBJ (.obj) and MTL (.mtl) file formats.
+				The file is memory mapped and split into line aligned chunks
+				which are parsed in parallel, then merged in file order.
 *********************************************************************/
 
 #pragma once
@@ -23,6 +25,44 @@ namespace irt
 
 class OBJLoader
 {
+public:
+	// vertex of a face as written in the file, 0 based indices, -1 if not given
+	typedef struct VertexRef_t
+	{
+		int v, vt, vn;
+	} VertexRef;
+
+	// faces before unifying vertices
+	typedef struct FaceRefList_t
+	{
+		vector<unsigned char> n;	// number of vertices of each face
+		vector<VertexRef> refs;		// vertices of all the faces in order
+
+		size_t size() const {return n.size();}
+	} FaceRefList;
+
+	// statement changing the current group, replayed in file order after parsing
+	typedef struct Command_t
+	{
+		enum Type {MTLLIB, USEMTL, OBJECT, GROUP, SMOOTH};
+
+		Type type;
+		size_t numFacesBefore;		// number of faces of the chunk before this statement
+		string arg;
+	} Command;
+
+	// result of parsing a part of the file
+	typedef struct Chunk_t
+	{
+		const char *begin, *end;
+
+		vector<Vector3> v, vt, vn, vp;
+		FaceRefList faces;
+		vector<Command> commands;
+
+		Vector3 BBMin, BBMax;
+	} Chunk;
+
 public:
 	OBJLoader(void);
 	~OBJLoader(void);
@@ -79,7 +119,7 @@ private:
 	vector<Vector3> m_vtList;
 	vector<Vector3> m_vnList;
 	vector<Vector3> m_vpList;
-	vector<vector<FaceStr> > m_fList;
+	vector<FaceRefList> m_fList;
 
 	// Vertices may be duplicated to make them unified (a vertex has position, normal, and texture coordinate together)
 	vector<vector<Face> > m_faceList;
@@ -97,7 +137,9 @@ private:
 	string trim(const string& s);
 	char *trim(char* s);
 	void loadMTLMaterial(const char *fileName);
-	void addSubMesh(GroupInfo &group, vector<FaceStr> &subFaceList);
+	void addSubMesh(GroupInfo &group, FaceRefList &subFaceList);
+	void parseChunk(Chunk &chunk);
+	void runCommand(const Command &command, const char *fileName, GroupInfo &curGroup, FaceRefList &subFaceList);
 };
 
 };
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "Triangle.h"
 #include "BufferedOutputs.h"
 #include "Materials.h"
+#include "BuildManifest.h"
 
 #include <xmmintrin.h>
 
@@ -52,17 +53,32 @@ public:
 	bool secondVertexPassSmall(const char *fileName, float *mat = NULL);
 	bool bridge2to3();
 	bool thirdVertexPassSmall(const char *fileName, int curIter, int matIndex = -1);
+	void processFaceSmall(std::vector<int> &vIdxList, int curIter, int mtlMatIndex, unsigned int &materialIndex);
 	void finalizeMeshPass();
 	bool buildBVHSmall();
 
 	bool buildSmallMulti(const char *outputPath, const char *fileListName, bool useModelTransform, bool useFileMat, const char *mtlFileName = NULL);
+
+	// buildSmallMulti() converts each input to a mesh file of its own, an unchanged
+	// input is not parsed again. The passes over the mesh files merge the inputs.
+	typedef struct InputMeshHeader_t {
+		unsigned int numVertices;
+		unsigned int numFaces;
+		Vector3 bb_min, bb_max;
+		bool hasColor;
+		bool hasVertNormal;
+		bool hasVertTexture;
+	} InputMeshHeader;
+	bool convertInputSmall(const char *fileName, float *mat, const std::string &meshFileName);
+	bool firstVertexPassMesh(const std::string &meshFileName);
+	bool secondVertexPassMesh(const std::string &meshFileName);
+	bool thirdVertexPassMesh(const std::string &meshFileName, int curIter, int matIndex = -1);
 	bool hasVertexColors;
 	bool hasVertexNormals;
 	bool hasVertexTextures;
 	BufferedOutputs<Vertex> *m_pVertices;
 	BufferedOutputs<rgb> *m_pColorList;
-	HANDLE m_hFileVertex, m_hFileColor;
-	HANDLE m_hMappingVertex, m_hMappingColor;
+	// memory mapped by FileMapper between bridge2to3() and finalizeMeshPass()
 	Vertex *m_pVertexFile;
 	rgb *m_pColorFile;
 	BufferedOutputs<Triangle> *m_pTris;
@@ -73,20 +89,59 @@ public:
 protected:	
 
 	/**
-	 * First vertex pass, counts vertices & faces, determines
-	 * bounding box
+	 * Vertex pass, the only pass over the vertices of the PLY file.
+	 * Writes the vertex file and determines bounding box, the number
+	 * of faces comes from the header.
 	 **/
-	bool firstVertexPass();
+	bool vertexPass();
 
 	/**
 	 * Calculate resolution of voxel grid from scene information
 	 **/
 	void calculateVoxelResolution();
 
-	/*	*
-	 * Sort vertices and triangles into voxels
+	/**
+	 * Face pass, the only pass over the faces of the PLY file.
+	 * Faces are read in batches, the next batch is parsed while
+	 * the current one is set up in parallel, then sorted into
+	 * voxels by parallel writers each owning a subset of voxels.
+	 **/
+	bool facePass();
+
+	/**
+	 * Transform by the model matrix, if any
 	 **/
-	bool secondVertexPass();
+	void transformVertex(Vertex &vert);
+
+	/**
+	 * I/O volume and wall time of each build stage
+	 **/
+	typedef struct BuildStage_t {
+		const char *name;
+		__int64 bytesRead;
+		__int64 bytesWritten;
+		double time;
+	} BuildStage;
+
+	void addBuildStage(const char *name, __int64 bytesRead, __int64 bytesWritten, double time);
+	void printBuildStages();
+
+	std::vector<BuildStage> buildStages;
+
+	/**
+	 * Stage keys and records of completed stages, see BuildManifest.
+	 * vertexKey: input and transform, faceKey: vertexKey and output
+	 * formats, voxelBVHKey/bvhKey: faceKey and BVH builder options.
+	 **/
+	BuildManifest *manifest;
+	BuildManifest::Hash vertexKey, faceKey, voxelBVHKey, bvhKey;
+	bool facesUpToDate;
+
+	// files of the final model, checked before skipping a whole build
+	std::vector<std::string> getModelOutputs();
+
+	// adds the BVH builder options which change its output to a key
+	static BuildManifest::Hash hashBVHOptions(BuildManifest::Hash seed);
 
 	/**
 	 * Build kD trees for each voxel.
@@ -169,6 +224,12 @@ protected:
 	std::string getLogFileName() {
 		return std::string(outDirName) + "/RLOD";
 	}
+	std::string getManifestFileName() {
+		return std::string(outDirName) + "/manifest";
+	}
+	std::string getInputMeshFileName(unsigned int inputNr) {
+		return std::string(outDirName) + "/input_" + toString(inputNr,5,'0') + ".mesh";
+	}
 
 	FORCEINLINE void setBB(Vector3 &min, Vector3 &max, Vector3 &init)
 	{
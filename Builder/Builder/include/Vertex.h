@@ -73,6 +73,21 @@ typedef struct VertexVNCT_t {
 	unsigned char dummy[20];
 } VertexVNCT, *VertexVNCTPtr;
 
+/**
+ * Split vertex streams (vertex_pos.ooc and vertex_attrib.ooc) for the
+ * renderer. Normals are octahedral encoded (snorm16), texture
+ * coordinates are half floats.
+ */
+typedef struct VertexPosition_t {
+	Vector3 v;				// vertex geometry
+	unsigned char dummy[4];
+} VertexPosition, *VertexPositionPtr;
+
+typedef struct VertexAttrib_t {
+	short n[2];				// octahedral encoded normal
+	unsigned short uv[2];	// Texture coordinate, half float
+} VertexAttrib, *VertexAttribPtr;
+
 typedef enum VertexType_t {
 	V, VN, VC, VT, VNC, VCT, VNT, VNCT
 } VertexType;
@@ -11,6 +11,7 @@
 #include "Octree.h"
 #include "OOC_PCA.h"
 #include "NewMaterial.h"
+#include <xmmintrin.h>
 
 //#define BUILD_BOEING
 #define BUILD_SPONZA
@@ -31,6 +32,11 @@
 #define MAX_LOW_DEPTH 5
 #endif
 
+// upper octree and its LOD are split into at least this many subtrees per thread
+#define SUBTREES_PER_THREAD 8
+// triangles binned to the regions of cells at once in computeLOD
+#define LOD_TRI_CHUNK 1000000
+
 class VoxelMaterialExtra
 {
 public:
@@ -105,6 +111,53 @@ protected:
 
 	typedef std::vector<OOCVoxel> OOCVoxelList;
 
+	/**
+	* Subtree of the upper octree, built by one thread. Voxels are in blocks of N*N*N,
+	* block 0 is the root of the subtree. Child and OOC voxel indices are local to the
+	* subtree until it is spliced into the octree.
+	*/
+	typedef struct OctreeSubtree_t
+	{
+		int depth;
+		AABB box;
+		std::vector<Voxel> voxels;
+		OOCVoxelList oocVoxels;
+		int lastIndex;
+		int numVoxels;
+		bool isOOCPart;
+	} OctreeSubtree;
+
+	typedef std::vector<OctreeSubtree> OctreeSubtreeList;
+
+	// output of createOctreeNode, subtrees at splitDepth are collected (first pass) or spliced
+	typedef struct OctreeBuild_t
+	{
+		std::vector<Voxel> voxels;
+		OOCVoxelList oocVoxels;
+		OctreeSubtreeList *subtrees;
+		int splitDepth;
+		int nextSubtree;
+		bool collect;
+
+		OctreeBuild_t() : subtrees(0), splitDepth(0), nextSubtree(0), collect(false) {}
+	} OctreeBuild;
+
+	// voxel with children whose LOD is computed by one thread
+	typedef struct LODSubtree_t
+	{
+		int index;
+		AABB box;
+	} LODSubtree;
+
+	// 4 boxes in SoA layout for the SIMD triangle-box test
+	typedef struct BoxPacket_t
+	{
+		__m128 center[3];
+		__m128 halfSize[3];
+		__m128 min[3];
+		__m128 max[3];
+	} BoxPacket;
+
 protected:
 	FILE *m_fp;
 
@@ -137,17 +190,32 @@ public:
 	bool isIntersect(const AABB &box, Vector3 *vert);
 	bool isIntersect(const AABB &a, const BVHNode *b);
 	bool isIntersect(const AABB &a);
+	// SIMD version of isIntersect(box, vert) for the active boxes of a packet, returns mask of intersecting boxes
+	int isIntersect(const BoxPacket &boxes, const Vector3 *vert, int activeMask);
+	// tests the geometry against up to 32 boxes with one BVH traversal, returns mask of intersecting boxes
+	int isIntersect(const AABB *boxes, int numBoxes);
+	void setBoxPacket(BoxPacket &packet, const AABB *boxes, int numBoxes);
 	void getIntersectVoxels(const BVHNode *tree, const Triangle &tri, std::vector<int> &list);
 	AABB computeSubBox(int x, int y, int z, const AABB &box);
+	// N*N*N sub boxes in the order of the voxels of a block
+	void computeSubBoxes(const AABB &box, AABB *subBoxes);
 	void setGeomBitmap(Voxel &voxel, const AABB &box);
 	int createOctreeNode();
 	int createOctreeNode(FILE *fp, const OOCVoxel &voxel);
-	int createOctreeNode(FILE *fp, int parentIndex, int myIndex, int &lastIndex, const AABB &box, int depth, bool generateOOC = false, bool *isOOCPart = NULL);
+	int createOctreeNode(OctreeBuild &build, int parentIndex, int myIndex, int &lastIndex, const AABB &box, int depth, bool generateOOC = false, bool *isOOCPart = NULL);
+	// builds the subtrees in parallel, then the upper levels splicing them in the sequential order
+	int buildOctree(OctreeBuild &build, const AABB &box, int depth, bool generateOOC);
+	int spliceOctreeSubtree(OctreeBuild &build, OctreeSubtree &subtree, int parentIndex, int myIndex, int &lastIndex, bool *isOOCPart);
 
 	float triArea(std::vector<Vector3> &verts, int pos);
 	void applyTri(int index, const AABB &bb, Vector3 *vert, const Vector3 &norm, const NewMaterial &material);
-	COOCPCAwoExtent computeGeomLOD(const AABB &bb, int index);
-	VoxelMaterialExtra computeMaterialLOD(int index);
+	// voxels with children at splitLevel are subtrees, their LOD is already computed
+	COOCPCAwoExtent computeGeomLOD(const AABB &bb, int index, int splitLevel = -1);
+	VoxelMaterialExtra computeMaterialLOD(int index, int splitLevel = -1, const VoxelMaterialExtra **subtreeMaterial = NULL);
+	void collectLODSubtrees(const AABB &bb, int index, int level, std::vector<LODSubtree> &subtrees);
+	void computeInnerLOD(const AABB &bb);
+	// applies the triangles to the leaf voxels in a region of cells, [regionMin, regionMax]
+	void applyTris(const std::vector<int> &tris, const int *regionMin, const int *regionMax);
 	void computeLOD(const char *fileName, int startDepth = 1);
 	void setGeomLOD(int index, const AABB &bb);
 
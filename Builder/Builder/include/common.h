@@ -34,6 +34,13 @@
 // use triangle materials:
 #define _USE_TRI_MATERIALS
 
+// build BVHs with the binned SAH (parallel) instead of the exact sorted sweep
+// of BVH::SubdivideSAH, comment out to compare build time and SAH cost
+#define _USE_BINNED_SAH
+
+// number of bins per axis for the binned SAH
+#define SAH_NUM_BINS 32
+
 // use extended size kD-tree nodes (for LOD):
 #define KDTREENODE_16BYTES
 
@@ -124,6 +131,7 @@
 FORCEINLINE int omp_get_max_threads() { return 1; }
 FORCEINLINE int omp_get_num_threads() { return 1; }
 FORCEINLINE int omp_get_thread_num() { return 0; }
+FORCEINLINE int omp_in_parallel() { return 0; }
 FORCEINLINE void omp_set_num_threads(int num) {}
 #endif
 
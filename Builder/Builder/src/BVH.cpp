@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <algorithm>
+#include <emmintrin.h>
 
 #include "BVH.h"
 #if HIERARCHY_TYPE == TYPE_BVH 
@@ -28,6 +29,26 @@ __inline float surfaceArea(float dim1, float dim2, float dim3) {
 	return 2.0f * ((dim1 * dim2) + (dim2 * dim3) + (dim1 * dim3));
 }
 
+// surface area of a SSE bounding box
+__inline float surfaceArea(const __m128 &min, const __m128 &max) {
+	__declspec(align(16)) float dim[4];
+	_mm_store_ps(dim, _mm_sub_ps(max, min));
+	return surfaceArea(dim[0], dim[1], dim[2]);
+}
+
+// bins of a centroid for all axes, clamped to [0, SAH_NUM_BINS-1]
+__inline void getSAHBins(const __m128 &centroid, const __m128 &cmin, const __m128 &scale, int bins[4]) {
+	_mm_storeu_si128((__m128i*)bins, _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(centroid, cmin), scale)));
+	for(int k = 0; k < 3; k++)
+		bins[k] = bins[k] < 0 ? 0 : (bins[k] >= SAH_NUM_BINS ? SAH_NUM_BINS - 1 : bins[k]);
+}
+
+__inline void storeSAHBound(const __m128 &v, Vector3 &out) {
+	__declspec(align(16)) float f[4];
+	_mm_store_ps(f, v);
+	out.set(f);
+}
+
 #if 0
 void BVH::buildTree()
 {				
@@ -296,6 +317,88 @@ void BVH::buildTreeSAH()
 		
 		maxDEPTH = 0;
 
+#ifdef _USE_BINNED_SAH
+		// node offsets of the binned build assume one triangle per leaf
+		if(maxNumTrisPerLeaf == 1)
+		{
+			// gather bounds and centroids first, lookups in the vertex cache are not thread safe
+			sahTriInfos = (SAHTriInfo *)_aligned_malloc(sizeof(SAHTriInfo)*((__int64) treeStats.numTris), 16);
+
+			#ifdef _USE_OPENMP
+			#pragma omp parallel for if(!m_useOOC)
+			#endif
+			for (int i = 0; i < treeStats.numTris; i++) 
+			{
+				const Triangle &tri = GETTRI(i);
+				const Vector3 &p0 = GETVERTEX(tri.p[0]).v;
+				const Vector3 &p1 = GETVERTEX(tri.p[1]).v;
+				const Vector3 &p2 = GETVERTEX(tri.p[2]).v;
+				__m128 v0 = _mm_setr_ps(p0.e[0], p0.e[1], p0.e[2], 0.0f);
+				__m128 v1 = _mm_setr_ps(p1.e[0], p1.e[1], p1.e[2], 0.0f);
+				__m128 v2 = _mm_setr_ps(p2.e[0], p2.e[1], p2.e[2], 0.0f);
+
+				sahTriInfos[i].min = _mm_min_ps(v0, _mm_min_ps(v1, v2));
+				sahTriInfos[i].max = _mm_max_ps(v0, _mm_max_ps(v1, v2));
+				sahTriInfos[i].centroid = _mm_div_ps(_mm_add_ps(v0, _mm_add_ps(v1, v2)), _mm_set1_ps(3.0f));
+			}
+
+			SAHBuildStats stats = {0, 0, 0, 0};
+			std::vector<SAHJob> jobs;
+
+			// hand subtrees to threads unless we are already in a parallel region (voxel BVHs)
+			bool useJobs = omp_get_max_threads() > 1 && !omp_in_parallel();
+			unsigned int jobSize = treeStats.numTris / (omp_get_max_threads() * 8);
+			if(jobSize < SAH_MIN_JOB_SIZE) jobSize = SAH_MIN_JOB_SIZE;
+
+			if(treeStats.numTris == 1)
+			{
+				root->indexCount = MAKECHILDCOUNT(1);
+				root->indexOffset = 0;
+				indexlists[0] = triIndexList[(*leftlist[0])[0]];
+				stats.numLeafs = 1;
+				stats.sumTris = 1;
+			}
+			else
+				SubdivideSAHBinned(leftlist[0], 0, treeStats.numTris-1, 0, 1, 0, stats, useJobs ? &jobs : NULL, jobSize);
+
+			for(unsigned int i = 0; i < stats.sumTris; i++)
+				progBuildTree->step();
+
+			#ifdef _USE_OPENMP
+			#pragma omp parallel for schedule(dynamic, 1)
+			#endif
+			for(int i = 0; i < (int)jobs.size(); i++)
+			{
+				const SAHJob &job = jobs[i];
+				SAHBuildStats jobStats = {0, 0, 0, 0};
+
+				SubdivideSAHBinned(leftlist[0], job.left, job.right, job.myIndex, job.nextIndex, job.depth, jobStats, NULL, 0);
+
+				#ifdef _USE_OPENMP
+				#pragma omp critical
+				#endif
+				{
+					stats.numLeafs += jobStats.numLeafs;
+					stats.sumDepth += jobStats.sumDepth;
+					stats.sumTris += jobStats.sumTris;
+					if(jobStats.maxDepth > stats.maxDepth) stats.maxDepth = jobStats.maxDepth;
+					for(unsigned int j = 0; j < jobStats.sumTris; j++)
+						progBuildTree->step();
+				}
+			}
+
+			treeStats.numNodes = 2*stats.numLeafs - 1;
+			treeStats.numLeafs += stats.numLeafs;
+			treeStats.sumDepth += stats.sumDepth;
+			treeStats.sumTris += stats.sumTris;
+			maxDEPTH = stats.maxDepth;
+			curIndex = stats.sumTris;
+
+			_aligned_free(sahTriInfos);
+			sahTriInfos = NULL;
+		}
+		else
+#endif
 		SubdivideSAH(leftlist[0], 0, treeStats.numTris-1, 0, 1 , 0);
 
 		printf("\n\nMAX DEPTH : %d\n",maxDEPTH);
@@ -1212,6 +1315,338 @@ bool BVH::SubdivideSAH(TriangleIndexList *triIDs, unsigned int left, unsigned in
 }
 
 
+void BVH::boundSAHCentroids(const TriangleIndexList *triIDs, unsigned int left, unsigned int right, __m128 &cmin, __m128 &cmax)
+{
+	cmin = _mm_set1_ps(FLT_MAX);
+	cmax = _mm_set1_ps(-FLT_MAX);
+	for(unsigned int i=left;i<=right;i++)
+	{
+		const __m128 &c = sahTriInfos[(*triIDs)[i]].centroid;
+		cmin = _mm_min_ps(cmin, c);
+		cmax = _mm_max_ps(cmax, c);
+	}
+}
+
+void BVH::binSAHTriangles(const TriangleIndexList *triIDs, unsigned int left, unsigned int right, const __m128 &cmin, const __m128 &scale, SAHBin bins[3][SAH_NUM_BINS])
+{
+	int b[4];
+	for(unsigned int i=left;i<=right;i++)
+	{
+		const SAHTriInfo &info = sahTriInfos[(*triIDs)[i]];
+		getSAHBins(info.centroid, cmin, scale, b);
+		for(int k=0;k<3;k++)
+		{
+			SAHBin &bin = bins[k][b[k]];
+			bin.min = _mm_min_ps(bin.min, info.min);
+			bin.max = _mm_max_ps(bin.max, info.max);
+			bin.count++;
+		}
+	}
+}
+
+void BVH::boundSAHTriangles(const TriangleIndexList *triIDs, unsigned int left, unsigned int right, Vector3 &min, Vector3 &max)
+{
+	__m128 bmin = _mm_set1_ps(FLT_MAX);
+	__m128 bmax = _mm_set1_ps(-FLT_MAX);
+	for(unsigned int i=left;i<=right;i++)
+	{
+		const SAHTriInfo &info = sahTriInfos[(*triIDs)[i]];
+		bmin = _mm_min_ps(bmin, info.min);
+		bmax = _mm_max_ps(bmax, info.max);
+	}
+	storeSAHBound(bmin, min);
+	storeSAHBound(bmax, max);
+}
+
+void BVH::SubdivideSAHBinned(TriangleIndexList *triIDs, unsigned int left, unsigned int right, unsigned int myIndex, unsigned int nextIndex, int depth, SAHBuildStats &stats, std::vector<SAHJob> *jobs, unsigned int jobSize)
+{
+	if(myIndex > treeStats.numTris*2 - 1 || nextIndex + 1 > treeStats.numTris*2 - 1)
+	{
+		printf("Out of index! %d, %d\n", myIndex, nextIndex + 1);
+		exit(-1);
+	}
+	if( depth > stats.maxDepth )
+	{
+		stats.maxDepth = depth;
+	}
+
+	BSPArrayTreeNodePtr lChild = (BSPArrayTreeNodePtr)((char *)tree + ((((__int64)(nextIndex)) * BVHNODE_BYTES) << 0) );
+	BSPArrayTreeNodePtr rChild = (BSPArrayTreeNodePtr)((char *)tree + ((((__int64)(nextIndex + 1)) * BVHNODE_BYTES) << 0) );
+	BSPArrayTreeNodePtr node = (BSPArrayTreeNodePtr)((char *)tree + (((__int64)myIndex) * BVHNODE_BYTES) );
+
+	int i, k, b, nL, nR, nT, count;
+	int bestAxis = -1, bestBin = 0;
+	float bestVal = FLT_MAX, val;
+	unsigned int curL, curR, temp;
+	__m128 cmin, cmax, scale, bmin, bmax;
+	__declspec(align(16)) float extent[4], binScale[4];
+	SAHBin bins[3][SAH_NUM_BINS];
+	float areaR[SAH_NUM_BINS];
+	int countR[SAH_NUM_BINS];
+
+	nT = right - left + 1;
+
+	// nodes on the top of the tree are binned by all threads, each takes a chunk
+	int numChunks = (jobs && nT >= SAH_PARALLEL_BINNING) ? omp_get_max_threads() : 1;
+
+	if(numChunks > 1)
+	{
+		cmin = _mm_set1_ps(FLT_MAX);
+		cmax = _mm_set1_ps(-FLT_MAX);
+
+		#ifdef _USE_OPENMP
+		#pragma omp parallel for schedule(static, 1)
+		#endif
+		for(int c = 0; c < numChunks; c++)
+		{
+			__m128 chunkMin, chunkMax;
+			boundSAHCentroids(triIDs, left + (unsigned int)(((__int64)nT*c) / numChunks), left + (unsigned int)(((__int64)nT*(c+1)) / numChunks) - 1, chunkMin, chunkMax);
+
+			#ifdef _USE_OPENMP
+			#pragma omp critical
+			#endif
+			{
+				cmin = _mm_min_ps(cmin, chunkMin);
+				cmax = _mm_max_ps(cmax, chunkMax);
+			}
+		}
+	}
+	else
+		boundSAHCentroids(triIDs, left, right, cmin, cmax);
+
+	// axes without extent of centroids are not split
+	_mm_store_ps(extent, _mm_sub_ps(cmax, cmin));
+	for(k=0;k<3;k++)
+		binScale[k] = extent[k] > 0.0f ? (SAH_NUM_BINS * (1.0f - 1e-5f)) / extent[k] : 0.0f;
+	binScale[3] = 0.0f;
+	scale = _mm_load_ps(binScale);
+
+	for(k=0;k<3;k++)
+	{
+		for(b=0;b<SAH_NUM_BINS;b++)
+		{
+			bins[k][b].min = _mm_set1_ps(FLT_MAX);
+			bins[k][b].max = _mm_set1_ps(-FLT_MAX);
+			bins[k][b].count = 0;
+		}
+	}
+
+	if(numChunks > 1)
+	{
+		#ifdef _USE_OPENMP
+		#pragma omp parallel for schedule(static, 1)
+		#endif
+		for(int c = 0; c < numChunks; c++)
+		{
+			SAHBin chunkBins[3][SAH_NUM_BINS];
+			for(int ck=0;ck<3;ck++)
+			{
+				for(int cb=0;cb<SAH_NUM_BINS;cb++)
+				{
+					chunkBins[ck][cb].min = _mm_set1_ps(FLT_MAX);
+					chunkBins[ck][cb].max = _mm_set1_ps(-FLT_MAX);
+					chunkBins[ck][cb].count = 0;
+				}
+			}
+
+			binSAHTriangles(triIDs, left + (unsigned int)(((__int64)nT*c) / numChunks), left + (unsigned int)(((__int64)nT*(c+1)) / numChunks) - 1, cmin, scale, chunkBins);
+
+			#ifdef _USE_OPENMP
+			#pragma omp critical
+			#endif
+			{
+				for(int ck=0;ck<3;ck++)
+				{
+					for(int cb=0;cb<SAH_NUM_BINS;cb++)
+					{
+						bins[ck][cb].min = _mm_min_ps(bins[ck][cb].min, chunkBins[ck][cb].min);
+						bins[ck][cb].max = _mm_max_ps(bins[ck][cb].max, chunkBins[ck][cb].max);
+						bins[ck][cb].count += chunkBins[ck][cb].count;
+					}
+				}
+			}
+		}
+	}
+	else
+		binSAHTriangles(triIDs, left, right, cmin, scale, bins);
+
+	// sweep the bins, splitting before bin b
+	for(k=0;k<3;k++)
+	{
+		if(extent[k] <= 0.0f) continue;
+
+		bmin = _mm_set1_ps(FLT_MAX);
+		bmax = _mm_set1_ps(-FLT_MAX);
+		count = 0;
+		for(b=SAH_NUM_BINS-1;b>0;b--)
+		{
+			bmin = _mm_min_ps(bmin, bins[k][b].min);
+			bmax = _mm_max_ps(bmax, bins[k][b].max);
+			count += bins[k][b].count;
+			areaR[b] = count ? surfaceArea(bmin, bmax) : 0.0f;
+			countR[b] = count;
+		}
+
+		bmin = _mm_set1_ps(FLT_MAX);
+		bmax = _mm_set1_ps(-FLT_MAX);
+		count = 0;
+		for(b=1;b<SAH_NUM_BINS;b++)
+		{
+			bmin = _mm_min_ps(bmin, bins[k][b-1].min);
+			bmax = _mm_max_ps(bmax, bins[k][b-1].max);
+			count += bins[k][b-1].count;
+			if(count == 0 || countR[b] == 0) continue;
+
+			val = surfaceArea(bmin, bmax) * ( (float)count ) + areaR[b] * ( (float)countR[b] );
+			if( val < bestVal )
+			{
+				bestVal = val;
+				bestAxis = k;
+				bestBin = b;
+			}
+		}
+	}
+
+	curL = left;
+	curR = right;
+
+	if(bestAxis >= 0)
+	{
+		int triBins[4];
+		for(i=0;i<nT;i++)
+		{
+			getSAHBins(sahTriInfos[(*triIDs)[curL]].centroid, cmin, scale, triBins);
+			if( triBins[bestAxis] < bestBin )
+			{
+				curL++;
+			}
+			else
+			{
+				temp = (*triIDs)[curL];
+				(*triIDs)[curL] = (*triIDs)[curR];
+				(*triIDs)[curR] = temp;
+				curR--;
+			}
+		}
+	}
+
+	nL = curL - left;
+	nR = nT - nL;
+
+	// all centroids at the same position
+	if( nL == 0 || nR == 0 )
+	{
+		nL = (nT+1) / 2;
+		nR = nT - nL;
+		bestAxis = -1;
+	}
+
+	node->children = ((nextIndex) * (BVHNODE_BYTES >> 3) ) | (bestAxis < 0 ? 0 : bestAxis);
+	#ifndef _USE_CONTI_NODE
+	node->children2 = ((nextIndex+1) * (BVHNODE_BYTES >> 3) );
+	#else
+	node->children2 = 0;
+	#endif
+
+	if(bestAxis >= 0)
+	{
+		// bounds of the children are the unions of their bins
+		bmin = _mm_set1_ps(FLT_MAX);
+		bmax = _mm_set1_ps(-FLT_MAX);
+		for(b=0;b<bestBin;b++)
+		{
+			bmin = _mm_min_ps(bmin, bins[bestAxis][b].min);
+			bmax = _mm_max_ps(bmax, bins[bestAxis][b].max);
+		}
+		storeSAHBound(bmin, lChild->min);
+		storeSAHBound(bmax, lChild->max);
+
+		bmin = _mm_set1_ps(FLT_MAX);
+		bmax = _mm_set1_ps(-FLT_MAX);
+		for(b=bestBin;b<SAH_NUM_BINS;b++)
+		{
+			bmin = _mm_min_ps(bmin, bins[bestAxis][b].min);
+			bmax = _mm_max_ps(bmax, bins[bestAxis][b].max);
+		}
+		storeSAHBound(bmin, rChild->min);
+		storeSAHBound(bmax, rChild->max);
+	}
+	else
+	{
+		boundSAHTriangles(triIDs, left, left + nL - 1, lChild->min, lChild->max);
+		boundSAHTriangles(triIDs, left + nL, right, rChild->min, rChild->max);
+	}
+
+	// a subtree of nL triangles takes 2*nL-1 nodes, so the right subtree starts after
+	// the 2*nL-2 nodes below the left child
+	if( nL <= maxNumTrisPerLeaf )
+	{
+		lChild->indexCount = MAKECHILDCOUNT(nL);
+		lChild->indexOffset = left;
+
+		for(i=left;i<=(int)(left+nL-1);i++)
+			indexlists[i] = triIndexList[(*triIDs)[i]];
+
+		stats.numLeafs++;
+		stats.sumDepth += depth;
+		stats.sumTris += nL;
+	}
+	else if( jobs && (unsigned int)nL <= jobSize )
+	{
+		SAHJob job = {left, left + nL - 1, nextIndex, nextIndex + 2, depth + 1};
+		jobs->push_back(job);
+	}
+	else
+	{
+		SubdivideSAHBinned( triIDs , left , left + nL - 1 , nextIndex , nextIndex + 2 , depth + 1, stats, jobs, jobSize );
+	}
+
+	if( nR <= maxNumTrisPerLeaf )
+	{
+		rChild->indexCount = MAKECHILDCOUNT(nR);
+		rChild->indexOffset = left + nL;
+
+		for(i=left+nL;i<=(int)right;i++)
+			indexlists[i] = triIndexList[(*triIDs)[i]];
+
+		stats.numLeafs++;
+		stats.sumDepth += depth;
+		stats.sumTris += nR;
+	}
+	else if( jobs && (unsigned int)nR <= jobSize )
+	{
+		SAHJob job = {left + nL, right, nextIndex + 1, nextIndex + 2 * nL, depth + 1};
+		jobs->push_back(job);
+	}
+	else
+	{
+		SubdivideSAHBinned( triIDs , left + nL , right , nextIndex + 1 , nextIndex + 2 * nL , depth + 1, stats, jobs, jobSize );
+	}
+}
+
+float BVH::computeSAHCost()
+{
+	if(!tree || treeStats.numNodes <= 0)
+		return 0.0f;
+
+	float rootArea = surfaceArea( tree->max[0] - tree->min[0] , tree->max[1] - tree->min[1] , tree->max[2] - tree->min[2] );
+	if(rootArea <= 0.0f)
+		return 0.0f;
+
+	double cost = 0.0;
+	for(int i = 0; i < treeStats.numNodes; i++)
+	{
+		BSPArrayTreeNodePtr node = (BSPArrayTreeNodePtr)((char *)tree + (((__int64)i) * BVHNODE_BYTES) );
+		float area = surfaceArea( node->max[0] - node->min[0] , node->max[1] - node->min[1] , node->max[2] - node->min[2] );
+
+		if(ISLEAF(node))
+			cost += area * BSP_COST_INTERSECTION * (node->indexCount >> 2);
+		else
+			cost += area * BSP_COST_TRAVERSAL;
+	}
+	return (float)(cost / rootArea);
+}
+
 void BVH::renderSplit(int axisNr, float splitCoord, Vector3 min, Vector3 max,TriangleIndexList *newlists[2]) {	
 }
 
@@ -1594,6 +2029,12 @@ void BVH::printTree(bool dumpTree, const char *LoggerName) {
 	}
 	sprintf(outputBuffer, "Used memory:\t%d KB", (treeStats.numNodes*sizeof(BSPArrayTreeNode) + (treeStats.sumTris * sizeof(int))) / 1024);
 	log->logMessage(outputBuffer, LoggerName);
+#ifdef _USE_BINNED_SAH
+	sprintf(outputBuffer, "SAH cost:\t%.4f (binned, %d bins)", computeSAHCost(), SAH_NUM_BINS);
+#else
+	sprintf(outputBuffer, "SAH cost:\t%.4f (exact sweep)", computeSAHCost());
+#endif
+	log->logMessage(outputBuffer, LoggerName);
 
 	
 	if (dumpTree) {		
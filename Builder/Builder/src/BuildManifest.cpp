@@ -0,0 +1,436 @@
+#include "BuildManifest.h"
+
+#define _CRT_SECURE_NO_DEPRECATE
+#pragma warning (disable: 4996)
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+#define MANIFEST_ID "OpenIRT build manifest"
+#define HASH_PRIME 0x100000001b3ULL
+
+// splits a line of tab separated fields in place, returns number of fields
+static int splitFields(char *line, char **fields, int maxFields)
+{
+	int numFields = 0;
+	char *cur = line;
+
+	// strip line end
+	size_t len = strlen(line);
+	while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+		line[--len] = 0;
+
+	while (numFields < maxFields) {
+		fields[numFields++] = cur;
+		char *tab = strchr(cur, '\t');
+		if (!tab) break;
+		*tab = 0;
+		cur = tab + 1;
+	}
+	return numFields;
+}
+
+BuildManifest::BuildManifest(const std::string &fileName) : m_fileName(fileName), m_hasFile(false)
+{
+}
+
+bool BuildManifest::load()
+{
+	m_stages.clear();
+	m_inputs.clear();
+	m_hasFile = false;
+
+	FILE *fp = fopen(m_fileName.c_str(), "r");
+	if (!fp) return false;
+
+	char line[4096];
+	char *fields[8];
+	int version = 0;
+
+	if (!fgets(line, sizeof(line), fp) || sscanf(line, MANIFEST_ID " %d", &version) != 1 || version != VERSION) {
+		printf("Ignoring build manifest of an other version: %s\n", m_fileName.c_str());
+		fclose(fp);
+		return false;
+	}
+
+	// number of outputs each stage record announces, a record cut off by a crash is dropped
+	std::map<std::string, size_t> numOutputs;
+	size_t numLines = 1;
+
+	while (fgets(line, sizeof(line), fp)) {
+		// the last line of a crashed run may be partial
+		if (line[strlen(line)-1] != '\n') break;
+
+		numLines++;
+		int numFields = splitFields(line, fields, 8);
+
+		if (!strcmp(fields[0], "input") && numFields == 5) {
+			Input input;
+			sscanf(fields[2], "%I64d", &input.size);
+			sscanf(fields[3], "%I64d", &input.modifiedTime);
+			sscanf(fields[4], "%I64x", &input.hash);
+			m_inputs[fields[1]] = input;
+		}
+		else if (!strcmp(fields[0], "stage") && numFields == 4) {
+			Stage &stage = m_stages[fields[1]];
+			sscanf(fields[2], "%I64x", &stage.key);
+			stage.outputs.clear();
+			numOutputs[fields[1]] = (size_t)atoi(fields[3]);
+		}
+		else if (!strcmp(fields[0], "output") && numFields == 6) {
+			// outputs follow their stage
+			StageMap::iterator it = m_stages.find(fields[1]);
+			if (it == m_stages.end()) continue;
+
+			Output output;
+			output.fileName = fields[2];
+			sscanf(fields[3], "%I64d", &output.size);
+			sscanf(fields[4], "%I64d", &output.modifiedTime);
+			sscanf(fields[5], "%I64x", &output.hash);
+			it->second.outputs.push_back(output);
+		}
+		else if (!strcmp(fields[0], "remove") && numFields == 2) {
+			m_stages.erase(fields[1]);
+		}
+	}
+
+	fclose(fp);
+	m_hasFile = true;
+
+	size_t numCompactLines = 1 + m_inputs.size();
+	StageMap::iterator it = m_stages.begin();
+	while (it != m_stages.end()) {
+		if (it->second.outputs.size() != numOutputs[it->first]) {
+			m_stages.erase(it++);
+			continue;
+		}
+		numCompactLines += 1 + it->second.outputs.size();
+		it++;
+	}
+
+	// rewrite without the journal, so that it does not grow over runs
+	if (numLines != numCompactLines)
+		saveUnlocked();
+
+	return true;
+}
+
+bool BuildManifest::save()
+{
+	bool ret;
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	ret = saveUnlocked();
+	return ret;
+}
+
+void BuildManifest::writeInput(FILE *fp, const std::string &fileName, const Input &input)
+{
+	fprintf(fp, "input\t%s\t%I64d\t%I64d\t%016I64x\n", fileName.c_str(), input.size, input.modifiedTime, input.hash);
+}
+
+void BuildManifest::writeStage(FILE *fp, const std::string &stageName, const Stage &stage)
+{
+	fprintf(fp, "stage\t%s\t%016I64x\t%d\n", stageName.c_str(), stage.key, (int)stage.outputs.size());
+	for (size_t i = 0; i < stage.outputs.size(); i++) {
+		const Output &output = stage.outputs[i];
+		fprintf(fp, "output\t%s\t%s\t%I64d\t%I64d\t%016I64x\n", stageName.c_str(), output.fileName.c_str(), output.size, output.modifiedTime, output.hash);
+	}
+}
+
+bool BuildManifest::saveUnlocked()
+{
+	std::string tempFileName = m_fileName + ".tmp";
+	FILE *fp = fopen(tempFileName.c_str(), "w");
+	if (!fp) {
+		printf("Cannot write build manifest: %s\n", tempFileName.c_str());
+		return false;
+	}
+
+	fprintf(fp, MANIFEST_ID " %d\n", VERSION);
+
+	for (InputMap::iterator it = m_inputs.begin(); it != m_inputs.end(); it++)
+		writeInput(fp, it->first, it->second);
+
+	for (StageMap::iterator it = m_stages.begin(); it != m_stages.end(); it++)
+		writeStage(fp, it->first, it->second);
+
+	bool ok = ferror(fp) == 0;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		printf("Cannot write build manifest: %s\n", tempFileName.c_str());
+		remove(tempFileName.c_str());
+		return false;
+	}
+
+	// replaces the old manifest in one step, there is always a complete one
+	if (!MoveFileExA(tempFileName.c_str(), m_fileName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		printf("Cannot replace build manifest: %s\n", m_fileName.c_str());
+		remove(tempFileName.c_str());
+		return false;
+	}
+	m_hasFile = true;
+	return true;
+}
+
+FILE *BuildManifest::openJournal()
+{
+	// the header is written by a full save
+	if (!m_hasFile) return NULL;
+
+	FILE *fp = fopen(m_fileName.c_str(), "a");
+	if (!fp) printf("Cannot append to build manifest: %s\n", m_fileName.c_str());
+	return fp;
+}
+
+void BuildManifest::closeJournal(FILE *fp)
+{
+	bool ok = ferror(fp) == 0;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		// a partial record is dropped by load(), rewrite the manifest to keep the others
+		printf("Cannot append to build manifest: %s\n", m_fileName.c_str());
+		saveUnlocked();
+	}
+}
+
+BuildManifest::Hash BuildManifest::hashInput(const std::string &fileName)
+{
+	struct __stat64 st;
+	if (_stat64(fileName.c_str(), &st) != 0) {
+		printf("Cannot find input: %s\n", fileName.c_str());
+		return 0;
+	}
+
+	InputMap::iterator it;
+	bool cached = false;
+	Input input;
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	{
+		if ((it = m_inputs.find(fileName)) != m_inputs.end()) {
+			input = it->second;
+			cached = input.size == st.st_size && input.modifiedTime == (__int64)st.st_mtime;
+		}
+	}
+	if (cached) return input.hash;
+
+	printf("Hashing input %s ...\n", fileName.c_str());
+	input.hash = hashFile(fileName, &input.size);
+	input.modifiedTime = (__int64)st.st_mtime;
+
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	{
+		m_inputs[fileName] = input;
+
+		FILE *fp = openJournal();
+		if (fp) {
+			writeInput(fp, fileName, input);
+			closeJournal(fp);
+		}
+		else
+			saveUnlocked();
+	}
+
+	return input.hash;
+}
+
+bool BuildManifest::isUpToDate(const char *stageName, Hash key)
+{
+	StageMap::iterator it;
+	bool found = false;
+	Stage stage;
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	{
+		if ((it = m_stages.find(stageName)) != m_stages.end()) {
+			stage = it->second;
+			found = true;
+		}
+	}
+	if (!found) return false;
+
+	if (stage.key != key) {
+		printf("[%s] inputs or options changed\n", stageName);
+		return false;
+	}
+
+	// sizes and times first, a truncated file is found without reading anything
+	std::vector<size_t> touched;
+	for (size_t i = 0; i < stage.outputs.size(); i++) {
+		Output &output = stage.outputs[i];
+		struct __stat64 st;
+		if (_stat64(output.fileName.c_str(), &st) != 0 || st.st_size != output.size) {
+			printf("[%s] %s is missing or truncated\n", stageName, output.fileName.c_str());
+			return false;
+		}
+		if ((__int64)st.st_mtime != output.modifiedTime) {
+			output.modifiedTime = (__int64)st.st_mtime;
+			touched.push_back(i);
+		}
+	}
+
+	// only files written after the commit are hashed
+	for (size_t i = 0; i < touched.size(); i++) {
+		const Output &output = stage.outputs[touched[i]];
+		if (hashFile(output.fileName) != output.hash) {
+			printf("[%s] %s was modified\n", stageName, output.fileName.c_str());
+			return false;
+		}
+	}
+
+	if (touched.empty()) return true;
+
+	// the contents are the same, record the new times so they are not hashed again
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	{
+		if ((it = m_stages.find(stageName)) != m_stages.end() && it->second.key == key) {
+			it->second = stage;
+
+			FILE *fp = openJournal();
+			if (fp) {
+				writeStage(fp, stageName, stage);
+				closeJournal(fp);
+			}
+			else
+				saveUnlocked();
+		}
+	}
+
+	return true;
+}
+
+void BuildManifest::commit(const char *stageName, Hash key, const std::vector<std::string> &outputs)
+{
+	Stage stage;
+	stage.key = key;
+
+	for (size_t i = 0; i < outputs.size(); i++) {
+		Output output;
+		struct __stat64 st;
+		output.fileName = outputs[i];
+		output.size = -1;
+		if (_stat64(outputs[i].c_str(), &st) == 0)
+			output.hash = hashFile(outputs[i], &output.size);
+		if (output.size < 0) {
+			printf("[%s] output %s does not exist, stage is not recorded\n", stageName, outputs[i].c_str());
+			return;
+		}
+		output.modifiedTime = (__int64)st.st_mtime;
+		stage.outputs.push_back(output);
+	}
+
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	{
+		m_stages[stageName] = stage;
+
+		FILE *fp = openJournal();
+		if (fp) {
+			writeStage(fp, stageName, stage);
+			closeJournal(fp);
+		}
+		else
+			saveUnlocked();
+	}
+}
+
+void BuildManifest::invalidate(const char *stageName, bool isPrefix)
+{
+#ifdef _USE_OPENMP
+	#pragma omp critical (buildManifest)
+#endif
+	{
+		std::vector<std::string> removed;
+		if (isPrefix) {
+			size_t len = strlen(stageName);
+			StageMap::iterator it = m_stages.begin();
+			while (it != m_stages.end()) {
+				if (it->first.compare(0, len, stageName) == 0) {
+					removed.push_back(it->first);
+					m_stages.erase(it++);
+				}
+				else
+					it++;
+			}
+		}
+		else if (m_stages.erase(stageName) > 0)
+			removed.push_back(stageName);
+
+		if (!removed.empty()) {
+			FILE *fp = openJournal();
+			if (fp) {
+				for (size_t i = 0; i < removed.size(); i++)
+					fprintf(fp, "remove\t%s\n", removed[i].c_str());
+				closeJournal(fp);
+			}
+			else
+				saveUnlocked();
+		}
+	}
+}
+
+// FNV-1a on 64 bit words with a shift to mix high bits down, the tail is hashed bytewise
+BuildManifest::Hash BuildManifest::hashData(const void *data, size_t size, Hash seed)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	Hash h = seed;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8) {
+		Hash word;
+		memcpy(&word, bytes + i, 8);
+		h = (h ^ word) * HASH_PRIME;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++) {
+		h = (h ^ bytes[i]) * HASH_PRIME;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+BuildManifest::Hash BuildManifest::hashString(const char *str, Hash seed)
+{
+	return hashData(str, strlen(str), seed);
+}
+
+BuildManifest::Hash BuildManifest::hashFile(const std::string &fileName, __int64 *size)
+{
+	if (size) *size = -1;
+
+	FILE *fp = fopen(fileName.c_str(), "rb");
+	if (!fp) return 0;
+
+	// block size is a multiple of 8, so that the hash equals hashData() of the whole file
+	const size_t blockSize = 1 << 20;
+	unsigned char *block = new unsigned char[blockSize];
+	Hash h = HASH_SEED;
+	__int64 total = 0;
+	size_t ret;
+
+	while ((ret = fread(block, 1, blockSize, fp)) > 0) {
+		h = hashData(block, ret, h);
+		total += ret;
+		if (ret < blockSize) break;
+	}
+
+	delete[] block;
+	fclose(fp);
+
+	if (size) *size = total;
+	return h;
+}
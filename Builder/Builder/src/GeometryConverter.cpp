@@ -3,6 +3,7 @@
 #include <io.h>
 #include "FileMapper.h"
 #include <hash_map>
+#include "../../../OpenIRT/include/VertexEncoding.h"
 
 GeometryConverter::TCReturnType GeometryConverter::convertTri(const char *fullFileName, bool useBackup)
 {
@@ -170,6 +171,87 @@ GeometryConverter::TCReturnType GeometryConverter::convert(const char *filePath)
 	return SUCCESS;
 }
 
+GeometryConverter::TCReturnType GeometryConverter::splitVert(const char *filePath)
+{
+	typedef struct NewVertex_t {
+		Vector3 v;				// vertex geometry
+		float dummy1;
+		Vector3 n;				// normal vector
+		float dummy2;
+		Vector3 c;				// color
+		float dummy3;
+		Vector2 uv;				// Texture coordinate
+		unsigned char dummy[8];
+	} NewVertex;
+
+	char vertFileName[256];
+	char posFileName[256];
+	char attribFileName[256];
+	sprintf_s(vertFileName, "%s\\vertex.ooc", filePath);
+	sprintf_s(posFileName, "%s\\vertex_pos.ooc", filePath);
+	sprintf_s(attribFileName, "%s\\vertex_attrib.ooc", filePath);
+
+	FILE *fpSrc, *fpPos = NULL, *fpAttrib = NULL;
+	if(fopen_s(&fpSrc, vertFileName, "rb"))
+	{
+		printf("File open error : %s\n", vertFileName);
+		return ERR;
+	}
+	if(fopen_s(&fpPos, posFileName, "wb") || fopen_s(&fpAttrib, attribFileName, "wb"))
+	{
+		printf("File open error : %s\n", fpPos ? attribFileName : posFileName);
+		fclose(fpSrc);
+		if(fpPos) fclose(fpPos);
+		remove(posFileName);
+		return ERR;
+	}
+
+	const int chunkSize = 65536;
+	NewVertex *srcVerts = new NewVertex[chunkSize];
+	VertexPosition *posVerts = new VertexPosition[chunkSize];
+	VertexAttrib *attribVerts = new VertexAttrib[chunkSize];
+
+	__int64 numVerts = 0;
+	size_t numRead;
+	bool written = true;
+	while(written && (numRead = fread(srcVerts, sizeof(NewVertex), chunkSize, fpSrc)) > 0)
+	{
+		for(int i=0;i<(int)numRead;i++)
+		{
+			posVerts[i].v = srcVerts[i].v;
+			memset(posVerts[i].dummy, 0, sizeof(posVerts[i].dummy));
+			encodeOctahedralNormal(srcVerts[i].n.e[0], srcVerts[i].n.e[1], srcVerts[i].n.e[2], attribVerts[i].n);
+			attribVerts[i].uv[0] = floatToHalf(srcVerts[i].uv.e[0]);
+			attribVerts[i].uv[1] = floatToHalf(srcVerts[i].uv.e[1]);
+		}
+		written = fwrite(posVerts, sizeof(VertexPosition), numRead, fpPos) == numRead &&
+			fwrite(attribVerts, sizeof(VertexAttrib), numRead, fpAttrib) == numRead;
+		numVerts += numRead;
+	}
+
+	delete[] srcVerts;
+	delete[] posVerts;
+	delete[] attribVerts;
+
+	bool failed = !written || ferror(fpSrc);
+	fclose(fpSrc);
+	failed = fclose(fpPos) != 0 || failed;
+	failed = fclose(fpAttrib) != 0 || failed;
+
+	if(failed)
+	{
+		// the renderer would load partial streams, vertex.ooc is used without them
+		printf("Write error : %s, %s\n", posFileName, attribFileName);
+		remove(posFileName);
+		remove(attribFileName);
+		return ERR;
+	}
+
+	printf("%I64d vertices : %d + %d bytes per vertex (was %d)\n", numVerts, (int)sizeof(VertexPosition), (int)sizeof(VertexAttrib), (int)sizeof(NewVertex));
+
+	return SUCCESS;
+}
+
 GeometryConverter::TCReturnType GeometryConverter::convertCluster(const char *filePath)
 {
 	char oldDir[256]; // Save working directory
@@ -196,6 +278,11 @@ GeometryConverter::TCReturnType GeometryConverter::convertCluster(const char *fi
 	sprintf_s(singleVertFileName, "%s\\vertex.ooc", filePath);
 
 	Vertex *verts = (Vertex*)FileMapper::map(singleVertFileName);
+	if(!verts)
+	{
+		_chdir(oldDir);
+		return ERR;
+	}
 
 	for(int i=0;i<numClusters;i++)
 	{
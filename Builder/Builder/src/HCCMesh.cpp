@@ -142,28 +142,22 @@ int HCCMesh::convertHCCMesh(unsigned int nodeIndex, int &numNodes, VertexHash &v
 		// just make sure
 		curNode.children2 = GETRIGHTCHILD(node) << 2;
 
-		unsigned int leftClusterFileSize, rightClusterFileSize;
-
 		if(leftStat != 0) 
 		{
-			unsigned int clusterID = curCluster;
-			leftClusterFileSize = makeCluster(GETLEFTCHILD(node), numLeftNodes, nodeIndex, 1);
-			for(int i=0;i<numLeftNodes;i++) prog.step();
+			unsigned int clusterID = addCluster(GETLEFTCHILD(node), numLeftNodes);
 			int axis = curNode.children & 0x3;
 			curNode.children = (clusterID << 2) | axis;
 			curNode.children2 |= 0x2;
 		}
 		if(rightStat != 0) 
 		{
-			unsigned int clusterID = curCluster;
 			if(nodeIndex == 4)
 			{
 				printf("!!!! %d %d 2\n", GETRIGHTCHILD(node), nodeIndex);
 				printf("%u %u %f %f %f %f %f %f\n", node->children, node->children2, node->min.e[0], node->min.e[1], node->min.e[2], node->max.e[0], node->max.e[1], node->max.e[2]);
 				exit(-1);
 			}
-			rightClusterFileSize = makeCluster(GETRIGHTCHILD(node), numRightNodes, nodeIndex, 2);
-			for(int i=0;i<numRightNodes;i++) prog.step();
+			unsigned int clusterID = addCluster(GETRIGHTCHILD(node), numRightNodes);
 			int childStat = curNode.children2 & 0x3;
 			curNode.children2 = (clusterID << 2) | childStat;
 			curNode.children2 |= 0x1;
@@ -196,15 +190,10 @@ int HCCMesh::convertHCCMesh(unsigned int nodeIndex, int &numNodes, VertexHash &v
 		// just make sure
 		curNode.children2 = GETRIGHTCHILD(node) << 2;
 
-		unsigned int leftClusterFileSize, rightClusterFileSize;
 		unsigned int leftClusterID, rightClusterID;
 
-		leftClusterID = curCluster;
-		leftClusterFileSize = makeCluster(GETLEFTCHILD(node), numLeftNodes, nodeIndex, 3);
-		for(int i=0;i<numLeftNodes;i++) prog.step();
-		rightClusterID = curCluster;
-		rightClusterFileSize = makeCluster(GETRIGHTCHILD(node), numRightNodes, nodeIndex, 4);
-		for(int i=0;i<numRightNodes;i++) prog.step();
+		leftClusterID = addCluster(GETLEFTCHILD(node), numLeftNodes);
+		rightClusterID = addCluster(GETRIGHTCHILD(node), numRightNodes);
 
 		int axis = curNode.children & 0x3;
 		curNode.children = (leftClusterID << 2) | axis;
@@ -219,15 +208,108 @@ int HCCMesh::convertHCCMesh(unsigned int nodeIndex, int &numNodes, VertexHash &v
 	return 1;
 }
 
-unsigned int HCCMesh::makeCluster(unsigned int nodeIndex, int numNodes, unsigned int parentIndex, int type)
+unsigned int HCCMesh::addCluster(unsigned int nodeIndex, int numNodes)
 {
-	//cout << "Cluster " << numClusters << " has " << numNodes << " nodes" << endl;
 	if(processedClusters.find(nodeIndex) != processedClusters.end())
 	{
 		printf("Already made cluster! root index = %d\n", nodeIndex);
 	}
 	processedClusters.insert(nodeIndex);
 
+	// the ID is given in the order of the traversal, the cluster is compressed later
+	ClusterJob job;
+	job.nodeIndex = nodeIndex;
+	job.numNodes = numNodes;
+	clusterJobs.push_back(job);
+
+	return curCluster++;
+}
+
+void HCCMesh::initWorker(const HCCMesh &master)
+{
+	tree = master.tree;
+	tris = master.tris;
+	indices = master.indices;
+	verts = master.verts;
+
+	maxNodesPerCluster = master.maxNodesPerCluster;
+	maxVertsPerCluster = master.maxVertsPerCluster;
+	nQuantize = master.nQuantize;
+	numTemplates = master.numTemplates;
+	memcpy(templates, master.templates, sizeof(templates));
+	memcpy(templateByShape, master.templateByShape, sizeof(templateByShape));
+	memcpy(quantizedNormals, master.quantizedNormals, sizeof(quantizedNormals));
+#ifdef USE_VERTEX_QUANTIZE
+	pqVert = master.pqVert;
+#endif
+}
+
+int HCCMesh::compressClusters()
+{
+	int numThreads = omp_in_parallel() ? 1 : omp_get_max_threads();
+#ifdef USE_LOD
+	// LODs are appended to the LOD cluster file while a cluster is made
+	numThreads = 1;
+#endif
+
+	// a worker has its own state of the current cluster and shares the source files
+	HCCMesh *workers = this;
+	if(numThreads > 1)
+	{
+		workers = new HCCMesh[numThreads];
+		for(int i=0;i<numThreads;i++)
+			workers[i].initWorker(*this);
+	}
+
+	int numJobs = (int)clusterJobs.size();
+	vector<vector<unsigned char> > batchData(CLUSTER_BATCH_SIZE);
+
+	for(int batchStart=0;batchStart<numJobs;batchStart+=CLUSTER_BATCH_SIZE)
+	{
+		int batchSize = numJobs - batchStart;
+		if(batchSize > CLUSTER_BATCH_SIZE) batchSize = CLUSTER_BATCH_SIZE;
+
+#ifdef _USE_OPENMP
+		#pragma omp parallel for schedule(dynamic, 1) if(numThreads > 1)
+#endif
+		for(int i=0;i<batchSize;i++)
+		{
+			HCCMesh &worker = workers[omp_get_thread_num()];
+			const ClusterJob &job = clusterJobs[batchStart+i];
+			worker.makeCluster(job.nodeIndex, job.numNodes);
+			batchData[i].swap(worker.clusterData);
+		}
+
+		// clusters are stored in the order of their IDs
+		for(int i=0;i<batchSize;i++)
+		{
+			fwrite(&batchData[i][0], 1, batchData[i].size(), fpCluster);
+			for(int j=0;j<clusterJobs[batchStart+i].numNodes;j++) prog.step();
+		}
+	}
+
+	if(workers != this)
+	{
+		for(int i=0;i<numThreads;i++)
+		{
+			numClusters += workers[i].numClusters;
+			numLowLevelNodes += workers[i].numLowLevelNodes;
+			fileSizeHeader += workers[i].fileSizeHeader;
+			fileSizeNode += workers[i].fileSizeNode;
+			fileSizeSupp += workers[i].fileSizeSupp;
+			fileSizeVert += workers[i].fileSizeVert;
+		}
+		fileSize = fileSizeHeader + fileSizeNode + fileSizeSupp + fileSizeVert;
+		delete[] workers;
+	}
+
+	clusterJobs.clear();
+	return 1;
+}
+
+unsigned int HCCMesh::makeCluster(unsigned int nodeIndex, int numNodes)
+{
+	//cout << "Cluster " << numClusters << " has " << numNodes << " nodes" << endl;
 	curCNodeIndex = 0;
 	curCSuppIndex = 0;
 	curCVertIndex = 0;
@@ -294,23 +376,8 @@ unsigned int HCCMesh::makeCluster(unsigned int nodeIndex, int numNodes, unsigned
 
 
 	// find template type of root of this cluster
-	rootType = -1;
 	TREE_CLASS* localRootNode = GETNODE(tree, nodeIndex);
-	if(ISLEAF(localRootNode))
-	{
-		rootType = numTemplates-1;
-	}
-	else
-	{
-		for(int i=0;i<numTemplates;i++)
-		{
-			if(isSameTree(nodeIndex, 0, 1, templates[i].tree))
-			{
-				rootType = i;
-				break;
-			}
-		}
-	}
+	rootType = findTemplate(nodeIndex);
 	assert(rootType >= 0);
 
 	ts.type = rootType;
@@ -380,10 +447,15 @@ unsigned int HCCMesh::makeCluster(unsigned int nodeIndex, int numNodes, unsigned
 	for(int i=0;i<clusterNumVert;i++) fwrite(&clusterVert[i], sizeof(CompTreeVert), 1, fpCluster);
 	fclose(fpCluster);
 	*/
-	fwrite(&header, sizeof(CompClusterHeader), 1, fpCluster);
-	for(int i=0;i<clusterNumNode;i++) fwrite(&compTreeNode[i], sizeof(CTREE_CLASS), 1, fpCluster);
-	for(int i=0;i<clusterNumSupp;i++) fwrite(&compTreeSupp[i], sizeof(CompTreeSupp), 1, fpCluster);
-	for(int i=0;i<clusterNumVert;i++) fwrite(&clusterVert[i], sizeof(CompTreeVert), 1, fpCluster);
+	clusterData.resize(clusterFileSize);
+	unsigned char *data = &clusterData[0];
+	memcpy(data, &header, sizeof(CompClusterHeader));
+	data += sizeof(CompClusterHeader);
+	if(clusterNumNode) memcpy(data, &compTreeNode[0], clusterNumNode*sizeof(CTREE_CLASS));
+	data += clusterNumNode*sizeof(CTREE_CLASS);
+	if(clusterNumSupp) memcpy(data, &compTreeSupp[0], clusterNumSupp*sizeof(CompTreeSupp));
+	data += clusterNumSupp*sizeof(CompTreeSupp);
+	if(clusterNumVert) memcpy(data, &clusterVert[0], clusterNumVert*sizeof(CompTreeVert));
 
 /*////
 #ifdef GENERATE_OUT_OF_CORE_REP
@@ -414,8 +486,6 @@ unsigned int HCCMesh::makeCluster(unsigned int nodeIndex, int numNodes, unsigned
 
 #endif
 *////
-	curCluster++;
-
 	return clusterFileSize;
 }
 
@@ -526,24 +596,7 @@ int HCCMesh::StoreGeneralNodes(unsigned int startIndex, int maxDepth, vector<uns
 {
 	if(maxDepth <= 4)
 	{
-		TREE_CLASS* rootNode = GETNODE(tree, startIndex);
-
-		int templateType = -1;
-		if(ISLEAF(rootNode))
-		{
-			templateType = numTemplates-1;
-		}
-		else
-		{
-			for(int i=0;i<numTemplates;i++)
-			{
-				if(isSameTree(startIndex, 0, 1, templates[i].tree))
-				{
-					templateType = i;
-					break;
-				}
-			}
-		}
+		int templateType = findTemplate(startIndex);
 		assert(templateType >= 0);
 
 		// make link between parent and child links
@@ -985,6 +1038,8 @@ int HCCMesh::convertHCCMesh(const char* filepath, unsigned int maxNodesPerCluste
 		printf("Error! Node %d->%d\n", numNodes, numProcessedNodes);
 	}
 
+	compressClusters();
+
 	reassignHighNodeStruct(GETROOT(), -1, -1);
 
 	// store templates
@@ -1465,6 +1520,7 @@ int HCCMesh::generateTemplates()
 		}
 	}
 
+	initTemplateShapes();
 	return 1;
 }
 
@@ -1503,6 +1559,8 @@ int HCCMesh::generateTemplates(const char* srcFileName)
 	}
 
 	fclose(fp);
+
+	initTemplateShapes();
 	return 1;
 }
 
@@ -1529,6 +1587,41 @@ int HCCMesh::isSameTree(unsigned int startIndexA, unsigned int startIndexB, int
 	return isSameTree(GETLEFTCHILD(nodeA), GETLEFTCHILD(nodeB), depth+1, t) && isSameTree(GETRIGHTCHILD(nodeA), GETRIGHTCHILD(nodeB), depth+1, t);
 }
 
+// appends the shape of a subtree down to the depth at which isSameTree() stops comparing
+// with a template, an inner node is 1 followed by its children and a leaf is 0
+int HCCMesh::getTreeShape(unsigned int startIndex, int depth, int shape, TREE_CLASS t[])
+{
+	if(depth >= DEPTH_TEMPLATE) return shape;
+
+	TREE_CLASS *node;
+	if(t)
+		node = GETNODE(&t, startIndex);
+	else
+		node = GETNODE(tree, startIndex);
+
+	if(ISLEAF(node)) return shape << 1;
+
+	shape = (shape << 1) | 1;
+	shape = getTreeShape(GETLEFTCHILD(node), depth+1, shape, t);
+	return getTreeShape(GETRIGHTCHILD(node), depth+1, shape, t);
+}
+
+void HCCMesh::initTemplateShapes()
+{
+	for(int i=0;i<NUM_TEMPLATE_SHAPES;i++) templateByShape[i] = -1;
+
+	// the first matching template wins, as in a linear search with isSameTree()
+	for(int i=numTemplates-1;i>=0;i--)
+		templateByShape[getTreeShape(0, 1, 1, templates[i].tree)] = i;
+}
+
+// same as the first template for which isSameTree() is true, with a single lookup
+int HCCMesh::findTemplate(unsigned int startIndex)
+{
+	if(ISLEAF(GETNODE(tree, startIndex))) return numTemplates-1;
+	return templateByShape[getTreeShape(startIndex, 1, 1)];
+}
+
 int HCCMesh::findCorrIndex(unsigned int startIndexS, unsigned int startIndexT, TREE_CLASS t[], unsigned int map[])
 {
 	map[startIndexT] = startIndexS;
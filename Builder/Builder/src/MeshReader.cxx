@@ -315,6 +315,22 @@ int PlyReader::getNrFaces()
 	return -1;
 }
 
+
+int PlyReader::getNrElements(const char *elemName) const
+{
+	for (int et = 0; et < plyFile->num_elem_types; ++et) {
+		if (equal_strings((char *)elemName, plyFile->elems[et]->name)) return plyFile->elems[et]->num;
+	}
+	return -1;
+}
+
+
+__int64 PlyReader::getFilePosition() const
+{
+	__int64 pos = _ftelli64(plyFile->fp);
+	return pos < 0 ? 0 : pos;
+}
+
 #include "App.h"
 
 /// check the next element block
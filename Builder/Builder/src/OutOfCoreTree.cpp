@@ -20,6 +20,7 @@
 #include "OptionManager.h"
 #include "Progression.h"
 #include "Materials.h"
+#include "FileMapper.h"
 
 //#define USE_CUSTOM_MATRIX
 
@@ -29,12 +30,16 @@ OutOfCoreTree::OutOfCoreTree() {
 	numFaces = 0;
 	numVertices = 0;
 	useFileMat = false;
+	manifest = NULL;
+	facesUpToDate = false;
 }
 
 OutOfCoreTree::~OutOfCoreTree() {
 
 	if (reader)
 		delete reader;
+	if (manifest)
+		delete manifest;
 }
 
 #if HIERARCHY_TYPE == TYPE_BVH 
@@ -74,9 +79,6 @@ bool OutOfCoreTree::build(const char *outputPath, const char *fileName, bool use
 		fclose(fp);
 	}
 
-	// build reader:
-	reader = new PlyReader(curFileName);
-
 	//const char *baseDirName = opt->getOption("global", "scenePath", "");
 	char tempFileName[MAX_PATH];
 	int pos = 0;
@@ -92,11 +94,54 @@ bool OutOfCoreTree::build(const char *outputPath, const char *fileName, bool use
 	sprintf(outDirName, "%s\\%s.ooc", outputPath, tempFileName);
 	mkdir(outDirName);
 
+	buildStages.clear();
+
+	//
+	// keys of the build stages, each one includes the key of the stage before
+	//
+	if (manifest) delete manifest;
+	manifest = new BuildManifest(getManifestFileName());
+	manifest->load();
+
+	vertexKey = manifest->hashInput(curFileName);
+	vertexKey = BuildManifest::hashValue(useModelTransform, vertexKey);
+	if (useModelTransform)
+		vertexKey = BuildManifest::hashData(mat, sizeof(mat), vertexKey);
+	vertexKey = BuildManifest::hashValue((int)sizeof(Vertex), vertexKey);
+	#ifdef _USE_TRI_MATERIALS
+	vertexKey = BuildManifest::hashString("colors", vertexKey);
+	#endif
+
+	faceKey = BuildManifest::hashValue((int)sizeof(Triangle), vertexKey);
+	#ifdef NORMAL_INCLUDED
+	faceKey = BuildManifest::hashString("normals", faceKey);
+	#endif
+
+	voxelBVHKey = hashBVHOptions(BuildManifest::hashString("voxel BVH", faceKey));
+	bvhKey = hashBVHOptions(BuildManifest::hashString("model", faceKey));
+
+	if (manifest->isUpToDate("model", bvhKey)) {
+		cout << "Skipping build, all outputs are up to date.\n";
+		return true;
+	}
+	manifest->invalidate("model");
+
+	// checked once, the vertex pass is skipped with the face pass
+	facesUpToDate = manifest->isUpToDate("faces", faceKey);
+
+	// build reader:
+	reader = new PlyReader(curFileName);
+
+	// vertex properties are known from the header
+	hasVertexColors = reader->hasColor();
+	hasVertexNormals = reader->hasVertNormal();
+	hasVertexTextures = reader->hasVertTexture();
+
 	//
-	// first pass:
-	// find number of vertices/tris and bounding-box:
+	// vertex pass:
+	// write vertices, find number of vertices/tris and bounding-box:
 	//
-	firstVertexPass();
+	vertexPass();
 
 	cout << "Model dimensions: " << grid.getExtent() << endl;
 	cout << "BB: min: " << grid.p_min << ", max: " << grid.p_max << endl;
@@ -107,9 +152,9 @@ bool OutOfCoreTree::build(const char *outputPath, const char *fileName, bool use
 	cout << "Using " << grid.getSize() << " Voxels." << endl;
 
 	//
-	// second pass: sort vertices & triangles to voxels
+	// face pass: sort triangles to voxels
 	//
-	secondVertexPass();
+	facePass();
 
 	//
 	// for each voxel: build BVH:
@@ -130,6 +175,8 @@ bool OutOfCoreTree::build(const char *outputPath, const char *fileName, bool use
 	double elapsedMinOfHourFrac = modf((end - start)/(float)(60*60), &elapsedHours);
 	elapsedMinOfHour = elapsedMinOfHourFrac * 60.0;
 	
+	printBuildStages();
+
 	cout << "OOC tree build ended, time = " << (end - start) << "s (" << (int)elapsedHours << " h, " << elapsedMinOfHour << " min)" << endl;
 
 
@@ -137,10 +184,160 @@ bool OutOfCoreTree::build(const char *outputPath, const char *fileName, bool use
 }
 #endif
 
-bool OutOfCoreTree::firstVertexPass() {
+std::vector<std::string> OutOfCoreTree::getModelOutputs() {
+	std::vector<std::string> outputs;
+	outputs.push_back(getSceneInfoName());
+	outputs.push_back(getVertexFileName());
+	outputs.push_back(getTriangleFileName());
+	outputs.push_back(getMaterialListName());
+	outputs.push_back(getBVHFileName());
+	outputs.push_back(getBVHFileName() + ".idx");
+	outputs.push_back(getBVHFileName() + ".node");
+	return outputs;
+}
+
+BuildManifest::Hash OutOfCoreTree::hashBVHOptions(BuildManifest::Hash seed) {
+	seed = BuildManifest::hashValue((int)BVHNODE_BYTES, seed);
+	#ifdef _USE_BINNED_SAH
+	seed = BuildManifest::hashString("binned SAH", seed);
+	seed = BuildManifest::hashValue((int)SAH_NUM_BINS, seed);
+	#else
+	seed = BuildManifest::hashString("exact SAH", seed);
+	#endif
+	return seed;
+}
+
+void OutOfCoreTree::addBuildStage(const char *name, __int64 bytesRead, __int64 bytesWritten, double time) {
+	BuildStage stage;
+	stage.name = name;
+	stage.bytesRead = bytesRead;
+	stage.bytesWritten = bytesWritten;
+	stage.time = time;
+	buildStages.push_back(stage);
+
+	printf("[%s] read %.1f MB, written %.1f MB, %.2f s\n", name, bytesRead / (1024.0*1024.0), bytesWritten / (1024.0*1024.0), time);
+}
+
+void OutOfCoreTree::printBuildStages() {
+	__int64 sumRead = 0, sumWritten = 0;
+	double sumTime = 0.0;
+
+	printf("%-16s %12s %12s %10s\n", "Stage", "Read (MB)", "Written (MB)", "Time (s)");
+	for (unsigned int i = 0; i < buildStages.size(); i++) {
+		const BuildStage &stage = buildStages[i];
+		printf("%-16s %12.1f %12.1f %10.2f\n", stage.name, stage.bytesRead / (1024.0*1024.0), stage.bytesWritten / (1024.0*1024.0), stage.time);
+		sumRead += stage.bytesRead;
+		sumWritten += stage.bytesWritten;
+		sumTime += stage.time;
+	}
+	printf("%-16s %12.1f %12.1f %10.2f\n", "Total", sumRead / (1024.0*1024.0), sumWritten / (1024.0*1024.0), sumTime);
+}
+
+void OutOfCoreTree::transformVertex(Vertex &curVert) {
+	if(!useModelTransform) return;
+
+	Vector3 &pv = curVert.v;
+	Vector3 pt;
+	pt.e[0] = pv.e[0]*mat[0*4+0] + pv.e[1]*mat[0*4+1] + pv.e[2]*mat[0*4+2] + mat[0*4+3];
+	pt.e[1] = pv.e[0]*mat[1*4+0] + pv.e[1]*mat[1*4+1] + pv.e[2]*mat[1*4+2] + mat[1*4+3];
+	pt.e[2] = pv.e[0]*mat[2*4+0] + pv.e[1]*mat[2*4+1] + pv.e[2]*mat[2*4+2] + mat[2*4+3];
+
+	pv.e[0] = pt.e[0];
+	pv.e[1] = pt.e[1];
+	pv.e[2] = pt.e[2];
 
-	if (fileExists(getSceneInfoName())) {
-		cout << "Skipping 1st pass, already generated...\n";
+	Vector3 &pn = curVert.n;
+	pt.e[0] = pn.e[0]*mat[0*4+0] + pn.e[1]*mat[0*4+1] + pn.e[2]*mat[0*4+2];
+	pt.e[1] = pn.e[0]*mat[1*4+0] + pn.e[1]*mat[1*4+1] + pn.e[2]*mat[1*4+2];
+	pt.e[2] = pn.e[0]*mat[2*4+0] + pn.e[1]*mat[2*4+1] + pn.e[2]*mat[2*4+2];
+
+	pn.e[0] = pt.e[0];
+	pn.e[1] = pt.e[1];
+	pn.e[2] = pt.e[2];
+	pn.makeUnitVector();
+}
+
+// number of vertices or faces parsed at once, a batch is parsed while the previous one is processed
+#define OOC_BATCH_SIZE (1 << 16)
+
+typedef struct VertexBatch_t {
+	std::vector<Vertex> verts;
+	std::vector<rgba> colors;
+	int numVerts;
+} VertexBatch;
+
+typedef struct FaceBatch_t {
+	std::vector<int> faces;					// first three vertex indices of each face
+	std::vector<Triangle> tris;
+	std::vector<unsigned int> voxels;
+	std::vector<Vector3> areaNormals;		// area weighted face normals for vertex normals
+	std::vector<unsigned int> colorVerts;	// vertex whose color is the material
+	unsigned int firstTri;
+	int numFaces;
+} FaceBatch;
+
+static void readVertexBatch(PlyReader *reader, bool readColors, VertexBatch &batch, Progression &prog) {
+	batch.verts.resize(OOC_BATCH_SIZE);
+	#ifdef _USE_TRI_MATERIALS
+	batch.colors.resize(OOC_BATCH_SIZE);
+	rgba tempColor;
+	int tempMat, tempFile = 0;
+	#endif
+
+	batch.numVerts = 0;
+	while (batch.numVerts < OOC_BATCH_SIZE && reader->haveVertex()) {
+		#ifdef _USE_TRI_MATERIALS
+		if (readColors) {
+			batch.verts[batch.numVerts] = reader->readVertexWithColorMatFile(tempColor, tempMat, tempFile);
+			tempColor.alpha = (float)tempFile;
+			batch.colors[batch.numVerts] = tempColor;
+		}
+		else {
+			batch.verts[batch.numVerts] = reader->readVertex();
+			// insert dummy color:
+			batch.colors[batch.numVerts] = rgba(0.7f, 0.7f, 0.7f, 1.0f);
+		}
+		#else
+		batch.verts[batch.numVerts] = reader->readVertex();
+		#endif
+		batch.numVerts++;
+		prog.step();
+	}
+}
+
+static void readFaceBatch(PlyReader *reader, unsigned int firstTri, FaceBatch &batch, Progression &prog) {
+	std::vector<int> vIdxList;
+
+	batch.faces.resize(OOC_BATCH_SIZE*3);
+	batch.tris.resize(OOC_BATCH_SIZE);
+	batch.voxels.resize(OOC_BATCH_SIZE);
+	batch.areaNormals.resize(OOC_BATCH_SIZE);
+	batch.colorVerts.resize(OOC_BATCH_SIZE);
+
+	batch.firstTri = firstTri;
+	batch.numFaces = 0;
+	while (batch.numFaces < OOC_BATCH_SIZE && reader->haveFace()) {
+		reader->readFace(vIdxList);
+		batch.faces[batch.numFaces*3+0] = vIdxList[0];
+		batch.faces[batch.numFaces*3+1] = vIdxList[1];
+		batch.faces[batch.numFaces*3+2] = vIdxList[2];
+		batch.numFaces++;
+		prog.step();
+	}
+}
+
+bool OutOfCoreTree::vertexPass() {
+	TimerValue start, end;
+	start.set();
+
+	__int64 startPos = reader->getFilePosition();
+
+	// the face pass updates the vertex file and removes the colors, its record
+	// covers the vertices once it is done
+	bool done = facesUpToDate || manifest->isUpToDate("vertices", vertexKey);
+
+	if (done) {
+		cout << "Skipping vertex pass, already generated...\n";
 		
 		FILE *firstPassFile = fopen(getSceneInfoName().c_str(), "rb");
 		fread(&numVertices, sizeof(int), 1, firstPassFile);
@@ -150,96 +347,124 @@ bool OutOfCoreTree::firstVertexPass() {
 
 		cout << numVertices << " Vertices read.\n";
 		cout << numFaces << " Tris read.\n";
+
+		// faces follow the vertices
+		reader->skipVertices();
+
+		end.set();
+		addBuildStage("vertices", reader->getFilePosition() - startPos, 0, end - start);
+
+		return numVertices > 0 && numFaces > 0;
 	}
-	else {
-	
-		// init reader
-		reader->restart();
-		// init bounding box
-		grid.clear();
-		// count number of vertices
-		numVertices = 0;
-		numFaces = 0;
 
-		//
-		///
-		//
+	// outputs of this and the following stages are rewritten
+	manifest->invalidate("vertices");
+	manifest->invalidate("faces");
 
-		/*
-		FILE *fp = fopen("david_1_50.ply", "w");
-		fprintf(fp, "ply\n");
-		fprintf(fp, "format ascii 1.0\n");
-		fprintf(fp, "element vertex 4129614\n");
-		fprintf(fp, "property float x\n");
-		fprintf(fp, "property float y\n");
-		fprintf(fp, "property float z\n");
-		fprintf(fp, "element face 8254150\n");
-		fprintf(fp, "property list uint8 int32 vertex_indices\n");
-		fprintf(fp, "end_header\n");
-		while(reader->haveVertex())
-		{
-			Vector3 v = reader->readVertex().v;
-			fprintf(fp, "%f %f %f\n", v.e[0]/50.0f, v.e[1]/50.0f, v.e[2]/50.0f);
-		}
-		std::vector<int> IdxList;
-		while(reader->haveFace())
-		{
-			reader->readFace(IdxList);
-			fprintf(fp, "3 %d %d %d\n", IdxList[0], IdxList[1], IdxList[2]);
-		}
-		fclose(fp);
-		exit(1);
-		*/
+	// init bounding box
+	grid.clear();
+	numVertices = 0;
+	// the header has the number of faces, no need to read them here
+	numFaces = reader->getNrElements("face");
+	if ((int)numFaces < 0) numFaces = 0;
 
-		//
-		///
-		//
+	// init out file for all vertices	
+	BufferedOutputs<Vertex> *pVertices = new BufferedOutputs<Vertex>(getVertexFileName(), 100000);
+	pVertices->clear();
+
+	// init out file for all vertices' colors (temporary)
+	BufferedOutputs<rgba> *pColorList = new BufferedOutputs<rgba>(getColorListName(), 10000);
+	pColorList->clear();
 
-		// read all vertices
-		while (reader->haveVertex()) {
-			// update bounding box
-			++numVertices;
-			if (numVertices%1000000 == 0) {
-				cout << " > " << numVertices << " vertices read" << endl;
-			}		
+	int numThreads = omp_get_max_threads();
+	std::vector<Vector3> threadMins(numThreads, Vector3(FLT_MAX, FLT_MAX, FLT_MAX));
+	std::vector<Vector3> threadMaxs(numThreads, Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+
+	Progression prog("read verts" , reader->getNrElements("vertex"), 20);
+
+	bool readColors = reader->hasColor();
+
+	// batch k is transformed while batch k+1 is parsed and batch k-1 is written
+	VertexBatch batches[3];
+	batches[0].numVerts = batches[2].numVerts = 0;
+	readVertexBatch(reader, readColors, batches[1], prog);
+
+	for (int k = 1; batches[k%3].numVerts > 0 || batches[(k-1)%3].numVerts > 0; k++) {
+		VertexBatch &prevBatch = batches[(k-1)%3];
+		VertexBatch &curBatch = batches[k%3];
+		VertexBatch &nextBatch = batches[(k+1)%3];
+		int numCurVerts = curBatch.numVerts;
+		nextBatch.numVerts = 0;
+
+#ifdef _USE_OPENMP
+		#pragma omp parallel
+#endif
+		{
+#ifdef _USE_OPENMP
+			#pragma omp single nowait
+#endif
+			if (numCurVerts > 0)
+				readVertexBatch(reader, readColors, nextBatch, prog);
 
-			if(useModelTransform)
+#ifdef _USE_OPENMP
+			#pragma omp single nowait
+#endif
 			{
-				Vertex curVert = reader->readVertex();
-				Vector3 &pv = curVert.v;
-				Vector3 pt;
-				pt.e[0] = pv.e[0]*mat[0*4+0] + pv.e[1]*mat[0*4+1] + pv.e[2]*mat[0*4+2] + mat[0*4+3];
-				pt.e[1] = pv.e[0]*mat[1*4+0] + pv.e[1]*mat[1*4+1] + pv.e[2]*mat[1*4+2] + mat[1*4+3];
-				pt.e[2] = pv.e[0]*mat[2*4+0] + pv.e[1]*mat[2*4+1] + pv.e[2]*mat[2*4+2] + mat[2*4+3];
-
-				grid.addPoint(pt);
+				for (int i = 0; i < prevBatch.numVerts; i++) {
+					pVertices->appendElement(prevBatch.verts[i]);
+					#ifdef _USE_TRI_MATERIALS
+					pColorList->appendElement(prevBatch.colors[i]);
+					#endif
+				}
+			}
+
+			int thread = omp_get_thread_num();
+#ifdef _USE_OPENMP
+			#pragma omp for schedule(dynamic, 4096)
+#endif
+			for (int i = 0; i < numCurVerts; i++) {
+				transformVertex(curBatch.verts[i]);
+				updateBB(threadMins[thread], threadMaxs[thread], curBatch.verts[i].v);
 			}
-			else
-				grid.addPoint(reader->readVertex().v);
 		}
 
-		cout << numVertices << " Vertices read.\n";
+		numVertices += prevBatch.numVerts;
+		prevBatch.numVerts = 0;
+	}
 
-		// read all faces
-		std::vector<int> vIdxList;
-		while (reader->haveFace()) {
-			// update bounding box
-			++numFaces;
-			if (numFaces%1000000 == 0) {
-				cout << " > " << numFaces << " tris read " << endl;
-			}		
+	for (int i = 0; i < numThreads; i++) {
+		if (threadMins[i].e[0] > threadMaxs[i].e[0]) continue;
+		grid.addPoint(threadMins[i]);
+		grid.addPoint(threadMaxs[i]);
+	}
 
-			reader->readFace(vIdxList);
-		}
+	delete pVertices;
+	delete pColorList;
 
-		cout << numFaces << " Tris read.\n";
+	cout << numVertices << " Vertices read.\n";
+	cout << numFaces << " Tris in the header.\n";
 
-		FILE *firstPassFile = fopen(getSceneInfoName().c_str(), "wb");
-		fwrite(&numVertices, sizeof(int), 1, firstPassFile);
-		fwrite(&numFaces, sizeof(int), 1, firstPassFile);
-		fwrite(&grid, sizeof(Grid), 1, firstPassFile);
-		fclose(firstPassFile);
-	}
+	FILE *firstPassFile = fopen(getSceneInfoName().c_str(), "wb");
+	fwrite(&numVertices, sizeof(int), 1, firstPassFile);
+	fwrite(&numFaces, sizeof(int), 1, firstPassFile);
+	fwrite(&grid, sizeof(Grid), 1, firstPassFile);
+	fclose(firstPassFile);
+
+	std::vector<std::string> outputs;
+	outputs.push_back(getSceneInfoName());
+	outputs.push_back(getVertexFileName());
+	#ifdef _USE_TRI_MATERIALS
+	outputs.push_back(getColorListName());
+	#endif
+	manifest->commit("vertices", vertexKey, outputs);
+
+	end.set();
+
+	__int64 bytesWritten = (__int64)numVertices * sizeof(Vertex);
+	#ifdef _USE_TRI_MATERIALS
+	bytesWritten += (__int64)numVertices * sizeof(rgba);
+	#endif
+	addBuildStage("vertices", reader->getFilePosition() - startPos, bytesWritten, end - start);
 
 	return numVertices > 0 && numFaces > 0;
 }
@@ -259,20 +484,18 @@ void OutOfCoreTree::calculateVoxelResolution() {
 }
 
 
-bool OutOfCoreTree::secondVertexPass() {
+bool OutOfCoreTree::facePass() {
+	TimerValue start, end;
+	start.set();
+
 	VoxelHashTableIterator it;
 	voxelHashTable = new VoxelHashTable;
-	MaterialDiffuse *plyMat = new MaterialDiffuse(rgb(0.7f,0.7f,0.7f));
 	numUsedVoxels = 0;
 
-	bool hasVertexColors = false;	// initialize
-	bool hasVertexNormals = false;
-	bool hasVertexTextures = false;
-
 	// Test if this pass was already completed in an earlier run:
 	// then just read in the already generated data.
-	if (fileExists(getVertexFileName()) && fileExists(getTriangleFileName())) {
-		cout << "Skipping 2nd pass, already generated...\n";
+	if (facesUpToDate) {
+		cout << "Skipping face pass, already generated...\n";
 		 // go through all voxels:
 		for (unsigned int boxNr = 0; boxNr < grid.getSize(); boxNr++) {			
 			if (fileExists(getVTriangleFileName(boxNr))) {
@@ -281,271 +504,206 @@ bool OutOfCoreTree::secondVertexPass() {
 				voxelHashTable->insert(std::pair<int,int>(boxNr,voxelTris));						
 				numUsedVoxels++;
 			}	
-			else
-			{
-				printf("hello \n");
-			}
 		}		
-	}
-	else { // start construction:
-		reader->restart();
-		if (fileExists(getVertexFileName()) && fileExists(getVertexIndexFileName()) && fileExists(getColorListName())) {
-			// skip first half of second pass...
-			reader->skipVertices();
-		}
-		else {
 
-			// sungeui's note: there is no guarantee that this single vertex file supports
-			//					cache-coherent access patters.
-			//					Need to use small vertex file for each voxel.
-			// init out file for all vertices	
-			//BufferedOutputs<Vector3> *pVertices = new BufferedOutputs<Vector3>(getVertexFileName(), 100000);
-			BufferedOutputs<Vertex> *pVertices = new BufferedOutputs<Vertex>(getVertexFileName(), 100000);
-			pVertices->clear();
-
-			// init out file for all vertices' voxel IDs (temporary)	
-			BufferedOutputs<unsigned int> *pVertexIndexMap = new BufferedOutputs<unsigned int>(getVertexIndexFileName(), 100000);
-			pVertexIndexMap->clear();
-
-			// init out file for all vertices' colors (temporary)
-			BufferedOutputs<rgba> *pColorList = new BufferedOutputs<rgba>(getColorListName(), 10000);
-			pColorList->clear();
-					
-			// init reader
-			
-			Progression prog1("read verts" , numVertices, 20);
-
-			hasVertexColors = reader->hasColor();
-			hasVertexNormals = reader->hasVertNormal();
-			hasVertexTextures = reader->hasVertTexture();
-
-//			float mat[] = {1, 0, 0, 0, 0, 0, 1, 0, 0, -1, 0, 0, 0, 0, 0, 1};
-
-			// read all vertices:
-			// 
-			#ifdef _USE_TRI_MATERIALS
-			rgba tempColor;
-			int tempMat, tempFile;
-			if (reader->hasColor()) {
-				while (reader->haveVertex()) {					
-					//Vertex curVert = reader->readVertexWithColor(tempColor);
-					Vertex curVert = reader->readVertexWithColorMatFile(tempColor, tempMat, tempFile);
-
-					if(useModelTransform)
-					{
-						Vector3 &pv = curVert.v;
-						Vector3 pt;
-						pt.e[0] = pv.e[0]*mat[0*4+0] + pv.e[1]*mat[0*4+1] + pv.e[2]*mat[0*4+2] + mat[0*4+3];
-						pt.e[1] = pv.e[0]*mat[1*4+0] + pv.e[1]*mat[1*4+1] + pv.e[2]*mat[1*4+2] + mat[1*4+3];
-						pt.e[2] = pv.e[0]*mat[2*4+0] + pv.e[1]*mat[2*4+1] + pv.e[2]*mat[2*4+2] + mat[2*4+3];
-
-						pv.e[0] = pt.e[0];
-						pv.e[1] = pt.e[1];
-						pv.e[2] = pt.e[2];
-
-						Vector3 &pn = curVert.n;
-						pt.e[0] = pn.e[0]*mat[0*4+0] + pn.e[1]*mat[0*4+1] + pn.e[2]*mat[0*4+2];
-						pt.e[1] = pn.e[0]*mat[1*4+0] + pn.e[1]*mat[1*4+1] + pn.e[2]*mat[1*4+2];
-						pt.e[2] = pn.e[0]*mat[2*4+0] + pn.e[1]*mat[2*4+1] + pn.e[2]*mat[2*4+2];
-
-						pn.e[0] = pt.e[0];
-						pn.e[1] = pt.e[1];
-						pn.e[2] = pt.e[2];
-						pn.makeUnitVector();
-					}
-					tempColor.alpha = (float)tempFile;
-					
-					// get voxel for point:
-					unsigned int idx = grid.getCellIndex(curVert.v);
-
-					// write to file:
-					//pVertices->appendElement(curVert);
-					pVertices->appendElement(curVert);
-					pVertexIndexMap->appendElement(idx);
-					pColorList->appendElement(tempColor);
-					prog1.step();
-				}			
-			}
-			else
-			#endif
-
-			while (reader->haveVertex()) {	
-				Vertex curVert = reader->readVertex();
-				if(useModelTransform)
-				{
-					Vector3 &pv = curVert.v;
-					Vector3 pt;
-					pt.e[0] = pv.e[0]*mat[0*4+0] + pv.e[1]*mat[0*4+1] + pv.e[2]*mat[0*4+2] + mat[0*4+3];
-					pt.e[1] = pv.e[0]*mat[1*4+0] + pv.e[1]*mat[1*4+1] + pv.e[2]*mat[1*4+2] + mat[1*4+3];
-					pt.e[2] = pv.e[0]*mat[2*4+0] + pv.e[1]*mat[2*4+1] + pv.e[2]*mat[2*4+2] + mat[2*4+3];
-
-					pv.e[0] = pt.e[0];
-					pv.e[1] = pt.e[1];
-					pv.e[2] = pt.e[2];
-
-					Vector3 &pn = curVert.n;
-					pt.e[0] = pn.e[0]*mat[0*4+0] + pn.e[1]*mat[0*4+1] + pn.e[2]*mat[0*4+2];
-					pt.e[1] = pn.e[0]*mat[1*4+0] + pn.e[1]*mat[1*4+1] + pn.e[2]*mat[1*4+2];
-					pt.e[2] = pn.e[0]*mat[2*4+0] + pn.e[1]*mat[2*4+1] + pn.e[2]*mat[2*4+2];
-
-					pn.e[0] = pt.e[0];
-					pn.e[1] = pt.e[1];
-					pn.e[2] = pt.e[2];
-					pn.makeUnitVector();
-				}
+		end.set();
+		addBuildStage("faces", 0, 0, end - start);
+		return true;
+	}
 
-				#ifdef _USE_TRI_MATERIALS
-				// insert dummy color:
-				pColorList->appendElement(rgba(0.7f, 0.7f, 0.7f, 1.0f));
-				#endif
+	__int64 startPos = reader->getFilePosition();
 
-				// get voxel for point:
-				unsigned int idx = grid.getCellIndex(curVert.v);
+	// the voxel BVHs are built from the outputs of this pass
+	manifest->invalidate("faces");
+	manifest->invalidate("voxel BVH", true);
 
-				// write to file:
-				pVertices->appendElement(curVert);
-				//pVertices->appendElement(curVert);
-				pVertexIndexMap->appendElement(idx);
-				prog1.step();
-			}
+	// vertices are fetched by triangle indices, normals are accumulated in place
+	Vertex *vertexFile;
+	if (!(vertexFile = (Vertex *)FileMapper::map(getVertexFileName().c_str(), false, FileMapper::HINT_RANDOM))) {
+		cout << "ERROR: could not map file " << getVertexFileName() << " !" << endl;
+		return false;
+	}
 
-			// close vertex files...
-			delete pVertexIndexMap;
-			delete pVertices;
-			delete pColorList;
-		}
+	#ifdef _USE_TRI_MATERIALS
+	rgba *colorFile;
+	if (!(colorFile = (rgba *)FileMapper::map(getColorListName().c_str(), true, FileMapper::HINT_RANDOM))) {
+		cout << "ERROR: could not map file " << getColorListName() << " !" << endl;
+		FileMapper::unmap(vertexFile);
+		return false;
+	}
+	#endif
 
-		// ...and open again for cached access
-		CashedBoxSingleFile<unsigned int> *pVertexIndexCache = new CashedBoxSingleFile<unsigned int>(getVertexIndexFileName(), grid.getSize(), 10, false);
-		CashedBoxSingleFile<unsigned int> &voxelIndexCache = *pVertexIndexCache;
-		//CashedBoxSingleFile<Vector3> *pVertexCache = new CashedBoxSingleFile<Vector3>(getVertexFileName(), grid.getSize(), 10, false);
-		//CashedBoxSingleFile<Vector3> &vertexCache = *pVertexCache;
-		CashedBoxSingleFile<Vertex> *pVertexCache = new CashedBoxSingleFile<Vertex>(getVertexFileName(), grid.getSize(), 10, false);
-		CashedBoxSingleFile<Vertex> &vertexCache = *pVertexCache;
-		CashedBoxSingleFile<rgba> *pColorCache = new CashedBoxSingleFile<rgba>(getColorListName(), grid.getSize(), 10, false);
-		CashedBoxSingleFile<rgba> &colorCache = *pColorCache;
-
-		// init out file for all tris	
-		BufferedOutputs<Triangle> *pTris = new BufferedOutputs<Triangle>(getTriangleFileName(), 100000);
-		pTris->clear();
-
-		// init out file for all materials
-		//BufferedOutputs<MaterialDiffuse> *outputs_mat = new BufferedOutputs<MaterialDiffuse>(getMaterialListName().c_str(), 1000);
-		m_outputs_mat = new BufferedOutputs<MaterialDiffuse>(getMaterialListName().c_str(), 1000);
-		m_outputs_mat->clear();
-		
-		// init out files for single voxels	
-		BufferedOutputs<Triangle> *outputs = new BufferedOutputs<Triangle>(getVTriangleFileName().c_str(), grid.getSize(), 5000);
-		outputs->clear();
+	// init out file for all tris	
+	BufferedOutputs<Triangle> *pTris = new BufferedOutputs<Triangle>(getTriangleFileName(), 100000);
+	pTris->clear();
 
-		// init out file for all tri indices
-		BufferedOutputs<unsigned int> *outputs_idx = new BufferedOutputs<unsigned int>(getTriangleIdxFileName().c_str(), grid.getSize(), 5000);
-		outputs_idx->clear();
+	// init out file for all materials
+	m_outputs_mat = new BufferedOutputs<MaterialDiffuse>(getMaterialListName().c_str(), 1000);
+	m_outputs_mat->clear();
 	
-		//
-		// read all triangles:
-		//
+	// init out files for single voxels	
+	BufferedOutputs<Triangle> *outputs = new BufferedOutputs<Triangle>(getVTriangleFileName().c_str(), grid.getSize(), 5000);
+	outputs->clear();
 
-		std::vector<int> vIdxList;
-		Triangle tri;
-		Vector3 p[3];
-		unsigned int voxel[3];
-		unsigned int triCount = 0;		
-		typedef stdext::hash_map<__int64, unsigned int> ColorTable;
-		typedef ColorTable::iterator ColorTableIterator;
+	// init out file for all tri indices
+	BufferedOutputs<unsigned int> *outputs_idx = new BufferedOutputs<unsigned int>(getTriangleIdxFileName().c_str(), grid.getSize(), 5000);
+	outputs_idx->clear();
 
-		#ifdef NORMAL_INCLUDED
-		if(!hasVertexNormals)
+	#ifdef NORMAL_INCLUDED
+	if(!hasVertexNormals)
+	{
+		// initialize vertex normals
+#ifdef _USE_OPENMP
+		#pragma omp parallel for
+#endif
+		for(int i=0;i<(int)numVertices;i++)
 		{
-			// initialize vertex normals
-			for(int i=0;i<vertexCache.nrElements;i++)
-			{
-				Vertex &v = vertexCache.getRef(i);
-				v.n.e[0] = 0;
-				v.n.e[1] = 0;
-				v.n.e[2] = 0;
-			}
+			Vertex &v = vertexFile[i];
+			v.n.e[0] = 0;
+			v.n.e[1] = 0;
+			v.n.e[2] = 0;
 		}
-		#endif
-		// ColorTable usedColors;
-		//unsigned int materialIndex = 0;
-		m_materialIndex = 0;
-		ColorTableIterator colorIter;
-		Progression prog("make voxels" , numFaces, 20);
-		while (reader->haveFace()) {	
-			prog.step();
-
-			// read vertex indices into vector
-			reader->readFace(vIdxList);
-
-			// read in vertices
-			p[0] = vertexCache[vIdxList[0]].v;
-			p[1] = vertexCache[vIdxList[1]].v;
-			p[2] = vertexCache[vIdxList[2]].v;
-			
-			// write triangle to complete list:		
-			tri.n = cross(p[1] - p[0], p[2] - p[0]);
-			//tri.n = cross(p[2] - p[0], p[1] - p[0]);
-			tri.n.makeUnitVector();
- 
-			// sungeui start ------------------------
-			// Detect degerated cases
-
-			if (vIdxList[0] == vIdxList[1] ||
-				vIdxList[0] == vIdxList[2] ||
-				vIdxList[1] == vIdxList[2] ||
-				p[0] == p[1] ||
-				p[1] == p[2] ||
-				p[2] == p[0] ||
-				tri.n.e [0] < -1.f || tri.n.e [0] > 1.f ||
-				tri.n.e [1] < -1.f || tri.n.e [1] > 1.f ||
-				tri.n.e [2] < -1.f || tri.n.e [2] > 1.f) {
-				//printf ("Found degenerated triangle\n");
-				//continue;
-			}
-			// sungeui end ---------------------------
+	}
+	#endif
+
+	// a writer owns the voxels and vertices of the same index modulo number of writers,
+	// so that writers do not share any output buffer
+	int numWriters = omp_get_max_threads();
+	std::vector<unsigned int> voxelTriCounts(grid.getSize(), 0);
+
+	m_materialIndex = 0;
+	ColorTableIterator colorIter;
+	Progression prog("make voxels" , numFaces, 20);
+
+	// batch k is set up while batch k+1 is parsed and batch k-1 is written
+	FaceBatch batches[3];
+	batches[0].numFaces = batches[2].numFaces = 0;
+	readFaceBatch(reader, 0, batches[1], prog);
+
+	unsigned int triCount = 0;
+	for (int k = 1; batches[k%3].numFaces > 0 || batches[(k-1)%3].numFaces > 0; k++) {
+		FaceBatch &prevBatch = batches[(k-1)%3];
+		FaceBatch &curBatch = batches[k%3];
+		FaceBatch &nextBatch = batches[(k+1)%3];
+		int numCurFaces = curBatch.numFaces;
+		nextBatch.numFaces = 0;
 
+#ifdef _USE_OPENMP
+		#pragma omp parallel
+#endif
+		{
+#ifdef _USE_OPENMP
+			#pragma omp single nowait
+#endif
+			if (numCurFaces > 0)
+				readFaceBatch(reader, curBatch.firstTri + numCurFaces, nextBatch, prog);
 
-			tri.d = dot(p[0], tri.n);
+#ifdef _USE_OPENMP
+			#pragma omp for schedule(dynamic, 1024) nowait
+#endif
+			for (int i = 0; i < numCurFaces; i++) {
+				const int *vIdxList = &curBatch.faces[i*3];
+				Triangle &tri = curBatch.tris[i];
+				Vector3 p[3];
+
+				// read in vertices
+				p[0] = vertexFile[vIdxList[0]].v;
+				p[1] = vertexFile[vIdxList[1]].v;
+				p[2] = vertexFile[vIdxList[2]].v;
+				
+				// write triangle to complete list:		
+				tri.n = cross(p[1] - p[0], p[2] - p[0]);
+				tri.n.makeUnitVector();
+				tri.d = dot(p[0], tri.n);
+				tri.material = 0;
+
+				// find best projection plane (YZ, XZ, XY)
+				if (fabs(tri.n[0]) > fabs(tri.n[1]) && fabs(tri.n[0]) > fabs(tri.n[2])) {								
+					tri.i1 = 1;
+					tri.i2 = 2;
+				}
+				else if (fabs(tri.n[1]) > fabs(tri.n[2])) {								
+					tri.i1 = 0;
+					tri.i2 = 2;
+				}
+				else {								
+					tri.i1 = 0;
+					tri.i2 = 1;
+				}
 
-			// find best projection plane (YZ, XZ, XY)
-			if (fabs(tri.n[0]) > fabs(tri.n[1]) && fabs(tri.n[0]) > fabs(tri.n[2])) {								
-				tri.i1 = 1;
-				tri.i2 = 2;
-			}
-			else if (fabs(tri.n[1]) > fabs(tri.n[2])) {								
-				tri.i1 = 0;
-				tri.i2 = 2;
+				int firstIdx;
+				float u1list[3];
+				u1list[0] = fabs(p[1].e[tri.i1] - p[0].e[tri.i1]);
+				u1list[1] = fabs(p[2].e[tri.i1] - p[1].e[tri.i1]);
+				u1list[2] = fabs(p[0].e[tri.i1] - p[2].e[tri.i1]);
+
+				if (u1list[0] >= u1list[1] && u1list[0] >= u1list[2])
+					firstIdx = 0;
+				else if (u1list[1] >= u1list[2])
+					firstIdx = 1;
+				else
+					firstIdx = 2;
+
+				int secondIdx = (firstIdx + 1) % 3;
+				int thirdIdx = (firstIdx + 2) % 3;
+
+				// apply coordinate order to tri structure:
+				tri.p[0] = vIdxList[firstIdx];
+				tri.p[1] = vIdxList[secondIdx];
+				tri.p[2] = vIdxList[thirdIdx];		
+
+				curBatch.colorVerts[i] = vIdxList[firstIdx];
+
+				// the triangle is assigned to the voxel of its first vertex
+				/// TODO: triangles spanning multiple voxels!
+				curBatch.voxels[i] = grid.getCellIndex(p[0]);
+
+				float tArea = triangleArea(p[0], p[1], p[2]);
+				curBatch.areaNormals[i] = tArea > 0 ? tArea*tri.n : Vector3(0.0f, 0.0f, 0.0f);
 			}
-			else {								
-				tri.i1 = 0;
-				tri.i2 = 1;
+
+#ifdef _USE_OPENMP
+			#pragma omp for schedule(dynamic, 1)
+#endif
+			for (int writer = 0; writer < numWriters; writer++) {
+				if (writer == 0) {
+					for (int i = 0; i < prevBatch.numFaces; i++)
+						pTris->appendElement(prevBatch.tris[i]);
+				}
+
+				for (int i = 0; i < prevBatch.numFaces; i++) {
+					unsigned int voxel = prevBatch.voxels[i];
+					if ((int)(voxel % numWriters) != writer) continue;
+
+					outputs->appendElement(voxel, prevBatch.tris[i]);
+					outputs_idx->appendElement(voxel, prevBatch.firstTri + i);
+					voxelTriCounts[voxel]++;
+				}
+
+				#ifdef NORMAL_INCLUDED
+				if(!hasVertexNormals)
+				{
+					// calculate vertex normals
+					for (int i = 0; i < prevBatch.numFaces; i++) {
+						for (int j = 0; j < 3; j++) {
+							int vIdx = prevBatch.faces[i*3+j];
+							if (vIdx % numWriters != writer) continue;
+							vertexFile[vIdx].n += prevBatch.areaNormals[i];
+						}
+					}
+				}
+				#endif
 			}
+		}
+
+		triCount += prevBatch.numFaces;
+		prevBatch.numFaces = 0;
 
-			int firstIdx;
-			float u1list[3];
-			u1list[0] = fabs(p[1].e[tri.i1] - p[0].e[tri.i1]);
-			u1list[1] = fabs(p[2].e[tri.i1] - p[1].e[tri.i1]);
-			u1list[2] = fabs(p[0].e[tri.i1] - p[2].e[tri.i1]);
-
-			if (u1list[0] >= u1list[1] && u1list[0] >= u1list[2])
-				firstIdx = 0;
-			else if (u1list[1] >= u1list[2])
-				firstIdx = 1;
-			else
-				firstIdx = 2;
-
-			int secondIdx = (firstIdx + 1) % 3;
-			int thirdIdx = (firstIdx + 2) % 3;
-
-			// apply coordinate order to tri structure:
-			tri.p[0] = vIdxList[firstIdx];
-			tri.p[1] = vIdxList[secondIdx];
-			tri.p[2] = vIdxList[thirdIdx];		
-
-			// handle materials if necessary:
-			#ifdef _USE_TRI_MATERIALS
-			rgba color = colorCache[vIdxList[firstIdx]]; 
+		// handle materials if necessary, in the order of the triangles:
+		#ifdef _USE_TRI_MATERIALS
+		for (int i = 0; i < numCurFaces; i++) {
+			Triangle &tri = curBatch.tris[i];
+			rgba color = colorFile[curBatch.colorVerts[i]]; 
 			__int64 hash = (__int64)(color.r() + 256*color.g() + 256*256*color.b()) + ((__int64)color.alpha)*256*256*256;
 
 			if ((colorIter = m_usedColors.find(hash)) != m_usedColors.end()) {
@@ -558,92 +716,48 @@ bool OutOfCoreTree::secondVertexPass() {
 				m_usedColors[hash] = tri.material;
 				m_materialIndex++;
 			}
+		}
+		#endif
+	}
 
-			#endif
-
-			#ifdef NORMAL_INCLUDED
-			if(!hasVertexNormals)
-			{
-				// calculate vertex normals
-				Vertex &v0 = vertexCache.getRef(vIdxList[0]);
-				Vertex &v1 = vertexCache.getRef(vIdxList[1]);
-				Vertex &v2 = vertexCache.getRef(vIdxList[2]);
-				float tArea = triangleArea(v0.v, v1.v, v2.v);
-				if(tArea > 0)
-				{
-					v0.n += tArea*tri.n;
-					v1.n += tArea*tri.n;
-					v2.n += tArea*tri.n;
-				}
-			}
-			#endif
-			pTris->appendElement(tri);
-
-			// insert triangle into each voxel it belongs in:		
-			voxel[0] = voxelIndexCache[vIdxList[0]];
-			voxel[1] = voxelIndexCache[vIdxList[1]];
-			voxel[2] = voxelIndexCache[vIdxList[2]];
-
-			for (int i = 0; i < 3; i++) {
-				/// TODO: triangles spanning multiple voxels!
-
-				/*
-				// don't insert triangle multiple times
-				if (i == 1 && voxel[1] == voxel[0])
-					continue;
-				else if (i == 2 && (voxel[2] == voxel[0] || voxel[2] == voxel[1]))
-					continue;
-				*/
-
-				// assign the triangle to the Voxel [0]
-				if (i != 0)
-					continue;
-
-				outputs->appendElement(voxel[i], tri);
-				outputs_idx->appendElement(voxel[i], triCount);
-
-				// add to hash table counter
-				it = voxelHashTable->find(voxel[i]);
-				if (it != voxelHashTable->end()) {
-					(*it).second = (*it).second + 1;
-				}
-				else {
-					voxelHashTable->insert(std::pair<int,int>(voxel[i],1));		
-					numUsedVoxels++;
-				}
-			}
+	for (unsigned int boxNr = 0; boxNr < grid.getSize(); boxNr++) {
+		if (voxelTriCounts[boxNr] == 0) continue;
+		voxelHashTable->insert(std::pair<int,int>(boxNr, voxelTriCounts[boxNr]));
+		numUsedVoxels++;
+	}
 
-			triCount++;
-		}
+	outputs->flush();
+	outputs_idx->flush();
+	m_outputs_mat->flush();
+	delete outputs;
+	delete outputs_idx;
+	delete m_outputs_mat;
+	delete pTris;		
 
-		outputs->flush();
-		outputs_idx->flush();
-		m_outputs_mat->flush();
-		delete outputs;
-		delete outputs_idx;
-		delete m_outputs_mat;
-		delete pTris;		
+	#ifdef NORMAL_INCLUDED
+	if(!hasVertexNormals)
+	{
+		FileMapper::advise(vertexFile, FileMapper::HINT_SEQUENTIAL);
 
-		#ifdef NORMAL_INCLUDED
-		if(!hasVertexNormals)
+		// normalize vertex normals
+#ifdef _USE_OPENMP
+		#pragma omp parallel for
+#endif
+		for(int i=0;i<(int)numVertices;i++)
 		{
-			// initialize vertex normals
-			for(int i=0;i<vertexCache.nrElements;i++)
-			{
-				Vertex &v = vertexCache.getRef(i);
-				v.n.makeUnitVector();
-			}
-			pVertexCache->flush();
+			Vertex &v = vertexFile[i];
+			v.n.makeUnitVector();
 		}
-		#endif
-
-		// delete temporary cache file for vertex->voxel cache
-		delete pVertexIndexCache;
-		delete pVertexCache;
-		delete pColorCache;
-		unlink(getVertexIndexFileName().c_str());
-		unlink(getColorListName().c_str());
 	}
+	#endif
+
+	FileMapper::unmap(vertexFile);
+	#ifdef _USE_TRI_MATERIALS
+	FileMapper::unmap(colorFile);
+	#endif
+	unlink(getColorListName().c_str());
+
+	end.set();
 		
 	cout << "Voxels used: " << numUsedVoxels << " of " << grid.getSize() << endl;
 	unsigned int sumTris = 0;
@@ -652,6 +766,27 @@ bool OutOfCoreTree::secondVertexPass() {
 		sumTris += it->second;
 	}
 	cout << "Tri references: " << sumTris << " (original: " << numFaces << ")" << endl;
+
+	// the vertex file has the normals now and the colors are removed
+	std::vector<std::string> stageOutputs;
+	stageOutputs.push_back(getSceneInfoName());
+	stageOutputs.push_back(getVertexFileName());
+	stageOutputs.push_back(getTriangleFileName());
+	stageOutputs.push_back(getMaterialListName());
+	for (it = voxelHashTable->begin(); it != voxelHashTable->end(); it++) {
+		stageOutputs.push_back(getVTriangleFileName(it->first));
+		stageOutputs.push_back(getTriangleIdxFileName(it->first));
+	}
+	manifest->commit("faces", faceKey, stageOutputs);
+	manifest->invalidate("vertices");
+
+	// triangles twice (all and per voxel), indices, materials and vertex normals
+	__int64 bytesWritten = (__int64)triCount * (2*sizeof(Triangle) + sizeof(unsigned int)) + (__int64)m_materialIndex * sizeof(MaterialDiffuse);
+	#ifdef NORMAL_INCLUDED
+	if(!hasVertexNormals)
+		bytesWritten += (__int64)numVertices * sizeof(Vertex);
+	#endif
+	addBuildStage("faces", reader->getFilePosition() - startPos, bytesWritten, end - start);
 	
 	return true;
 }
@@ -665,6 +800,16 @@ bool OutOfCoreTree::buildVoxelBVH() {
 	cout << "Overall BB: [" << grid.p_min << "] - [" << grid.p_max << "]" << endl;
 
 	start.set();
+
+	__int64 bytesRead = 0, bytesWritten = 0;
+
+	// vertices are shared by all voxels, the file is mapped once
+	Vertex *vertexFile;
+	if (!(vertexFile = (Vertex *)FileMapper::map(getVertexFileName().c_str(), true, FileMapper::HINT_RANDOM))) {
+		cout << "ERROR: could not map file " << getVertexFileName() << " !" << endl;
+		return false;
+	}
+
 	voxelMins = new Vector3[numUsedVoxels];
 	voxelMaxs = new Vector3[numUsedVoxels];
 	Vector3 *voxelMinsTemp = new Vector3[numBoxes];
@@ -720,25 +865,31 @@ bool OutOfCoreTree::buildVoxelBVH() {
 		boxesBuilt++;
 #endif
 
-		// open the vertex file in ooc mode:
-		//
-		//CashedBoxSingleFile<Vector3> *pVertexCache = new CashedBoxSingleFile<Vector3>(getVertexFileName(), grid.getSize(), 10, false);
-		//CashedBoxSingleFile<Vector3> &vertexCache = *pVertexCache;
-		CashedBoxSingleFile<Vertex> *pVertexCache = new CashedBoxSingleFile<Vertex>(getVertexFileName(), grid.getSize(), 10, false);
-		CashedBoxSingleFile<Vertex> &vertexCache = *pVertexCache;
-
 		unsigned int numTris = it->second;		
 		
 		sprintf(output, " - Processor %d voxel %d / %d (%u tris)", omp_get_thread_num(), boxesBuilt, numUsedVoxels, numTris);
 		log->logMessage(LOG_INFO, output);		
 
-		// skip this if tree already exists
-		FILE *test = fopen(getBVHFileName(boxNr).c_str(), "rb");
-		if (test != 0) {
-			cout << "   skipping, already built." << endl;
-			fclose(test);
-			continue;
+		// skip this if tree was already built from the same triangles,
+		// the bounding box is read from the header of the tree then
+		std::string stageName = "voxel BVH " + toString(boxNr,5,'0');
+		BuildManifest::Hash voxelKey = BuildManifest::hashValue(boxNr, voxelBVHKey);
+		if (manifest->isUpToDate(stageName.c_str(), voxelKey)) {
+			BSPTreeInfo treeInfo;
+			FILE *test = fopen(getBVHFileName(boxNr).c_str(), "rb");
+			if (test != 0) {
+				fseek(test, BSP_FILEIDSTRINGLEN + 1, SEEK_SET);
+				size_t ret = fread(&treeInfo, sizeof(BSPTreeInfo), 1, test);
+				fclose(test);
+				if (ret == 1) {
+					cout << "   skipping, already built." << endl;
+					voxelMinsTemp[boxNr] = treeInfo.min;
+					voxelMaxsTemp[boxNr] = treeInfo.max;
+					continue;
+				}
+			}
 		}
+		manifest->invalidate(stageName.c_str());
 
 		// read in file with triangle indices for this voxel
 		//cout << "   > caching triangles..." << endl;
@@ -779,12 +930,12 @@ bool OutOfCoreTree::buildVoxelBVH() {
 		// storage. that way, we can still access the vertices via absolute index.
 		//cout << "   > caching vertices..." << endl;
 		for (unsigned int i = 0; i < numTris; i++) {			
-			vertexMap[triangleCache[i].p[0]] = vertexCache[triangleCache[i].p[0]];
-			vertexMap[triangleCache[i].p[1]] = vertexCache[triangleCache[i].p[1]];
-			vertexMap[triangleCache[i].p[2]] = vertexCache[triangleCache[i].p[2]];
-			updateBB(bb_min, bb_max, vertexCache[triangleCache[i].p[0]].v);
-			updateBB(bb_min, bb_max, vertexCache[triangleCache[i].p[1]].v);
-			updateBB(bb_min, bb_max, vertexCache[triangleCache[i].p[2]].v);
+			vertexMap[triangleCache[i].p[0]] = vertexFile[triangleCache[i].p[0]];
+			vertexMap[triangleCache[i].p[1]] = vertexFile[triangleCache[i].p[1]];
+			vertexMap[triangleCache[i].p[2]] = vertexFile[triangleCache[i].p[2]];
+			updateBB(bb_min, bb_max, vertexFile[triangleCache[i].p[0]].v);
+			updateBB(bb_min, bb_max, vertexFile[triangleCache[i].p[1]].v);
+			updateBB(bb_min, bb_max, vertexFile[triangleCache[i].p[2]].v);
 		}
 
 		voxelMinsTemp[boxNr] = bb_min;
@@ -802,8 +953,19 @@ bool OutOfCoreTree::buildVoxelBVH() {
 		tree->buildTreeSAH();		
 		tree->saveToFile(getBVHFileName(boxNr).c_str());
 		tree->printTree(false);
+
+		manifest->commit(stageName.c_str(), voxelKey, std::vector<std::string>(1, getBVHFileName(boxNr)));
+
+		__int64 voxelBytesRead = (__int64)numTris * (sizeof(Triangle) + sizeof(unsigned int)) + (__int64)vertexMap.size() * sizeof(Vertex);
+		__int64 voxelBytesWritten = fileSize64(getBVHFileName(boxNr));
+#ifdef _USE_OPENMP
+#pragma omp critical
+#endif
+		{
+			bytesRead += voxelBytesRead;
+			bytesWritten += voxelBytesWritten;
+		}
 		
-		delete pVertexCache;
 		delete triangleCache;
 		delete triangleIndexCache;
 		delete tree;
@@ -811,6 +973,8 @@ bool OutOfCoreTree::buildVoxelBVH() {
 
 	end.set();
 
+	FileMapper::unmap(vertexFile);
+
 	// Pack the voxel mins and maxes
 	for (int boxTemp = 0, box = 0; boxTemp < numBoxes; boxTemp++)
 	{
@@ -825,6 +989,8 @@ bool OutOfCoreTree::buildVoxelBVH() {
 	delete voxelMaxsTemp;
 
 	cout << "BVH build ended, time = " << (end - start) << "s" << endl;
+
+	addBuildStage("voxel BVHs", bytesRead, bytesWritten, end - start);
 	
 	return true;
 }
@@ -876,6 +1042,21 @@ bool OutOfCoreTree::buildHighLevelBVH() {
 	end.set();
 	cout << "High-Level tree build ended, time = " << (end - start) << "s" << endl;
 
+	// voxel BVHs are merged into the BVH file with its index and node files
+	__int64 bytesRead = 0;
+	for (boxNr = 0; boxNr < grid.getSize(); boxNr++) {
+		if (voxelHashTable->find(boxNr) != voxelHashTable->end())
+			bytesRead += fileSize64(getBVHFileName(boxNr));
+	}
+	__int64 bytesWritten = fileSize64(getBVHFileName()) + fileSize64(getBVHFileName() + ".idx") + fileSize64(getBVHFileName() + ".node");
+	addBuildStage("high-level BVH", bytesRead, bytesWritten, end - start);
+
+	// the model is complete, the records of the intermediate files are
+	// not needed since the files are removed below
+	manifest->commit("model", bvhKey, getModelOutputs());
+	manifest->invalidate("faces");
+	manifest->invalidate("voxel BVH", true);
+
 	delete tree;
 	delete voxellist;
 	delete voxelMins;
@@ -16,6 +16,7 @@
 #include "Progression.h"
 #include "Materials.h"
 #include "Files.h"
+#include "FileMapper.h"
 
 //#define USE_DOE
 #ifdef USE_DOE
@@ -74,6 +75,23 @@ bool OutOfCoreTree::buildSmall(const char *outputPath, const char *fileName, boo
 	sprintf(outDirName, "%s\\%s.ooc", outputPath, tempFileName);
 	mkdir(outDirName);
 
+	// the passes share state in memory, the model is built as one stage
+	if (manifest) delete manifest;
+	manifest = new BuildManifest(getManifestFileName());
+	manifest->load();
+
+	bvhKey = manifest->hashInput(curFileName);
+	bvhKey = BuildManifest::hashValue(useModelTransform, bvhKey);
+	if (useModelTransform)
+		bvhKey = BuildManifest::hashData(mat, sizeof(mat), bvhKey);
+	bvhKey = hashBVHOptions(BuildManifest::hashString("small model", bvhKey));
+
+	if (manifest->isUpToDate("model", bvhKey)) {
+		cout << "Skipping build, all outputs are up to date.\n";
+		return true;
+	}
+	manifest->invalidate("model");
+
 	initSmall();
 
 	firstVertexPassSmall(curFileName);
@@ -82,16 +100,18 @@ bool OutOfCoreTree::buildSmall(const char *outputPath, const char *fileName, boo
 
 	secondVertexPassSmall(curFileName);
 
-	bridge2to3();
+	if(!bridge2to3()) return false;
 
 	thirdVertexPassSmall(curFileName, 0);
 
 	finalizeMeshPass();
 
-	buildBVHSmall();
+	if(!buildBVHSmall()) return false;
 
 	unlink(getTriangleIdxFileName().c_str());
 
+	manifest->commit("model", bvhKey, getModelOutputs());
+
 	end.set();
 	
 	float elapsedHours;
@@ -309,20 +329,15 @@ bool OutOfCoreTree::bridge2to3()
 	delete m_pVertices;
 	delete m_pColorList;
 
-	// ...and open again for access
-	SYSTEM_INFO systemInfo;
-	BY_HANDLE_FILE_INFORMATION fileInfo;
-	GetSystemInfo(&systemInfo);
-
-	m_hFileVertex = CreateFile(getVertexFileName().c_str(), GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	GetFileInformationByHandle(m_hFileVertex, &fileInfo);
-	m_hMappingVertex = CreateFileMapping(m_hFileVertex, NULL, PAGE_READWRITE, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	m_pVertexFile = (Vertex *)MapViewOfFile(m_hMappingVertex, FILE_MAP_WRITE, 0, 0, 0);
+	// ...and open again for access, vertices are fetched by triangle indices
+	if(!(m_pVertexFile = (Vertex *)FileMapper::map(getVertexFileName().c_str(), false, FileMapper::HINT_RANDOM)))
+		return false;
 
-	m_hFileColor = CreateFile(getColorListName().c_str(), GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	GetFileInformationByHandle(m_hFileColor, &fileInfo);
-	m_hMappingColor = CreateFileMapping(m_hFileColor, NULL, PAGE_READWRITE, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	m_pColorFile = (rgb *)MapViewOfFile(m_hMappingColor, FILE_MAP_WRITE, 0, 0, 0);
+	if(!(m_pColorFile = (rgb *)FileMapper::map(getColorListName().c_str(), false, FileMapper::HINT_RANDOM)))
+	{
+		FileMapper::unmap(m_pVertexFile);
+		return false;
+	}
 
 	// init out file for all tris	
 	m_pTris = new BufferedOutputs<Triangle>(getTriangleFileName(), 100000);
@@ -346,14 +361,7 @@ bool OutOfCoreTree::thirdVertexPassSmall(const char *fileName, int curIter, int
 	//
 
 	std::vector<int> vIdxList;
-	Triangle tri;
-	Vector3 p[3];
-	static unsigned int triCount = 0;		
-	typedef stdext::hash_map<__int64, unsigned int> ColorTable;
-	typedef ColorTable::iterator ColorTableIterator;
-
 	unsigned int materialIndex = 0;
-	ColorTableIterator colorIter;
 
 	if(useFileMat)
 	{
@@ -370,140 +378,363 @@ bool OutOfCoreTree::thirdVertexPassSmall(const char *fileName, int curIter, int
 
 		// read vertex indices into vector
 		reader->readFace(vIdxList);
-		for(int i=0;i<vIdxList.size();i++)
-		{
-			vIdxList[i] += m_numVertexList[curIter];
-		}
+		processFaceSmall(vIdxList, curIter, mtlMatIndex, materialIndex);
+	}
 
-		// read in vertices
-		p[0] = m_pVertexFile[vIdxList[0]].v;
-		p[1] = m_pVertexFile[vIdxList[1]].v;
-		p[2] = m_pVertexFile[vIdxList[2]].v;
-		
-		// write triangle to complete list:		
-		tri.n = cross(p[1] - p[0], p[2] - p[0]);
-		//tri.n = cross(p[2] - p[0], p[1] - p[0]);
-		tri.n.makeUnitVector();
-
-		// sungeui start ------------------------
-		// Detect degerated cases
-
-		bool isValid = true;
-		if (vIdxList[0] == vIdxList[1] ||
-			vIdxList[0] == vIdxList[2] ||
-			vIdxList[1] == vIdxList[2] ||
-			p[0] == p[1] ||
-			p[1] == p[2] ||
-			p[2] == p[0] ||
-			tri.n.e [0] < -1.f || tri.n.e [0] > 1.f ||
-			tri.n.e [1] < -1.f || tri.n.e [1] > 1.f ||
-			tri.n.e [2] < -1.f || tri.n.e [2] > 1.f) {
-			//printf ("Found degenerated triangle\n");
-			//continue;
-				isValid = false;
-		}
-		// sungeui end ---------------------------
+	delete reader;
 
+	return true;
+}
 
-		tri.d = dot(p[0], tri.n);
+// sets up a triangle of input curIter from its vertex indices in the input and appends it
+void OutOfCoreTree::processFaceSmall(std::vector<int> &vIdxList, int curIter, int mtlMatIndex, unsigned int &materialIndex)
+{
+	Triangle tri;
+	Vector3 p[3];
+	static unsigned int triCount = 0;
+	ColorTableIterator colorIter;
 
-		// find best projection plane (YZ, XZ, XY)
-		if (fabs(tri.n[0]) > fabs(tri.n[1]) && fabs(tri.n[0]) > fabs(tri.n[2])) {								
-			tri.i1 = 1;
-			tri.i2 = 2;
-		}
-		else if (fabs(tri.n[1]) > fabs(tri.n[2])) {								
-			tri.i1 = 0;
-			tri.i2 = 2;
-		}
-		else {								
-			tri.i1 = 0;
-			tri.i2 = 1;
-		}
+	for(int i=0;i<vIdxList.size();i++)
+	{
+		vIdxList[i] += m_numVertexList[curIter];
+	}
 
-		int firstIdx;
-		float u1list[3];
-		u1list[0] = fabs(p[1].e[tri.i1] - p[0].e[tri.i1]);
-		u1list[1] = fabs(p[2].e[tri.i1] - p[1].e[tri.i1]);
-		u1list[2] = fabs(p[0].e[tri.i1] - p[2].e[tri.i1]);
+	// read in vertices
+	p[0] = m_pVertexFile[vIdxList[0]].v;
+	p[1] = m_pVertexFile[vIdxList[1]].v;
+	p[2] = m_pVertexFile[vIdxList[2]].v;
+	
+	// write triangle to complete list:		
+	tri.n = cross(p[1] - p[0], p[2] - p[0]);
+	//tri.n = cross(p[2] - p[0], p[1] - p[0]);
+	tri.n.makeUnitVector();
+
+	// sungeui start ------------------------
+	// Detect degerated cases
+
+	bool isValid = true;
+	if (vIdxList[0] == vIdxList[1] ||
+		vIdxList[0] == vIdxList[2] ||
+		vIdxList[1] == vIdxList[2] ||
+		p[0] == p[1] ||
+		p[1] == p[2] ||
+		p[2] == p[0] ||
+		tri.n.e [0] < -1.f || tri.n.e [0] > 1.f ||
+		tri.n.e [1] < -1.f || tri.n.e [1] > 1.f ||
+		tri.n.e [2] < -1.f || tri.n.e [2] > 1.f) {
+		//printf ("Found degenerated triangle\n");
+		//continue;
+			isValid = false;
+	}
+	// sungeui end ---------------------------
 
-		if (u1list[0] >= u1list[1] && u1list[0] >= u1list[2])
-			firstIdx = 0;
-		else if (u1list[1] >= u1list[2])
-			firstIdx = 1;
-		else
-			firstIdx = 2;
 
-		int secondIdx = (firstIdx + 1) % 3;
-		int thirdIdx = (firstIdx + 2) % 3;
+	tri.d = dot(p[0], tri.n);
+
+	// find best projection plane (YZ, XZ, XY)
+	if (fabs(tri.n[0]) > fabs(tri.n[1]) && fabs(tri.n[0]) > fabs(tri.n[2])) {								
+		tri.i1 = 1;
+		tri.i2 = 2;
+	}
+	else if (fabs(tri.n[1]) > fabs(tri.n[2])) {								
+		tri.i1 = 0;
+		tri.i2 = 2;
+	}
+	else {								
+		tri.i1 = 0;
+		tri.i2 = 1;
+	}
+
+	int firstIdx;
+	float u1list[3];
+	u1list[0] = fabs(p[1].e[tri.i1] - p[0].e[tri.i1]);
+	u1list[1] = fabs(p[2].e[tri.i1] - p[1].e[tri.i1]);
+	u1list[2] = fabs(p[0].e[tri.i1] - p[2].e[tri.i1]);
+
+	if (u1list[0] >= u1list[1] && u1list[0] >= u1list[2])
+		firstIdx = 0;
+	else if (u1list[1] >= u1list[2])
+		firstIdx = 1;
+	else
+		firstIdx = 2;
 
-		// apply coordinate order to tri structure:
-		tri.p[0] = vIdxList[firstIdx];
-		tri.p[1] = vIdxList[secondIdx];
-		tri.p[2] = vIdxList[thirdIdx];		
+	int secondIdx = (firstIdx + 1) % 3;
+	int thirdIdx = (firstIdx + 2) % 3;
 
-		// handle materials if necessary:
-		if(useFileMat)
+	// apply coordinate order to tri structure:
+	tri.p[0] = vIdxList[firstIdx];
+	tri.p[1] = vIdxList[secondIdx];
+	tri.p[2] = vIdxList[thirdIdx];		
+
+	// handle materials if necessary:
+	if(useFileMat)
+	{
+		tri.material = (unsigned short)curIter;
+	}
+	else if(mtlMatIndex >= 0)
+	{
+		tri.material = mtlMatIndex;
+		// for base color
+		static bool baseColorAdded = false;
+		if(!baseColorAdded)
 		{
-			tri.material = (unsigned short)curIter;
+			MaterialDiffuse newMat(rgb(0.7f, 0.7f, 0.7f));
+			m_pOutputs_mat->appendElement(newMat);
+			baseColorAdded = true;
 		}
-		else if(mtlMatIndex >= 0)
-		{
-			tri.material = mtlMatIndex;
-			// for base color
-			static bool baseColorAdded = false;
-			if(!baseColorAdded)
-			{
-				MaterialDiffuse newMat(rgb(0.7f, 0.7f, 0.7f));
-				m_pOutputs_mat->appendElement(newMat);
-				baseColorAdded = true;
-			}
-		}
-		else
-		{
-			#ifdef _USE_TRI_MATERIALS
-			rgb color = m_pColorFile[vIdxList[firstIdx]]; 
+	}
+	else
+	{
+		#ifdef _USE_TRI_MATERIALS
+		rgb color = m_pColorFile[vIdxList[firstIdx]]; 
 #			ifdef USE_DOE
-			unsigned int hash = (((unsigned int)(color.r() * 256)) & 0xFF) + 256*(((unsigned int)(color.g() * 256)) & 0xFF) + 256*256*(((unsigned int)(color.b() * 256)) & 0xFF);
+		unsigned int hash = (((unsigned int)(color.r() * 256)) & 0xFF) + 256*(((unsigned int)(color.g() * 256)) & 0xFF) + 256*256*(((unsigned int)(color.b() * 256)) & 0xFF);
 #			else
-			unsigned int hash = (unsigned int)(color.r() + 256*color.g() + 256*256*color.b());
+		unsigned int hash = (unsigned int)(color.r() + 256*color.g() + 256*256*color.b());
 #			endif
 
-			if ((colorIter = m_usedColors.find(hash)) != m_usedColors.end()) {
-				tri.material = colorIter->second;
-			}
-			else {
-				MaterialDiffuse newMat(color);					
-				m_pOutputs_mat->appendElement(newMat);				
-				tri.material = materialIndex;
-				m_usedColors[hash] = tri.material;
-				materialIndex++;
-			}
-			#endif
+		if ((colorIter = m_usedColors.find(hash)) != m_usedColors.end()) {
+			tri.material = colorIter->second;
+		}
+		else {
+			MaterialDiffuse newMat(color);					
+			m_pOutputs_mat->appendElement(newMat);				
+			tri.material = materialIndex;
+			m_usedColors[hash] = tri.material;
+			materialIndex++;
+		}
+		#endif
+	}
+
+	if(!hasVertexNormals && isValid)
+	{
+		// calculate vertex normals
+		Vertex &v0 = m_pVertexFile[vIdxList[0]];
+		Vertex &v1 = m_pVertexFile[vIdxList[1]];
+		Vertex &v2 = m_pVertexFile[vIdxList[2]];
+		float tArea = triangleArea(v0.v, v1.v, v2.v);
+		if(tArea > 0)
+		{
+			v0.n += tArea*tri.n;
+			v1.n += tArea*tri.n;
+			v2.n += tArea*tri.n;
 		}
+	}
+	m_pTris->appendElement(tri);
+	m_pOutputs_idx->appendElement(triCount);
+
+	triCount++;
+}
+
+// parses an input of buildSmallMulti() once, the passes read its mesh file instead
+bool OutOfCoreTree::convertInputSmall(const char *fileName, float *mat, const std::string &meshFileName)
+{
+	FILE *fp = fopen(meshFileName.c_str(), "wb");
+	if(!fp)
+	{
+		cout << "ERROR: could not open file " << meshFileName << " !" << endl;
+		return false;
+	}
+
+	reader = new PlyReader(fileName);
+
+	InputMeshHeader header;
+	memset(&header, 0, sizeof(InputMeshHeader));
+	header.bb_min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	header.bb_max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	header.hasColor = reader->hasColor();
+	header.hasVertNormal = reader->hasVertNormal();
+	header.hasVertTexture = reader->hasVertTexture();
+
+	// counts and bounding box are filled in at the end
+	bool written = fwrite(&header, sizeof(InputMeshHeader), 1, fp) == 1;
+
+	// vertices, each followed by its color if the input has colors
+	while (reader->haveVertex() && written) {
+		rgb color;
+		Vertex curVert;
+		#ifdef _USE_TRI_MATERIALS
+		if (header.hasColor)
+			curVert = reader->readVertexWithColor(color);
+		else
+		#endif
+		curVert = reader->readVertex();
 
-		if(!hasVertexNormals && isValid)
+		if(mat)
 		{
-			// calculate vertex normals
-			Vertex &v0 = m_pVertexFile[vIdxList[0]];
-			Vertex &v1 = m_pVertexFile[vIdxList[1]];
-			Vertex &v2 = m_pVertexFile[vIdxList[2]];
-			float tArea = triangleArea(v0.v, v1.v, v2.v);
-			if(tArea > 0)
-			{
-				v0.n += tArea*tri.n;
-				v1.n += tArea*tri.n;
-				v2.n += tArea*tri.n;
-			}
+			Vector3 &pv = curVert.v;
+			Vector3 pt;
+			pt.e[0] = pv.e[0]*mat[0*4+0] + pv.e[1]*mat[0*4+1] + pv.e[2]*mat[0*4+2] + mat[0*4+3];
+			pt.e[1] = pv.e[0]*mat[1*4+0] + pv.e[1]*mat[1*4+1] + pv.e[2]*mat[1*4+2] + mat[1*4+3];
+			pt.e[2] = pv.e[0]*mat[2*4+0] + pv.e[1]*mat[2*4+1] + pv.e[2]*mat[2*4+2] + mat[2*4+3];
+
+			pv.e[0] = pt.e[0];
+			pv.e[1] = pt.e[1];
+			pv.e[2] = pt.e[2];
+
+			Vector3 &pn = curVert.n;
+			pt.e[0] = pn.e[0]*mat[0*4+0] + pn.e[1]*mat[0*4+1] + pn.e[2]*mat[0*4+2];
+			pt.e[1] = pn.e[0]*mat[1*4+0] + pn.e[1]*mat[1*4+1] + pn.e[2]*mat[1*4+2];
+			pt.e[2] = pn.e[0]*mat[2*4+0] + pn.e[1]*mat[2*4+1] + pn.e[2]*mat[2*4+2];
+
+			pn.e[0] = pt.e[0];
+			pn.e[1] = pt.e[1];
+			pn.e[2] = pt.e[2];
+			pn.makeUnitVector();
 		}
-		m_pTris->appendElement(tri);
-		m_pOutputs_idx->appendElement(triCount);
+		updateBB(header.bb_min, header.bb_max, curVert.v);
 
-		triCount++;
+		written = fwrite(&curVert, sizeof(Vertex), 1, fp) == 1;
+		#ifdef _USE_TRI_MATERIALS
+		if (header.hasColor && written)
+			written = fwrite(&color, sizeof(rgb), 1, fp) == 1;
+		#endif
+		header.numVertices++;
+	}
+
+	// faces, the first three vertex indices of each
+	std::vector<int> vIdxList;
+	while (reader->haveFace() && written) {
+		reader->readFace(vIdxList);
+		vIdxList.resize(3, 0);
+		written = fwrite(&vIdxList[0], sizeof(int), 3, fp) == 3;
+		header.numFaces++;
 	}
 
 	delete reader;
+	reader = 0;
 
+	if (written)
+		written = fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(InputMeshHeader), 1, fp) == 1;
+	written = ferror(fp) == 0 && written;
+	written = fclose(fp) == 0 && written;
+	if (!written)
+	{
+		cout << "ERROR: could not write file " << meshFileName << " !" << endl;
+		unlink(meshFileName.c_str());
+		return false;
+	}
+
+	cout << fileName << ": " << header.numVertices << " vertices, " << header.numFaces << " tris" << endl;
+	return true;
+}
+
+bool OutOfCoreTree::firstVertexPassMesh(const std::string &meshFileName) {
+	InputMeshHeader header;
+	FILE *fp = fopen(meshFileName.c_str(), "rb");
+	if (!fp || fread(&header, sizeof(InputMeshHeader), 1, fp) != 1) {
+		cout << "ERROR: could not read file " << meshFileName << " !" << endl;
+		if (fp) fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	hasVertexColors |= header.hasColor;
+	hasVertexNormals |= header.hasVertNormal;
+	hasVertexTextures |= header.hasVertTexture;
+
+	numVertices += header.numVertices;
+	numFaces += header.numFaces;
+	if (header.numVertices > 0) {
+		updateBB(m_bb_min, m_bb_max, header.bb_min);
+		updateBB(m_bb_min, m_bb_max, header.bb_max);
+	}
+
+	m_numVertexList.push_back(numVertices);
+
+#	ifdef USE_DOE
+	g_doeColoring.zMidForDOE = m_bb_min.e[2];
+	g_doeColoring.maxDistForDOE = m_bb_max.e[2] - m_bb_min.e[2];
+	g_doeColoring.scaleForDOE = 1.0f/(COLORS_IN_MAP-1);
+#	endif
+
+	return true;
+}
+
+bool OutOfCoreTree::secondVertexPassMesh(const std::string &meshFileName) {
+	InputMeshHeader header;
+	FILE *fp = fopen(meshFileName.c_str(), "rb");
+	if (!fp || fread(&header, sizeof(InputMeshHeader), 1, fp) != 1) {
+		cout << "ERROR: could not read file " << meshFileName << " !" << endl;
+		if (fp) fclose(fp);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < header.numVertices; i++) {
+		Vertex curVert;
+		if (fread(&curVert, sizeof(Vertex), 1, fp) != 1) break;
+
+		#ifdef _USE_TRI_MATERIALS
+		if (header.hasColor) {
+			rgb color;
+			if (fread(&color, sizeof(rgb), 1, fp) != 1) break;
+			m_pColorList->appendElement(color);
+		}
+		else {
+#			ifdef USE_DOE
+			rgb col;
+			g_doeColoring.getDOEColor(curVert.v.e[2], col);
+			m_pColorList->appendElement(col);
+#			else
+			// insert dummy color:
+			m_pColorList->appendElement(rgb(0.7f, 0.7f, 0.7f));
+#			endif
+		}
+		#endif
+
+		// write to file:
+		m_pVertices->appendElement(curVert);
+	}
+
+	bool ok = ferror(fp) == 0 && !feof(fp);
+	fclose(fp);
+	if (!ok) {
+		cout << "ERROR: could not read file " << meshFileName << " !" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool OutOfCoreTree::thirdVertexPassMesh(const std::string &meshFileName, int curIter, int mtlMatIndex) {
+	InputMeshHeader header;
+	FILE *fp = fopen(meshFileName.c_str(), "rb");
+	if (!fp || fread(&header, sizeof(InputMeshHeader), 1, fp) != 1) {
+		cout << "ERROR: could not read file " << meshFileName << " !" << endl;
+		if (fp) fclose(fp);
+		return false;
+	}
+
+	// move current position to face region
+	__int64 vertexBytes = sizeof(Vertex);
+	#ifdef _USE_TRI_MATERIALS
+	if (header.hasColor) vertexBytes += sizeof(rgb);
+	#endif
+	_fseeki64(fp, sizeof(InputMeshHeader) + vertexBytes * header.numVertices, SEEK_SET);
+
+	std::vector<int> vIdxList(3);
+	unsigned int materialIndex = 0;
+
+	if(useFileMat)
+	{
+		MaterialDiffuse newMat(rgb(0.7f, 0.7f, 0.7f));
+		m_pOutputs_mat->appendElement(newMat);
+	}
+
+	Progression prog("Process triangles" , numFaces, 20);
+	unsigned int i;
+	for (i = 0; i < header.numFaces; i++) {
+		prog.step();
+
+		vIdxList.resize(3);
+		if (fread(&vIdxList[0], sizeof(int), 3, fp) != 3) break;
+		processFaceSmall(vIdxList, curIter, mtlMatIndex, materialIndex);
+	}
+
+	fclose(fp);
+	if (i < header.numFaces) {
+		cout << "ERROR: could only read " << i << " of " << header.numFaces << " triangles from file " << meshFileName << " !" << endl;
+		return false;
+	}
 	return true;
 }
 
@@ -511,6 +742,8 @@ void OutOfCoreTree::finalizeMeshPass()
 {
 	if(!hasVertexNormals)
 	{
+		FileMapper::advise(m_pVertexFile, FileMapper::HINT_SEQUENTIAL);
+
 		// initialize vertex normals
 		for(int i=0;i<numVertices;i++)
 		{
@@ -525,12 +758,8 @@ void OutOfCoreTree::finalizeMeshPass()
 	delete m_pOutputs_idx;
 	delete m_pTris;		
 
-	UnmapViewOfFile(m_pVertexFile);
-	UnmapViewOfFile(m_pColorFile);
-	CloseHandle (m_hMappingVertex);
-	CloseHandle (m_hMappingColor);
-	CloseHandle (m_hFileVertex);
-	CloseHandle (m_hFileColor);
+	FileMapper::unmap(m_pVertexFile);
+	FileMapper::unmap(m_pColorFile);
 	unlink(getColorListName().c_str());
 
 	reader = 0;
@@ -558,41 +787,25 @@ bool OutOfCoreTree::buildBVHSmall() {
 
 	// open the vertex file in ooc mode:
 	//
-	HANDLE hFileTriangle, hFileTriangleIndex, hFileVertex;
-	HANDLE hMappingTriangle, hMappingTriangleIndex, hMappingVertex;
-	SYSTEM_INFO systemInfo;
-	BY_HANDLE_FILE_INFORMATION fileInfo;
-	GetSystemInfo(&systemInfo);
-
-	hFileTriangle = CreateFile(getTriangleFileName().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	GetFileInformationByHandle(hFileTriangle, &fileInfo);
-	hMappingTriangle = CreateFileMapping(hFileTriangle, NULL, PAGE_READONLY, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	triangleFile = (Triangle *)MapViewOfFile(hMappingTriangle, FILE_MAP_READ, 0, 0, 0);
-	if(!triangleFile)
+	if(!(triangleFile = (Triangle *)FileMapper::map(getTriangleFileName().c_str(), true, FileMapper::HINT_RANDOM)))
 	{
 		printf("Mapping falied! [triangleFile]\n");
-		exit(-1);
+		return false;
 	}
 
-	hFileTriangleIndex = CreateFile(getTriangleIdxFileName().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	GetFileInformationByHandle(hFileTriangleIndex, &fileInfo);
-	hMappingTriangleIndex = CreateFileMapping(hFileTriangleIndex, NULL, PAGE_READONLY, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	triangleIndexFile = (unsigned int *)MapViewOfFile(hMappingTriangleIndex, FILE_MAP_READ, 0, 0, 0);
-	if(!triangleIndexFile)
+	if(!(triangleIndexFile = (unsigned int *)FileMapper::map(getTriangleIdxFileName().c_str(), true, FileMapper::HINT_RANDOM)))
 	{
 		printf("Mapping falied! [triangleIndexFile]\n");
-		exit(-1);
+		FileMapper::unmap(triangleFile);
+		return false;
 	}
 
-	hFileVertex = CreateFile(getVertexFileName().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	DWORD err = GetLastError();
-	GetFileInformationByHandle(hFileVertex, &fileInfo);
-	hMappingVertex = CreateFileMapping(hFileVertex, NULL, PAGE_READONLY, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	vertexFile = (Vertex *)MapViewOfFile(hMappingVertex, FILE_MAP_READ, 0, 0, 0);
-	if(!vertexFile)
+	if(!(vertexFile = (Vertex *)FileMapper::map(getVertexFileName().c_str(), true, FileMapper::HINT_RANDOM)))
 	{
 		printf("Mapping falied! [vertexFile]\n");
-		exit(-1);
+		FileMapper::unmap(triangleFile);
+		FileMapper::unmap(triangleIndexFile);
+		return false;
 	}
 
 	tree = new BVH(triangleFile, triangleIndexFile, numFaces, vertexFile, m_bb_min, m_bb_max);
@@ -608,15 +821,9 @@ bool OutOfCoreTree::buildBVHSmall() {
 	tree->printTree(false);
 
 
-	UnmapViewOfFile(triangleFile);
-	UnmapViewOfFile(triangleIndexFile);
-	UnmapViewOfFile(vertexFile);
-	CloseHandle (hMappingTriangle);
-	CloseHandle (hMappingTriangleIndex);
-	CloseHandle (hMappingVertex);
-	CloseHandle (hFileTriangle);
-	CloseHandle (hFileTriangleIndex);
-	CloseHandle (hFileVertex);
+	FileMapper::unmap(triangleFile);
+	FileMapper::unmap(triangleIndexFile);
+	FileMapper::unmap(vertexFile);
 	delete tree;
 
 	end.set();
@@ -733,99 +940,165 @@ bool OutOfCoreTree::buildSmallMulti(const char *outputPath, const char *fileList
 
 	fclose(fpList);
 
-	initSmall();
-
-	for(int i=0;i<fileList.size();i++)
+	// source files of the textures are next to the material file
+	vector<string> textureSrcList;
+	for(size_t i=0;i<textureFileList.size();i++)
 	{
-		firstVertexPassSmall(fileList[i], useModelTransform ? matList[i] : 0);
+		char srcFileName[256];
+
+		strncpy_s(srcFileName, 256, mtlFileName, strlen(mtlFileName));
+		for(int j=(int)strlen(srcFileName)-1;j>=0;j--)
+		{
+			if(srcFileName[j] == '/' || srcFileName[j] == '\\')
+			{
+				memcpy_s(&srcFileName[j+1], 256, textureFileList[i], strlen(textureFileList[i])+1);
+				break;
+			}
+			else if(j == 0)
+			{
+				memcpy_s(srcFileName, 256, textureFileList[i], strlen(textureFileList[i])+1);
+			}
+		}
+		textureSrcList.push_back(srcFileName);
 	}
 
-	writeModelInfo();
+	// each input is converted to a mesh file of its own, only changed inputs are parsed again.
+	// The passes merge the mesh files and share state in memory, the model is built as one
+	// stage. Textures are copied as stages of their own.
+	if (manifest) delete manifest;
+	manifest = new BuildManifest(getManifestFileName());
+	manifest->load();
 
-	for(int i=0;i<fileList.size();i++)
+	vector<BuildManifest::Hash> inputKeys;
+	bvhKey = BuildManifest::hashValue(useFileMat);
+	for(size_t i=0;i<fileList.size();i++)
 	{
-		secondVertexPassSmall(fileList[i], useModelTransform ? matList[i] : 0);
+		BuildManifest::Hash inputKey = manifest->hashInput(fileList[i]);
+		inputKey = BuildManifest::hashValue(useModelTransform, inputKey);
+		if(useModelTransform)
+			inputKey = BuildManifest::hashData(matList[i], sizeof(float)*16, inputKey);
+		inputKey = BuildManifest::hashValue((int)sizeof(Vertex), inputKey);
+		#ifdef _USE_TRI_MATERIALS
+		inputKey = BuildManifest::hashString("colors", inputKey);
+		#endif
+		inputKeys.push_back(inputKey);
+		bvhKey = BuildManifest::hashValue(inputKey, bvhKey);
 	}
+	// material indices of the triangles depend on the material file
+	if(mtlFileName)
+		bvhKey = BuildManifest::hashValue(manifest->hashInput(mtlFileName), bvhKey);
+	bvhKey = hashBVHOptions(BuildManifest::hashString("small model", bvhKey));
 
-	bridge2to3();
+	std::vector<std::string> outputs = getModelOutputs();
+	if(mtlFileName)
+		outputs.push_back(std::string(outDirName) + "\\material.mtl");
 
-	for(int i=0;i<fileList.size();i++)
+	if (manifest->isUpToDate("model", bvhKey))
 	{
-		// read mtl name from ply comment
-		char mtlName[MAX_PATH];
-		int matIndex = -1;
-		if(mtlList.size() > 0)
+		cout << "Skipping build, all outputs are up to date.\n";
+	}
+	else
+	{
+		manifest->invalidate("model");
+
+		for(size_t i=0;i<fileList.size();i++)
+		{
+			std::string stageName = "input " + toString((unsigned int)i,5,'0');
+			if (manifest->isUpToDate(stageName.c_str(), inputKeys[i]))
+			{
+				cout << fileList[i] << ": skipping, already converted." << endl;
+				continue;
+			}
+			manifest->invalidate(stageName.c_str());
+
+			if(!convertInputSmall(fileList[i], useModelTransform ? matList[i] : 0, getInputMeshFileName(i))) return false;
+
+			manifest->commit(stageName.c_str(), inputKeys[i], std::vector<std::string>(1, getInputMeshFileName(i)));
+		}
+
+		initSmall();
+
+		for(int i=0;i<fileList.size();i++)
+		{
+			if(!firstVertexPassMesh(getInputMeshFileName(i))) return false;
+		}
+
+		writeModelInfo();
+
+		for(int i=0;i<fileList.size();i++)
 		{
-			matIndex = 0;
-			FILE *fp = fopen(fileList[i], "r");
-			while (fgets(currentLine, 499, fp)) 
+			if(!secondVertexPassMesh(getInputMeshFileName(i))) return false;
+		}
+
+		if(!bridge2to3()) return false;
+
+		for(int i=0;i<fileList.size();i++)
+		{
+			// read mtl name from ply comment
+			char mtlName[MAX_PATH];
+			int matIndex = -1;
+			if(mtlList.size() > 0)
 			{
-				if(strstr(currentLine, "end_header")) break;
-				if(strstr(currentLine, "used material"))
+				matIndex = 0;
+				FILE *fp = fopen(fileList[i], "r");
+				while (fgets(currentLine, 499, fp)) 
 				{
-					sscanf(currentLine, "comment used material = %s", mtlName);
-					for(int j=0;j<mtlList.size();j++)
+					if(strstr(currentLine, "end_header")) break;
+					if(strstr(currentLine, "used material"))
 					{
-						if(!strcmp(mtlList[j], mtlName)) 
+						sscanf(currentLine, "comment used material = %s", mtlName);
+						for(int j=0;j<mtlList.size();j++)
 						{
-							matIndex = j;
-							break;
+							if(!strcmp(mtlList[j], mtlName)) 
+							{
+								matIndex = j;
+								break;
+							}
 						}
+						break;
 					}
-					break;
 				}
+				fclose(fp);
 			}
-			fclose(fp);
+
+			if(!thirdVertexPassMesh(getInputMeshFileName(i), i, matIndex)) return false;
 		}
 
-		thirdVertexPassSmall(fileList[i], i, matIndex);
-	}
+		finalizeMeshPass();
 
-	finalizeMeshPass();
+		if(!buildBVHSmall()) return false;
 
-	buildBVHSmall();
+		unlink(getTriangleIdxFileName().c_str());
 
-	unlink(getTriangleIdxFileName().c_str());
+		// copy material file
+		if(mtlFileName)
+		{
+			char fileName[256];
+			sprintf(fileName, "%s\\material.mtl", outDirName);
+			copyFile(mtlFileName, fileName);
+		}
 
-	// copy material file
-	if(mtlFileName)
-	{
-		char fileName[256];
-		sprintf(fileName, "%s\\material.mtl", outDirName);
-		copyFile(mtlFileName, fileName);
+		manifest->commit("model", bvhKey, outputs);
 	}
 
-	// copy textures
+	// copy textures, a changed texture does not rebuild the model
 	char textureFolderName[256];
+	sprintf(textureFolderName, "%s\\texture", outDirName);
 	if(textureFileList.size() > 0)
-	{
-		sprintf(textureFolderName, "%s\\texture", outDirName);
 		mkdir(textureFolderName);
-	}
 	for(size_t i=0;i<textureFileList.size();i++)
 	{
-		char srcFileName[256];
-		char dstFileName[256];
+		std::string dstFileName = std::string(textureFolderName) + "\\" + textureFileList[i];
+		std::string stageName = "texture " + toString((unsigned int)i,5,'0');
+		BuildManifest::Hash textureKey = BuildManifest::hashString(dstFileName.c_str(), manifest->hashInput(textureSrcList[i]));
+		if (manifest->isUpToDate(stageName.c_str(), textureKey)) continue;
+		manifest->invalidate(stageName.c_str());
 
-		strncpy_s(srcFileName, 256, mtlFileName, strlen(mtlFileName));
-		for(int j=(int)strlen(srcFileName)-1;j>=0;j--)
-		{
-			if(srcFileName[j] == '/' || srcFileName[j] == '\\')
-			{
-				memcpy_s(&srcFileName[j+1], 256, textureFileList[i], strlen(textureFileList[i])+1);
-				break;
-			}
-			else if(j == 0)
-			{
-				memcpy_s(srcFileName, 256, textureFileList[i], strlen(textureFileList[i])+1);
-			}
-		}
+		copyFile(textureSrcList[i], dstFileName);
 
-		sprintf(dstFileName, "%s\\%s", textureFolderName, textureFileList[i]);
-		copyFile(srcFileName, dstFileName);
+		manifest->commit(stageName.c_str(), textureKey, std::vector<std::string>(1, dstFileName));
 	}
 
-
 	for(size_t i=0;i<fileList.size();i++) delete[] fileList[i];
 	for(size_t i=0;i<matList.size();i++) delete[] matList[i];
 	for(size_t i=0;i<mtlList.size();i++) delete[] mtlList[i];
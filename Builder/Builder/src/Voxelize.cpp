@@ -39,6 +39,14 @@ AABB Voxelize::computeSubBox(int x, int y, int z, const AABB &box)
 	return subBox;
 }
 
+void Voxelize::computeSubBoxes(const AABB &box, AABB *subBoxes)
+{
+	for(int x=0;x<N;x++)
+		for(int y=0;y<N;y++)
+			for(int z=0;z<N;z++)
+				*subBoxes++ = computeSubBox(x, y, z, box);
+}
+
 bool Voxelize::isIntersect(const AABB &box, const Triangle &tri)
 {
 	Vector3 vert[3] = {m_vert[tri.p[0]].v, m_vert[tri.p[1]].v, m_vert[tri.p[2]].v};
@@ -239,6 +247,203 @@ bool Voxelize::isIntersect(const AABB &a)
 	return false;
 }
 
+void Voxelize::setBoxPacket(BoxPacket &packet, const AABB *boxes, int numBoxes)
+{
+	// unused lanes get the first box, they are masked out by the callers
+	const AABB *box[4];
+	for(int i=0;i<4;i++)
+		box[i] = &boxes[i < numBoxes ? i : 0];
+
+	for(int i=0;i<3;i++)
+	{
+		float center[4], halfSize[4];
+		for(int j=0;j<4;j++)
+		{
+			center[j] = 0.5f*(box[j]->min.e[i] + box[j]->max.e[i]);
+			halfSize[j] = 0.5f*(box[j]->max.e[i] - box[j]->min.e[i]);
+		}
+		packet.center[i] = _mm_loadu_ps(center);
+		packet.halfSize[i] = _mm_loadu_ps(halfSize);
+		packet.min[i] = _mm_setr_ps(box[0]->min.e[i], box[1]->min.e[i], box[2]->min.e[i], box[3]->min.e[i]);
+		packet.max[i] = _mm_setr_ps(box[0]->max.e[i], box[1]->max.e[i], box[2]->max.e[i], box[3]->max.e[i]);
+	}
+}
+
+int Voxelize::isIntersect(const BoxPacket &boxes, const Vector3 *vert, int activeMask)
+{
+	// same tests and operation order as the scalar version, one box per lane
+#define SIMD_SEPARATED(min, max, rad) \
+	_mm_or_ps(_mm_cmpgt_ps(min, _mm_add_ps(rad, eps)), _mm_cmplt_ps(max, _mm_sub_ps(_mm_xor_ps(rad, signMask), eps)))
+
+#define SIMD_AXISTEST_X(a, b, fa, fb, va, vb) \
+	p0 = _mm_sub_ps(_mm_mul_ps(a, va[1]), _mm_mul_ps(b, va[2])); \
+	p1 = _mm_sub_ps(_mm_mul_ps(a, vb[1]), _mm_mul_ps(b, vb[2])); \
+	rad = _mm_add_ps(_mm_mul_ps(fa, boxes.halfSize[1]), _mm_mul_ps(fb, boxes.halfSize[2])); \
+	separated = _mm_or_ps(separated, SIMD_SEPARATED(_mm_min_ps(p0, p1), _mm_max_ps(p0, p1), rad));
+
+#define SIMD_AXISTEST_Y(a, b, fa, fb, va, vb) \
+	p0 = _mm_add_ps(_mm_mul_ps(_mm_xor_ps(a, signMask), va[0]), _mm_mul_ps(b, va[2])); \
+	p1 = _mm_add_ps(_mm_mul_ps(_mm_xor_ps(a, signMask), vb[0]), _mm_mul_ps(b, vb[2])); \
+	rad = _mm_add_ps(_mm_mul_ps(fa, boxes.halfSize[0]), _mm_mul_ps(fb, boxes.halfSize[2])); \
+	separated = _mm_or_ps(separated, SIMD_SEPARATED(_mm_min_ps(p0, p1), _mm_max_ps(p0, p1), rad));
+
+#define SIMD_AXISTEST_Z(a, b, fa, fb, va, vb) \
+	p0 = _mm_sub_ps(_mm_mul_ps(a, va[0]), _mm_mul_ps(b, va[1])); \
+	p1 = _mm_sub_ps(_mm_mul_ps(a, vb[0]), _mm_mul_ps(b, vb[1])); \
+	rad = _mm_add_ps(_mm_mul_ps(fa, boxes.halfSize[0]), _mm_mul_ps(fb, boxes.halfSize[1])); \
+	separated = _mm_or_ps(separated, SIMD_SEPARATED(_mm_min_ps(p0, p1), _mm_max_ps(p0, p1), rad));
+
+	if((vert[0] - vert[1]).maxAbsComponent() == 0.0f ||
+		(vert[1] - vert[2]).maxAbsComponent() == 0.0f ||
+		(vert[2] - vert[0]).maxAbsComponent() == 0.0f)
+	{
+		return 0;
+	}
+
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 eps = _mm_set1_ps(m_intersectEpsilon);
+
+	__m128 v0[3], v1[3], v2[3];
+	__m128 e0[3], e1[3], e2[3];
+	__m128 min, max, p0, p1, rad, fex, fey, fez;
+	__m128 separated = _mm_setzero_ps();
+
+	for(int i=0;i<3;i++)
+	{
+		v0[i] = _mm_sub_ps(_mm_set1_ps(vert[0].e[i]), boxes.center[i]);
+		v1[i] = _mm_sub_ps(_mm_set1_ps(vert[1].e[i]), boxes.center[i]);
+		v2[i] = _mm_sub_ps(_mm_set1_ps(vert[2].e[i]), boxes.center[i]);
+
+		// bounding box of the triangle first, it rejects most of the boxes
+		min = _mm_min_ps(_mm_min_ps(v0[i], v1[i]), v2[i]);
+		max = _mm_max_ps(_mm_max_ps(v0[i], v1[i]), v2[i]);
+		separated = _mm_or_ps(separated, SIMD_SEPARATED(min, max, boxes.halfSize[i]));
+	}
+
+	activeMask &= ~_mm_movemask_ps(separated);
+	if(!activeMask) return 0;
+
+	for(int i=0;i<3;i++)
+	{
+		e0[i] = _mm_sub_ps(v1[i], v0[i]);
+		e1[i] = _mm_sub_ps(v2[i], v1[i]);
+		e2[i] = _mm_sub_ps(v0[i], v2[i]);
+	}
+
+	fex = _mm_andnot_ps(signMask, e0[0]);
+	fey = _mm_andnot_ps(signMask, e0[1]);
+	fez = _mm_andnot_ps(signMask, e0[2]);
+	SIMD_AXISTEST_X(e0[2], e0[1], fez, fey, v0, v2);
+	SIMD_AXISTEST_Y(e0[2], e0[0], fez, fex, v0, v2);
+	SIMD_AXISTEST_Z(e0[1], e0[0], fey, fex, v1, v2);
+
+	fex = _mm_andnot_ps(signMask, e1[0]);
+	fey = _mm_andnot_ps(signMask, e1[1]);
+	fez = _mm_andnot_ps(signMask, e1[2]);
+	SIMD_AXISTEST_X(e1[2], e1[1], fez, fey, v0, v2);
+	SIMD_AXISTEST_Y(e1[2], e1[0], fez, fex, v0, v2);
+	SIMD_AXISTEST_Z(e1[1], e1[0], fey, fex, v0, v1);
+
+	fex = _mm_andnot_ps(signMask, e2[0]);
+	fey = _mm_andnot_ps(signMask, e2[1]);
+	fez = _mm_andnot_ps(signMask, e2[2]);
+	SIMD_AXISTEST_X(e2[2], e2[1], fez, fey, v0, v1);
+	SIMD_AXISTEST_Y(e2[2], e2[0], fez, fex, v0, v1);
+	SIMD_AXISTEST_Z(e2[1], e2[0], fey, fex, v1, v2);
+
+	return activeMask & ~_mm_movemask_ps(separated);
+}
+
+int Voxelize::isIntersect(const AABB *boxes, int numBoxes)
+{
+	BoxPacket packets[8];
+	int numPackets = (numBoxes + 3) / 4;
+	int allMask = numBoxes == 32 ? 0xFFFFFFFF : (1 << numBoxes) - 1;
+	int hitMask = 0;
+
+	AABB bound;
+	for(int i=0;i<numBoxes;i++)
+	{
+		updateBB(bound.min, bound.max, boxes[i].min);
+		updateBB(bound.min, bound.max, boxes[i].max);
+	}
+
+	for(int i=0;i<numPackets;i++)
+		setBoxPacket(packets[i], boxes + 4*i, min(4, numBoxes - 4*i));
+
+	int stack[100];
+	int stackPtr = 1;
+	stack[0] = 0;
+	int axis;
+	unsigned int lChild;
+	int side;
+
+	const BVHNode *currentNode = &m_node[0];
+	Vector3 boxCenter = 0.5f*(bound.min + bound.max);
+
+	while(true)
+	{
+		// boxes not hit yet which overlap the node
+		int nodeMask = 0;
+		if(isIntersect(bound, currentNode))
+		{
+			for(int i=0;i<numPackets;i++)
+			{
+				__m128 outside = _mm_setzero_ps();
+				for(int j=0;j<3;j++)
+				{
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(packets[i].max[j], _mm_set1_ps(currentNode->min.e[j] - m_intersectEpsilon)));
+					outside = _mm_or_ps(outside, _mm_cmpgt_ps(packets[i].min[j], _mm_set1_ps(currentNode->max.e[j] + m_intersectEpsilon)));
+				}
+				nodeMask |= (~_mm_movemask_ps(outside) & 0xF) << (4*i);
+			}
+			nodeMask &= allMask & ~hitMask;
+		}
+
+		if(nodeMask)
+		{
+			if(!ISLEAF(currentNode))
+			{
+				lChild = GETLEFTCHILD(currentNode);
+
+				axis = AXIS(currentNode);
+
+				side = boxCenter.e[axis] < (0.5f*(currentNode->min + currentNode->max)).e[axis];
+
+				stack[stackPtr] = side + lChild;
+				currentNode =  &m_node[(side^1) + lChild];
+
+				++stackPtr;
+				continue;
+			}
+			else
+			{
+				for(int i=0;i<GETCHILDCOUNT(currentNode);i++)
+				{
+					const Triangle &tri = m_tri[currentNode->indexOffset+i];
+					if(tri.p[0] == tri.p[1] || tri.p[1] == tri.p[2] || tri.p[2] == tri.p[0]) continue;
+
+					Vector3 vert[3] = {m_vert[tri.p[0]].v, m_vert[tri.p[1]].v, m_vert[tri.p[2]].v};
+					for(int j=0;j<numPackets;j++)
+					{
+						int activeMask = (nodeMask & ~hitMask) >> (4*j) & 0xF;
+						if(activeMask)
+							hitMask |= isIntersect(packets[j], vert, activeMask) << (4*j);
+					}
+					if(hitMask == allMask) 
+						return hitMask;
+				}
+			}
+		}
+
+		if(--stackPtr == 0) break;
+
+		currentNode = &m_node[stack[stackPtr]];
+	}
+
+	return hitMask;
+}
+
 void Voxelize::getIntersectVoxels(const BVHNode *tree, const Triangle &tri, std::vector<int> &list)
 {
 	int stack[100];
@@ -297,70 +502,66 @@ bool Voxelize::depthTest(int depth, const AABB &bb)
 	return false;
 }
 
-int Voxelize::createOctreeNode(FILE *fp, int parentIndex, int myIndex, int &lastIndex, const AABB &box, int depth, bool generateOOC, bool *isOOCPart)
+int Voxelize::createOctreeNode(OctreeBuild &build, int parentIndex, int myIndex, int &lastIndex, const AABB &box, int depth, bool generateOOC, bool *isOOCPart)
 {
-	int childIndex[N][N][N];
-	AABB childBox[N][N][N];
-	bool childIsOOCPart[N][N][N] = {0, };
-	int curIndex = myIndex*N*N*N;
+	if(build.subtrees && depth == build.splitDepth)
+	{
+		if(!build.collect)
+			return spliceOctreeSubtree(build, (*build.subtrees)[build.nextSubtree++], parentIndex, myIndex, lastIndex, isOOCPart);
+
+		OctreeSubtree subtree;
+		subtree.depth = depth;
+		subtree.box = box;
+		subtree.lastIndex = 0;
+		subtree.numVoxels = 0;
+		subtree.isOOCPart = false;
+		build.subtrees->push_back(subtree);
+		return 0;
+	}
 
-	//int voxelSize = N << (g_maxDepth-1);
-	//unsigned char intChar[4];
+	int childIndex[N*N*N];
+	AABB childBox[N*N*N];
+	bool childIsOOCPart[N*N*N] = {0, };
+	int curIndex = myIndex*N*N*N;
 
 	bool maxDepth = false;
 
-	for(int x=0;x<N;x++)
+	if((int)build.voxels.size() < curIndex+N*N*N)
 	{
-		for(int y=0;y<N;y++)
+		if((int)build.voxels.capacity() < curIndex+N*N*N)
+			build.voxels.reserve(2*(curIndex+N*N*N));
+		build.voxels.resize(curIndex+N*N*N);
+	}
+
+	computeSubBoxes(box, childBox);
+	int intersectMask = isIntersect(childBox, N*N*N);
+
+	for(int i=0;i<N*N*N;i++,curIndex++)
+	{
+		Voxel voxel;
+		voxel.clear();
+
+		childIndex[i] = 0;
+
+		if(intersectMask & (1 << i))
 		{
-			for(int z=0;z<N;z++)
+			if(	(generateOOC && g_maxDepth == depth) ||
+				(!generateOOC && g_maxDepth2 == depth))
 			{
-				Voxel voxel;
-				voxel.clear();
-				//voxel.parentIndex = parentIndex;
+				maxDepth = true;
 
-				childBox[x][y][z] = computeSubBox(x, y, z, box);
-				childIndex[x][y][z] = 0;
+				voxel.setLeaf();
 
-				if(isIntersect(childBox[x][y][z]))
-				{
-					//if(depthTest(depth, childBox[x][y][z]))
-					if(	(generateOOC && g_maxDepth == depth) ||
-						(!generateOOC && g_maxDepth2 == depth))
-					{
-						maxDepth = true;
-						/*
-						int gx, gy, gz;
-						Vector3 pos = (childBox[x][y][z].min + (0.5f*m_voxelDelta)) - m_BB.min;
-						gx = (int)(pos[0] / m_voxelDelta[0]);
-						gy = (int)(pos[1] / m_voxelDelta[1]);
-						gz = (int)(pos[2] / m_voxelDelta[2]);
-						*/
-
-						voxel.setLeaf();
-						/*
-						memcpy(intChar, &curIndex, sizeof(int));
-						m_indexMap[gx + gy*voxelSize + gz*voxelSize*voxelSize + 0*voxelSize*voxelSize*(__int64)voxelSize] = intChar[0];
-						m_indexMap[gx + gy*voxelSize + gz*voxelSize*voxelSize + 1*voxelSize*voxelSize*(__int64)voxelSize] = intChar[1];
-						m_indexMap[gx + gy*voxelSize + gz*voxelSize*voxelSize + 2*voxelSize*voxelSize*(__int64)voxelSize] = intChar[2];
-						m_indexMap[gx + gy*voxelSize + gz*voxelSize*voxelSize + 3*voxelSize*voxelSize*(__int64)voxelSize] = intChar[3];
-						//m_psh.push(HashElem<int>(Position(gx, gy, gz), curIndex));
-						*/
-
-						setGeomBitmap(voxel, childBox[x][y][z]);
-					}
-					else
-					{
-						voxel.setChildIndex(++lastIndex);
-						childIndex[x][y][z] = voxel.getChildIndex();
-					}
-				}
-				
-				_fseeki64(fp, (__int64)curIndex*sizeof(Voxel)+sizeof(OctreeHeader), SEEK_SET);
-				fwrite(&voxel, sizeof(Voxel), 1, fp);
-				curIndex++;
+				setGeomBitmap(voxel, childBox[i]);
+			}
+			else
+			{
+				voxel.setChildIndex(++lastIndex);
+				childIndex[i] = voxel.getChildIndex();
 			}
 		}
+
+		build.voxels[curIndex] = voxel;
 	}
 
 	int numVoxels = N*N*N;
@@ -368,31 +569,25 @@ int Voxelize::createOctreeNode(FILE *fp, int parentIndex, int myIndex, int &last
 
 	curIndex = myIndex*N*N*N;
 	bool hasOOCPart = false;
-	for(int x=0;x<N;x++)
-		for(int y=0;y<N;y++)
-			for(int z=0;z<N;z++)
-			{
-				if(childIndex[x][y][z])
-				{
-					numVoxels += createOctreeNode(fp, curIndex, childIndex[x][y][z], lastIndex, childBox[x][y][z], depth+1, generateOOC, &childIsOOCPart[x][y][z]);
-					hasOOCPart |= childIsOOCPart[x][y][z];
-				}
-				curIndex++;
-			}
+	for(int i=0;i<N*N*N;i++,curIndex++)
+	{
+		if(childIndex[i])
+		{
+			numVoxels += createOctreeNode(build, curIndex, childIndex[i], lastIndex, childBox[i], depth+1, generateOOC, &childIsOOCPart[i]);
+			hasOOCPart |= childIsOOCPart[i];
+		}
+	}
 
 	curIndex = myIndex*N*N*N;
 	if(hasOOCPart)
 	{
-		for(int x=0;x<N;x++)
-			for(int y=0;y<N;y++)
-				for(int z=0;z<N;z++)
-				{
-					if(childIndex[x][y][z] && !childIsOOCPart[x][y][z])
-					{
-						m_oocVoxelList.push_back(OOCVoxel(curIndex, depth+1, childBox[x][y][z]));
-					}
-					curIndex++;
-				}
+		for(int i=0;i<N*N*N;i++,curIndex++)
+		{
+			if(childIndex[i] && !childIsOOCPart[i])
+			{
+				build.oocVoxels.push_back(OOCVoxel(curIndex, depth+1, childBox[i]));
+			}
+		}
 	}
 
 	//if(generateOOC && numVoxels > 1000)
@@ -400,7 +595,7 @@ int Voxelize::createOctreeNode(FILE *fp, int parentIndex, int myIndex, int &last
 	{
 		if(!hasOOCPart)
 		{
-			m_oocVoxelList.push_back(OOCVoxel(parentIndex, depth, box));
+			build.oocVoxels.push_back(OOCVoxel(parentIndex, depth, box));
 		}
 		if(isOOCPart)
 			*isOOCPart = true;
@@ -409,40 +604,121 @@ int Voxelize::createOctreeNode(FILE *fp, int parentIndex, int myIndex, int &last
 	return numVoxels;
 }
 
+int Voxelize::spliceOctreeSubtree(OctreeBuild &build, OctreeSubtree &subtree, int parentIndex, int myIndex, int &lastIndex, bool *isOOCPart)
+{
+	// the root block of the subtree is myIndex, the other blocks follow lastIndex in the order
+	// the recursive build would have allocated them, so the octree is the same as a sequential build
+	int base = lastIndex;
+	lastIndex += subtree.lastIndex;
+
+	if((int)build.voxels.size() < (lastIndex+1)*N*N*N)
+	{
+		if((int)build.voxels.capacity() < (lastIndex+1)*N*N*N)
+			build.voxels.reserve(2*(lastIndex+1)*N*N*N);
+		build.voxels.resize((lastIndex+1)*N*N*N);
+	}
+
+	for(int i=0;i<(int)subtree.voxels.size();i++)
+	{
+		int block = i / (N*N*N);
+		Voxel voxel = subtree.voxels[i];
+		if(voxel.hasChild())
+			voxel.setChildIndex(base + voxel.getChildIndex());
+		build.voxels[(block == 0 ? myIndex : base + block)*N*N*N + i % (N*N*N)] = voxel;
+	}
+
+	for(int i=0;i<(int)subtree.oocVoxels.size();i++)
+	{
+		OOCVoxel oocVoxel = subtree.oocVoxels[i];
+		// -1 is the parent of the subtree root
+		if(oocVoxel.rootChildIndex < 0)
+			oocVoxel.rootChildIndex = parentIndex;
+		else
+		{
+			int block = oocVoxel.rootChildIndex / (N*N*N);
+			oocVoxel.rootChildIndex = (block == 0 ? myIndex : base + block)*N*N*N + oocVoxel.rootChildIndex % (N*N*N);
+		}
+		build.oocVoxels.push_back(oocVoxel);
+	}
+
+	if(isOOCPart && subtree.isOOCPart)
+		*isOOCPart = true;
+
+	std::vector<Voxel>().swap(subtree.voxels);
+	OOCVoxelList().swap(subtree.oocVoxels);
+
+	return subtree.numVoxels;
+}
+
+int Voxelize::buildOctree(OctreeBuild &build, const AABB &box, int depth, bool generateOOC)
+{
+	int leafDepth = generateOOC ? g_maxDepth : g_maxDepth2;
+	int lastIndex;
+
+	// the first passes only visit the upper levels to find a depth with enough subtrees for the threads
+	OctreeSubtreeList subtrees;
+	int splitDepth = 0;
+	int numThreads = omp_in_parallel() ? 1 : omp_get_max_threads();
+	for(int curDepth=depth+1;curDepth<=leafDepth && numThreads > 1;curDepth++)
+	{
+		OctreeSubtreeList curSubtrees;
+		OctreeBuild collectBuild;
+		collectBuild.subtrees = &curSubtrees;
+		collectBuild.splitDepth = curDepth;
+		collectBuild.collect = true;
+
+		lastIndex = 0;
+		createOctreeNode(collectBuild, -1, 0, lastIndex, box, depth, generateOOC);
+		if(curSubtrees.empty()) break;
+
+		subtrees.swap(curSubtrees);
+		splitDepth = curDepth;
+		if((int)subtrees.size() >= SUBTREES_PER_THREAD*numThreads) break;
+	}
+
+	if(subtrees.size() > 0)
+		printf("Build %d subtrees from depth %d with %d threads\n", (int)subtrees.size(), splitDepth, numThreads);
+
+#	pragma omp parallel for schedule(dynamic, 1)
+	for(int i=0;i<(int)subtrees.size();i++)
+	{
+		OctreeSubtree &subtree = subtrees[i];
+		OctreeBuild subtreeBuild;
+
+		subtree.lastIndex = 0;
+		subtree.numVoxels = createOctreeNode(subtreeBuild, -1, 0, subtree.lastIndex, subtree.box, subtree.depth, generateOOC, &subtree.isOOCPart);
+		subtree.voxels.swap(subtreeBuild.voxels);
+		subtree.oocVoxels.swap(subtreeBuild.oocVoxels);
+	}
+
+	build.subtrees = subtrees.size() > 0 ? &subtrees : NULL;
+	build.splitDepth = splitDepth;
+	build.nextSubtree = 0;
+	build.collect = false;
+
+	lastIndex = 0;
+	int numVoxels = createOctreeNode(build, -1, 0, lastIndex, box, depth, generateOOC);
+	build.subtrees = NULL;
+	return numVoxels;
+}
+
 void Voxelize::setGeomBitmap(Voxel &voxel, const AABB &box)
 {
-	AABB childBox1;
-	AABB childBox2;
+	AABB childBox1[N*N*N];
+	AABB childBox2[N*N*N];
+
 	// level 1
-	for(int x1=0,offset1=0;x1<N;x1++)
+	computeSubBoxes(box, childBox1);
+	int intersectMask = isIntersect(childBox1, N*N*N);
+	for(int offset1=0;offset1<N*N*N;offset1++)
 	{
-		for(int y1=0;y1<N;y1++)
-		{
-			for(int z1=0;z1<N;z1++,offset1++)
-			{
-				voxel.geomBitmap[offset1] = 0;
+		voxel.geomBitmap[offset1] = 0;
 
-				childBox1 = computeSubBox(x1, y1, z1, box);
-				if(isIntersect(childBox1))
-				{
-					// level 2
-					for(int x2=0,offset2=0;x2<N;x2++)
-					{
-						for(int y2=0;y2<N;y2++)
-						{
-							for(int z2=0;z2<N;z2++,offset2++)
-							{
-								childBox2 = computeSubBox(x2, y2, z2, childBox1);
-
-								if(isIntersect(childBox2))
-								{
-									voxel.geomBitmap[offset1] |= (1u << offset2);
-								}
-							}
-						}
-					}
-				}
-			}
+		if(intersectMask & (1 << offset1))
+		{
+			// level 2
+			computeSubBoxes(childBox1[offset1], childBox2);
+			voxel.geomBitmap[offset1] = (unsigned char)isIntersect(childBox2, N*N*N);
 		}
 	}
 }
@@ -456,8 +732,6 @@ int Voxelize::createOctreeNode()
 	m_BB.min = Vector3(center.x() - targetHalfSize, center.y() - targetHalfSize, center.z() - targetHalfSize);
 	m_BB.max = Vector3(center.x() + targetHalfSize, center.y() + targetHalfSize, center.z() + targetHalfSize);
 
-	m_lastIndex = 0;
-
 	OctreeHeader header;
 	header.dim = N;
 	header.maxDepth = g_maxDepth;
@@ -469,20 +743,15 @@ int Voxelize::createOctreeNode()
 	m_voxelDelta = (m_BB.max - m_BB.min) / voxelSize;
 	m_intersectEpsilon = 0.0f;//(m_BB.max - m_BB.min).maxAbsComponent() * 0.0001f;
 
-	//if(m_indexMap) delete[] m_indexMap;
-	//m_indexMap = new unsigned char[voxelSize*voxelSize*(__int64)voxelSize*4];
-	//memset(m_indexMap, 255, voxelSize*voxelSize*(__int64)voxelSize*4);
-
 	Voxel::initD(m_BB);
-	int numVoxels = createOctreeNode(m_fp, -1, 0, m_lastIndex, m_BB, 1, g_maxDepth != g_maxDepth2);
 
-	/*
-	cimg_library::CImg<unsigned char> data(m_indexMap, voxelSize, voxelSize, voxelSize, 4);
-	PSH psh(data);
-	psh.perform();
-	psh.display();
-	//psh.save("hash.txt", "offset.txt");
-	*/
+	OctreeBuild build;
+	int numVoxels = buildOctree(build, m_BB, 1, g_maxDepth != g_maxDepth2);
+	m_lastIndex = (int)build.voxels.size() / (N*N*N) - 1;
+
+	fwrite(&build.voxels[0], sizeof(Voxel), build.voxels.size(), m_fp);
+	m_oocVoxelList.insert(m_oocVoxelList.end(), build.oocVoxels.begin(), build.oocVoxels.end());
+
 	return numVoxels;
 }
 
@@ -501,7 +770,10 @@ int Voxelize::createOctreeNode(FILE *fp, const OOCVoxel &voxel)
 	m_voxelDelta = (voxel.rootBB.max - voxel.rootBB.min) / voxelSize;
 	m_intersectEpsilon = 0.0f;//(voxel.rootBB.max - voxel.rootBB.min).maxAbsComponent() * 0.0001f;
 
-	int numVoxels = createOctreeNode(fp, -1, 0, lastIndex, voxel.rootBB, voxel.startDepth, false);
+	// called by the threads of oocVoxelize, sequential here
+	OctreeBuild build;
+	int numVoxels = createOctreeNode(build, -1, 0, lastIndex, voxel.rootBB, voxel.startDepth, false);
+	fwrite(&build.voxels[0], sizeof(Voxel), build.voxels.size(), fp);
 	return numVoxels;
 }
 
@@ -522,7 +794,7 @@ void Voxelize::setGeomLOD(int index, const AABB &bb)
 	*/
 }
 
-COOCPCAwoExtent Voxelize::computeGeomLOD(const AABB &bb, int index)
+COOCPCAwoExtent Voxelize::computeGeomLOD(const AABB &bb, int index, int splitLevel)
 {
 	int childIndex = index * N * N * N;
 
@@ -534,8 +806,12 @@ COOCPCAwoExtent Voxelize::computeGeomLOD(const AABB &bb, int index)
 				AABB subBox = computeSubBox(x, y, z, bb);
 				if(m_octree[childIndex].hasChild())
 				{
-					m_PCAOctree[childIndex] = computeGeomLOD(subBox, m_octree[childIndex].getChildIndex());
-					setGeomLOD(childIndex, subBox);
+					// subtrees are already computed by the threads
+					if(splitLevel != 0)
+					{
+						m_PCAOctree[childIndex] = computeGeomLOD(subBox, m_octree[childIndex].getChildIndex(), splitLevel-1);
+						setGeomLOD(childIndex, subBox);
+					}
 					pca = pca + m_PCAOctree[childIndex];
 				}
 				else if(m_octree[childIndex].isLeaf())
@@ -549,7 +825,7 @@ COOCPCAwoExtent Voxelize::computeGeomLOD(const AABB &bb, int index)
 	return pca;
 }
 
-VoxelMaterialExtra Voxelize::computeMaterialLOD(int index)
+VoxelMaterialExtra Voxelize::computeMaterialLOD(int index, int splitLevel, const VoxelMaterialExtra **subtreeMaterial)
 {
 	int childIndex = index * N * N * N;
 
@@ -560,8 +836,15 @@ VoxelMaterialExtra Voxelize::computeMaterialLOD(int index)
 			{
 				if(m_octree[childIndex].hasChild())
 				{
-					VoxelMaterialExtra childMaterialExtra = computeMaterialLOD(m_octree[childIndex].getChildIndex());
-					m_octree[childIndex].setMat(childMaterialExtra.getKd(), childMaterialExtra.getKs(), childMaterialExtra.getD(), childMaterialExtra.getNs());
+					VoxelMaterialExtra childMaterialExtra;
+					// subtrees are already computed by the threads, in the order they are visited here
+					if(splitLevel == 0)
+						childMaterialExtra = *(*subtreeMaterial)++;
+					else
+					{
+						childMaterialExtra = computeMaterialLOD(m_octree[childIndex].getChildIndex(), splitLevel-1, subtreeMaterial);
+						m_octree[childIndex].setMat(childMaterialExtra.getKd(), childMaterialExtra.getKs(), childMaterialExtra.getD(), childMaterialExtra.getNs());
+					}
 					materialExtra = materialExtra + childMaterialExtra;
 				}
 				else if(m_octree[childIndex].isLeaf())
@@ -581,6 +864,71 @@ VoxelMaterialExtra Voxelize::computeMaterialLOD(int index)
 	return materialExtra;
 }
 
+void Voxelize::collectLODSubtrees(const AABB &bb, int index, int level, std::vector<LODSubtree> &subtrees)
+{
+	int childIndex = index * N * N * N;
+
+	for(int x=0;x<N;x++)
+		for(int y=0;y<N;y++)
+			for(int z=0;z<N;z++)
+			{
+				if(m_octree[childIndex].hasChild())
+				{
+					AABB subBox = computeSubBox(x, y, z, bb);
+					if(level == 0)
+					{
+						LODSubtree subtree;
+						subtree.index = childIndex;
+						subtree.box = subBox;
+						subtrees.push_back(subtree);
+					}
+					else
+						collectLODSubtrees(subBox, m_octree[childIndex].getChildIndex(), level-1, subtrees);
+				}
+				childIndex++;
+			}
+}
+
+void Voxelize::computeInnerLOD(const AABB &bb)
+{
+	// split below the first level with enough subtrees for the threads
+	std::vector<LODSubtree> subtrees;
+	int splitLevel = -1;
+	int numThreads = omp_in_parallel() ? 1 : omp_get_max_threads();
+	for(int level=0;numThreads > 1;level++)
+	{
+		std::vector<LODSubtree> curSubtrees;
+		collectLODSubtrees(bb, 0, level, curSubtrees);
+		if(curSubtrees.empty()) break;
+
+		subtrees.swap(curSubtrees);
+		splitLevel = level;
+		if((int)subtrees.size() >= SUBTREES_PER_THREAD*numThreads) break;
+	}
+
+	std::vector<VoxelMaterialExtra> subtreeMaterials(subtrees.size());
+
+#	pragma omp parallel for schedule(dynamic, 1)
+	for(int i=0;i<(int)subtrees.size();i++)
+	{
+		const LODSubtree &subtree = subtrees[i];
+		int childIndex = m_octree[subtree.index].getChildIndex();
+
+		m_PCAOctree[subtree.index] = computeGeomLOD(subtree.box, childIndex);
+		setGeomLOD(subtree.index, subtree.box);
+
+		VoxelMaterialExtra &materialExtra = subtreeMaterials[i];
+		materialExtra = computeMaterialLOD(childIndex);
+		m_octree[subtree.index].setMat(materialExtra.getKd(), materialExtra.getKs(), materialExtra.getD(), materialExtra.getNs());
+	}
+
+	// upper levels
+	computeGeomLOD(bb, 0, splitLevel);
+
+	const VoxelMaterialExtra *subtreeMaterial = subtreeMaterials.size() > 0 ? &subtreeMaterials[0] : NULL;
+	computeMaterialLOD(0, splitLevel, &subtreeMaterial);
+}
+
 float Voxelize::triArea(std::vector<Vector3> &verts, int pos)
 {
 	return cross(verts[pos+1] - verts[pos], verts[pos+2] - verts[pos]).length() * 0.5f;
@@ -599,43 +947,57 @@ void Voxelize::applyTri(int index, const AABB &bb, Vector3 *vert, const Vector3
 
 	int childIndex = voxel.getChildIndex() * N * N * N;
 
-	for(int x=0;x<N;x++)
-		for(int y=0;y<N;y++)
-			for(int z=0;z<N;z++)
-			{
-				AABB subBox = computeSubBox(x, y, z, bb);
-				if(isIntersect(subBox, vert))
-					applyTri(childIndex, subBox, vert, norm, material);
-				childIndex++;
-			}
+	AABB subBox[N*N*N];
+	BoxPacket packets[(N*N*N + 3) / 4];
+	int intersectMask = 0;
+
+	computeSubBoxes(bb, subBox);
+	for(int i=0;i<(N*N*N + 3) / 4;i++)
+	{
+		int numBoxes = min(4, N*N*N - 4*i);
+		setBoxPacket(packets[i], subBox + 4*i, numBoxes);
+		intersectMask |= isIntersect(packets[i], vert, (1 << numBoxes) - 1) << (4*i);
+	}
+
+	for(int i=0;i<N*N*N;i++,childIndex++)
+	{
+		if(intersectMask & (1 << i))
+			applyTri(childIndex, subBox[i], vert, norm, material);
+	}
 }
 
-void Voxelize::computeLOD(const char *fileName, int startDepth)
+// cells of the octree a triangle can touch
+static void getCellRange(Octree &octree, const Vector3 *vert, int *minPos, int *maxPos)
 {
-	m_octree.load(fileName, startDepth);
-	m_voxelDelta = m_octree.m_voxelDelta;
-
-	m_PCAOctree = new COOCPCAwoExtent[m_octree.m_numVoxels];
-	m_leafVoxelMat = new VoxelMaterialExtra[m_octree.m_numVoxels];
+	Octree::Position minP(INT_MAX, INT_MAX, INT_MAX), maxP(0, 0, 0);
+	for(int j=0;j<3;j++)
+	{
+		Octree::Position pos = octree.getPosition(vert[j]);
+		minP.x = min(minP.x, pos.x); minP.y = min(minP.y, pos.y); minP.z = min(minP.z, pos.z);
+		maxP.x = max(maxP.x, pos.x); maxP.y = max(maxP.y, pos.y); maxP.z = max(maxP.z, pos.z);
+	}
 
-	// compute PCA for leaf voxels
-	int numTris = (int)(m_tri.m_fileSize.QuadPart / sizeof(Triangle));
+	minPos[0] = max(0, minP.x-1);
+	minPos[1] = max(0, minP.y-1);
+	minPos[2] = max(0, minP.z-1);
+	maxPos[0] = min(N << (g_maxDepth-1), maxP.x+1);
+	maxPos[1] = min(N << (g_maxDepth-1), maxP.y+1);
+	maxPos[2] = min(N << (g_maxDepth-1), maxP.z+1);
+}
 
+void Voxelize::applyTris(const std::vector<int> &tris, const int *regionMin, const int *regionMax)
+{
 	int maxIndex = m_octree.m_voxelDelta.indexOfMaxComponent();
 	float areaLimit = m_voxelDelta.e[maxIndex] * max(m_octree.m_voxelDelta.e[(maxIndex + 1)%3], m_octree.m_voxelDelta.e[(maxIndex + 2)%3]);
-	rgb col;
 
 	std::vector<Vector3> tesselatedTris;
 
 	Vector3 absTriN;
 	Vector3 up(0.0f, 1.0f, 0.0f);
 
-	if(m_matList.size() == 0)
-		m_matList.push_back(NewMaterial());
-
-	for(int i=0;i<numTris;i++)
+	for(int i=0;i<(int)tris.size();i++)
 	{
-		const Triangle &tri = m_tri[i];
+		const Triangle &tri = m_tri[tris[i]];
 		if(tri.p[0] == tri.p[1] || tri.p[1] == tri.p[2] || tri.p[2] == tri.p[0]) continue;
 
 		const NewMaterial &material = m_matList[m_matList.size() == 1 ? 0 : tri.material];
@@ -673,29 +1035,17 @@ void Voxelize::computeLOD(const char *fileName, int startDepth)
 			}
 		}
 
-		//printf("1 -> %.1f\n", tesselatedTris.size() / 3.0f);
 		for(int pos=0;pos<tesselatedTris.size();pos+=3)
 		{
 			Vector3 vert[3] = {tesselatedTris[pos], tesselatedTris[pos+1], tesselatedTris[pos+2]};
 
-			Octree::Position minPos(INT_MAX, INT_MAX, INT_MAX), maxPos(0, 0, 0);
-			for(int j=0;j<3;j++)
-			{
-				Octree::Position pos = m_octree.getPosition(vert[j]);
-				minPos.x = min(minPos.x, pos.x); minPos.y = min(minPos.y, pos.y); minPos.z = min(minPos.z, pos.z);
-				maxPos.x = max(maxPos.x, pos.x); maxPos.y = max(maxPos.y, pos.y); maxPos.z = max(maxPos.z, pos.z);
-			}
+			int minPos[3], maxPos[3];
+			getCellRange(m_octree, vert, minPos, maxPos);
 
-			minPos.x = max(0, minPos.x-1);
-			minPos.y = max(0, minPos.y-1);
-			minPos.z = max(0, minPos.z-1);
-			maxPos.x = min(N << (g_maxDepth-1), maxPos.x+1);
-			maxPos.y = min(N << (g_maxDepth-1), maxPos.y+1);
-			maxPos.z = min(N << (g_maxDepth-1), maxPos.z+1);
-
-			for(int x=minPos.x;x<=maxPos.x;x++)
-				for(int y=minPos.y;y<=maxPos.y;y++)
-					for(int z=minPos.z;z<=maxPos.z;z++)
+			// only the cells of the region, the others are updated by other threads
+			for(int x=max(minPos[0], regionMin[0]);x<=min(maxPos[0], regionMax[0]);x++)
+				for(int y=max(minPos[1], regionMin[1]);y<=min(maxPos[1], regionMax[1]);y++)
+					for(int z=max(minPos[2], regionMin[2]);z<=min(maxPos[2], regionMax[2]);z++)
 					{
 						Octree::Position pos(x, y, z);
 
@@ -706,57 +1056,101 @@ void Voxelize::computeLOD(const char *fileName, int startDepth)
 						if(!isIntersect(bb, vert)) continue;
 
 						absTriN = dot(tri.n, up) > 0 ? tri.n : -tri.n;
-						//m_PCAOctree[m_octree.m_hash[pos]].InsertTriangle(vert, absTriN, col, m_octree.m_hash[pos]);
-						applyTri(m_octree.m_hash[pos], bb, vert, absTriN, material);
-						m_octree[m_octree.m_hash[pos]].m = tri.material;
+						applyTri(it->second, bb, vert, absTriN, material);
+						m_octree[it->second].m = tri.material;
 					}
-
 		}
-		/*
-		// insert each tesselated triangle into voxel which contain first vertex, (not except method)
-		for(int pos=0;pos<tesselatedTris.size();pos+=3)
-		{
-			Octree::Position voxelPos = m_octree.getPosition(tesselatedTris[pos]);
-			Octree::Hash::iterator it = m_octree.m_hash.find(voxelPos);
-			if(it == m_octree.m_hash.end()) continue;
+	}
+}
 
-			Vector3 vert[3] = {tesselatedTris[pos], tesselatedTris[pos+1], tesselatedTris[pos+2]};
-			m_PCAOctree[m_octree.m_hash[voxelPos]].InsertTriangle(vert, tri.n, col);
-		}
-		*/
+void Voxelize::computeLOD(const char *fileName, int startDepth)
+{
+	m_octree.load(fileName, startDepth);
+	m_voxelDelta = m_octree.m_voxelDelta;
+
+	m_PCAOctree = new COOCPCAwoExtent[m_octree.m_numVoxels];
+	m_leafVoxelMat = new VoxelMaterialExtra[m_octree.m_numVoxels];
+
+	// compute PCA for leaf voxels
+	int numTris = (int)(m_tri.m_fileSize.QuadPart / sizeof(Triangle));
+
+	if(m_matList.size() == 0)
+		m_matList.push_back(NewMaterial());
 
-		/*
-		Vector3 vert[3] = {m_vert[tri.p[0]].v, m_vert[tri.p[1]].v, m_vert[tri.p[2]].v};
+	// The cells are split into regions, each region is processed by one thread with the triangles
+	// touching it in the original order. A voxel gets the same triangles in the same order as in
+	// a sequential build, so the PCA sums do not depend on the number of threads.
+	int numThreads = omp_in_parallel() ? 1 : omp_get_max_threads();
+	int regionsPerAxis = 1;
+	while(numThreads > 1 && regionsPerAxis*regionsPerAxis*regionsPerAxis < SUBTREES_PER_THREAD*numThreads && regionsPerAxis < m_octree.m_voxelSize)
+		regionsPerAxis *= 2;
+	int regionSize = (m_octree.m_voxelSize + regionsPerAxis - 1) / regionsPerAxis;
+	int numRegions = regionsPerAxis*regionsPerAxis*regionsPerAxis;
+
+	int chunkSize = min(LOD_TRI_CHUNK, numTris);
+	int *triRegions = new int[6*(chunkSize > 0 ? chunkSize : 1)];
+	std::vector<int> *regionTris = new std::vector<int>[numRegions];
+
+	for(int startTri=0;startTri<numTris;startTri+=chunkSize)
+	{
+		int numCurTris = min(chunkSize, numTris - startTri);
 
-		Octree::Position minPos(INT_MAX, INT_MAX, INT_MAX), maxPos(0, 0, 0);
-		for(int j=0;j<3;j++)
+		// range of regions a triangle can touch
+#		pragma omp parallel for schedule(dynamic, 4096)
+		for(int i=0;i<numCurTris;i++)
 		{
-			Octree::Position pos = m_octree.getPosition(vert[j]);
-			minPos.x = min(minPos.x, pos.x); minPos.y = min(minPos.y, pos.y); minPos.z = min(minPos.z, pos.z);
-			maxPos.x = max(maxPos.x, pos.x); maxPos.y = max(maxPos.y, pos.y); maxPos.z = max(maxPos.z, pos.z);
+			int *range = &triRegions[6*i];
+			const Triangle &tri = m_tri[startTri+i];
+			if(tri.p[0] == tri.p[1] || tri.p[1] == tri.p[2] || tri.p[2] == tri.p[0])
+			{
+				range[0] = range[1] = range[2] = 0;
+				range[3] = range[4] = range[5] = -1;
+				continue;
+			}
+
+			Vector3 vert[3] = {m_vert[tri.p[0]].v, m_vert[tri.p[1]].v, m_vert[tri.p[2]].v};
+			int minPos[3], maxPos[3];
+			getCellRange(m_octree, vert, minPos, maxPos);
+			for(int j=0;j<3;j++)
+			{
+				range[j] = min(minPos[j] / regionSize, regionsPerAxis-1);
+				range[3+j] = maxPos[j] < 0 ? -1 : min(maxPos[j] / regionSize, regionsPerAxis-1);
+			}
 		}
 
-		for(int x=minPos.x;x<=maxPos.x;x++)
-			for(int y=minPos.y;y<=maxPos.y;y++)
-				for(int z=minPos.z;z<=maxPos.z;z++)
-				{
-					Octree::Position pos(x, y, z);
+		for(int i=0;i<numCurTris;i++)
+		{
+			const int *range = &triRegions[6*i];
+			for(int z=range[2];z<=range[5];z++)
+				for(int y=range[1];y<=range[4];y++)
+					for(int x=range[0];x<=range[3];x++)
+						regionTris[x + (y + z*regionsPerAxis)*regionsPerAxis].push_back(startTri+i);
+		}
 
-					Octree::Hash::iterator it = m_octree.m_hash.find(pos);
-					if(it == m_octree.m_hash.end()) continue;
+#		pragma omp parallel for schedule(dynamic, 1)
+		for(int i=0;i<numRegions;i++)
+		{
+			if(regionTris[i].empty()) continue;
 
-					if(!isIntersect(m_octree.computeBox(pos), tri)) continue;
+			int regionPos[3] = {i % regionsPerAxis, (i / regionsPerAxis) % regionsPerAxis, i / (regionsPerAxis*regionsPerAxis)};
+			int regionMin[3], regionMax[3];
+			for(int j=0;j<3;j++)
+			{
+				regionMin[j] = regionPos[j]*regionSize;
+				// cells out of the octree are not found in the hash, the last region takes them
+				regionMax[j] = regionPos[j] == regionsPerAxis-1 ? INT_MAX : (regionPos[j]+1)*regionSize-1;
+			}
 
-					m_PCAOctree[m_octree.m_hash[pos]].InsertTriangle(vert, tri.n, col);
-				}
-		*/
+			applyTris(regionTris[i], regionMin, regionMax);
+			regionTris[i].clear();
+		}
 	}
 
-	// compute PCA for LOD voxels, bottom up
-	computeGeomLOD(AABB(m_octree.getHeader().min,m_octree.getHeader().max), 0);
+	delete[] triRegions;
+	delete[] regionTris;
 
-	// compute avg materials for LOD voxels, bottom up
-	computeMaterialLOD(0);
+	// compute PCA and avg materials for LOD voxels, bottom up
+	computeInnerLOD(AABB(m_octree.getHeader().min,m_octree.getHeader().max));
 
 	m_octree.save(fileName);
 
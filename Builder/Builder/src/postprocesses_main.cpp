@@ -18,6 +18,7 @@
 #define MTL				0x4
 #define ASVO			0x8
 #define GPU				0x10
+#define SPLIT_VERTEX	0x20
 
 using namespace std;
 
@@ -27,7 +28,7 @@ int main(int argc, char ** argv)
 	char filePath[255];
 	char outputPath[255];
 
-	printf ("Usage: %s file \"REMOVE_INDEX | HCCMESH | MTL | ASVO | GPU\" ASVO_options\n", argv [0]);
+	printf ("Usage: %s file \"REMOVE_INDEX | HCCMESH | MTL | ASVO | GPU | SPLIT_VERTEX\" ASVO_options\n", argv [0]);
 
 	sprintf(outputPath, ".");
 
@@ -69,6 +70,7 @@ int main(int argc, char ** argv)
 			if(strstr(argv[2], "MTL")) flag |= MTL;
 			if(strstr(argv[2], "ASVO")) flag |= ASVO;
 			if(strstr(argv[2], "GPU")) flag |= GPU;
+			if(strstr(argv[2], "SPLIT_VERTEX")) flag |= SPLIT_VERTEX;
 		}
 
 		printf("Process ");
@@ -77,6 +79,7 @@ int main(int argc, char ** argv)
 		if((flag & MTL) == MTL) printf("MTL generation, ");
 		if((flag & ASVO) == ASVO) printf("ASVO generation, ");
 		if((flag & GPU) == GPU) printf("GPU conversion, ");
+		if((flag & SPLIT_VERTEX) == SPLIT_VERTEX) printf("Vertex stream split, ");
 		printf("\n");
 	}
 	
@@ -138,6 +141,12 @@ int main(int argc, char ** argv)
 		//gc->convert(filePath, GeometryConverter::NEW_OOC, GeometryConverter::SIMP);
 		delete gc;
 	}
+
+	if((flag & SPLIT_VERTEX) == SPLIT_VERTEX)
+	{
+		cout << "Split vertex file into position and shading attribute streams." << endl;
+		GeometryConverter::splitVert(filePath);
+	}
 	/*
 	cout << "Rearrange voxels into sequential order." << endl;
 	RearrangeVoxels *rav = new RearrangeVoxels();
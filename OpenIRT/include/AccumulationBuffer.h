@@ -0,0 +1,102 @@
+/********************************************************************
+	file base:	AccumulationBuffer
+	file ext:	h
+
+	comment:	Float RGBA frame buffer for progressive rendering on CPU.
+				Each pixel keeps the running mean of its samples, the
+				number of samples and the variance of the luminance of the
+				samples (for adaptive sampling). Colors are tone mapped and
+				quantized to an 8 bit Image only when flush() is called.
+*********************************************************************/
+
+#pragma once
+
+#include "RGB.h"
+#include "Image.h"
+
+namespace irt
+{
+
+class AccumulationBuffer
+{
+public:
+	enum ToneMappingType
+	{
+		CLAMP,		// same as Image::setPixel()
+		REINHARD	// c / (1 + c)
+	};
+
+	AccumulationBuffer(void);
+	~AccumulationBuffer(void);
+
+	// clears the buffer when the size is changed
+	void resize(int width, int height);
+	void clear();
+
+	int getWidth() const {return m_width;}
+	int getHeight() const {return m_height;}
+
+	// x, y are in image coordinates (row 0 is the first row of Image::data)
+	inline void addSample(int x, int y, const RGB4f &color);
+
+	const RGB4f &getColor(int x, int y) const {return m_color[x + y*m_width];}
+	int getNumSamples(int x, int y) const {return m_numSamples[x + y*m_width];}
+
+	// sample variance of the luminance
+	float getVariance(int x, int y) const
+	{
+		int offset = x + y*m_width;
+		return m_numSamples[offset] > 1 ? m_M2[offset] / (m_numSamples[offset] - 1) : 0.0f;
+	}
+
+	// standard error of the mean luminance relative to the mean, FLT_MAX with less than 2 samples
+	inline float getRelativeError(int x, int y) const;
+
+	// image should have the same size as the buffer
+	void flush(Image *image, float exposure = 1.0f, ToneMappingType toneMapping = CLAMP) const;
+
+protected:
+	int m_width;
+	int m_height;
+
+	RGB4f *m_color;		// running mean
+	int *m_numSamples;
+	float *m_M2;		// sum of squared differences of the luminance from the mean
+
+	static inline float luminance(const __m128 &c)
+	{
+		__declspec(align(16)) float e[4];
+		_mm_store_ps(e, c);
+		return 0.2126f*e[0] + 0.7152f*e[1] + 0.0722f*e[2];
+	}
+};
+
+inline void AccumulationBuffer::addSample(int x, int y, const RGB4f &color)
+{
+	int offset = x + y*m_width;
+	float weight = 1.0f / (float)(++m_numSamples[offset]);
+
+	// mean += (sample - mean) / n
+	__m128 &mean = m_color[offset].data4;
+	float lum = luminance(color.data4);
+	float delta = lum - luminance(mean);
+	mean = _mm_add_ps(mean, _mm_mul_ps(_mm_sub_ps(color.data4, mean), _mm_set1_ps(weight)));
+
+	// Welford's update
+	m_M2[offset] += delta * (lum - luminance(mean));
+}
+
+inline float AccumulationBuffer::getRelativeError(int x, int y) const
+{
+	int offset = x + y*m_width;
+	int n = m_numSamples[offset];
+	if(n < 2) return FLT_MAX;
+
+	float variance = m_M2[offset] / (n - 1);
+	float mean = luminance(m_color[offset].data4);
+
+	// dark pixels are compared with a small absolute error instead
+	return sqrtf(variance / n) / (mean > 0.01f ? mean : 0.01f);
+}
+
+};
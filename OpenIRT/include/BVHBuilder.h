@@ -1,5 +1,6 @@
 #pragma once
 
+#include <vector>
 #include "Model.h"
 
 namespace irt
@@ -9,21 +10,83 @@ namespace irt
 class BVHBuilder
 {
 public:
+	enum BuildType
+	{
+		MEDIAN,			// spatial median of the longest axis, one triangle per leaf
+		BINNED_SAH		// binned surface area heuristic, subtrees are built in parallel
+	};
+
 	BVHBuilder(void);
 	~BVHBuilder(void);
 
-	void init(Model *mesh);
+	void init(Model *mesh, BuildType type = BINNED_SAH);
 	void clear(void);
 
 	bool build(void);
 
+	// build type is selected by USE_MEDIAN_BVH_BUILDER in CommonOptions.h
 	static bool build(Model *mesh);
+	static bool build(Model *mesh, BuildType type);
+
+	// expected cost of a ray traversing the BVH of the mesh (surface area heuristic)
+	static float computeSAHCost(Model *mesh);
 
 protected:
+	enum
+	{
+		NUM_BINS = 32,
+		MAX_LEAF_SIZE = 8,
+		MAX_DEPTH = 100		// traversal stacks in Model have 150 entries
+	};
+
+	typedef struct Bounds_t
+	{
+		Vector3 min;
+		Vector3 max;
+	} Bounds;
+
+	typedef struct Bin_t
+	{
+		Bounds bb;
+		int count;
+	} Bin;
+
+	typedef std::vector<BVHNode> NodeList;
+
+	// a subtree which is built independently by one thread
+	typedef struct BuildTask_t
+	{
+		unsigned int nodeIndex;		// index of the subtree root in the top level node list
+		unsigned int left;
+		unsigned int right;
+		Bounds centroidBB;
+		int depth;
+		NodeList nodes;
+	} BuildTask;
+
 	Model *m_mesh;
+	BuildType m_type;
+
+	// working set of the SAH builder
+	unsigned int *m_triIDs;
+	Bounds *m_triBB;
+	Vector3 *m_triCentroid;
+	unsigned int m_taskThreshold;
 
 	void updateBB(Vector3 &min, Vector3 &max, const Vector3 &vec);
 	bool subDivide(unsigned int *triIDs, unsigned int left, unsigned int right, unsigned int myIndex = 0, unsigned int nextIndex = 1, int depth = 0);
+
+	bool buildMedian(void);
+	bool buildBinnedSAH(void);
+
+	void computeBounds(unsigned int left, unsigned int right, Bounds &bb, Bounds &centroidBB, bool parallel);
+	void binCentroids(unsigned int left, unsigned int right, const Bounds &centroidBB, Bin bins[][NUM_BINS], bool parallel);
+	void makeLeaf(NodeList &nodes, unsigned int myIndex, unsigned int left, unsigned int right);
+	void subDivideSAH(NodeList &nodes, unsigned int myIndex, unsigned int left, unsigned int right, const Bounds &centroidBB, int depth, std::vector<BuildTask*> *tasks);
+
+	static bool isBiggerTask(const BuildTask *a, const BuildTask *b);
+	static float getArea(const Vector3 &min, const Vector3 &max);
+	static void mergeBounds(Bounds &dst, const Bounds &src);
 };
 
-};
\ No newline at end of file
+};
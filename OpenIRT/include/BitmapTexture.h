@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdio.h>
+#include <Windows.h>
+#include <vector>
 #include "Image.h"
 #include "Vector2.h"
 #include "Vector3.h"
@@ -13,6 +16,9 @@
 // mirror
 #define TEXTURE_MODE_MIRROR 2
 
+// texels per side of a tile of the MIP chain
+#define TEXTURE_TILE_SIZE 32
+
 namespace irt
 {
 
@@ -26,13 +32,14 @@ public:
 		width = 0;
 		height = 0;
 		bpp = 0;
-		textureImage = NULL;
-		data = NULL;
+		tileFile = NULL;
+		numTiles = 0;
+		firstCacheTile = -1;
 	}
 
 	~BitmapTexture() {
-		if (textureImage)
-			delete textureImage;
+		if (tileFile)
+			CloseHandle(tileFile);
 	} 
 
 	bool loadFromFile(const char *fileName);
@@ -40,73 +47,78 @@ public:
 
 	/**
 	 * Get the texture value at a certain texture position
+	 * (bilinear filtering of the finest level)
 	 */	
 	void getTexValue(RGBf &color, float u, float v, int mode = TEXTURE_MODE_WRAP);
+
+	/**
+	 * Trilinear filtering, footprint is the width of the filter in
+	 * texture space (1.0 = whole texture), e.g. from a ray cone or
+	 * ray differentials. 0 gives the finest level.
+	 */	
+	void getTexValue(RGBf &color, float u, float v, float footprint, int mode = TEXTURE_MODE_WRAP);
 	RGBf BitmapTexture::Sample(const Vector2 &tex);
 	const char *getLastErrorString() {
 		return lastError;
 	}
-	unsigned char* getData() {
-		return data;
-	}
+	/**
+	 * Reads a level of the MIP chain (0 is the image) into rgba,
+	 * width*height RGBA texels (8 bit) of the level in rows.
+	 */
+	bool readLevel(int level, unsigned char *rgba);
 
 	int getWidth() {return width;}
 	int getHeight() {return height;}
 	int getBpp() {return bpp;}
 	const char *getFileName() {return fileName;}
 
+	int getNumLevels() {return (int)levels.size();}
+	int getNumTiles() {return numTiles;}
+
 	friend TextureManager;
 protected:
+	typedef struct MipLevel_t
+	{
+		int width, height;
+		int tilesX, tilesY;
+		int firstTile;		// index of the first tile of this level in tileData
+	} MipLevel;
+
 	// reference counter of this bitmap texture
 	int refCount;
 
-	// image this texture uses
-	Image *textureImage;
-	// .. and its dimensions
+	// dimensions of the image this texture uses
 	int width, height;
 	int bpp;
 
-	unsigned char *data;
+	// MIP chain, each level is stored in tiles of TEXTURE_TILE_SIZE^2 RGBA texels (8 bit).
+	// The image is not kept in memory, the tiles are written to a temporary file
+	// at load time and read into the tile cache of TextureManager on a cache miss.
+	std::vector<MipLevel> levels;
+	HANDLE tileFile;
+	int numTiles;
+	int firstCacheTile;	// index of the first tile in the tile cache of TextureManager
 
 	char lastError[200];
 
 	char fileName[256];
+
+	// builds the MIP chain from the image by 2x2 box filtering and writes it to tileFile
+	bool buildMipChain(const unsigned char *data);
+
+	// reads tiles from tileFile at their offset, threads can read at the same time
+	bool readTiles(int firstTile, int count, unsigned char *dst);
+
+	// bilinear filtering of a level, returns RGBA
+	__m128 getBilinear(int level, float u, float v, int mode);
 	
 private:
 };
 
 inline RGBf BitmapTexture::Sample(const Vector2 &tex) {
-	float u = tex.x();
-	float v = tex.y();
-
-	// Simplest and fastest texture filtering: point filter
-
-	// TODO: use texturing mode !
-	int x = (int)(u*(float)width) % width;
-	int y = (int)(v*(float)height) % height;
-
-	if (x < 0)
-		x = width + x;
-	if (y < 0)
-		y = height + y;
-
-	return textureImage->getPixel(x,y);
-}
-
-
-inline void BitmapTexture::getTexValue(RGBf &color, float u, float v, int mode) {
-	// Simplest and fastest texture filtering: point filter
-
-	// TODO: use texturing mode !
-	int x = (int)(u*(float)width) % width;
-	int y = (int)(v*(float)height) % height;
-
-	if (x < 0)
-		x = width + x;
-	if (y < 0)
-		y = height + y;
-	
-	textureImage->getPixel(x,y,color);
+	RGBf color;
+	getTexValue(color, tex.x(), tex.y());
+	return color;
 }
 
 };
\ No newline at end of file
@@ -0,0 +1,113 @@
+/********************************************************************
+	file base:	CPUPathTracer
+	file ext:	h
+
+	comment:	Path tracer on CPU, same light transport as CUDAPathTracer.
+				Tiles are rendered in parallel and samples are accumulated
+				progressively until the camera or the scene is changed.
+*********************************************************************/
+
+#pragma once
+
+#include "Renderer.h"
+#include "AccumulationBuffer.h"
+#include "TileScheduler.h"
+
+namespace irt
+{
+
+class CPUPathTracer :
+	public Renderer
+{
+public:
+	CPUPathTracer(void);
+	virtual ~CPUPathTracer(void);
+
+	virtual void init(Scene *scene);
+	virtual void done();
+
+	virtual void resized(int width, int height);
+
+	virtual void sceneChanged();
+	virtual void materialChanged();
+	virtual void lightChanged(bool soft = false);
+	virtual void controllerUpdated();
+
+	virtual void clearResult();
+
+	// renderer
+	virtual void render(Camera *camera, Image *image, unsigned int seed = UINT_MAX);
+
+	virtual bool canAccumulate() {return true;}
+	virtual void accumulate(Camera *camera, int numSamples, unsigned int seed = UINT_MAX);
+
+	/**
+	 * With Controller::convergenceThreshold > 0, samples are given to the tiles by their
+	 * error after ADAPTIVE_MIN_SAMPLES samples of every pixel. The result is converged when
+	 * no pixel has a larger relative error, or when Controller::timeLimit seconds are spent.
+	 */
+	virtual bool isConverged();
+	virtual void flushImage(Image *image);
+
+	// paths (samples) and rays (including shadow rays) per second of the last accumulate()
+	float getSamplesPerSecond() {return m_samplesPerSecond;}
+	float getRaysPerSecond() {return m_raysPerSecond;}
+
+	// tiles and their render times of the last accumulate()
+	const TileScheduler &getTileScheduler() {return m_tileScheduler;}
+
+protected:
+	float m_samplesPerSecond;
+	float m_raysPerSecond;
+	unsigned int m_frame;
+
+	// color of the environment light, used when a path leaves the scene
+	RGBf m_envColor;
+
+	AccumulationBuffer m_accumulationBuffer;
+	Camera m_lastCamera;
+
+	// angle between rays of neighboring pixels, the ray cone for texture filtering
+	float m_pixelSpread;
+
+	// adaptive sampling
+	float m_renderTime;			// ms since the accumulation is restarted
+	int m_numUniformSamples;	// samples given to every pixel
+	bool m_converged;
+
+	TileScheduler m_tileScheduler;
+
+	typedef struct RenderTileData_t
+	{
+		CPUPathTracer *renderer;
+		Camera *camera;
+		int numSamples;
+		unsigned int frameSeed;
+		bool adaptive;
+		float meanError;
+		volatile long numPixelSamples;
+		volatile long numActiveTiles;	// not converged
+	} RenderTileData;
+
+	// clears the accumulated samples and the convergence
+	void restartAccumulation();
+
+	// relative error averaged over the pixels above the threshold
+	float computeMeanError();
+
+	static double renderTileCallBack(const TileScheduler::Tile &tile, void *data);
+
+	// returns number of rays traced
+	int renderTile(Camera *camera, int startX, int startY, int endX, int endY, int numSamples, unsigned int frameSeed);
+
+	// radiance along a camera ray, seed is advanced
+	virtual int tracePath(const Ray &ray, RGB4f &color, unsigned int &seed);
+
+	// direct lighting from every emitter at a hit point, returns number of shadow rays
+	int shadeDirect(const Vector3 &hitPoint, const Vector3 &normal, const RGBf &matKa, const RGBf &matKd, RGBf &color, unsigned int &seed);
+
+	// fraction of unoccluded ambient occlusion rays within AODistance
+	float computeAmbientOcclusion(const Vector3 &hitPoint, const Vector3 &normal, unsigned int &seed);
+};
+
+};
@@ -0,0 +1,70 @@
+/********************************************************************
+	file base:	CPUPhotonMapping
+	file ext:	h
+
+	comment:	Progressive photon mapping on CPU.
+				Every accumulated frame is a pass with newly traced photons
+				(Scene::tracePhotons) in a PhotonKDTree, and the gathering
+				radius shrinks after each pass so that the average of the
+				passes converges (probabilistic progressive photon mapping).
+				Camera paths follow specular bounces like CPUPathTracer and
+				stop at the first diffuse surface, where the photon map is
+				looked up directly (numGatheringRays == 0) or through final
+				gathering rays. Without gatherPhotons only direct lighting
+				is computed.
+*********************************************************************/
+
+#pragma once
+
+#include "CPUPathTracer.h"
+#include "PhotonKDTree.h"
+
+namespace irt
+{
+
+class CPUPhotonMapping :
+	public CPUPathTracer
+{
+public:
+	CPUPhotonMapping(void);
+	virtual ~CPUPhotonMapping(void);
+
+	virtual void sceneChanged();
+	virtual void materialChanged();
+	virtual void lightChanged(bool soft = false);
+	virtual void controllerUpdated();
+
+	virtual void clearResult();
+
+	virtual void accumulate(Camera *camera, int numSamples, unsigned int seed = UINT_MAX);
+
+	int getNumPasses() {return m_pass;}
+	float getRadius() {return sqrtf(m_radius2);}
+	const PhotonKDTree &getPhotonMap() {return m_photonMap;}
+
+protected:
+	PhotonList m_photons;
+	PhotonKDTree m_photonMap;
+
+	int m_pass;
+	float m_radius2;		// gathering radius of the current pass, squared
+
+	// starts again from the first pass and the initial radius
+	void restartPasses();
+
+	// traces the photons of the next pass and shrinks the radius
+	void tracePhotonPass();
+
+	// average distance to the PHOTON_RADIUS_NUM_NEIGHBORS nearest photons
+	float estimateInitialRadius();
+
+	// reflected radiance from the photons around a diffuse hit point
+	RGBf estimateRadiance(const Vector3 &hitPoint, const RGBf &matKd);
+
+	// diffuse reflection of the photon map seen by numGatheringRays, returns number of rays
+	int finalGather(const Vector3 &hitPoint, const Vector3 &normal, const RGBf &matKd, RGBf &color, unsigned int &seed);
+
+	virtual int tracePath(const Ray &ray, RGB4f &color, unsigned int &seed);
+};
+
+};
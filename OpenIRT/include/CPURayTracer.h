@@ -11,6 +11,8 @@
 #pragma once
 
 #include "Renderer.h"
+#include "AccumulationBuffer.h"
+#include "TileScheduler.h"
 
 namespace irt
 {
@@ -29,9 +31,54 @@ public:
 
 	virtual void sceneChanged();
 	virtual void materialChanged();
+	virtual void lightChanged(bool soft = false);
+	virtual void controllerUpdated();
+
+	virtual void clearResult();
 
 	// renderer
 	virtual void render(Camera *camera, Image *image, unsigned int seed = UINT_MAX);
+
+	// progressive refinement, samples of a pixel are jittered except the first one at the pixel center
+	virtual bool canAccumulate() {return true;}
+	virtual void accumulate(Camera *camera, int numSamples, unsigned int seed = UINT_MAX);
+	virtual void flushImage(Image *image);
+
+	// rays per second of the last frame
+	float getRaysPerSecond() {return m_raysPerSecond;}
+
+	// tiles and their render times of the last frame
+	const TileScheduler &getTileScheduler() {return m_tileScheduler;}
+
+protected:
+	// packets are used only if all the models are intersected without transformation
+	bool m_canUsePackets;
+	float m_raysPerSecond;
+
+	AccumulationBuffer m_accumulationBuffer;
+	Camera m_lastCamera;
+
+	TileScheduler m_tileScheduler;
+
+	typedef struct RenderTileData_t
+	{
+		CPURayTracer *renderer;
+		Camera *camera;
+	} RenderTileData;
+
+	static double renderTileCallBack(const TileScheduler::Tile &tile, void *data);
+	static double renderPacketTileCallBack(const TileScheduler::Tile &tile, void *data);
+
+	void renderSingleRays(Camera *camera);
+	void renderPackets(Camera *camera);
+	void renderRegion(Camera *camera, int startX, int startY, int endX, int endY);
+
+	// packets of TILE_SIZE^2 rays, startX and startY are on the grid of packets
+	void renderPacketRegion(Camera *camera, int startX, int startY, int endX, int endY);
+	void renderPacket(Camera *camera, int startX, int startY);
+
+	// offset from the pixel center in [-0.5, 0.5) for sampleIndex-th sample of the pixel
+	void getJitter(int x, int y, int sampleIndex, float &jitterX, float &jitterY);
 };
 
 };
@@ -26,16 +26,28 @@
 //#define USE_TEXTURING
 //#define USE_2ND_RAYS_FILTER
 //#define USE_MM
+//#define USE_MEDIAN_BVH_BUILDER
+//#define USE_WIDE_BVH
+//#define USE_PACKED_TRIANGLES
 
 #define USE_PHONG_HIGHLIGHTING
 #define EXTRACT_IMAGE_DEPTH
 #define EXTRACT_IMAGE_NORMAL
 
 #define TILE_SIZE 8
+#define MIN_SPLIT_TILE_SIZE 8		// TileScheduler does not split tiles below this
+#define TILE_SPLIT_THRESHOLD 4.0f	// tiles slower per pixel than this times the average are split
+#define ADAPTIVE_MIN_SAMPLES 4		// samples of every pixel before adaptive sampling starts
+#define ADAPTIVE_MAX_SAMPLE_FACTOR 4	// a noisy tile gets at most this times the requested samples
+#define TEXTURE_CACHE_SIZE (64*1024*1024)	// bytes, 8 bit texture tiles cached by TextureManager
+#define WIDE_BVH_WIDTH 4	// 4 (SSE) or 8 (AVX)
+#define PACKED_TRIANGLE_WIDTH 4	// triangles per packet, 4 (SSE) or 8 (AVX)
 //#define STAT_TRY_COUNT 128
 
 #define PHOTON_INTENSITY_SCALING_FACTOR 1.0f
 #define PHOTON_INTENSITY_SCALING_FACTOR_FULL_DETAIL 0.4f
+#define PHOTON_RADIUS_ALPHA 0.7f			// fraction of photons kept per pass in progressive photon mapping
+#define PHOTON_RADIUS_NUM_NEIGHBORS 32		// initial gathering radius covers this many photons on average
 
 #define INTERSECT_EPSILON 0.01f
 #define TRI_INTERSECT_EPSILON 0.0001f
@@ -145,6 +145,33 @@ public:
 		}
 		return ori;
 	}
+
+	// with given uniforms in [0, 1) (e.g. from Sampler)
+	inline Vector3 sample(float u, float v) const
+	{
+		if(type == Emitter::PARALLELOGRAM_LIGHT)
+			return planar.sample(u, v);
+		else
+			return pos;
+	}
+
+	inline Vector3 sampleEmitDirection(const Vector3 &ori, float u, float v) const
+	{
+		switch(targetType)
+		{
+		case LIGHT_TARGET_SPHERE :
+			{
+				// uniform on the sphere
+				float z = 1.0f - 2.0f * u;
+				float r = sqrtf(z*z < 1.0f ? 1.0f - z*z : 0.0f);
+				float phi = 2.0f * 3.141592f * v;
+				return Vector3(r * cosf(phi), r * sinf(phi), z);
+			}
+		case LIGHT_TARGET_HALF_SPHERE : return Material::sampleDiffuseDirection(planar.normal, u, v);
+		case LIGHT_TARGET_PARALLELOGRAM : return (spotTarget.sample(u, v) - ori).normalize();
+		}
+		return ori;
+	}
 };
 
 typedef std::vector<Emitter> EmitterList;
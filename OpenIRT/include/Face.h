@@ -19,10 +19,4 @@ public:
 	int *verts;				// vertex indices
 };
 
-typedef struct FaceStr_t
-{
-	int n;
-	std::string *f;
-} FaceStr;
-
 };
\ No newline at end of file
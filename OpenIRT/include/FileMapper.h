@@ -6,107 +6,272 @@
 	file base:	FileMapper
 	file ext:	h
 	author:		Tae-Joon Kim (tjkim.kaist@gmail.com)
-	
-	comment:	For easy usage of windows memory mapped file
+
+	comment:	For easy usage of memory mapped file.
+				Windows (CreateFileMapping) and POSIX (mmap) backends.
+				map() returns NULL on failure. Access pattern hints
+				are passed to madvise() on POSIX and to CreateFile()
+				flags on Windows (populate/huge pages are ignored there).
 *********************************************************************/
 
-#include <Windows.h>
 #include <stdio.h>
-#include <hash_map>
+#include <map>
+
+#ifdef _WIN32
+#include <Windows.h>
 #include <io.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#endif
 
-class FileMapper 
+class FileMapper
 {
+public:
+	enum AccessHint
+	{
+		HINT_NORMAL = 0,
+		HINT_RANDOM = 1,		// e.g. BVH nodes, triangles fetched by traversal
+		HINT_SEQUENTIAL = 2,	// e.g. conversion passes which stream a file once
+		HINT_POPULATE = 4,		// prefault the whole file at map time
+		HINT_HUGE_PAGES = 8		// transparent huge pages, if the file system supports them
+	};
+
 protected:
-	static stdext::hash_map<void *, std::pair<HANDLE, HANDLE> > s_handles;
+	typedef struct Mapping_t
+	{
+#		ifdef _WIN32
+		HANDLE hFile;
+		HANDLE hMapping;
+#		else
+		int fd;
+#		endif
+		long long size;
+	} Mapping;
+
+	// files are mapped and unmapped from worker threads (models, textures)
+	class Lock
+	{
+	public:
+#		ifdef _WIN32
+		Lock() {InitializeCriticalSection(&m_cs);}
+		~Lock() {DeleteCriticalSection(&m_cs);}
+		void lock() {EnterCriticalSection(&m_cs);}
+		void unlock() {LeaveCriticalSection(&m_cs);}
+	protected:
+		CRITICAL_SECTION m_cs;
+#		else
+		Lock() {pthread_mutex_init(&m_mutex, NULL);}
+		~Lock() {pthread_mutex_destroy(&m_mutex);}
+		void lock() {pthread_mutex_lock(&m_mutex);}
+		void unlock() {pthread_mutex_unlock(&m_mutex);}
+	protected:
+		pthread_mutex_t m_mutex;
+#		endif
+	};
+
+	static std::map<void *, Mapping> s_mappings;
+	static Lock s_lock;		// guards s_mappings
 
 public:
-	static unsigned int size(const char *fileName)
+	// returns -1 if the file cannot be opened
+	static long long sizei64(const char *fileName)
 	{
-		FILE *fp;
-		fopen_s(&fp, fileName, "r");
-		unsigned int s = (unsigned int)_filelength(_fileno(fp));
-		fclose(fp);
-		return s;
+#		ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+		if(!GetFileAttributesEx(fileName, GetFileExInfoStandard, &fileInfo)) return -1;
+
+		ULARGE_INTEGER fileSize;
+		fileSize.LowPart = fileInfo.nFileSizeLow;
+		fileSize.HighPart = fileInfo.nFileSizeHigh;
+		return (long long)fileSize.QuadPart;
+#		else
+		struct stat st;
+		if(stat(fileName, &st) != 0) return -1;
+		return (long long)st.st_size;
+#		endif
 	}
 
-	static __int64 sizei64(const char *fileName)
+	// for files smaller than 4GB only, use sizei64() otherwise
+	static unsigned int size(const char *fileName)
 	{
-		FILE *fp;
-		fopen_s(&fp, fileName, "r");
-		__int64 s = _filelengthi64(_fileno(fp));
-		fclose(fp);
-		return s;
+		long long s = sizei64(fileName);
+		return s < 0 ? 0 : (unsigned int)s;
 	}
 
-	static void *map(const char *fileName, bool isRead = true)
+	/**
+	* Maps whole file. If isRead is false, the file is mapped for writing
+	* and has to exist already with its final size.
+	* Returns NULL on failure (empty file included).
+	*/
+	static void *map(const char *fileName, bool isRead = true, int hints = HINT_NORMAL)
 	{
-		BY_HANDLE_FILE_INFORMATION fileInfo;
+		Mapping mapping;
+		void *data = NULL;
 
-		DWORD fileMappingMode;
-		DWORD fileShareMode;
-		DWORD fileOpenMode;
-
-		if(isRead)
-		{
-			fileMappingMode = GENERIC_READ;
-			fileShareMode = FILE_SHARE_READ;
-			fileOpenMode = OPEN_EXISTING;
-		}
-		else 
-		{
-			fileMappingMode = GENERIC_WRITE | GENERIC_READ;
-			fileShareMode = FILE_SHARE_READ | FILE_SHARE_WRITE;
-			fileOpenMode = CREATE_NEW;
-		}
+#		ifdef _WIN32
+		DWORD fileAccessMode = isRead ? GENERIC_READ : GENERIC_WRITE | GENERIC_READ;
+		DWORD fileShareMode = isRead ? FILE_SHARE_READ : FILE_SHARE_READ | FILE_SHARE_WRITE;
+		DWORD fileFlags = FILE_ATTRIBUTE_NORMAL;
 
-		HANDLE hFile, hMapping;
+		if(hints & HINT_SEQUENTIAL)
+			fileFlags |= FILE_FLAG_SEQUENTIAL_SCAN;
+		else
+			fileFlags |= FILE_FLAG_RANDOM_ACCESS;
 
 		// open file:
-		if (! (hFile = CreateFile(fileName, fileMappingMode, fileShareMode, NULL, fileOpenMode,
-			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL))) 
+		mapping.hFile = CreateFile(fileName, fileAccessMode, fileShareMode, NULL, OPEN_EXISTING, fileFlags, NULL);
+		if(mapping.hFile == INVALID_HANDLE_VALUE)
 		{
-				printf("Cannot open file: %s\n", fileName);			
-				exit (-1);
+			printf("Cannot open file: %s\n", fileName);
+			return NULL;
 		}
 
 		// get file size:
-		GetFileInformationByHandle(hFile, &fileInfo);
+		BY_HANDLE_FILE_INFORMATION fileInfo;
+		GetFileInformationByHandle(mapping.hFile, &fileInfo);
 
 		ULARGE_INTEGER fileSize;
-
-		fileSize.LowPart = fileInfo.nFileSizeLow; 
+		fileSize.LowPart = fileInfo.nFileSizeLow;
 		fileSize.HighPart = fileInfo.nFileSizeHigh;
+		mapping.size = (long long)fileSize.QuadPart;
 
-		if(isRead)
-			fileMappingMode = PAGE_READONLY;
-		else
-			fileMappingMode = PAGE_READWRITE;
+		if(mapping.size == 0)
+		{
+			printf("Cannot map empty file: %s\n", fileName);
+			CloseHandle(mapping.hFile);
+			return NULL;
+		}
+
+		if(!(mapping.hMapping = CreateFileMapping(mapping.hFile, NULL, isRead ? PAGE_READONLY : PAGE_READWRITE,
+			fileSize.HighPart, fileSize.LowPart, NULL)))
+		{
+			printf("CreateFileMapping() failed [%d] : %s\n", GetLastError(), fileName);
+			CloseHandle(mapping.hFile);
+			return NULL;
+		}
+
+		if(!(data = MapViewOfFile(mapping.hMapping, isRead ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, 0)))
+		{
+			printf("MapViewOfFile() failed [%d] : %s\n", GetLastError(), fileName);
+			CloseHandle(mapping.hMapping);
+			CloseHandle(mapping.hFile);
+			return NULL;
+		}
+#		else
+		if((mapping.fd = open(fileName, isRead ? O_RDONLY : O_RDWR)) < 0)
+		{
+			printf("Cannot open file [%s] : %s\n", strerror(errno), fileName);
+			return NULL;
+		}
 
-		if (!(hMapping = CreateFileMapping(hFile, NULL, fileMappingMode, 
-			fileSize.HighPart, fileSize.LowPart, NULL))) 
+		struct stat st;
+		if(fstat(mapping.fd, &st) != 0 || st.st_size == 0)
 		{
-				printf("CreateFileMapping() failed\n");
-				exit (-1);
+			printf("Cannot map empty file: %s\n", fileName);
+			close(mapping.fd);
+			return NULL;
 		}
+		mapping.size = (long long)st.st_size;
 
-		void *data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+		int flags = MAP_SHARED;
+#		ifdef MAP_POPULATE
+		if(hints & HINT_POPULATE) flags |= MAP_POPULATE;
+#		endif
 
-		s_handles[data] = std::pair<HANDLE, HANDLE>(hFile, hMapping);
+		data = mmap(NULL, (size_t)mapping.size, isRead ? PROT_READ : PROT_READ | PROT_WRITE, flags, mapping.fd, 0);
+		if(data == MAP_FAILED)
+		{
+			printf("mmap() failed [%s] : %s\n", strerror(errno), fileName);
+			close(mapping.fd);
+			return NULL;
+		}
+
+		applyHints(data, mapping.size, hints);
+#		endif
+
+		s_lock.lock();
+		s_mappings[data] = mapping;
+		s_lock.unlock();
 
 		return data;
 	}
 
+	// changes access pattern of a mapped file, e.g. before a sequential pass over randomly accessed data
+	static void advise(void *address, int hints)
+	{
+		long long size = getMappedSize(address);
+		if(size == 0) return;
+
+		applyHints(address, size, hints);
+	}
+
+	// returns 0 if the address is not returned by map()
+	static long long getMappedSize(void *address)
+	{
+		s_lock.lock();
+		std::map<void *, Mapping>::iterator it = s_mappings.find(address);
+		long long size = it == s_mappings.end() ? 0 : it->second.size;
+		s_lock.unlock();
+		return size;
+	}
+
 	static void unmap(void *address)
 	{
-		if (!UnmapViewOfFile(address)) 
+		s_lock.lock();
+		std::map<void *, Mapping>::iterator it = s_mappings.find(address);
+		if(it == s_mappings.end())
+		{
+			s_lock.unlock();
+			printf("unmap(%p) : not a mapped address\n", address);
+			return;
+		}
+
+		Mapping mapping = it->second;
+		s_mappings.erase(it);
+		s_lock.unlock();
+
+#		ifdef _WIN32
+		if(!UnmapViewOfFile(address))
 		{
-			printf("UnmapViewOfFile(%X) failed\n", address);
+			printf("UnmapViewOfFile(%p) failed\n", address);
 		}
 
-		CloseHandle(s_handles[address].second);
-		CloseHandle(s_handles[address].first);
+		CloseHandle(mapping.hMapping);
+		CloseHandle(mapping.hFile);
+#		else
+		if(munmap(address, (size_t)mapping.size) != 0)
+		{
+			printf("munmap(%p) failed [%s]\n", address, strerror(errno));
+		}
+
+		close(mapping.fd);
+#		endif
+	}
+
+protected:
+	static void applyHints(void *address, long long size, int hints)
+	{
+#		ifndef _WIN32
+		int advice = MADV_NORMAL;
+		if(hints & HINT_RANDOM) advice = MADV_RANDOM;
+		if(hints & HINT_SEQUENTIAL) advice = MADV_SEQUENTIAL;
+		madvise(address, (size_t)size, advice);
+
+		if(hints & HINT_POPULATE) madvise(address, (size_t)size, MADV_WILLNEED);
+
+#		ifdef MADV_HUGEPAGE
+		// only effective on file systems supporting huge pages for file mappings, failure is not an error
+		if(hints & HINT_HUGE_PAGES) madvise(address, (size_t)size, MADV_HUGEPAGE);
+#		endif
+#		endif
 	}
 };
 
-#endif
\ No newline at end of file
+#endif
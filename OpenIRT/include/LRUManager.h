@@ -4,14 +4,23 @@
 	file base:	LRUManager
 	file ext:	h
 	author:		Tae-Joon Kim (tjkim.kaist@gmail.com)
-	
+
 	comment:	LRU based cache manager. Size of element should be fixed. Clock algorithm is used.
+				The cache is split into shards (element idx % numShards), each shard
+				has its own slots, clock hand and lock. Hits do not take any lock and
+				the cache miss callback (disk I/O) runs outside of the lock, so threads
+				missing different elements load them concurrently.
+				prefetch() queues an element to background I/O threads.
+				An element returned by operator[] may be evicted while the pointer
+				is in use. pin() keeps the element in the cache until unpin().
 *********************************************************************/
 
 #pragma once
 
 #include <Windows.h>
 #include <WinLock.h>
+#include <deque>
+#include <vector>
 
 template <class ElemPtr>
 class LRUManager
@@ -19,6 +28,45 @@ class LRUManager
 public:
 	typedef void (*ProcessCacheMissCallBack)(unsigned int idx, ElemPtr address);
 
+	typedef struct Stats_t
+	{
+		__int64 hits;
+		__int64 misses;			// loaded by operator[]
+		__int64 prefetches;		// loaded by I/O threads
+		__int64 evictions;
+		float waitTime;			// ms, sum over threads waiting for an element loaded by another thread
+	} Stats;
+
+protected:
+	enum
+	{
+		NOT_LOADED = -1,
+		LOADING = -2
+	};
+
+	typedef struct Shard_t
+	{
+		WinLock lock;
+
+		int firstSlot;
+		int numSlots;
+		int numUsedSlots;
+		int curClock;
+
+		// updated with the lock of the shard held
+		__int64 misses;
+		__int64 prefetches;
+		__int64 evictions;
+	} Shard;
+
+	// counters of a thread, a hit touches only the cache line of its own thread
+	typedef struct ThreadStats_t
+	{
+		__int64 hits;
+		__int64 waitTicks;
+		char pad[64 - 2*sizeof(__int64)];
+	} ThreadStats;
+
 // Member variables
 protected:
 	ElemPtr m_cachedData;
@@ -28,22 +76,66 @@ protected:
 	int m_numElems;
 	int m_sizeElem;
 
-	int *m_loaded;
-	int *m_assigned;
-	int m_numUsedCache;
+	volatile LONG *m_loaded;		// slot of each element, NOT_LOADED or LOADING
+	int *m_assigned;				// element of each slot
+	volatile char *m_slotLoading;	// slot is being filled, skipped by the clock
+	volatile LONG *m_pinCount;		// slot is in use, skipped by the clock
 
-	int *m_clockCount;
-	int m_curClock;
+	volatile char *m_clockCount;
 
-	WinLock m_lock;
+	Shard *m_shards;
+	int m_numShards;
 
 	ProcessCacheMissCallBack m_processCacheMissCallBack;
 
+	// background I/O for prefetch()
+	std::deque<unsigned int> m_prefetchQueue;
+	int m_maxPrefetchQueue;
+	WinLock m_lockQueue;
+	HANDLE m_hQueueSemaphore;
+	HANDLE *m_hIOThreads;
+	int m_numIOThreads;
+	volatile bool m_exit;
+
+	// statistics of each thread, summed by getStats()
+	DWORD m_tlsStats;
+	std::vector<ThreadStats*> m_threadStats;
+	WinLock m_lockStats;
+	__int64 m_baseHits;			// sums at the last resetStats()
+	__int64 m_baseWaitTicks;
+
+	LARGE_INTEGER m_tickFrequency;
+
 // Member functions
 public:
 
-	LRUManager(int numElems, int sizeElem, ProcessCacheMissCallBack function, __int64 allowedMem = 256*1024*1024);
+	LRUManager(int numElems, int sizeElem, ProcessCacheMissCallBack function, __int64 allowedMem = 256*1024*1024, int numShards = 16, int numIOThreads = 2);
 	~LRUManager();
 
 	ElemPtr operator[](unsigned int idx);
-};
\ No newline at end of file
+
+	// same as operator[], but the element stays in the cache until unpin(slot) is called.
+	// A thread should not pin more than a few elements at a time.
+	ElemPtr pin(unsigned int idx, int &slot);
+	void unpin(int slot) {InterlockedDecrement(&m_pinCount[slot]);}
+
+	// loads the element in background, returns immediately
+	void prefetch(unsigned int idx);
+
+	Stats getStats();
+	void resetStats();
+
+protected:
+	ElemPtr getAddress(int slot) {return (ElemPtr)(((unsigned char*)m_cachedData) + (__int64)slot * m_sizeElem);}
+
+	// returns slot of the element, -1 only for a prefetch which found the element being loaded
+	int load(unsigned int idx, bool isPrefetch);
+
+	// called with the lock of the shard, returns -1 if every slot of the shard is being loaded
+	int claimSlot(Shard &shard);
+
+	// allocated at the first access of a thread
+	ThreadStats *getThreadStats();
+
+	static unsigned __stdcall ioThread(void *arg);
+};
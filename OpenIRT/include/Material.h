@@ -120,12 +120,20 @@ public:
 	inline bool isRefraction(unsigned int seed) {return isRefraction(mat_d, seed);}
 
 	static Vector3 sampleDiffuseDirection(const Vector3 &normal, unsigned int &prevRnd)
+	{
+		float u = rnd(prevRnd);
+		float v = rnd(prevRnd);
+		return sampleDiffuseDirection(normal, u, v);
+	}
+
+	// cosine weighted, with given uniforms in [0, 1) (e.g. from Sampler)
+	static Vector3 sampleDiffuseDirection(const Vector3 &normal, float u, float v)
 	{
 		Vector3 m1(1.0f, 0.0f, 0.0f);
 		Vector3 m2(0.0f, 1.0f, 0.0f);
 
-		float phi = 2.0f * 3.141592f * rnd(prevRnd);
-		float r = sqrtf(rnd(prevRnd));
+		float phi = 2.0f * 3.141592f * u;
+		float r = sqrtf(v);
 		float x = r * cosf(phi);
 		float y = r * sinf(phi);
 		float z = sqrtf(1.0f - x*x - y*y);
@@ -162,6 +170,12 @@ public:
 	}
 
 	Vector3 sampleDirection(const Vector3 &normal, const Vector3 &inDirection, unsigned int seed)
+	{
+		return sampleDirection(normal, inDirection, seed, rangeKd, rangeKs, mat_d, mat_Ns);
+	}
+
+	// same as above with the attributes given, e.g. from ShadingMaterialTable
+	static Vector3 sampleDirection(const Vector3 &normal, const Vector3 &inDirection, unsigned int seed, float rangeKd, float rangeKs, float mat_d, float mat_Ns)
 	{
 		/*
 		Vector3 m1(1.0f, 0.0f, 0.0f);
@@ -210,7 +224,7 @@ public:
 			if(!isRefrac)
 			{
 				// reflection
-				if(!isPerfectSpecular())
+				if(!(rangeKs != rangeKd && mat_Ns > 2047.0f))	// isPerfectSpecular()
 				{
 					float phi = 2.0f * PI * rnd(seed);
 
@@ -15,6 +15,7 @@ typedef unsigned int Index_t;
 #define MAX_NUM_THREADS 32
 #define MAX_NUM_INTERSECTION_STREAM 4
 
+#include "CommonOptions.h"
 #include "Vertex.h"
 #include "Triangle.h"
 #include "Face.h"
@@ -24,6 +25,8 @@ typedef unsigned int Index_t;
 #include "Ray.h"
 #include "RayPacket.h"
 #include "Matrix.h"
+#include "WideBVH.h"
+#include "PackedTriangles.h"
 #include <map>
 
 namespace irt
@@ -49,14 +52,28 @@ protected:
 	char m_fileName[256];
 	char m_name[256];
 
+	int m_ID;	// index in the model list of the scene, see ShadingMaterialTable
+
 	// geometry
-	Vertex *m_vertList;
+	Vertex *m_vertList;			// interleaved vertices, or decoded from the split streams by decodeVertices()
+	VertexPosition *m_posList;	// split vertex streams, NULL for interleaved vertices
+	VertexAttrib *m_attribList;
 	Triangle *m_triList;
 	BVHNode *m_nodeList;
 	int m_numVerts;
 	int m_numTris;
 	int m_numNodes;
 
+	// collapsed from m_nodeList when USE_WIDE_BVH is defined
+	WideBVH<WIDE_BVH_WIDTH> *m_wideBVH;
+
+	// leaf triangles precomputed for SIMD intersection when USE_PACKED_TRIANGLES is defined
+	PackedTriangles<PACKED_TRIANGLE_WIDTH> *m_packedTris;
+
+	// positions of either vertex format, see getPosition()
+	const unsigned char *m_posStream;
+	int m_posStride;
+
 	bool m_visible;
 	bool m_enabled;
 
@@ -68,6 +85,9 @@ protected:
 	} StackElem;
 	__declspec(align(16)) StackElem **stacks;
 
+	// points m_posStream to the positions of the loaded vertex format
+	void setPositionStream();
+
 	// material
 	bool m_useMTL;	// use material template library (MTL)
 	MaterialList m_matList;
@@ -86,6 +106,9 @@ public:
 	virtual bool load(const char *fileName);
 	virtual void unload();
 
+	int getID() {return m_ID;}
+	void setID(int ID) {m_ID = ID;}
+
 	bool isVisible() {return m_visible;}
 	bool isEnabled() {return m_enabled;}
 	void setVisibility(bool visible) {m_visible = visible;}
@@ -106,9 +129,20 @@ public:
 	virtual int getNumIndices() {return 0;}
 
 	// APIs for accessing vertices and triangles
+	// NULL for split vertex streams until decodeVertices() is called
 	Vertex *getVertex(const Index_t n);
 	Triangle *getTriangle(const Index_t n);
 
+	// vertex attributes from either vertex format
+	const Vector3 &getPosition(const Index_t n) {return *((const Vector3*)(m_posStream + (size_t)n*m_posStride));}
+	Vector3 getNormal(const Index_t n) {return m_attribList ? m_attribList[n].getNormal() : m_vertList[n].n;}
+	Vector2 getUV(const Index_t n) {return m_attribList ? m_attribList[n].getUV() : m_vertList[n].uv;}
+
+	bool hasSplitVertices() {return m_posList != NULL;}
+
+	// interleaved copy of the split vertex streams for the users of getVertex() (rasterizer, CUDA)
+	bool decodeVertices();
+
 	// APIs for accessing BVH
 	Index_t getRootIdx();
 	BVHNode *getBV(const Index_t n);
@@ -127,6 +161,12 @@ public:
 	int getNumTriangles(const BVHNode *n);
 	int getAxis(const BVHNode *n);
 
+	// converts the binary BVH into WideBVH, does nothing unless USE_WIDE_BVH is defined
+	void buildWideBVH();
+
+	// packs the triangles of the BVH leaves, does nothing unless USE_PACKED_TRIANGLES is defined
+	void buildPackedTriangles();
+
 	void setModelBB(const AABB &bb) {m_BB = bb;}
 	const AABB &getModelBB() {return m_BB;}
 
@@ -154,6 +194,32 @@ public:
 
 		return mat;
 	}
+	// footprint is the width of the texture filter in texture space (trilinear filtering)
+	Material getMaterial(const HitPointInfo &hit, float footprint)
+	{
+		Material mat = getMaterial(hit.m);
+		RGBf texValue;
+
+		BitmapTexture *map = NULL;
+
+		map = mat.getMapKa();
+		if(map)
+		{
+			map->getTexValue(texValue, hit.uv.e[0], hit.uv.e[1], footprint);
+			mat.setMatKa(mat.getMatKa() * texValue);
+		}
+
+		map = mat.getMapKd();
+		if(map)
+		{
+			map->getTexValue(texValue, hit.uv.e[0], hit.uv.e[1], footprint);
+			mat.setMatKd(mat.getMatKd() * texValue);
+		}
+
+		return mat;
+	}
+	// texture space width of a ray cone (width coneWidth at the hit point) on the hit triangle
+	float getTextureFootprint(const HitPointInfo &hit, const Vector3 &rayDir, float coneWidth);
 	void setMaterial(Material &mat, int idx) {m_matList[idx >= 0 && idx < (int)m_matList.size() ? idx : 0] = mat;}
 
 	const Matrix &getTransfMatrix() {return m_transfMatrix;}
@@ -191,16 +257,14 @@ bool Model::getIntersectionWithTri(RayPacketT &rayPacket, int triID, int firstAc
 
 	const Triangle &tri = *getTriangle(triID);
 	
-	Vertex *verts[3] = {getVertex(tri.p[0]), getVertex(tri.p[1]), getVertex(tri.p[2])};
-
-	Vector3 &tri_p0 = verts[0]->v;
-	Vector3 &tri_p1 = verts[1]->v;
-	Vector3 &tri_p2 = verts[2]->v;
+	const Vector3 &tri_p0 = getPosition(tri.p[0]);
+	const Vector3 &tri_p1 = getPosition(tri.p[1]);
+	const Vector3 &tri_p2 = getPosition(tri.p[2]);
 
-	Vector3 vertNormals[3] = {verts[0]->n, verts[1]->n, verts[2]->n};
+	Vector3 vertNormals[3] = {getNormal(tri.p[0]), getNormal(tri.p[1]), getNormal(tri.p[2])};
 
 #	ifdef USE_TEXTURING
-	Vector2 vertTextures[3] = {verts[0]->uv, verts[1]->uv, verts[2]->uv};
+	Vector2 vertTextures[3] = {getUV(tri.p[0]), getUV(tri.p[1]), getUV(tri.p[2])};
 #	endif
 
 	Index_t matID = tri.material;
@@ -361,7 +425,10 @@ bool Model::getIntersection(RayPacketT &rayPacket, int stream)
 			else {				
 				// is leaf node:
 				// intersect with current node's members
-				Model::getIntersectionWithTri(rayPacket, getTriangleIdx(currentNode), firstNonHit);
+				Index_t triID = getTriangleIdx(currentNode);
+				int numTris = getNumTriangles(currentNode);
+				for(int i=0;i<numTris;i++)
+					Model::getIntersectionWithTri(rayPacket, triID + i, firstNonHit);
 			}
 		}
 
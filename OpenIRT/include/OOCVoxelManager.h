@@ -132,10 +132,8 @@ protected:
 	WinLock m_lockQOut;
 	WinLock m_lockMem;
 
-	HANDLE m_hVoxelFile, m_hVoxelMap;
+	// memory mapped by FileMapper
 	Voxel *m_voxelFile;
-
-	HANDLE m_hPhotonVoxelFile, m_hPhotonVoxelMap;
 	PhotonVoxel *m_photonVoxelFile;
 
 	int m_allowedMem;
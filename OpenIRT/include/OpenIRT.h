@@ -63,6 +63,9 @@ public:
 	float getCurrentFrameTime();
 	float getCurrentFPS();
 
+	// see Renderer::isConverged()
+	bool isConverged();
+
 	void setCurrentFrameTime(float frameTime);
 	void setCurrentFPS(float FPS);
 
@@ -94,7 +97,9 @@ public:
 
 	void prepareRender();
 
-	void render(irt::Image *image = NULL, unsigned int seed = UINT_MAX);
+	// numSamples > 1 : samples per pixel added in this call. Renderers accumulating on CPU
+	// write the image once at the end, image can be NULL to defer it to flushImage().
+	void render(irt::Image *image = NULL, unsigned int seed = UINT_MAX, int numSamples = 1);
 
 	void clearResult();
 
@@ -6,6 +6,9 @@
 	author:		Tae-Joon Kim (tjkim.kaist@gmail.com)
 	
 	comment:	PLYLoader class, load Polygon file format (.ply)
+				Binary little endian files with float vertex properties and
+				uint8/int32 index lists are converted directly from the mapped
+				file, other files are read through ply.cpp.
 *********************************************************************/
 
 #pragma once
@@ -51,7 +54,14 @@ private:
 	vector<Face> m_faceList;
 	vector<Vertex> m_vertList;
 
+	// index lists of all the faces, only when loaded by loadBinary()
+	int *m_indexPool;
+
 	Vector3 m_BBMin, m_BBMax;
+
+	// returns false without loading anything if the file is not supported
+	bool loadBinary(const char *fileName);
+	void computeBB();
 };
 
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+/********************************************************************
+	file base:	PackedTriangles
+	file ext:	h
+
+	comment:	Precomputed triangles for intersection, packed N at a time
+				(N = 4 : SSE, N = 8 : AVX) in SoA layout. A packet has the
+				first vertex and the two edges of its triangles, so that
+				one Moller-Trumbore test with SIMD handles N triangles
+				without touching the vertex list. Packets of a BVH leaf are
+				contiguous, the last one is padded with degenerate
+				triangles which are never hit.
+*********************************************************************/
+
+#pragma once
+
+#include "BVHNode.h"
+#include "Ray.h"
+
+namespace irt
+{
+
+class Model;
+
+template <int N>
+class PackedTriangles
+{
+public:
+	enum
+	{
+		EMPTY = 0xFFFFFFFF
+	};
+
+	/**
+	* SoA packet. v0[a][i], e1[a][i] and e2[a][i] are a-th coordinates of the first vertex
+	* and the edges (p1 - p0, p2 - p0) of i-th triangle. tri[i] is the index in the
+	* triangle list, EMPTY for padding.
+	*/
+	typedef struct Packet_t
+	{
+		float v0[3][N];
+		float e1[3][N];
+		float e2[3][N];
+		unsigned int tri[N];
+	} Packet;
+
+	PackedTriangles(void);
+	~PackedTriangles(void);
+
+	void clear();
+
+	// packs the triangles of all leaves of the binary BVH of a model
+	bool build(Model *model);
+
+	int getNumPackets() {return m_numPackets;}
+
+	/**
+	* Nearest hit in (INTERSECT_EPSILON, tmax] among count triangles of a leaf starting
+	* from firstTri. Returns index of the hit triangle (-1 if no hit) with its distance
+	* and barycentric coordinates of p1 (alpha) and p2 (beta). Ray should be in the model space.
+	*/
+	int getIntersection(const Ray &ray, unsigned int firstTri, int count, float tmax, float &t, float &alpha, float &beta) const;
+
+protected:
+	Packet *m_packets;
+	int m_numPackets;
+
+	// first packet of the leaf starting from a triangle, indexed by triangle
+	unsigned int *m_leafPacket;
+	int m_numTris;
+
+	// returns the nearest hit lane of the packet or -1
+	static int intersectPacket(const Packet *packet, const Ray &ray, float tmax, float &t, float &alpha, float &beta);
+};
+
+};
@@ -27,6 +27,12 @@ public:
 	{
 		return corner + v1 * rnd(prevRnd) + v2 * rnd(prevRnd);
 	}
+
+	// with given uniforms in [0, 1)
+	inline Vector3 sample(float u, float v) const
+	{
+		return corner + v1 * u + v2 * v;
+	}
 };
 
 };
\ No newline at end of file
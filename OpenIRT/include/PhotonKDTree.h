@@ -0,0 +1,87 @@
+/********************************************************************
+	file base:	PhotonKDTree
+	file ext:	h
+
+	comment:	Photon kd-tree for photon mapping on CPU.
+				The tree is balanced and implicit: a node covering photons
+				[lo, hi) is split at lo + (hi-lo)/2 along the longest axis
+				of its box, so only the split planes are stored. Every
+				4 levels of inner nodes (15 nodes) are packed into one
+				64 byte cache line, leaves are ranges of up to MAX_LEAF_SIZE
+				photons whose positions are also stored as SoA arrays for
+				SSE distance tests.
+				Levels are built one after another, the nodes of a level
+				in parallel.
+				Scene::buildPhotonKDTree() still builds the heap layout
+				used by the GPU.
+*********************************************************************/
+
+#pragma once
+
+#include "Photon.h"
+#include "BV.h"
+
+namespace irt
+{
+
+class PhotonKDTree
+{
+public:
+	enum
+	{
+		BLOCK_DEPTH = 4,		// levels of inner nodes in a block
+		MAX_LEAF_SIZE = 32,
+		MAX_DEPTH = 32			// traversal uses fixed size stacks
+	};
+
+	PhotonKDTree(void);
+	~PhotonKDTree(void);
+
+	// photons are copied (in the order of the leaves)
+	void build(const Photon *photons, int numPhotons);
+	void clear();
+
+	int getNumPhotons() const {return m_numPhotons;}
+	const Photon &getPhoton(int i) const {return m_photons[i];}
+	const AABB &getBB() const {return m_BB;}
+
+	/**
+	 * Photons within radius of pos. Writes up to maxPhotons indices (for getPhoton())
+	 * and returns the number written.
+	 */
+	int gatherRadius(const Vector3 &pos, float radius, int *outIndices, int maxPhotons) const;
+
+	// sum of the power of the photons within radius of pos, returns the number of photons
+	int gatherPower(const Vector3 &pos, float radius, RGBf &outPower) const;
+
+	/**
+	 * k nearest photons within maxRadius of pos. outIndices and outDist2 (squared
+	 * distances) should have k elements, they are returned as a max-heap so the
+	 * farthest photon comes first. Returns the number of photons found.
+	 */
+	int gatherKNearest(const Vector3 &pos, int k, float maxRadius, int *outIndices, float *outDist2) const;
+
+protected:
+	typedef struct NodeBlock_t
+	{
+		float split[15];	// heap order in the block
+		unsigned int axes;	// 2 bits per node
+	} NodeBlock;
+
+	int m_numPhotons;
+	int m_depth;			// levels of inner nodes, multiple of BLOCK_DEPTH
+	AABB m_BB;
+
+	Photon *m_photons;
+	float *m_posX;			// SoA copy of m_photons[i].pos, padded to a multiple of 4
+	float *m_posY;
+	float *m_posZ;
+
+	NodeBlock *m_nodes;
+	int m_numBlocks;
+
+	template <class LeafVisitor>
+	void traverse(const Vector3 &pos, float &maxDist2, LeafVisitor &visitor) const;
+};
+
+};
@@ -76,6 +76,12 @@ public:
 
 	virtual void flushImage(Image *image) {}
 
+	// renderers accumulating samples on CPU add numSamples samples per pixel without writing an image, flushImage() writes it
+	virtual bool canAccumulate() {return false;}
+	virtual void accumulate(Camera *camera, int numSamples, unsigned int seed = UINT_MAX) {}
+	// accumulating more samples does not change the result (or the time limit is reached)
+	virtual bool isConverged() {return false;}
+
 	virtual void prepareRender() {}
 	virtual void render(Camera *camera, Image *image, unsigned int seed = UINT_MAX) = 0;
 
@@ -166,20 +172,23 @@ public:
 		if(m_rayOrder) delete[] m_rayOrder;
 		m_rayOrder = new RayPixelPosition[width*height];
 		m_curRayOrder = 0;
-		unsigned int tilesX = width / tileWidth;
-		unsigned int tilesY = height / tileHeight;
+		// tiles on the right and bottom borders can be smaller
+		unsigned int tilesX = (width + tileWidth - 1) / tileWidth;
+		unsigned int tilesY = (height + tileHeight - 1) / tileHeight;
 		int numTiles = tilesX * tilesY;	
 
 		for (int curTile = 0; curTile < numTiles; curTile++) 
 		{
 			unsigned int start_x = (curTile % tilesX) * tileWidth;
-			unsigned int start_y = (unsigned int)(curTile / tilesY) * tileHeight;	
+			unsigned int start_y = (unsigned int)(curTile / tilesX) * tileHeight;	
+			unsigned int end_x = start_x + tileWidth < (unsigned int)width ? start_x + tileWidth : width;
+			unsigned int end_y = start_y + tileHeight < (unsigned int)height ? start_y + tileHeight : height;
 		
-			for (int y = 0; y < tileHeight; y++)
-				for (int x = 0; x < tileWidth; x++)
+			for (unsigned int y = start_y; y < end_y; y++)
+				for (unsigned int x = start_x; x < end_x; x++)
 				{
-					m_rayOrder[m_curRayOrder].x = start_x+x;
-					m_rayOrder[m_curRayOrder++].y = start_y+y;
+					m_rayOrder[m_curRayOrder].x = x;
+					m_rayOrder[m_curRayOrder++].y = y;
 				}
 		}
 	}
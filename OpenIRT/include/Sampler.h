@@ -1,9 +1,21 @@
+/********************************************************************
+	file base:	Sampler
+	file ext:	h
+
+	comment:	Low discrepancy samples computed on the fly.
+				A sample is indexed by (pixel, sampleIndex, dimension) and is
+				a 4D Sobol point with Owen scrambling (hashed nested uniform
+				scrambling of Burley 2020). Higher dimensions are padded:
+				every group of 4 dimensions uses its own shuffle of the
+				sample indices. The scrambling is seeded by the pixel, so
+				neighboring pixels are decorrelated.
+				Nothing is allocated or precomputed per frame.
+*********************************************************************/
+
 #pragma once
 
 #include "Vector2.h"
 #include "random.h"
-#include <vector>
-#include <stopwatch.h>
 
 namespace irt
 {
@@ -13,82 +25,124 @@ class Sampler
 protected:
 	int m_numPixelX, m_numPixelY;
 	int m_numSubSample;
-	Vector2 *m_samplerPool;
+	unsigned int m_seed;
 
 public:
-	Sampler() : m_numPixelX(0), m_numPixelY(0), m_numSubSample(0), m_samplerPool(0) {}
+	Sampler() : m_numPixelX(0), m_numPixelY(0), m_numSubSample(0), m_seed(0) {}
 
-	~Sampler()
-	{
-		clear();
-	}
-
-	void clear()
-	{
-		if(m_samplerPool)
-			delete[] m_samplerPool;
-		m_samplerPool = 0;
-	}
+	void clear() {}
 
 	void reset(int numPixelX, int numPixelY, int numSubSample)
 	{
-		clear();
-
 		m_numPixelX = numPixelX;
 		m_numPixelY = numPixelY;
 		m_numSubSample = numSubSample;
-
-		m_samplerPool = new Vector2[numPixelX*numPixelY*numSubSample];
 	}
 
+	// another scrambling
 	void resample(int frame)
 	{
-		unsigned int seed = tea<16>((unsigned int)frame, 0);
+		m_seed = tea<16>((unsigned int)frame, 0);
+	}
 
-		static int timer = StopWatch::create();
-		StopWatch::get(timer).start();
+	// 2D sample in [0, 1) of a pixel at frame
+	Vector2 getSample(int x, int y, int frame) const
+	{
+		Vector2 sample;
+		get2D((unsigned int)(x + y*m_numPixelX), (unsigned int)frame, 0, sample.e[0], sample.e[1], m_seed);
+		return sample;
+	}
 
-		// jittering
-		int subSize = (int)sqrtf((float)m_numSubSample+0.1f);
-		std::vector<int> IDs;
+	int getNumSubSample() {return m_numSubSample;}
 
-		float delta = 1.0f / subSize;
-		for(int y=0;y<m_numPixelY;y++)
-		{
-			for(int x=0;x<m_numPixelX;x++)
-			{
-				for(int i=0;i<m_numSubSample;i++)
-					IDs.push_back(i);
+	/**
+	 * dimension-th coordinate in [0, 1) of sampleIndex-th sample of a pixel (or any other
+	 * sequence, e.g. an emitter). Samples of different seeds are scrambled differently.
+	 */
+	static inline float get1D(unsigned int pixel, unsigned int sampleIndex, int dimension, unsigned int seed = 0)
+	{
+		unsigned int pixelSeed = tea<4>(pixel, seed);
+		unsigned int index = nestedUniformScramble(sampleIndex, tea<4>(pixelSeed, 0x10000u + (dimension >> 2)));
+		unsigned int x = nestedUniformScramble(sobol(index, dimension & 3), tea<4>(pixelSeed, dimension));
+		return toFloat(x);
+	}
 
-				for(int i=0;i<m_numSubSample;i++)
-				{
-					Vector2 &sample = m_samplerPool[i+(x+y*m_numPixelX)*m_numSubSample];
+	// coordinates dimension and dimension+1, dimension should be even
+	static inline void get2D(unsigned int pixel, unsigned int sampleIndex, int dimension, float &u, float &v, unsigned int seed = 0)
+	{
+		unsigned int pixelSeed = tea<4>(pixel, seed);
+		unsigned int index = nestedUniformScramble(sampleIndex, tea<4>(pixelSeed, 0x10000u + (dimension >> 2)));
+		u = toFloat(nestedUniformScramble(sobol(index, dimension & 3), tea<4>(pixelSeed, dimension)));
+		v = toFloat(nestedUniformScramble(sobol(index, (dimension & 3) + 1), tea<4>(pixelSeed, dimension + 1)));
+	}
 
-					int pos = (int)(rnd(seed) * IDs.size());
-					int ID = IDs[pos];
-					IDs[pos] = IDs[IDs.size()-1];
-					IDs.pop_back();
+protected:
+	static inline unsigned int sobol(unsigned int index, int dimension)
+	{
+		// direction numbers of the first 4 dimensions (Joe and Kuo)
+		static const unsigned int directions[4][32] = {
+			{
+				0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+				0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+				0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+				0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001
+			},
+			{
+				0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+				0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+				0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+				0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff
+			},
+			{
+				0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+				0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+				0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+				0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555
+			},
+			{
+				0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+				0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+				0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+				0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093
+			}
+		};
 
-					int sx = ID % subSize;
-					int sy = ID / subSize;
+		unsigned int x = 0;
+		for(int bit=0;index;index >>= 1, bit++)
+			if(index & 1) x ^= directions[dimension][bit];
+		return x;
+	}
 
-					sample.e[0] = ((float)sx + rnd(seed)) * delta;
-					sample.e[1] = ((float)sy + rnd(seed)) * delta;
-				}
-			}
-		}
+	static inline unsigned int reverseBits(unsigned int x)
+	{
+		x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+		x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+		x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+		x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+		return (x >> 16) | (x << 16);
+	}
 
-		StopWatch::get(timer).stop();
-		//printf("Sample time: %f ms\n", StopWatch::get(timer).getTime());
-		StopWatch::get(timer).reset();
+	// a random permutation where each bit depends only on the lower bits
+	static inline unsigned int laineKarrasPermutation(unsigned int x, unsigned int seed)
+	{
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
 	}
 
-	const Vector2 &getSample(int x, int y, int frame)
+	// Owen scrambling: each bit is flipped depending on the higher bits
+	static inline unsigned int nestedUniformScramble(unsigned int x, unsigned int seed)
 	{
-		return m_samplerPool[(frame%m_numSubSample)+(x+y*m_numPixelX)*m_numSubSample];
+		return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
 	}
 
-	int getNumSubSample() {return m_numSubSample;}
+	static inline float toFloat(unsigned int x)
+	{
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
 };
 
-};
\ No newline at end of file
+};
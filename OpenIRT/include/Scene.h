@@ -14,7 +14,9 @@
 #include "Model.h"
 #include "Emitter.h"
 #include "SceneNode.h"
+#include "SceneBVH.h"
 #include "Photon.h"
+#include "ShadingMaterialTable.h"
 
 namespace irt
 {
@@ -70,11 +72,14 @@ protected:
 
 	AABB m_sceneBB;
 	SceneNode m_sceneGraph;
+	SceneBVH m_sceneBVH;		// top level BVH over model instances of m_sceneGraph
 
 	bool m_hasSceneStructure;
 
 	EnvironmentMap m_envMap;
 
+	ShadingMaterialTable m_shadingMaterials;
+
 	typedef SceneNode* StackElem;
 	__declspec(align(16)) StackElem **m_stacks;
 
@@ -102,7 +107,9 @@ public:
 	const AABB& getSceneBB() {return m_sceneBB;}
 	void setSceneBB(const AABB &bb) {m_sceneBB = bb;}
 	SceneNode &getSceneGraph() {return m_sceneGraph;}
+	SceneBVH &getSceneBVH() {return m_sceneBVH;}
 	EnvironmentMap &getEnvironmentMap() {return m_envMap;}
+	const ShadingMaterialTable &getShadingMaterials() {return m_shadingMaterials;}
 
 	int pushEmitter(const Emitter &emitter);
 	void removeEmitter(int pos);
@@ -137,12 +144,16 @@ public:
 
 	void generateEmitter();
 	void generateSceneStructure();
+	void buildSceneBVH();
+	// recompiles the shading material table, call when materials of models are changed
+	void buildShadingMaterials();
 	void generatePMTarget(Emitter &emitter);
 
 	int getIntersectionStream();
 
 	void trace(const Ray &ray, RGB4f &color, Material *outMat = 0, int depth = 0, float traveledDist = 0.0f, HitPointInfo *outHit = 0, int stream = 0);
 	void shade(const Ray &ray, RGB4f &color, HitPointInfo &hit, bool hasHit = true);
+	void shadeHit(const Ray &ray, RGB4f &color, HitPointInfo &hit, bool hasHit, Material *outMat = 0);
 	RayPacketTemplate
 	void trace(RayPacketT &ray, RGB4f *color, int depth = 0, int stream = 0);
 	bool getIntersection(const Ray &ray, HitPointInfo &hitPointInfo, float tLimit = 0.0f, int stream = 0);
@@ -150,8 +161,10 @@ public:
 	void getIntersection(RayPacketT &rayPacket, int stream = 0);
 
 	int getNumMaxPhotons();
-	int tracePhotons(int size, Photon *outPhotons, void (*funcProcessPhoton)(const Photon &photon) = NULL);
-	void tracePhotons(int emitterIndex, Photon *outPhotons, int idx, int &numTotalPhotons, void (*funcProcessPhoton)(const Photon &photon));
+	// photons of different passes are traced with different random numbers
+	int tracePhotons(int size, Photon *outPhotons, void (*funcProcessPhoton)(const Photon &photon) = NULL, int pass = 0);
+	// traces photon idx of numPhotons emitted by an emitter, returns false if it is not stored
+	bool tracePhoton(int emitterIndex, int numPhotons, int idx, Photon &photon, int pass = 0);
 	void buildPhotonKDTree(Photon *photons, Photon *outPhotons, int left, int right, int depth, int curRoot, Photon::SplitChoice splitChoice, const AABB &bb);
 	int buildPhotonKDTree(int size, Photon **photons, AABB &bb);
 
@@ -175,26 +188,37 @@ void Scene::getIntersection(RayPacketT &rayPacket, int stream)
 	//case Model::HCCMESH2 : ((HCCMesh2*)model)->getIntersection(rayPacket, stream); break;
 	//}
 
-	int threadID = omp_get_thread_num();
-	StackElem *stack = m_stacks[threadID+MAX_NUM_THREADS*stream];
+	if(m_sceneBVH.isEmpty()) return;
 
+	unsigned int stack[SceneBVH::STACK_SIZE];
 	unsigned int stackPtr;
-	SceneNode *currentNode;
-	bool hasHit = false;
-
+	const BVHNode *currentNode;
 
-	currentNode = &(m_sceneGraph);
-	stack[0] = currentNode;
+	stack[0] = 0;
 	stackPtr = 1;
 
+	currentNode = m_sceneBVH.getNode(0);
+
 	while(true)
 	{
 		// is current node intersected and also closer than previous hit?
-		if (rayPacket.intersectWithBox(&currentNode->nodeBB.min, 0) < nRays)  // yes, at least one ray intersects
+		if (rayPacket.intersectWithBox(&currentNode->min, 0) < nRays)  // yes, at least one ray intersects
 		{
-			if(currentNode->model)
+			if(!SceneBVH::isLeaf(currentNode))
+			{
+				unsigned int lChild = SceneBVH::getLeftChildIdx(currentNode);
+				stack[stackPtr++] = lChild + 1;
+				currentNode = m_sceneBVH.getNode(lChild);
+				continue;
+			}
+
+			unsigned int first = SceneBVH::getFirstInstanceIdx(currentNode);
+			unsigned int last = first + SceneBVH::getNumInstances(currentNode);
+			for(unsigned int i=first;i<last;i++)
 			{
-				Model *model = currentNode->model;
+				Model *model = m_sceneBVH.getInstance(i)->model;
+				if(m_modelTypeSelector != Model::NONE && m_modelTypeSelector != model->getType()) continue;
+
 				switch(model->getType())
 				{
 				case Model::OOC_FILE : ((Model*)model)->getIntersection(rayPacket, stream); break;
@@ -202,18 +226,11 @@ void Scene::getIntersection(RayPacketT &rayPacket, int stream)
 				case Model::HCCMESH2 : ((HCCMesh2*)model)->getIntersection(rayPacket, stream); break;
 				}
 			}
-			if(currentNode->hasChilds())
-			{
-				for(size_t i=0;i<currentNode->childs->size();i++)
-				{
-					stack[stackPtr++] = currentNode->childs->at(i);
-				}
-			}
 		}
 		// traversal ends when stack empty
 		if(--stackPtr == 0) break;
 
-		currentNode = stack[stackPtr];
+		currentNode = m_sceneBVH.getNode(stack[stackPtr]);
 	}
 }
 
@@ -241,91 +258,29 @@ void Scene::trace(RayPacketT &rayPacket, RGB4f *colors, int depth, int stream) {
 		
 		int bit = 1;
 		for (int i = 0 ; i < 4; i++, bit <<= 1) {
+			// shading and secondary rays are not coherent any more, process them ray by ray
+			Ray ray;
+			ray.set(rayPacket.rays[r].getOrigin(i), rayPacket.rays[r].getDirection(i));
 
-			// has missed the scene, i.e. no hit ?
-			if ((rayPacket.rayHasHit[r] & bit) == 0) {
-				// shade from background		
-				Vector3 dir = rayPacket.rays[r].getDirection(i);
-
-				RGBf col;
-
-				m_envMap.shade(dir, col);
-				colors[r*4 + i].set(col, 1.0f);
-
-				continue;
-			}		
+			HitPointInfo hit;
+			bool hasHit = (rayPacket.rayHasHit[r] & bit) != 0;
 
-			Material currentMaterial;
-			if(rayPacket.hitpoints[r].modelPtr[i]) currentMaterial = rayPacket.hitpoints[r].modelPtr[i]->getMaterial(rayPacket.hitpoints[r].m[i]);
-
-			Vector3 hitPosition(rayPacket.hitpoints[r].x[0].e[i], rayPacket.hitpoints[r].x[1].e[i], rayPacket.hitpoints[r].x[2].e[i]);
-			Vector3 hitNormal(rayPacket.hitpoints[r].n[0].e[i], rayPacket.hitpoints[r].n[1].e[i], rayPacket.hitpoints[r].n[2].e[i]);
-			Vector3 shadowDir;
-
-			//float weight = 2.0f / m_emitList.size();
-			float maxCosFactor = 0.0f;
-			// for each emitter
-			for(size_t l=0;l<m_emitList.size();l++)
+			if(hasHit)
 			{
-				Emitter &emitter = m_emitList[l];
-
-				if(emitter.type == Emitter::ENVIRONMENT_LIGHT) continue;
-				// just use diffuse values now...
-				const RGBf &emitColor = emitter.color_Kd;
-
-				// compute shadow ray direction
-
-				shadowDir = emitter.pos - hitPosition;
-				shadowDir.makeUnitVector();
-
-				float cosFactor = dot(shadowDir, hitNormal);
-
-				if(maxCosFactor < cosFactor)
-				{
-					maxCosFactor = cosFactor;
-				}
-
-				if(cosFactor > 0.0f)
-				{
-					/*
-					int idx = shadowDir.indexOfMaxComponent();
-					float tLimit = (emitter.pos.e[idx] - hitPosition.e[idx]) / shadowDir.e[idx];
-					HitPointInfo shadowHit;
-					shadowHit.t = tLimit;
-
-					Ray shadowRay;
-					shadowRay.set(hitPosition, shadowDir);
-
-					if(!getIntersection(shadowRay, shadowHit, stream))
-					*/
-						colors[r*4 + i] += currentMaterial.getMatKd() * emitColor * cosFactor;// * weight;
-				}
+				const SIMDHitpoint &hitpoint = rayPacket.hitpoints[r];
+				hit.t = hitpoint.t.e[i];
+				hit.n = Vector3(hitpoint.n[0].e[i], hitpoint.n[1].e[i], hitpoint.n[2].e[i]);
+				hit.alpha = hitpoint.alpha.e[i];
+				hit.beta = hitpoint.beta.e[i];
+				hit.m = hitpoint.m[i];
+				hit.uv = Vector2(hitpoint.u.e[i], hitpoint.v.e[i]);
+				hit.modelPtr = hitpoint.modelPtr[i];
+				hit.tri = hitpoint.triIdx[i];
+				hit.x = Vector3(hitpoint.x[0].e[i], hitpoint.x[1].e[i], hitpoint.x[2].e[i]);
 			}
 
-			//colors[r*4 + i] = currentMaterial.getMatKd() * maxCosFactor;
-
-			colors[r*4 + i].e[0] = min(1.0f, colors[r*4 + i].e[0]);
-			colors[r*4 + i].e[1] = min(1.0f, colors[r*4 + i].e[1]);
-			colors[r*4 + i].e[2] = min(1.0f, colors[r*4 + i].e[2]);
-
-			
-			// get local shaded color from material
-			//currentMaterial->shade(rayPacket.rays[r], rayPacket.hitpoints[r], i, shaded_color[r*4 + i]);
-			
-			/*
-			// add constant ambient term
-			if (currentMaterial->isEmitter()) {
-				currentMaterial->emittedRadiance( rayPacket.hitpoints[r],  rayPacket.rays[r].getOrigin(i), i,  colors[r*4 + i]);
-			}
-			else
-				colors[r*4 + i] = ambientColor * shaded_color[r*4 + i];	
-			*/
-			/*
-			#ifdef _USE_REFLECTIONS
-			specular_reflectance[r*4 + i] = currentMaterial->getReflectance();
-			reflection_hit[r] |= (currentMaterial->hasReflection()&g_ReflectionRays)?bit:0;	
-			#endif
-			*/
+			colors[r*4 + i] = RGBf(0.0f, 0.0f, 0.0f);
+			shadeHit(ray, colors[r*4 + i], hit, hasHit);
 		}	
 
 	} // for all rays in packet
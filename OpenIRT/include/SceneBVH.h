@@ -0,0 +1,78 @@
+/********************************************************************
+	file base:	SceneBVH
+	file ext:	h
+
+	comment:	Top level BVH over the model instances of a scene graph.
+				Nodes use the same encoding as the BVH of a model
+				(see BVHNode.h). A leaf points to a range of instances.
+				build() is called once for a loaded scene graph. When
+				the transform of an instance is changed, only the path
+				from its leaf to the root is refitted, see
+				SceneNode::updateBB().
+*********************************************************************/
+
+#pragma once
+
+#include <vector>
+#include "BVHNode.h"
+
+namespace irt
+{
+
+class SceneNode;
+
+class SceneBVH
+{
+public:
+	enum
+	{
+		MAX_DEPTH = 64,		// traversal uses fixed size stacks
+		STACK_SIZE = MAX_DEPTH + 2
+	};
+
+	SceneBVH(void);
+	~SceneBVH(void);
+
+	void clear();
+
+	// collects all the nodes having a model under root and builds the hierarchy
+	void build(SceneNode *root);
+
+	// called when bounding box of an instance is changed
+	void refit(SceneNode *instance);
+
+	bool isEmpty() const {return m_nodes.empty();}
+	int getNumInstances() const {return (int)m_instances.size();}
+	int getNumNodes() const {return (int)m_nodes.size();}
+
+	SceneNode *getInstance(unsigned int i) const {return m_instances[i];}
+	const BVHNode *getNode(unsigned int i) const {return &m_nodes[i];}
+
+	static bool isLeaf(const BVHNode *node) {return (node->left & 3) == 3;}
+	static int getAxis(const BVHNode *node) {return node->left & 3;}
+	static unsigned int getLeftChildIdx(const BVHNode *node) {return node->left >> 2;}
+	static unsigned int getNumInstances(const BVHNode *node) {return node->left >> 2;}
+	static unsigned int getFirstInstanceIdx(const BVHNode *node) {return node->right;}
+
+protected:
+	enum
+	{
+		NUM_BINS = 16
+	};
+
+	std::vector<SceneNode*> m_instances;
+	std::vector<BVHNode> m_nodes;
+	std::vector<int> m_parents;
+
+	// working set of the builder
+	std::vector<Vector3> m_centroids;
+
+	void collectInstances(SceneNode *node);
+	void subDivide(unsigned int myIndex, unsigned int left, unsigned int right, int depth);
+	void makeLeaf(unsigned int myIndex, unsigned int left, unsigned int right);
+	void computeLeafBB(BVHNode *node);
+
+	static float getArea(const Vector3 &min, const Vector3 &max);
+};
+
+};
@@ -17,6 +17,8 @@
 namespace irt
 {
 
+class SceneBVH;
+
 class SceneNode
 {
 public:
@@ -27,6 +29,10 @@ public:
 
 	Model *model;
 	AABB nodeBB;
+	AABB modelBB;			// bounding box of the transformed model
+
+	SceneBVH *sceneBVH;		// top level BVH which contains this node as an instance
+	int sceneBVHLeaf;
 	
 	SceneNode();
 	SceneNode(const char *name, SceneNode *parent, Model* model = NULL, Matrix *matrix = NULL);
@@ -38,9 +44,18 @@ public:
 	SceneNode* addChild(const char *name, Model *model, Matrix *matrix = NULL);
 
 	Matrix getTransformedMatrix();
+
+	// changes local transform, see updateBB()
+	void setMatrix(const Matrix &matrix);
+
+	// call after the transform of this node or a model box of its subtree is changed.
+	// Bounding boxes of this subtree and its ancestors and the top level BVH are refitted.
 	void updateBB();
 	void updateBB(const AABB &bb, bool updateParents = false);
+	void refitBB();
 	static void updateBBWithVertex(AABB &bb, const Vector3 &vert);
+protected:
+	void updateTransform();
 };
 
 };
\ No newline at end of file
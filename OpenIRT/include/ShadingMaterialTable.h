@@ -0,0 +1,114 @@
+/********************************************************************
+	file base:	ShadingMaterialTable
+	file ext:	h
+
+	comment:	Read-only copy of the materials of every model in a scene,
+				compiled for shading. Each attribute is stored in its own
+				array (SoA) and indexed by (model ID, material ID), so the
+				shading code reads only the attributes it needs instead of
+				copying a whole Material per hit.
+				Entry 0 is the default material, used when there is no model.
+*********************************************************************/
+
+#pragma once
+
+#include <vector>
+#include "Model.h"
+
+namespace irt
+{
+
+class ShadingMaterialTable
+{
+public:
+	ShadingMaterialTable(void);
+
+	// assigns model IDs (index in models) and compiles their materials
+	void build(const std::vector<Model*> &models);
+	void clear();
+
+	int getNumMaterials() const {return (int)m_Kd.size();}
+
+	// same fallback as Model::getMaterial(int), an invalid material ID uses the first material of the model
+	inline int getIndex(int modelID, unsigned int materialID) const
+	{
+		if(modelID < 0 || modelID >= (int)m_firstMaterial.size()) return 0;
+		return m_firstMaterial[modelID] + (materialID < (unsigned int)m_numModelMaterials[modelID] ? materialID : 0);
+	}
+	inline int getIndex(const HitPointInfo &hit) const
+	{
+		return hit.modelPtr ? getIndex(hit.modelPtr->getID(), hit.m) : 0;
+	}
+
+	const RGBf &getKa(int idx) const {return m_Ka[idx];}
+	const RGBf &getKd(int idx) const {return m_Kd[idx];}
+	const RGBf &getKs(int idx) const {return m_Ks[idx];}
+	float getMat_d(int idx) const {return m_d[idx];}
+	float getMat_Ns(int idx) const {return m_Ns[idx];}
+	BitmapTexture *getMapKa(int idx) const {return m_mapKa[idx];}
+	BitmapTexture *getMapKd(int idx) const {return m_mapKd[idx];}
+
+	// reflectances with the texture applied as in Model::getMaterial(hit) (footprint = 0 : finest level)
+	inline RGBf getKa(int idx, const Vector2 &uv, float footprint = 0.0f) const;
+	inline RGBf getKd(int idx, const Vector2 &uv, float footprint = 0.0f) const;
+
+	// Material::rangeKd/rangeKs for the (textured) diffuse reflectance Kd from getKd()
+	inline void getRanges(int idx, const RGBf &Kd, float &rangeKd, float &rangeKs) const;
+
+protected:
+	// per model ID
+	std::vector<int> m_firstMaterial;
+	std::vector<int> m_numModelMaterials;
+
+	// per material
+	std::vector<RGBf> m_Ka;
+	std::vector<RGBf> m_Kd;
+	std::vector<RGBf> m_Ks;
+	std::vector<float> m_d;
+	std::vector<float> m_Ns;
+	std::vector<float> m_rangeKd;
+	std::vector<float> m_rangeKs;
+	std::vector<float> m_sumKs;
+	std::vector<BitmapTexture*> m_mapKa;
+	std::vector<BitmapTexture*> m_mapKd;
+
+	void push(const Material &mat);
+};
+
+inline RGBf ShadingMaterialTable::getKa(int idx, const Vector2 &uv, float footprint) const
+{
+	BitmapTexture *map = m_mapKa[idx];
+	if(!map) return m_Ka[idx];
+
+	RGBf texValue;
+	if(footprint > 0.0f) map->getTexValue(texValue, uv.e[0], uv.e[1], footprint);
+	else map->getTexValue(texValue, uv.e[0], uv.e[1]);
+	return m_Ka[idx] * texValue;
+}
+
+inline RGBf ShadingMaterialTable::getKd(int idx, const Vector2 &uv, float footprint) const
+{
+	BitmapTexture *map = m_mapKd[idx];
+	if(!map) return m_Kd[idx];
+
+	RGBf texValue;
+	if(footprint > 0.0f) map->getTexValue(texValue, uv.e[0], uv.e[1], footprint);
+	else map->getTexValue(texValue, uv.e[0], uv.e[1]);
+	return m_Kd[idx] * texValue;
+}
+
+inline void ShadingMaterialTable::getRanges(int idx, const RGBf &Kd, float &rangeKd, float &rangeKs) const
+{
+	if(!m_mapKd[idx])
+	{
+		rangeKd = m_rangeKd[idx];
+		rangeKs = m_rangeKs[idx];
+		return;
+	}
+
+	// Material::setMatKd() recalculates the ranges
+	rangeKd = Kd.r() + Kd.g() + Kd.b();
+	rangeKs = rangeKd + m_sumKs[idx];
+}
+
+};
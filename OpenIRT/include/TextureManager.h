@@ -2,7 +2,9 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <hash_map>
+#include "LRUManager.h"
 
 struct eqstrTextureManager
 {
@@ -24,6 +26,8 @@ struct greater_strTextureManager {
 namespace irt
 {
 
+class BitmapTexture;
+
 class TextureManager
 {
 public:
@@ -62,6 +66,25 @@ public:
 		return lastError;
 	}
 
+	/**
+	 * Tiles of all textures share one LRU cache of 8 bit RGBA tiles, the
+	 * textures themselves are not kept in memory (see BitmapTexture).
+	 * The budget (in bytes) applies from the next cache miss after
+	 * textures are (un)loaded or the budget is changed. Do not call
+	 * these while rendering.
+	 */
+	void setCacheBudget(__int64 bytes);
+	__int64 getCacheBudget() {return m_cacheBudget;}
+	LRUManager<unsigned char*>::Stats getCacheStats();
+
+	/**
+	 * RGBA texels (8 bit) of a tile (tileIdx is local to the texture).
+	 * The tile is not evicted before releaseTile(slot) is called,
+	 * slot is set to the slot of the tile in the cache.
+	 */
+	const unsigned char *getTile(BitmapTexture *texPtr, int tileIdx, int &slot);
+	void releaseTile(int slot) {m_tileCache->unpin(slot);}
+
 	// get Singleton instance or create it
 	static TextureManager* getSingletonPtr();
 
@@ -77,6 +100,18 @@ protected:
 	// last error message
 	char lastError[500];
 
+	// tile cache, created at the first access after it was reset
+	LRUManager<unsigned char*> * volatile m_tileCache;
+	std::vector<BitmapTexture*> m_tileOwners;	// texture of each tile in the cache
+	__int64 m_cacheBudget;
+	WinLock m_lockTileCache;
+
+	void createTileCache();
+	void resetTileCache();
+
+	// cache miss callback, reads the tile from the tile file of its texture
+	static void loadTile(unsigned int idx, unsigned char *address);
+
 private:
 };
 
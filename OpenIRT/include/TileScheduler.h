@@ -0,0 +1,106 @@
+/********************************************************************
+	file base:	TileScheduler
+	file ext:	h
+
+	comment:	Tile scheduler for the CPU renderers.
+				The image is covered by tiles (smaller ones on the right and
+				top borders), which are sorted by Controller::tileOrderingType
+				and dealt round-robin to per-thread queues. A thread takes
+				tiles from the front of its queue and steals from the back
+				of the others when its queue is empty.
+				The render time of each tile is kept, tiles much slower
+				than the average are split for the next frame.
+				Tiles can be aligned to a grid, e.g. of ray packets.
+*********************************************************************/
+
+#pragma once
+
+#include <vector>
+#include "controls.h"
+#include "Image.h"
+
+namespace irt
+{
+
+class TileScheduler
+{
+public:
+	typedef struct Tile_t
+	{
+		int startX, startY;
+		int endX, endY;			// exclusive
+		float time;				// ms, of the last run
+		double priority;		// higher first
+	} Tile;
+
+	typedef double (*RenderTileCallBack)(const Tile &tile, void *data);
+
+	TileScheduler(void);
+	~TileScheduler(void);
+
+	/**
+	 * Tiles of tileSize covering width x height. The tiles (and the splits of
+	 * the previous frames) are kept if nothing is changed.
+	 * Tiles start on multiples of align, also after they are split
+	 * (tileSize is rounded up to a multiple of align).
+	 */
+	void setup(int width, int height, int tileSize, Controller::TileOrderingType ordering, int align = 1);
+
+	// saliency of the tiles for HIGHEST_SALIENT_TILE_FIRST, from the previous frame
+	void updateSaliency(Image *image);
+
+	/**
+	 * Calls func(tile, data) for every tile from all threads and returns the sum
+	 * of the returned values (e.g. number of rays).
+	 */
+	double run(RenderTileCallBack func, void *data);
+
+	int getNumTiles() const {return (int)m_tiles.size();}
+	const Tile &getTile(int i) const {return m_tiles[i];}
+
+	// number of tiles rendered by a thread other than the one it was given to in the last run
+	int getNumStolenTiles() const {return m_numStolen;}
+
+protected:
+	typedef struct __declspec(align(64)) TileQueue_t
+	{
+		volatile __int64 range;		// front in the low 32 bits, back (exclusive) in the high 32 bits
+		int first;					// in m_queuedTiles
+	} TileQueue;
+
+	int m_width, m_height;
+	int m_tileSize;
+	int m_align;
+	Controller::TileOrderingType m_ordering;
+
+	std::vector<Tile> m_tiles;
+	bool m_hasTimes;
+
+	// saliency on the grid of tileSize
+	std::vector<float> m_saliency;
+	int m_saliencyWidth, m_saliencyHeight;
+
+	unsigned int m_frame;
+
+	std::vector<int> m_queuedTiles;
+	TileQueue *m_queues;
+	int m_numQueues;
+	volatile long m_numStolen;
+
+	void resetTiles();
+
+	// splits the slow tiles of the last run
+	void splitSlowTiles();
+
+	void computePriorities();
+
+	// sorts the tiles and fills the queues
+	void distribute(int numThreads);
+
+	// -1 if there is no tile left
+	int popFront(int queue);
+	int popBack(int queue);
+	int nextTile(int thread);
+};
+
+};
@@ -12,6 +12,7 @@
 
 #include "Vector2.h"
 #include "Vector3.h"
+#include "VertexEncoding.h"
 
 /**
  * Main vertex structure
@@ -37,4 +38,46 @@ public:
 	Vector3 v;
 };
 
+/**
+ * Split vertex format (vertex_pos.ooc and vertex_attrib.ooc).
+ * Positions are in their own stream so that traversal does not fetch
+ * shading data, padded to 16 bytes for aligned SSE loads. Normals are
+ * octahedral encoded and texture coordinates are half floats in the
+ * shading stream. Colors are not stored.
+ */
+class VertexPosition {
+public:
+	Vector3 v;				// vertex geometry
+	float dummy;
+};
+
+class VertexAttrib {
+public:
+	short n[2];				// octahedral encoded normal, snorm16
+	unsigned short uv[2];	// texture coordinate, half float
+
+	void setNormal(const Vector3 &normal)
+	{
+		encodeOctahedralNormal(normal.e[0], normal.e[1], normal.e[2], n);
+	}
+
+	Vector3 getNormal() const
+	{
+		Vector3 normal;
+		decodeOctahedralNormal(n, normal.e[0], normal.e[1], normal.e[2]);
+		return normal;
+	}
+
+	void setUV(const Vector2 &texCoord)
+	{
+		uv[0] = floatToHalf(texCoord.e[0]);
+		uv[1] = floatToHalf(texCoord.e[1]);
+	}
+
+	Vector2 getUV() const
+	{
+		return Vector2(halfToFloat(uv[0]), halfToFloat(uv[1]));
+	}
+};
+
 };
\ No newline at end of file
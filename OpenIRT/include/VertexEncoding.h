@@ -0,0 +1,109 @@
+/********************************************************************
+	file base:	VertexEncoding
+	file ext:	h
+
+	comment:	Encoding of the shading attributes of the split vertex
+				format (VertexAttrib, vertex_attrib.ooc): octahedral
+				snorm16 normals and half float texture coordinates.
+				Shared by the renderer and GeometryConverter::splitVert()
+				of the Builder, so it depends on nothing but math.h.
+*********************************************************************/
+
+#pragma once
+
+#include <math.h>
+
+inline short floatToSnorm16(float x)
+{
+	x = x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x);
+	return (short)(x * 32767.0f + (x >= 0.0f ? 0.5f : -0.5f));
+}
+
+// (x, y, z) does not need to be normalized, a zero vector is encoded as (0, 0)
+inline void encodeOctahedralNormal(float x, float y, float z, short n[2])
+{
+	float l1 = fabs(x) + fabs(y) + fabs(z);
+	if(l1 == 0.0f)
+	{
+		n[0] = n[1] = 0;
+		return;
+	}
+
+	// project on the octahedron, and fold the lower half
+	float ox = x / l1, oy = y / l1;
+	if(z < 0.0f)
+	{
+		float fx = (1.0f - fabs(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+		float fy = (1.0f - fabs(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+		ox = fx;
+		oy = fy;
+	}
+	n[0] = floatToSnorm16(ox);
+	n[1] = floatToSnorm16(oy);
+}
+
+// unit vector, or zero for (0, 0)
+inline void decodeOctahedralNormal(const short n[2], float &x, float &y, float &z)
+{
+	x = n[0] * (1.0f / 32767.0f);
+	y = n[1] * (1.0f / 32767.0f);
+	z = 1.0f - fabs(x) - fabs(y);
+	if(z < 0.0f)
+	{
+		float fx = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float fy = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+
+	float len = sqrtf(x*x + y*y + z*z);
+	if(len > 0.0f)
+	{
+		x /= len;
+		y /= len;
+		z /= len;
+	}
+}
+
+// round to nearest, overflow to infinity
+inline unsigned short floatToHalf(float f)
+{
+	unsigned int bits = *((unsigned int*)&f);
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = bits & 0x7FFFFF;
+
+	if(((bits >> 23) & 0xFF) == 0xFF) return (unsigned short)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if(exponent >= 31) return (unsigned short)(sign | 0x7C00);
+	if(exponent <= 0)
+	{
+		// denormal
+		if(exponent < -10) return (unsigned short)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		if((mantissa >> (shift - 1)) & 1) half++;
+		return (unsigned short)(sign | half);
+	}
+
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	if(mantissa & 0x1000) half++;
+	return (unsigned short)half;
+}
+
+inline float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1F;
+	unsigned int mantissa = h & 0x3FF;
+	unsigned int bits;
+
+	if(exponent == 0)
+	{
+		float f = mantissa * (1.0f / 16777216.0f);
+		return sign ? -f : f;
+	}
+	if(exponent == 31) bits = sign | 0x7F800000 | (mantissa << 13);
+	else bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	return *((float*)&bits);
+}
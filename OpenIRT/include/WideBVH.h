@@ -0,0 +1,77 @@
+/********************************************************************
+	file base:	WideBVH
+	file ext:	h
+
+	comment:	N-ary BVH (N = 4 : QBVH, N = 8 : OBVH) collapsed from
+				a binary BVH. Bounding boxes of the N children are
+				stored in SoA layout so that one SIMD box test handles
+				all the children of a node (SSE for 4, AVX for 8).
+*********************************************************************/
+
+#pragma once
+
+#include "BVHNode.h"
+#include "Ray.h"
+#include "HitPointInfo.h"
+
+namespace irt
+{
+
+class Model;
+
+template <int N>
+class WideBVH
+{
+public:
+	enum
+	{
+		EMPTY = 0xFFFFFFFF,
+		STACK_SIZE = 128*N
+	};
+
+	/**
+	* SoA node. bounds[0..2][i] is min and bounds[3..5][i] is max of i-th child.
+	* count[i] == 0 : child[i] is index of an inner node
+	* count[i] > 0  : leaf with count[i] triangles starting from child[i]
+	* Unused slots have child[i] == EMPTY and an inverted box which is never hit.
+	*/
+	typedef struct Node_t
+	{
+		float bounds[6][N];
+		unsigned int child[N];
+		unsigned int count[N];
+	} Node;
+
+	WideBVH(void);
+	~WideBVH(void);
+
+	void clear();
+
+	// collapse a binary BVH, root is nodes[0] (BVHBuilder output or contents of BVH.node)
+	bool build(const BVHNode *nodes, int numNodes);
+	bool build(const char *nodeFileName);
+
+	int getNumNodes() {return m_numNodes;}
+	const Node *getNode(unsigned int n) {return &m_nodes[n];}
+
+	// ray should be in the model space
+	bool getIntersection(Model *model, const Ray &ray, HitPointInfo &hitPointInfo, float tLimit = 0.0f);
+
+protected:
+	Node *m_nodes;
+	int m_numNodes;
+	int m_maxNumNodes;
+	int m_maxDepth;
+
+	unsigned int allocNode();
+	unsigned int collapse(const BVHNode *nodes, unsigned int binaryIndex, int depth);
+
+	// returns bit mask of hit children, entry and exit distances are stored in tNear and tFar
+	static int intersectChildren(const Node *node, const Ray &ray, float tHit, float *tNear, float *tFar);
+	static float getArea(const BVHNode *node);
+};
+
+typedef WideBVH<4> QBVH;
+typedef WideBVH<8> OBVH;
+
+};
@@ -6,6 +6,8 @@ namespace RendererType
 	{
 		NONE,
 		CPU_RAY_TRACER,
+		CPU_PATH_TRACER,
+		CPU_PHOTON_MAPPING,
 		CUDA_RAY_TRACER,
 		CUDA_PATH_TRACER,
 		CUDA_PHOTON_MAPPING,
@@ -60,6 +62,8 @@ typedef struct Controller_t
 	float AODistance;
 	float envMapWeight;
 	float envColWeight;
+	bool useRayPackets;		// trace coherent primary rays in packets (CPU ray tracer)
+	float convergenceThreshold;	// relative error of the pixels for adaptive sampling (CPU path tracer), 0 to disable
 
 	Controller_t() : useZCurveOrdering(0), shadeLocalIllumination(1), useShadowRays(1), gatherPhotons(1), showLights(0), useAmbientOcclusion(0), printLog(1),
 		pathLength(1), numShadowRays(1), numGatheringRays(0), threadBlockSize(256*64), timeLimit(30.0f), tileSize(32),
@@ -71,6 +75,8 @@ typedef struct Controller_t
 		, drawBackground(1)
 		, envMapWeight(0.4f)
 		, envColWeight(0.0f)
+		, useRayPackets(0)
+		, convergenceThreshold(0.0f)
 	{}
 } Controller;
 
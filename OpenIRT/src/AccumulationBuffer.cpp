@@ -0,0 +1,109 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include <emmintrin.h>
+#include "AccumulationBuffer.h"
+
+using namespace irt;
+
+AccumulationBuffer::AccumulationBuffer(void)
+	: m_width(0), m_height(0), m_color(0), m_numSamples(0), m_M2(0)
+{
+}
+
+AccumulationBuffer::~AccumulationBuffer(void)
+{
+	if(m_color) _aligned_free(m_color);
+	if(m_numSamples) delete[] m_numSamples;
+	if(m_M2) delete[] m_M2;
+}
+
+void AccumulationBuffer::resize(int width, int height)
+{
+	if(m_width == width && m_height == height && m_color) return;
+
+	if(m_color) _aligned_free(m_color);
+	if(m_numSamples) delete[] m_numSamples;
+	if(m_M2) delete[] m_M2;
+
+	m_width = width;
+	m_height = height;
+	m_color = (RGB4f*)_aligned_malloc(sizeof(RGB4f)*width*height, 16);
+	m_numSamples = new int[width*height];
+	m_M2 = new float[width*height];
+
+	clear();
+}
+
+void AccumulationBuffer::clear()
+{
+	if(!m_color) return;
+
+	memset(m_color, 0, sizeof(RGB4f)*m_width*m_height);
+	memset(m_numSamples, 0, sizeof(int)*m_width*m_height);
+	memset(m_M2, 0, sizeof(float)*m_width*m_height);
+}
+
+// tone mapped color of one pixel in 0..255 (32 bit integers)
+static inline __m128i toneMap(const __m128 &color, const __m128 &exposure, AccumulationBuffer::ToneMappingType toneMapping)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 twofiftyfive = _mm_set1_ps(255.0f);
+
+	__m128 c = _mm_max_ps(_mm_mul_ps(color, exposure), zero);
+	if(toneMapping == AccumulationBuffer::REINHARD)
+		c = _mm_div_ps(c, _mm_add_ps(one, c));
+	c = _mm_min_ps(c, one);
+	return _mm_cvtps_epi32(_mm_mul_ps(c, twofiftyfive));
+}
+
+void AccumulationBuffer::flush(Image *image, float exposure, ToneMappingType toneMapping) const
+{
+	if(!image || !m_color) return;
+
+	if(image->width != m_width || image->height != m_height)
+	{
+		printf("AccumulationBuffer::flush() : image size (%d x %d) does not match (%d x %d)\n", image->width, image->height, m_width, m_height);
+		return;
+	}
+
+	const __m128 exposure4 = _mm_set1_ps(exposure);
+	const int bpp = image->bpp;
+
+#	pragma omp parallel for schedule(dynamic)
+	for(int y=0;y<m_height;y++)
+	{
+		const RGB4f *src = &m_color[y*m_width];
+		unsigned char *dst = &image->data[y*m_width*bpp];
+
+		__declspec(align(16)) unsigned char buffer[16];
+
+		// 4 pixels at once
+		int x = 0;
+		for(;x+4<=m_width;x+=4)
+		{
+			__m128i c01 = _mm_packs_epi32(toneMap(src[x].data4, exposure4, toneMapping), toneMap(src[x+1].data4, exposure4, toneMapping));
+			__m128i c23 = _mm_packs_epi32(toneMap(src[x+2].data4, exposure4, toneMapping), toneMap(src[x+3].data4, exposure4, toneMapping));
+			_mm_store_si128((__m128i*)buffer, _mm_packus_epi16(c01, c23));
+
+			// alpha channel of the image (if any) is kept as in Image::setPixel(RGBf)
+			for(int i=0;i<4;i++, dst += bpp)
+			{
+				dst[0] = buffer[i*4+0];
+				dst[1] = buffer[i*4+1];
+				dst[2] = buffer[i*4+2];
+			}
+		}
+
+		for(;x<m_width;x++, dst += bpp)
+		{
+			__m128i c = _mm_packs_epi32(toneMap(src[x].data4, exposure4, toneMapping), _mm_setzero_si128());
+			_mm_store_si128((__m128i*)buffer, _mm_packus_epi16(c, c));
+
+			dst[0] = buffer[0];
+			dst[1] = buffer[1];
+			dst[2] = buffer[2];
+		}
+	}
+}
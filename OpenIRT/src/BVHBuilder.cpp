@@ -1,32 +1,136 @@
+#include "CommonOptions.h"
+#include "defines.h"
 #include "BVHBuilder.h"
+#include <algorithm>
+#include <stopwatch.h>
+
+// cost constants of the surface area heuristic
+#define SAH_COST_TRAVERSAL 1.0f
+#define SAH_COST_INTERSECTION 1.0f
+
+// subtrees smaller than this are not split into further build tasks
+#define MIN_TASK_SIZE 4096
+
+// ranges larger than this are binned by all threads during the top level build
+#define MIN_PARALLEL_BINNING_SIZE 65536
 
 using namespace irt;
 
 BVHBuilder::BVHBuilder(void)
+	: m_mesh(0), m_type(BINNED_SAH), m_triIDs(0), m_triBB(0), m_triCentroid(0), m_taskThreshold(0)
 {
 }
 
 BVHBuilder::~BVHBuilder(void)
 {
+	clear();
 }
 
-void BVHBuilder::init(Model *mesh)
+void BVHBuilder::init(Model *mesh, BuildType type)
 {
 	clear();
 
 	m_mesh = mesh;
+	m_type = type;
 }
 
 void BVHBuilder::clear(void)
 {
+	if(m_triIDs) delete[] m_triIDs;
+	if(m_triBB) delete[] m_triBB;
+	if(m_triCentroid) delete[] m_triCentroid;
+
+	m_triIDs = NULL;
+	m_triBB = NULL;
+	m_triCentroid = NULL;
 }
 
 bool BVHBuilder::build(void)
+{
+	static unsigned int timer = StopWatch::create();
+
+	StopWatch::get(timer).reset();
+	StopWatch::get(timer).start();
+
+	bool ret = m_type == MEDIAN ? buildMedian() : buildBinnedSAH();
+
+	StopWatch::get(timer).stop();
+
+	printf("BVH build [%s] : %d triangles, %d nodes, %f ms, SAH cost = %f\n", 
+		m_type == MEDIAN ? "median" : "binned SAH", m_mesh->m_numTris, m_mesh->m_numNodes, 
+		StopWatch::get(timer).getTime(), m_mesh->m_nodeList ? computeSAHCost(m_mesh) : 0.0f);
+
+	return ret;
+}
+
+bool BVHBuilder::build(Model *mesh)
+{
+#	ifdef USE_MEDIAN_BVH_BUILDER
+	return build(mesh, MEDIAN);
+#	else
+	return build(mesh, BINNED_SAH);
+#	endif
+}
+
+bool BVHBuilder::build(Model *mesh, BuildType type)
+{
+	BVHBuilder *builder = new BVHBuilder;
+	builder->init(mesh, type);
+	bool ret = builder->build();
+	delete builder;
+
+	if(ret)
+	{
+		mesh->buildWideBVH();
+		mesh->buildPackedTriangles();
+	}
+	return ret;
+}
+
+float BVHBuilder::computeSAHCost(Model *mesh)
+{
+	if(mesh->getNumNodes() == 0) return 0.0f;
+
+	BVHNode *root = mesh->getBV(mesh->getRootIdx());
+	float rootArea = getArea(root->min, root->max);
+
+	if(rootArea <= 0.0f) return 0.0f;
+
+	float cost = 0.0f;
+
+	std::vector<Index_t> stack;
+	stack.push_back(mesh->getRootIdx());
+
+	while(!stack.empty())
+	{
+		Index_t idx = stack.back();
+		stack.pop_back();
+
+		BVHNode *node = mesh->getBV(idx);
+		float prob = getArea(node->min, node->max) / rootArea;
+
+		if(mesh->isLeaf(node))
+		{
+			cost += prob * SAH_COST_INTERSECTION * mesh->getNumTriangles(node);
+			continue;
+		}
+
+		cost += prob * SAH_COST_TRAVERSAL;
+
+		stack.push_back(mesh->getLeftChildIdx(node));
+		stack.push_back(mesh->getLeftChildIdx(node) + 1);
+	}
+
+	return cost;
+}
+
+bool BVHBuilder::buildMedian(void)
 {
 	if(m_mesh->m_nodeList) delete[] m_mesh->m_nodeList;
 	if(m_mesh->m_numTris == 0) 
 	{
 		m_mesh->m_nodeList = NULL;
+		m_mesh->m_numNodes = 0;
 		return true;
 	}
 
@@ -44,26 +148,21 @@ bool BVHBuilder::build(void)
 
 		for(int j=0;j<3;j++)
 		{
-			const Vertex &v = m_mesh->m_vertList[m_mesh->m_triList[i].p[j]];
-			updateBB(root->min, root->max, v.v);
+			updateBB(root->min, root->max, m_mesh->getPosition(m_mesh->m_triList[i].p[j]));
 		}
 	}
 
-	subDivide(triIDs, 0, m_mesh->m_numTris-1);
+	if(m_mesh->m_numTris == 1)
+	{
+		root->left = (1 << 2) | 3;
+		root->right = 0;
+	}
+	else subDivide(triIDs, 0, m_mesh->m_numTris-1);
 
 	delete[] triIDs;
 	return true;
 }
 
-bool BVHBuilder::build(Model *mesh)
-{
-	BVHBuilder *builder = new BVHBuilder;
-	builder->init(mesh);
-	bool ret = builder->build();
-	delete builder;
-	return ret;
-}
-
 void BVHBuilder::updateBB(Vector3 &min, Vector3 &max, const Vector3 &vec)
 {
 	min.e[0] = ( min.e[0] < vec.e[0] ) ? min.e[0] : vec.e[0];
@@ -102,9 +201,9 @@ bool BVHBuilder::subDivide(unsigned int *triIDs, unsigned int left, unsigned int
 
 		avgloc = 0.0f;
 
-		avgloc = m_mesh->m_vertList[tri.p[0]].v.e[biggestaxis];
-		avgloc += m_mesh->m_vertList[tri.p[1]].v.e[biggestaxis];
-		avgloc += m_mesh->m_vertList[tri.p[2]].v.e[biggestaxis];
+		avgloc = m_mesh->getPosition(tri.p[0]).e[biggestaxis];
+		avgloc += m_mesh->getPosition(tri.p[1]).e[biggestaxis];
+		avgloc += m_mesh->getPosition(tri.p[2]).e[biggestaxis];
 		avgloc /= 3.0f;
 
 		if (avgloc < split_pt) 
@@ -146,9 +245,9 @@ bool BVHBuilder::subDivide(unsigned int *triIDs, unsigned int left, unsigned int
 
 		const Triangle &tri = m_mesh->m_triList[lChild->right];
 
-		updateBB(lChild->min, lChild->max, m_mesh->m_vertList[tri.p[0]].v);
-		updateBB(lChild->min, lChild->max, m_mesh->m_vertList[tri.p[1]].v);
-		updateBB(lChild->min, lChild->max, m_mesh->m_vertList[tri.p[2]].v);
+		updateBB(lChild->min, lChild->max, m_mesh->getPosition(tri.p[0]));
+		updateBB(lChild->min, lChild->max, m_mesh->getPosition(tri.p[1]));
+		updateBB(lChild->min, lChild->max, m_mesh->getPosition(tri.p[2]));
 	}	
 	else 
 	{ 
@@ -158,9 +257,9 @@ bool BVHBuilder::subDivide(unsigned int *triIDs, unsigned int left, unsigned int
 		{
 			const Triangle &tri = m_mesh->m_triList[triIDs[i]];
 
-			updateBB(lChild->min, lChild->max, m_mesh->m_vertList[tri.p[0]].v);
-			updateBB(lChild->min, lChild->max, m_mesh->m_vertList[tri.p[1]].v);
-			updateBB(lChild->min, lChild->max, m_mesh->m_vertList[tri.p[2]].v);
+			updateBB(lChild->min, lChild->max, m_mesh->getPosition(tri.p[0]));
+			updateBB(lChild->min, lChild->max, m_mesh->getPosition(tri.p[1]));
+			updateBB(lChild->min, lChild->max, m_mesh->getPosition(tri.p[2]));
 		}
 
 		subDivide(triIDs, left, left+numLeft-1, nextIndex, nextIndex + 2, depth + 1);
@@ -175,9 +274,9 @@ bool BVHBuilder::subDivide(unsigned int *triIDs, unsigned int left, unsigned int
 
 		rChild->min.set(FLT_MAX);
 		rChild->max.set(-FLT_MAX);
-		updateBB(rChild->min, rChild->max, m_mesh->m_vertList[tri.p[0]].v);
-		updateBB(rChild->min, rChild->max, m_mesh->m_vertList[tri.p[1]].v);
-		updateBB(rChild->min, rChild->max, m_mesh->m_vertList[tri.p[2]].v);
+		updateBB(rChild->min, rChild->max, m_mesh->getPosition(tri.p[0]));
+		updateBB(rChild->min, rChild->max, m_mesh->getPosition(tri.p[1]));
+		updateBB(rChild->min, rChild->max, m_mesh->getPosition(tri.p[2]));
 	}	
 	else 
 	{ 
@@ -187,9 +286,9 @@ bool BVHBuilder::subDivide(unsigned int *triIDs, unsigned int left, unsigned int
 		{
 			const Triangle &tri = m_mesh->m_triList[triIDs[i]];
 
-			updateBB(rChild->min, rChild->max, m_mesh->m_vertList[tri.p[0]].v);
-			updateBB(rChild->min, rChild->max, m_mesh->m_vertList[tri.p[1]].v);
-			updateBB(rChild->min, rChild->max, m_mesh->m_vertList[tri.p[2]].v);
+			updateBB(rChild->min, rChild->max, m_mesh->getPosition(tri.p[0]));
+			updateBB(rChild->min, rChild->max, m_mesh->getPosition(tri.p[1]));
+			updateBB(rChild->min, rChild->max, m_mesh->getPosition(tri.p[2]));
 		}
 
 		subDivide(triIDs, left+numLeft, right, nextIndex + 1, m_mesh->m_numNodes, depth + 1);
@@ -197,3 +296,406 @@ bool BVHBuilder::subDivide(unsigned int *triIDs, unsigned int left, unsigned int
 
 	return true;
 }
+
+bool BVHBuilder::buildBinnedSAH(void)
+{
+	if(m_mesh->m_nodeList) delete[] m_mesh->m_nodeList;
+	m_mesh->m_nodeList = NULL;
+	m_mesh->m_numNodes = 0;
+
+	int numTris = m_mesh->m_numTris;
+	if(numTris == 0) return true;
+
+	m_triIDs = new unsigned int[numTris];
+	m_triBB = new Bounds[numTris];
+	m_triCentroid = new Vector3[numTris];
+
+#	pragma omp parallel for schedule(static)
+	for(int i=0;i<numTris;i++)
+	{
+		const Triangle &tri = m_mesh->m_triList[i];
+		Bounds &bb = m_triBB[i];
+
+		bb.min.set(FLT_MAX);
+		bb.max.set(-FLT_MAX);
+		updateBB(bb.min, bb.max, m_mesh->getPosition(tri.p[0]));
+		updateBB(bb.min, bb.max, m_mesh->getPosition(tri.p[1]));
+		updateBB(bb.min, bb.max, m_mesh->getPosition(tri.p[2]));
+
+		m_triCentroid[i] = (bb.min + bb.max) * 0.5f;
+		m_triIDs[i] = i;
+	}
+
+	// top levels are split by all threads until the remaining subtrees are
+	// small enough to be handed to one thread each
+	m_taskThreshold = (unsigned int)numTris / (unsigned int)(omp_get_max_threads() * 8);
+	if(m_taskThreshold < MIN_TASK_SIZE) m_taskThreshold = MIN_TASK_SIZE;
+
+	NodeList topNodes;
+	std::vector<BuildTask*> tasks;
+
+	Bounds rootBB, rootCentroidBB;
+	computeBounds(0, numTris, rootBB, rootCentroidBB, true);
+
+	topNodes.resize(1);
+	topNodes[0].min = rootBB.min;
+	topNodes[0].max = rootBB.max;
+
+	subDivideSAH(topNodes, 0, 0, numTris, rootCentroidBB, 0, &tasks);
+
+	// bigger subtrees first for better load balancing
+	std::sort(tasks.begin(), tasks.end(), isBiggerTask);
+
+#	pragma omp parallel for schedule(dynamic, 1)
+	for(int i=0;i<(int)tasks.size();i++)
+	{
+		BuildTask &task = *tasks[i];
+
+		task.nodes.reserve(2 * (task.right - task.left) / MAX_LEAF_SIZE + 1);
+		task.nodes.push_back(topNodes[task.nodeIndex]);
+
+		subDivideSAH(task.nodes, 0, task.left, task.right, task.centroidBB, task.depth, NULL);
+	}
+
+	// assemble subtrees into the node layout of Model. Children are always
+	// allocated as pairs, so sibling nodes stay adjacent after relocation.
+	size_t numNodes = topNodes.size();
+	for(size_t i=0;i<tasks.size();i++)
+		numNodes += tasks[i]->nodes.size() - 1;
+
+	BVHNode *nodeList = new BVHNode[numNodes];
+	memcpy(nodeList, &topNodes[0], sizeof(BVHNode) * topNodes.size());
+
+	unsigned int base = (unsigned int)topNodes.size() - 1;
+	for(size_t i=0;i<tasks.size();i++)
+	{
+		NodeList &nodes = tasks[i]->nodes;
+
+		for(size_t j=0;j<nodes.size();j++)
+		{
+			BVHNode node = nodes[j];
+			if((node.left & 3) != 3)
+			{
+				unsigned int child = (node.left >> 2) + base;
+				node.left = (child << 2) | (node.left & 3);
+				node.right = (child + 1) << 2;
+			}
+			nodeList[j == 0 ? tasks[i]->nodeIndex : base + j] = node;
+		}
+
+		base += (unsigned int)nodes.size() - 1;
+		delete tasks[i];
+	}
+
+	// leaves point to contiguous ranges of triangles
+	Triangle *triList = new Triangle[numTris];
+
+#	pragma omp parallel for schedule(static)
+	for(int i=0;i<numTris;i++)
+		triList[i] = m_mesh->m_triList[m_triIDs[i]];
+
+	delete[] m_mesh->m_triList;
+	m_mesh->m_triList = triList;
+
+	m_mesh->m_nodeList = nodeList;
+	m_mesh->m_numNodes = (int)numNodes;
+
+	clear();
+	return true;
+}
+
+void BVHBuilder::computeBounds(unsigned int left, unsigned int right, Bounds &bb, Bounds &centroidBB, bool parallel)
+{
+	bb.min.set(FLT_MAX);
+	bb.max.set(-FLT_MAX);
+	centroidBB.min.set(FLT_MAX);
+	centroidBB.max.set(-FLT_MAX);
+
+	if(!parallel || right - left < MIN_PARALLEL_BINNING_SIZE)
+	{
+		for(unsigned int i=left;i<right;i++)
+		{
+			unsigned int triID = m_triIDs[i];
+			mergeBounds(bb, m_triBB[triID]);
+			updateBB(centroidBB.min, centroidBB.max, m_triCentroid[triID]);
+		}
+		return;
+	}
+
+	int numChunks = omp_get_max_threads();
+	unsigned int chunkSize = (right - left + numChunks - 1) / numChunks;
+
+	Bounds *chunkBB = new Bounds[numChunks*2];
+
+#	pragma omp parallel for schedule(static)
+	for(int c=0;c<numChunks;c++)
+	{
+		Bounds &curBB = chunkBB[c*2];
+		Bounds &curCentroidBB = chunkBB[c*2+1];
+
+		curBB.min.set(FLT_MAX);
+		curBB.max.set(-FLT_MAX);
+		curCentroidBB.min.set(FLT_MAX);
+		curCentroidBB.max.set(-FLT_MAX);
+
+		unsigned int begin = left + c * chunkSize;
+		unsigned int end = begin + chunkSize < right ? begin + chunkSize : right;
+
+		for(unsigned int i=begin;i<end;i++)
+		{
+			unsigned int triID = m_triIDs[i];
+			mergeBounds(curBB, m_triBB[triID]);
+			updateBB(curCentroidBB.min, curCentroidBB.max, m_triCentroid[triID]);
+		}
+	}
+
+	for(int c=0;c<numChunks;c++)
+	{
+		mergeBounds(bb, chunkBB[c*2]);
+		mergeBounds(centroidBB, chunkBB[c*2+1]);
+	}
+
+	delete[] chunkBB;
+}
+
+void BVHBuilder::binCentroids(unsigned int left, unsigned int right, const Bounds &centroidBB, Bin bins[][NUM_BINS], bool parallel)
+{
+	Vector3 extent = centroidBB.max - centroidBB.min;
+	float scale[3];
+	for(int axis=0;axis<3;axis++)
+		scale[axis] = extent.e[axis] > 0.0f ? NUM_BINS * (1.0f - 1e-5f) / extent.e[axis] : 0.0f;
+
+	int numChunks = parallel && right - left >= MIN_PARALLEL_BINNING_SIZE ? omp_get_max_threads() : 1;
+	unsigned int chunkSize = (right - left + numChunks - 1) / numChunks;
+
+	// a single chunk is binned directly into the output
+	Bin (*chunkBins)[3][NUM_BINS] = numChunks > 1 ? new Bin[numChunks][3][NUM_BINS] : (Bin (*)[3][NUM_BINS])bins;
+
+#	pragma omp parallel for schedule(static) if(numChunks > 1)
+	for(int c=0;c<numChunks;c++)
+	{
+		Bin (&curBins)[3][NUM_BINS] = chunkBins[c];
+
+		for(int axis=0;axis<3;axis++)
+		{
+			for(int b=0;b<NUM_BINS;b++)
+			{
+				curBins[axis][b].count = 0;
+				curBins[axis][b].bb.min.set(FLT_MAX);
+				curBins[axis][b].bb.max.set(-FLT_MAX);
+			}
+		}
+
+		unsigned int begin = left + c * chunkSize;
+		unsigned int end = begin + chunkSize < right ? begin + chunkSize : right;
+
+		for(unsigned int i=begin;i<end;i++)
+		{
+			unsigned int triID = m_triIDs[i];
+			const Vector3 &centroid = m_triCentroid[triID];
+			const Bounds &triBB = m_triBB[triID];
+
+			for(int axis=0;axis<3;axis++)
+			{
+				int b = (int)((centroid.e[axis] - centroidBB.min.e[axis]) * scale[axis]);
+				b = b < 0 ? 0 : (b >= NUM_BINS ? NUM_BINS-1 : b);
+
+				curBins[axis][b].count++;
+				mergeBounds(curBins[axis][b].bb, triBB);
+			}
+		}
+	}
+
+	if(numChunks == 1) return;
+
+	for(int axis=0;axis<3;axis++)
+	{
+		for(int b=0;b<NUM_BINS;b++)
+		{
+			bins[axis][b] = chunkBins[0][axis][b];
+			for(int c=1;c<numChunks;c++)
+			{
+				bins[axis][b].count += chunkBins[c][axis][b].count;
+				mergeBounds(bins[axis][b].bb, chunkBins[c][axis][b].bb);
+			}
+		}
+	}
+
+	delete[] chunkBins;
+}
+
+void BVHBuilder::makeLeaf(NodeList &nodes, unsigned int myIndex, unsigned int left, unsigned int right)
+{
+	BVHNode &node = nodes[myIndex];
+	node.left = ((right - left) << 2) | 3;
+	node.right = left;
+}
+
+void BVHBuilder::subDivideSAH(NodeList &nodes, unsigned int myIndex, unsigned int left, unsigned int right, const Bounds &centroidBB, int depth, std::vector<BuildTask*> *tasks)
+{
+	unsigned int numTris = right - left;
+
+	if(tasks && numTris <= m_taskThreshold)
+	{
+		BuildTask *task = new BuildTask;
+		task->nodeIndex = myIndex;
+		task->left = left;
+		task->right = right;
+		task->centroidBB = centroidBB;
+		task->depth = depth;
+		tasks->push_back(task);
+		return;
+	}
+
+	if(numTris <= 1 || depth >= MAX_DEPTH)
+	{
+		makeLeaf(nodes, myIndex, left, right);
+		return;
+	}
+
+	bool parallel = tasks != NULL;
+
+	Bounds bb;
+	bb.min = nodes[myIndex].min;
+	bb.max = nodes[myIndex].max;
+
+	int bestAxis = -1;
+	int bestSplit = -1;
+	float bestCost = FLT_MAX;
+
+	Vector3 extent = centroidBB.max - centroidBB.min;
+
+	if(extent.maxComponent() > 0.0f)
+	{
+		Bin bins[3][NUM_BINS];
+		binCentroids(left, right, centroidBB, bins, parallel);
+
+		for(int axis=0;axis<3;axis++)
+		{
+			if(extent.e[axis] <= 0.0f) continue;
+
+			// sweep from right to left to get the cost of the right sides
+			float rightCost[NUM_BINS];
+			Bounds accBB;
+			accBB.min.set(FLT_MAX);
+			accBB.max.set(-FLT_MAX);
+			int accCount = 0;
+			for(int b=NUM_BINS-1;b>0;b--)
+			{
+				mergeBounds(accBB, bins[axis][b].bb);
+				accCount += bins[axis][b].count;
+				rightCost[b] = accCount ? accCount * getArea(accBB.min, accBB.max) : 0.0f;
+			}
+
+			// sweep from left to right, split between bin b-1 and b
+			accBB.min.set(FLT_MAX);
+			accBB.max.set(-FLT_MAX);
+			accCount = 0;
+			for(int b=1;b<NUM_BINS;b++)
+			{
+				mergeBounds(accBB, bins[axis][b-1].bb);
+				accCount += bins[axis][b-1].count;
+
+				if(accCount == 0 || accCount == (int)numTris) continue;
+
+				float cost = accCount * getArea(accBB.min, accBB.max) + rightCost[b];
+				if(cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+	}
+
+	float area = getArea(bb.min, bb.max);
+	float leafCost = SAH_COST_INTERSECTION * numTris;
+	if(bestAxis >= 0)
+		bestCost = SAH_COST_TRAVERSAL + SAH_COST_INTERSECTION * (area > 0.0f ? bestCost / area : (float)numTris);
+
+	if(numTris <= MAX_LEAF_SIZE && (bestAxis < 0 || bestCost >= leafCost))
+	{
+		makeLeaf(nodes, myIndex, left, right);
+		return;
+	}
+
+	unsigned int mid;
+	int axis;
+
+	if(bestAxis >= 0)
+	{
+		axis = bestAxis;
+
+		float scale = NUM_BINS * (1.0f - 1e-5f) / extent.e[axis];
+		float minCentroid = centroidBB.min.e[axis];
+		unsigned int *curLeft = m_triIDs + left, *curRight = m_triIDs + right;
+
+		while(curLeft < curRight)
+		{
+			int b = (int)((m_triCentroid[*curLeft].e[axis] - minCentroid) * scale);
+			if(b < bestSplit)
+			{
+				curLeft++;
+			}
+			else
+			{
+				unsigned int temp = *curLeft;
+				*curLeft = *(--curRight);
+				*curRight = temp;
+			}
+		}
+		mid = (unsigned int)(curLeft - m_triIDs);
+	}
+	else
+	{
+		// all centroids are at the same position, just go half/half
+		axis = extent.indexOfMaxComponent();
+		mid = left + numTris / 2;
+	}
+
+	if(mid == left || mid == right)
+		mid = left + numTris / 2;
+
+	unsigned int child = (unsigned int)nodes.size();
+	nodes.resize(child + 2);	// invalidates references to nodes
+
+	nodes[myIndex].left = (child << 2) | axis;
+	nodes[myIndex].right = (child + 1) << 2;
+
+	Bounds leftBB, leftCentroidBB, rightBB, rightCentroidBB;
+
+	computeBounds(left, mid, leftBB, leftCentroidBB, parallel);
+	nodes[child].min = leftBB.min;
+	nodes[child].max = leftBB.max;
+
+	computeBounds(mid, right, rightBB, rightCentroidBB, parallel);
+	nodes[child+1].min = rightBB.min;
+	nodes[child+1].max = rightBB.max;
+
+	subDivideSAH(nodes, child, left, mid, leftCentroidBB, depth + 1, tasks);
+	subDivideSAH(nodes, child + 1, mid, right, rightCentroidBB, depth + 1, tasks);
+}
+
+bool BVHBuilder::isBiggerTask(const BuildTask *a, const BuildTask *b)
+{
+	return (a->right - a->left) > (b->right - b->left);
+}
+
+float BVHBuilder::getArea(const Vector3 &min, const Vector3 &max)
+{
+	Vector3 diff = max - min;
+	if(diff.e[0] < 0.0f || diff.e[1] < 0.0f || diff.e[2] < 0.0f) return 0.0f;
+	return 2.0f * (diff.e[0] * diff.e[1] + diff.e[1] * diff.e[2] + diff.e[2] * diff.e[0]);
+}
+
+void BVHBuilder::mergeBounds(Bounds &dst, const Bounds &src)
+{
+	dst.min.e[0] = ( dst.min.e[0] < src.min.e[0] ) ? dst.min.e[0] : src.min.e[0];
+	dst.min.e[1] = ( dst.min.e[1] < src.min.e[1] ) ? dst.min.e[1] : src.min.e[1];
+	dst.min.e[2] = ( dst.min.e[2] < src.min.e[2] ) ? dst.min.e[2] : src.min.e[2];
+
+	dst.max.e[0] = ( dst.max.e[0] > src.max.e[0] ) ? dst.max.e[0] : src.max.e[0];
+	dst.max.e[1] = ( dst.max.e[1] > src.max.e[1] ) ? dst.max.e[1] : src.max.e[1];
+	dst.max.e[2] = ( dst.max.e[2] > src.max.e[2] ) ? dst.max.e[2] : src.max.e[2];
+}
@@ -1,26 +1,298 @@
+#include "CommonOptions.h"
 #include "BitmapTexture.h"
+#include "TextureManager.h"
 #include "ImageIL.h"
 
+#include <math.h>
+#include <emmintrin.h>
+
 using namespace irt;
 
 bool BitmapTexture::loadFromFile(const char *fileName) 
 {
 	strcpy_s(this->fileName, 256, fileName);
 	// try to load this image
-	textureImage = new ImageIL();
+	Image *textureImage = new ImageIL();
 	if (textureImage->loadFromFile(fileName)) {
 		//width = textureImage->width-1;
 		//height = textureImage->height-1;
 		width = textureImage->width;
 		height = textureImage->height;
 		bpp = textureImage->bpp;
-		data = textureImage->data;
 
+		// texels are read from the tile file from now on
+		bool built = buildMipChain(textureImage->data);
+		delete textureImage;
+
+		if (!built) {
+			sprintf_s(lastError, 200, "cannot write the tile file");
+			return false;
+		}
 		return true;
 	}
 	else { // error loading bitmap file
 		delete textureImage;
-		textureImage = NULL;
 		return false;
 	}	
-}
\ No newline at end of file
+}
+
+bool BitmapTexture::buildMipChain(const unsigned char *data)
+{
+	const int TS = TEXTURE_TILE_SIZE;
+	const int sizeTile = TS*TS*4;
+
+	if(tileFile) CloseHandle(tileFile);
+	tileFile = NULL;
+	levels.clear();
+	numTiles = 0;
+
+	if(width <= 0 || height <= 0) return true;
+
+	// temporary file, deleted when it is closed
+	char tempPath[MAX_PATH], tempFileName[MAX_PATH];
+	if(!GetTempPath(MAX_PATH, tempPath) || !GetTempFileName(tempPath, "tex", 0, tempFileName)) return false;
+	tileFile = CreateFile(tempFileName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if(tileFile == INVALID_HANDLE_VALUE)
+	{
+		tileFile = NULL;
+		DeleteFile(tempFileName);
+		return false;
+	}
+
+	// layout of the levels
+	int w = width, h = height;
+	while(true)
+	{
+		MipLevel level;
+		level.width = w;
+		level.height = h;
+		level.tilesX = (w + TS - 1) / TS;
+		level.tilesY = (h + TS - 1) / TS;
+		level.firstTile = numTiles;
+		numTiles += level.tilesX * level.tilesY;
+		levels.push_back(level);
+
+		if(w == 1 && h == 1) break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+
+	// finest level in RGBA, same rows as the image
+	std::vector<unsigned char> src((__int64)width*height*4), dst, tileRow;
+
+#	pragma omp parallel for schedule(dynamic)
+	for(int y=0;y<height;y++)
+	{
+		const unsigned char *in = &data[(__int64)y*width*bpp];
+		unsigned char *out = &src[(__int64)y*width*4];
+		for(int x=0;x<width;x++, in += bpp, out += 4)
+		{
+			out[0] = in[0];
+			out[1] = in[bpp >= 3 ? 1 : 0];
+			out[2] = in[bpp >= 3 ? 2 : 0];
+			out[3] = bpp == 4 ? in[3] : 255;
+		}
+	}
+
+	for(int i=0;i<(int)levels.size();i++)
+	{
+		const MipLevel &level = levels[i];
+
+		if(i > 0)
+		{
+			// 2x2 box filter of the previous level, odd borders are clamped
+			const MipLevel &prev = levels[i-1];
+			dst.resize((__int64)level.width*level.height*4);
+
+#			pragma omp parallel for schedule(dynamic)
+			for(int y=0;y<level.height;y++)
+			{
+				int y0 = 2*y, y1 = 2*y+1 < prev.height ? 2*y+1 : prev.height-1;
+				for(int x=0;x<level.width;x++)
+				{
+					int x0 = 2*x, x1 = 2*x+1 < prev.width ? 2*x+1 : prev.width-1;
+					const unsigned char *p00 = &src[((__int64)y0*prev.width + x0)*4];
+					const unsigned char *p01 = &src[((__int64)y0*prev.width + x1)*4];
+					const unsigned char *p10 = &src[((__int64)y1*prev.width + x0)*4];
+					const unsigned char *p11 = &src[((__int64)y1*prev.width + x1)*4];
+					unsigned char *out = &dst[((__int64)y*level.width + x)*4];
+					for(int c=0;c<4;c++)
+						out[c] = (unsigned char)((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+				}
+			}
+			src.swap(dst);
+		}
+
+		// scatter a row of tiles at a time and append it to the file, texels outside the level are 0
+		tileRow.resize((size_t)level.tilesX*sizeTile);
+		for(int ty=0;ty<level.tilesY;ty++)
+		{
+			memset(&tileRow[0], 0, tileRow.size());
+			for(int y=ty*TS;y<(ty+1)*TS && y<level.height;y++)
+			{
+				for(int x=0;x<level.width;x++)
+				{
+					unsigned char *out = &tileRow[((x / TS)*TS*TS + (y % TS)*TS + x % TS)*4];
+					*((unsigned int*)out) = *((const unsigned int*)&src[((__int64)y*level.width + x)*4]);
+				}
+			}
+			DWORD written = 0;
+			if(!WriteFile(tileFile, &tileRow[0], (DWORD)tileRow.size(), &written, NULL) || written != (DWORD)tileRow.size())
+			{
+				CloseHandle(tileFile);
+				tileFile = NULL;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool BitmapTexture::readTiles(int firstTile, int count, unsigned char *dst)
+{
+	const size_t sizeTile = TEXTURE_TILE_SIZE*TEXTURE_TILE_SIZE*4;
+
+	DWORD size = (DWORD)(count*sizeTile), read = 0;
+
+	// the offset is given with the read, there is no shared file pointer to seek
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(OVERLAPPED));
+	unsigned __int64 offset = (unsigned __int64)firstTile*sizeTile;
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	if(!tileFile || !ReadFile(tileFile, dst, size, &read, &overlapped) || read != size)
+	{
+		memset(dst, 0, size);
+		return false;
+	}
+	return true;
+}
+
+bool BitmapTexture::readLevel(int level, unsigned char *rgba)
+{
+	const int TS = TEXTURE_TILE_SIZE;
+
+	if(level < 0 || level >= (int)levels.size()) return false;
+
+	const MipLevel &l = levels[level];
+	std::vector<unsigned char> tileRow((size_t)l.tilesX*TS*TS*4);
+	bool ok = true;
+	for(int ty=0;ty<l.tilesY;ty++)
+	{
+		ok &= readTiles(l.firstTile + ty*l.tilesX, l.tilesX, &tileRow[0]);
+		for(int y=ty*TS;y<(ty+1)*TS && y<l.height;y++)
+		{
+			for(int x=0;x<l.width;x++)
+				*((unsigned int*)&rgba[((__int64)y*l.width + x)*4]) = *((const unsigned int*)&tileRow[((x / TS)*TS*TS + (y % TS)*TS + x % TS)*4]);
+		}
+	}
+	return ok;
+}
+
+static inline int applyTextureMode(int x, int size, int mode)
+{
+	switch(mode)
+	{
+	case TEXTURE_MODE_CLAMP :
+		return x < 0 ? 0 : (x >= size ? size-1 : x);
+	case TEXTURE_MODE_MIRROR :
+		x %= 2*size;
+		if(x < 0) x += 2*size;
+		return x < size ? x : 2*size - 1 - x;
+	default :
+		x %= size;
+		return x < 0 ? x + size : x;
+	}
+}
+
+__m128 BitmapTexture::getBilinear(int level, float u, float v, int mode)
+{
+	const int TS = TEXTURE_TILE_SIZE;
+	const MipLevel &l = levels[level];
+
+	// texel centers are at (i+0.5)/size
+	float s = u*l.width - 0.5f;
+	float t = v*l.height - 0.5f;
+	float fs = floorf(s);
+	float ft = floorf(t);
+	int x[2], y[2];
+	x[0] = applyTextureMode((int)fs, l.width, mode);
+	x[1] = applyTextureMode((int)fs + 1, l.width, mode);
+	y[0] = applyTextureMode((int)ft, l.height, mode);
+	y[1] = applyTextureMode((int)ft + 1, l.height, mode);
+
+	TextureManager *manager = TextureManager::getSingletonPtr();
+
+	// the four texels are usually in the same tile, a tile is released before the next one is fetched
+	__m128i zero = _mm_setzero_si128();
+	__m128 texel[4];
+	const unsigned char *tile = NULL;
+	int curTile = -1, slot = -1;
+	for(int j=0;j<2;j++)
+	{
+		for(int i=0;i<2;i++)
+		{
+			int tileIdx = l.firstTile + (y[j] / TS)*l.tilesX + x[i] / TS;
+			if(tileIdx != curTile)
+			{
+				if(tile) manager->releaseTile(slot);
+				tile = manager->getTile(this, tileIdx, slot);
+				curTile = tileIdx;
+			}
+			__m128i c = _mm_cvtsi32_si128(*((const int*)&tile[((y[j] % TS)*TS + x[i] % TS)*4]));
+			texel[j*2+i] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(c, zero), zero));
+		}
+	}
+	manager->releaseTile(slot);
+
+	// filtered in [0, 255]
+	__m128 wx = _mm_set1_ps(s - fs);
+	__m128 wy = _mm_set1_ps(t - ft);
+	__m128 c0 = _mm_add_ps(texel[0], _mm_mul_ps(_mm_sub_ps(texel[1], texel[0]), wx));
+	__m128 c1 = _mm_add_ps(texel[2], _mm_mul_ps(_mm_sub_ps(texel[3], texel[2]), wx));
+	__m128 c = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), wy));
+	return _mm_mul_ps(c, _mm_set1_ps(1.0f / 255.0f));
+}
+
+void BitmapTexture::getTexValue(RGBf &color, float u, float v, int mode)
+{
+	if(levels.empty()) return;
+
+	__declspec(align(16)) float result[4];
+	_mm_store_ps(result, getBilinear(0, u, v, mode));
+	color = RGBf(result[0], result[1], result[2]);
+}
+
+void BitmapTexture::getTexValue(RGBf &color, float u, float v, float footprint, int mode)
+{
+	if(levels.empty()) return;
+
+	// level where a texel has the size of the footprint
+	int maxLevel = (int)levels.size() - 1;
+	float numTexels = footprint * (width > height ? width : height);
+	float lod = numTexels > 1.0f ? logf(numTexels) * 1.442695f : 0.0f;
+
+	__m128 c;
+	if(lod <= 0.0f)
+	{
+		c = getBilinear(0, u, v, mode);
+	}
+	else if(lod >= (float)maxLevel)
+	{
+		c = getBilinear(maxLevel, u, v, mode);
+	}
+	else
+	{
+		// trilinear
+		int level = (int)lod;
+		__m128 c0 = getBilinear(level, u, v, mode);
+		__m128 c1 = getBilinear(level+1, u, v, mode);
+		c = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), _mm_set1_ps(lod - level)));
+	}
+
+	__declspec(align(16)) float result[4];
+	_mm_store_ps(result, c);
+	color = RGBf(result[0], result[1], result[2]);
+}
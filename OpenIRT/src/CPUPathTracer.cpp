@@ -0,0 +1,424 @@
+#include "CommonOptions.h"
+#include "CPUPathTracer.h"
+#include "random.h"
+#include "Sampler.h"
+
+using namespace irt;
+
+CPUPathTracer::CPUPathTracer(void)
+	: m_samplesPerSecond(0.0f), m_raysPerSecond(0.0f), m_frame(0), m_envColor(0.0f, 0.0f, 0.0f), m_pixelSpread(0.0f),
+	m_renderTime(0.0f), m_numUniformSamples(0), m_converged(false)
+{
+}
+
+CPUPathTracer::~CPUPathTracer(void)
+{
+	done();
+}
+
+void CPUPathTracer::init(Scene *scene)
+{
+	Renderer::init(scene);
+
+	if(!scene) return;
+
+	done();
+
+	m_intersectionStream = scene->getIntersectionStream();
+
+	sceneChanged();
+}
+
+void CPUPathTracer::done()
+{
+}
+
+void CPUPathTracer::resized(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+
+	m_accumulationBuffer.resize(width, height);
+	restartAccumulation();
+}
+
+void CPUPathTracer::restartAccumulation()
+{
+	m_accumulationBuffer.clear();
+	m_renderTime = 0.0f;
+	m_numUniformSamples = 0;
+	m_converged = false;
+}
+
+bool CPUPathTracer::isConverged()
+{
+	if(m_controller.convergenceThreshold <= 0.0f) return false;
+
+	return m_converged || (m_controller.timeLimit > 0.0f && m_renderTime >= m_controller.timeLimit * 1000.0f);
+}
+
+void CPUPathTracer::sceneChanged()
+{
+	lightChanged();
+}
+
+void CPUPathTracer::materialChanged()
+{
+	restartAccumulation();
+}
+
+void CPUPathTracer::lightChanged(bool soft)
+{
+	restartAccumulation();
+
+	m_envColor = RGBf(0.0f, 0.0f, 0.0f);
+
+	if(!m_scene) return;
+
+	// as in CUDAPathTracer, an environment light only gives the background color
+	for(int i=0;i<m_scene->getNumEmitters();i++)
+	{
+		Emitter &emitter = m_scene->getEmitter(i);
+		if(emitter.type == Emitter::ENVIRONMENT_LIGHT)
+			m_envColor = emitter.color_Kd;
+	}
+}
+
+void CPUPathTracer::controllerUpdated()
+{
+	restartAccumulation();
+}
+
+void CPUPathTracer::clearResult()
+{
+	restartAccumulation();
+}
+
+void CPUPathTracer::render(Camera *camera, Image *image, unsigned int seed)
+{
+	if(image->width != m_width || image->height != m_height)
+		resized(image->width, image->height);
+
+	// image still has the previous frame
+	if(m_controller.tileOrderingType == Controller::HIGHEST_SALIENT_TILE_FIRST)
+		m_tileScheduler.updateSaliency(image);
+
+	accumulate(camera, 1, seed);
+	flushImage(image);
+}
+
+void CPUPathTracer::accumulate(Camera *camera, int numSamples, unsigned int seed)
+{
+	static int timer = StopWatch::create();
+
+	// restart when the view is changed
+	if(*camera != m_lastCamera)
+	{
+		restartAccumulation();
+		m_lastCamera = *camera;
+	}
+
+	if(isConverged())
+	{
+		m_samplesPerSecond = m_raysPerSecond = 0.0f;
+		return;
+	}
+
+	unsigned int frameSeed = seed == UINT_MAX ? m_frame : seed;
+	m_frame++;
+
+	m_pixelSpread = 2.0f * tanf(camera->getFovY() * PI / 360.0f) / m_height;
+
+	StopWatch::get(timer).reset();
+	StopWatch::get(timer).start();
+
+	m_tileScheduler.setup(m_width, m_height, m_controller.tileSize, m_controller.tileOrderingType);
+
+	RenderTileData data;
+	data.renderer = this;
+	data.camera = camera;
+	data.numSamples = numSamples;
+	data.frameSeed = frameSeed;
+	data.adaptive = m_controller.convergenceThreshold > 0.0f && m_numUniformSamples >= ADAPTIVE_MIN_SAMPLES;
+	data.meanError = data.adaptive ? computeMeanError() : 0.0f;
+	data.numPixelSamples = 0;
+	data.numActiveTiles = 0;
+
+	double numRays = m_tileScheduler.run(renderTileCallBack, &data);
+
+	if(!data.adaptive)
+		m_numUniformSamples += numSamples;
+	else if(data.numActiveTiles == 0)
+		m_converged = true;
+
+	StopWatch::get(timer).stop();
+
+	float time = StopWatch::get(timer).getTime();
+	m_renderTime += time;
+	m_samplesPerSecond = time > 0.0f ? (float)data.numPixelSamples / (time * 0.001f) : 0.0f;
+	m_raysPerSecond = time > 0.0f ? (float)(numRays / (time * 0.001f)) : 0.0f;
+}
+
+float CPUPathTracer::computeMeanError()
+{
+	float threshold = m_controller.convergenceThreshold;
+	double sumError = 0.0;
+	int numPixels = 0;
+
+	// over the pixels which are not converged
+#	pragma omp parallel for schedule(dynamic) reduction(+:sumError, numPixels)
+	for(int y=0;y<m_height;y++)
+	{
+		for(int x=0;x<m_width;x++)
+		{
+			float error = m_accumulationBuffer.getRelativeError(x, y);
+			if(error >= threshold)
+			{
+				sumError += error < 1.0f ? error : 1.0f;
+				numPixels++;
+			}
+		}
+	}
+	return numPixels > 0 ? (float)(sumError / numPixels) : threshold;
+}
+
+void CPUPathTracer::flushImage(Image *image)
+{
+	m_accumulationBuffer.flush(image);
+}
+
+double CPUPathTracer::renderTileCallBack(const TileScheduler::Tile &tile, void *data)
+{
+	RenderTileData *renderData = (RenderTileData*)data;
+	CPUPathTracer *renderer = renderData->renderer;
+	int numSamples = renderData->numSamples;
+
+	if(renderData->adaptive)
+	{
+		// samples in proportion to the mean error of the tile, none when all the pixels are converged
+		float threshold = renderer->m_controller.convergenceThreshold;
+		float sumError = 0.0f, maxError = 0.0f;
+		for(int y=tile.startY;y<tile.endY;y++)
+		{
+			int imageY = renderer->m_height - y - 1;
+			for(int x=tile.startX;x<tile.endX;x++)
+			{
+				float error = renderer->m_accumulationBuffer.getRelativeError(x, imageY);
+				error = error < 1.0f ? error : 1.0f;
+				sumError += error;
+				maxError = error > maxError ? error : maxError;
+			}
+		}
+
+		if(maxError < threshold) return 0.0;
+
+		float tileError = sumError / ((tile.endX - tile.startX) * (tile.endY - tile.startY));
+		numSamples = (int)(numSamples * tileError / renderData->meanError + 0.5f);
+		numSamples = numSamples < 1 ? 1 : (numSamples > ADAPTIVE_MAX_SAMPLE_FACTOR * renderData->numSamples ? ADAPTIVE_MAX_SAMPLE_FACTOR * renderData->numSamples : numSamples);
+
+		InterlockedIncrement(&renderData->numActiveTiles);
+	}
+
+	InterlockedExchangeAdd(&renderData->numPixelSamples, numSamples * (tile.endX - tile.startX) * (tile.endY - tile.startY));
+
+	return renderer->renderTile(renderData->camera, tile.startX, tile.startY, tile.endX, tile.endY, numSamples, renderData->frameSeed);
+}
+
+int CPUPathTracer::renderTile(Camera *camera, int startX, int startY, int endX, int endY, int numSamples, unsigned int frameSeed)
+{
+	float deltaX = 1.0f / (float)m_width;
+	float deltaY = 1.0f / (float)m_height;
+
+	Ray ray;
+	RGB4f outColor;
+	int numRays = 0;
+
+	for(int y=startY;y<endY;y++)
+	{
+		int imageY = m_height - y - 1;
+		for(int x=startX;x<endX;x++)
+		{
+			unsigned int pixel = (unsigned int)(x + imageY*m_width);
+			unsigned int seed = tea<16>(pixel, frameSeed);
+
+			for(int i=0;i<numSamples;i++)
+			{
+				// pixel positions are stratified over all accumulated samples of the pixel
+				float jitterX, jitterY;
+				Sampler::get2D(pixel, (unsigned int)m_accumulationBuffer.getNumSamples(x, imageY), 0, jitterX, jitterY);
+
+				camera->getRayWithOrigin(ray, (x + jitterX)*deltaX, (y + jitterY)*deltaY);
+
+				numRays += tracePath(ray, outColor, seed);
+
+				m_accumulationBuffer.addSample(x, imageY, outColor);
+			}
+		}
+	}
+	return numRays;
+}
+
+int CPUPathTracer::tracePath(const Ray &ray, RGB4f &color, unsigned int &seed)
+{
+	RGBf outColor(0.0f, 0.0f, 0.0f);
+	RGBf attenuation(1.0f, 1.0f, 1.0f);
+	float alpha = 1.0f;
+	float pathDistance = 0.0f;
+	int numRays = 0;
+
+	Ray curRay = ray;
+	HitPointInfo hit;
+
+	// pathLength bounces after the primary hit
+	for(int depth=0;depth<=m_controller.pathLength;depth++)
+	{
+		hit.t = FLT_MAX;
+		numRays++;
+
+		if(!m_scene->getIntersection(curRay, hit, 0.0f, m_intersectionStream))
+		{
+			RGBf envMapColor(0.0f, 0.0f, 0.0f);
+			Vector3 dir = curRay.direction();
+			m_scene->getEnvironmentMap().shade(dir, envMapColor);
+
+			if(depth == 0)
+			{
+				outColor = m_scene->getEnvironmentMap().hasEnvMap() ? envMapColor : m_envColor;
+				if(!m_controller.drawBackground) alpha = 0.0f;
+			}
+			else
+			{
+				outColor += (envMapColor * m_controller.envMapWeight + m_envColor * m_controller.envColWeight) * attenuation;
+			}
+			break;
+		}
+
+		// the pixel cone keeps growing along the path
+		pathDistance += hit.t;
+
+		const ShadingMaterialTable &mats = m_scene->getShadingMaterials();
+		int matIdx = mats.getIndex(hit);
+
+		float footprint = 0.0f;
+		if(hit.modelPtr && (mats.getMapKa(matIdx) || mats.getMapKd(matIdx)))
+			footprint = hit.modelPtr->getTextureFootprint(hit, curRay.direction(), m_pixelSpread * pathDistance);
+
+		RGBf matKa = mats.getKa(matIdx, hit.uv, footprint);
+		RGBf matKd = mats.getKd(matIdx, hit.uv, footprint);
+
+		Vector3 hitPoint = curRay.origin() + hit.t * curRay.direction();
+
+		// two sided surfaces
+		Vector3 normal = hit.n;
+		if(dot(normal, curRay.direction()) > 0.0f) normal = -normal;
+
+		RGBf direct(0.0f, 0.0f, 0.0f);
+		numRays += shadeDirect(hitPoint, normal, matKa, matKd, direct, seed);
+
+		if(m_controller.useAmbientOcclusion)
+		{
+			// ambient term is occluded by the near geometry instead of by the shadow rays
+			RGBf ambient(0.0f, 0.0f, 0.0f);
+			for(int i=0;i<m_scene->getNumEmitters();i++)
+			{
+				const Emitter &emitter = m_scene->getEmitter(i);
+				if(emitter.type != Emitter::ENVIRONMENT_LIGHT) ambient += emitter.color_Ka * matKa;
+			}
+			direct += ambient * computeAmbientOcclusion(hitPoint, normal, seed);
+			numRays += m_controller.numShadowRays > 0 ? m_controller.numShadowRays : 1;
+		}
+
+		outColor += direct * attenuation;
+
+		if(depth == m_controller.pathLength) break;
+
+		// next direction from the BRDF, both use the same seed so that they choose the same lobe
+		float rangeKd, rangeKs;
+		mats.getRanges(matIdx, matKd, rangeKd, rangeKs);
+
+		unsigned int matSeed = seed;
+		Vector3 dir = Material::sampleDirection(normal, curRay.direction(), matSeed, rangeKd, rangeKs, mats.getMat_d(matIdx), mats.getMat_Ns(matIdx));
+		attenuation = attenuation * (Material::isDiffuse(rangeKd, rangeKs, matSeed) ? matKd : mats.getKs(matIdx));
+		lcg(seed);
+
+		if(!(attenuation > RGBf(0.0f, 0.0f, 0.0f))) break;
+
+		curRay.set(hitPoint, dir);
+	}
+
+	// clamp as in the CUDA path tracer to suppress fireflies
+	color.set(RGBf(outColor.e[0] < 1.0f ? outColor.e[0] : 1.0f,
+		outColor.e[1] < 1.0f ? outColor.e[1] : 1.0f,
+		outColor.e[2] < 1.0f ? outColor.e[2] : 1.0f), alpha);
+
+	return numRays;
+}
+
+int CPUPathTracer::shadeDirect(const Vector3 &hitPoint, const Vector3 &normal, const RGBf &matKa, const RGBf &matKd, RGBf &color, unsigned int &seed)
+{
+	int numShadowRays = m_controller.numShadowRays > 0 ? m_controller.numShadowRays : 1;
+	int numRays = 0;
+
+	for(int i=0;i<m_scene->getNumEmitters();i++)
+	{
+		const Emitter &emitter = m_scene->getEmitter(i);
+
+		if(emitter.type == Emitter::ENVIRONMENT_LIGHT) continue;
+
+		RGBf sum(0.0f, 0.0f, 0.0f);
+
+		for(int j=0;j<numShadowRays;j++)
+		{
+			Vector3 samplePos = emitter.sample(seed);
+			lcg(seed);
+
+			Vector3 shadowDir = samplePos - hitPoint;
+			float dist = shadowDir.length();
+			shadowDir.makeUnitVector();
+
+			float cosFactor = dot(shadowDir, normal);
+
+			if(cosFactor <= 0.0f) continue;
+
+			// cast shadow ray
+			float tLimit = dist - INTERSECT_EPSILON;
+
+			HitPointInfo shadowHit;
+			shadowHit.t = tLimit;
+
+			Ray shadowRay;
+			shadowRay.set(hitPoint, shadowDir);
+
+			numRays++;
+
+			if(!m_scene->getIntersection(shadowRay, shadowHit, tLimit, m_intersectionStream))
+			{
+				sum += emitter.color_Kd * matKd * cosFactor;
+				if(!m_controller.useAmbientOcclusion)
+					sum += emitter.color_Ka * matKa;
+			}
+		}
+
+		color += sum / (float)numShadowRays;
+	}
+	return numRays;
+}
+
+float CPUPathTracer::computeAmbientOcclusion(const Vector3 &hitPoint, const Vector3 &normal, unsigned int &seed)
+{
+	int numAORays = m_controller.numShadowRays > 0 ? m_controller.numShadowRays : 1;
+	int numUnoccluded = 0;
+
+	for(int i=0;i<numAORays;i++)
+	{
+		Ray AORay;
+		AORay.set(hitPoint, Material::sampleAmbientOcclusionDirection(normal, seed));
+
+		HitPointInfo AOHit;
+		AOHit.t = m_controller.AODistance;
+
+		if(!m_scene->getIntersection(AORay, AOHit, m_controller.AODistance, m_intersectionStream))
+			numUnoccluded++;
+	}
+	return (float)numUnoccluded / numAORays;
+}
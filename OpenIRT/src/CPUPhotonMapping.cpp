@@ -0,0 +1,267 @@
+#include "CommonOptions.h"
+#include "CPUPhotonMapping.h"
+#include "random.h"
+
+using namespace irt;
+
+CPUPhotonMapping::CPUPhotonMapping(void)
+	: m_pass(0), m_radius2(0.0f)
+{
+}
+
+CPUPhotonMapping::~CPUPhotonMapping(void)
+{
+}
+
+void CPUPhotonMapping::sceneChanged()
+{
+	CPUPathTracer::sceneChanged();
+	restartPasses();
+}
+
+void CPUPhotonMapping::materialChanged()
+{
+	CPUPathTracer::materialChanged();
+	restartPasses();
+}
+
+void CPUPhotonMapping::lightChanged(bool soft)
+{
+	CPUPathTracer::lightChanged(soft);
+	restartPasses();
+}
+
+void CPUPhotonMapping::controllerUpdated()
+{
+	CPUPathTracer::controllerUpdated();
+	restartPasses();
+}
+
+void CPUPhotonMapping::clearResult()
+{
+	CPUPathTracer::clearResult();
+	restartPasses();
+}
+
+void CPUPhotonMapping::restartPasses()
+{
+	m_pass = 0;
+	m_radius2 = 0.0f;
+}
+
+void CPUPhotonMapping::accumulate(Camera *camera, int numSamples, unsigned int seed)
+{
+	// CPUPathTracer::accumulate() clears the accumulated passes when the view is changed
+	bool restart = *camera != m_lastCamera;
+	if(restart)
+		restartPasses();
+
+	// no more passes for a converged result
+	if(m_controller.gatherPhotons && (restart || !isConverged()))
+		tracePhotonPass();
+
+	CPUPathTracer::accumulate(camera, numSamples, seed);
+}
+
+void CPUPhotonMapping::tracePhotonPass()
+{
+	static int timer = StopWatch::create();
+
+	StopWatch::get(timer).reset();
+	StopWatch::get(timer).start();
+
+	int numMaxPhotons = m_scene->getNumMaxPhotons();
+	if((int)m_photons.size() < numMaxPhotons)
+		m_photons.resize(numMaxPhotons);
+
+	int numPhotons = numMaxPhotons > 0 ? m_scene->tracePhotons(numMaxPhotons, &m_photons[0], NULL, m_pass) : 0;
+	m_photonMap.build(numPhotons > 0 ? &m_photons[0] : NULL, numPhotons);
+
+	// r_(i+1)^2 = r_i^2 * (i + alpha) / (i + 1)
+	if(m_pass == 0)
+	{
+		float radius = estimateInitialRadius();
+		m_radius2 = radius*radius;
+	}
+	else
+	{
+		m_radius2 *= (m_pass + PHOTON_RADIUS_ALPHA) / (m_pass + 1);
+	}
+	m_pass++;
+
+	StopWatch::get(timer).stop();
+
+	if(m_controller.printLog)
+		printf("Photon pass %d : %d photons, radius = %f, %f ms\n", m_pass, numPhotons, sqrtf(m_radius2), StopWatch::get(timer).getTime());
+}
+
+float CPUPhotonMapping::estimateInitialRadius()
+{
+	int numPhotons = m_photonMap.getNumPhotons();
+	if(numPhotons == 0) return 0.0f;
+
+	const AABB &bb = m_photonMap.getBB();
+	float maxRadius = (bb.max - bb.min).length();
+
+	// evenly spaced photons are the query points
+	int numQueries = numPhotons < 256 ? numPhotons : 256;
+	float sumRadius = 0.0f;
+	int numValidQueries = 0;
+
+#	pragma omp parallel for schedule(dynamic) reduction(+:sumRadius, numValidQueries)
+	for(int i=0;i<numQueries;i++)
+	{
+		int indices[PHOTON_RADIUS_NUM_NEIGHBORS];
+		float dist2[PHOTON_RADIUS_NUM_NEIGHBORS];
+
+		const Photon &photon = m_photonMap.getPhoton((int)((__int64)i * numPhotons / numQueries));
+		int count = m_photonMap.gatherKNearest(photon.pos, PHOTON_RADIUS_NUM_NEIGHBORS, maxRadius, indices, dist2);
+		if(count > 1)
+		{
+			// the farthest is at the top of the heap
+			sumRadius += sqrtf(dist2[0]);
+			numValidQueries++;
+		}
+	}
+
+	return numValidQueries > 0 ? sumRadius / numValidQueries : maxRadius * 0.01f;
+}
+
+RGBf CPUPhotonMapping::estimateRadiance(const Vector3 &hitPoint, const RGBf &matKd)
+{
+	if(m_radius2 <= 0.0f) return RGBf(0.0f, 0.0f, 0.0f);
+
+	RGBf power;
+	if(!m_photonMap.gatherPower(hitPoint, sqrtf(m_radius2), power)) return RGBf(0.0f, 0.0f, 0.0f);
+
+	// same density estimate as gatherPhotons() in CUDAPhotonMapping
+	return power * matKd / (m_radius2 * PI);
+}
+
+int CPUPhotonMapping::finalGather(const Vector3 &hitPoint, const Vector3 &normal, const RGBf &matKd, RGBf &color, unsigned int &seed)
+{
+	const ShadingMaterialTable &mats = m_scene->getShadingMaterials();
+	int numGatheringRays = m_controller.numGatheringRays;
+	RGBf sum(0.0f, 0.0f, 0.0f);
+
+	for(int i=0;i<numGatheringRays;i++)
+	{
+		// cosine weighted, which cancels the cosine and 1/PI of the diffuse BRDF
+		Ray gatherRay;
+		gatherRay.set(hitPoint, Material::sampleDiffuseDirection(normal, seed));
+		lcg(seed);
+
+		HitPointInfo gatherHit;
+		gatherHit.t = FLT_MAX;
+
+		if(!m_scene->getIntersection(gatherRay, gatherHit, 0.0f, m_intersectionStream))
+		{
+			RGBf envMapColor(0.0f, 0.0f, 0.0f);
+			Vector3 dir = gatherRay.direction();
+			m_scene->getEnvironmentMap().shade(dir, envMapColor);
+			sum += envMapColor * m_controller.envMapWeight + m_envColor * m_controller.envColWeight;
+			continue;
+		}
+
+		int matIdx = mats.getIndex(gatherHit);
+		sum += estimateRadiance(gatherRay.origin() + gatherHit.t * gatherRay.direction(), mats.getKd(matIdx, gatherHit.uv));
+	}
+
+	color += sum * matKd / (float)numGatheringRays;
+	return numGatheringRays;
+}
+
+int CPUPhotonMapping::tracePath(const Ray &ray, RGB4f &color, unsigned int &seed)
+{
+	RGBf outColor(0.0f, 0.0f, 0.0f);
+	RGBf attenuation(1.0f, 1.0f, 1.0f);
+	float alpha = 1.0f;
+	float pathDistance = 0.0f;
+	int numRays = 0;
+
+	bool usePhotons = m_controller.gatherPhotons && m_photonMap.getNumPhotons() > 0;
+
+	Ray curRay = ray;
+	HitPointInfo hit;
+
+	// specular bounces until a diffuse surface, at most pathLength of them
+	for(int depth=0;depth<=m_controller.pathLength;depth++)
+	{
+		hit.t = FLT_MAX;
+		numRays++;
+
+		if(!m_scene->getIntersection(curRay, hit, 0.0f, m_intersectionStream))
+		{
+			RGBf envMapColor(0.0f, 0.0f, 0.0f);
+			Vector3 dir = curRay.direction();
+			m_scene->getEnvironmentMap().shade(dir, envMapColor);
+
+			if(depth == 0)
+			{
+				outColor = m_scene->getEnvironmentMap().hasEnvMap() ? envMapColor : m_envColor;
+				if(!m_controller.drawBackground) alpha = 0.0f;
+			}
+			else
+			{
+				outColor += (envMapColor * m_controller.envMapWeight + m_envColor * m_controller.envColWeight) * attenuation;
+			}
+			break;
+		}
+
+		pathDistance += hit.t;
+
+		const ShadingMaterialTable &mats = m_scene->getShadingMaterials();
+		int matIdx = mats.getIndex(hit);
+
+		float footprint = 0.0f;
+		if(hit.modelPtr && (mats.getMapKa(matIdx) || mats.getMapKd(matIdx)))
+			footprint = hit.modelPtr->getTextureFootprint(hit, curRay.direction(), m_pixelSpread * pathDistance);
+
+		RGBf matKa = mats.getKa(matIdx, hit.uv, footprint);
+		RGBf matKd = mats.getKd(matIdx, hit.uv, footprint);
+
+		Vector3 hitPoint = curRay.origin() + hit.t * curRay.direction();
+
+		Vector3 normal = hit.n;
+		if(dot(normal, curRay.direction()) > 0.0f) normal = -normal;
+
+		float rangeKd, rangeKs;
+		mats.getRanges(matIdx, matKd, rangeKd, rangeKs);
+
+		unsigned int matSeed = seed;
+		if(depth == m_controller.pathLength || Material::isDiffuse(rangeKd, rangeKs, matSeed))
+		{
+			RGBf radiance(0.0f, 0.0f, 0.0f);
+
+			if(usePhotons && m_controller.numGatheringRays <= 0)
+			{
+				// photons are stored at their first diffuse hit, so they already hold direct lighting and caustics
+				radiance = estimateRadiance(hitPoint, matKd);
+			}
+			else
+			{
+				numRays += shadeDirect(hitPoint, normal, matKa, matKd, radiance, seed);
+				if(usePhotons)
+					numRays += finalGather(hitPoint, normal, matKd, radiance, seed);
+			}
+
+			outColor += radiance * attenuation;
+			break;
+		}
+
+		// specular, reflect or refract with the same lobe as isDiffuse()
+		Vector3 dir = Material::sampleDirection(normal, curRay.direction(), matSeed, rangeKd, rangeKs, mats.getMat_d(matIdx), mats.getMat_Ns(matIdx));
+		attenuation = attenuation * mats.getKs(matIdx);
+		lcg(seed);
+
+		if(!(attenuation > RGBf(0.0f, 0.0f, 0.0f))) break;
+
+		curRay.set(hitPoint, dir);
+	}
+
+	color.set(RGBf(outColor.e[0] < 1.0f ? outColor.e[0] : 1.0f,
+		outColor.e[1] < 1.0f ? outColor.e[1] : 1.0f,
+		outColor.e[2] < 1.0f ? outColor.e[2] : 1.0f), alpha);
+
+	return numRays;
+}
@@ -1,9 +1,12 @@
 #include "CommonOptions.h"
 #include "CPURayTracer.h"
+#include "random.h"
+#include "Sampler.h"
 
 using namespace irt;
 
 CPURayTracer::CPURayTracer(void)
+	: m_canUsePackets(false), m_raysPerSecond(0.0f)
 {
 }
 
@@ -31,149 +34,254 @@ void CPURayTracer::done()
 
 void CPURayTracer::resized(int width, int height)
 {
+	m_width = width;
+	m_height = height;
+
+	m_accumulationBuffer.resize(width, height);
 }
 
 void CPURayTracer::sceneChanged()
 {
+	m_accumulationBuffer.clear();
+
+	m_canUsePackets = true;
+
+	if(!m_scene) return;
+
+	// packet traversal does not transform rays into model space
+	ModelList &modelList = m_scene->getModelList();
+	for(size_t i=0;i<modelList.size();i++)
+	{
+		Model *model = modelList[i];
+
+		switch(model->getType())
+		{
+		case Model::OOC_FILE :
+		case Model::HCCMESH :
+		case Model::HCCMESH2 : break;
+		default : m_canUsePackets = false;
+		}
+
+		if(model->getTransfMatrix() != identityMatrix())
+			m_canUsePackets = false;
+	}
 }
 
 void CPURayTracer::materialChanged()
 {
+	m_accumulationBuffer.clear();
+}
+
+void CPURayTracer::lightChanged(bool soft)
+{
+	m_accumulationBuffer.clear();
+}
+
+void CPURayTracer::controllerUpdated()
+{
+	m_accumulationBuffer.clear();
+}
+
+void CPURayTracer::clearResult()
+{
+	m_accumulationBuffer.clear();
 }
 
 #include "HCCMesh.h"
 #include "HCCMesh2.h"
 void CPURayTracer::render(Camera *camera, Image *image, unsigned int seed)
 {
-#	if 1
+	if(image->width != m_width || image->height != m_height)
+		resized(image->width, image->height);
+
+	// image still has the previous frame
+	if(m_controller.tileOrderingType == Controller::HIGHEST_SALIENT_TILE_FIRST)
+		m_tileScheduler.updateSaliency(image);
+
+	accumulate(camera, 1, seed);
+	flushImage(image);
+}
+
+void CPURayTracer::accumulate(Camera *camera, int numSamples, unsigned int seed)
+{
 	static int timer = StopWatch::create();
-	
-	//
-	// set up tiling:
-	//
-	int tileWidth = 16;
-	int tileHeight = 16;
-	int tilesX = image->width / tileWidth;
-	int tilesY = image->height / tileHeight;
-	int numTiles = tilesX * tilesY;	
+
+	// restart when the view is changed
+	if(*camera != m_lastCamera)
+	{
+		m_accumulationBuffer.clear();
+		m_lastCamera = *camera;
+	}
 
 	StopWatch::get(timer).reset();
 	StopWatch::get(timer).start();
-#	pragma omp parallel for schedule(dynamic)
-	for (int curTile = 0; curTile < numTiles; curTile++)
-	{		
-		unsigned int startX = (curTile % tilesX) * tileWidth;
-		unsigned int startY = (unsigned int)(curTile / tilesY) * tileHeight;		
 
-		// normale single ray tracing:
-		float deltaX = 1.0f / (float)image->width;
-		float deltaY = 1.0f / (float)image->height;
+	for(int i=0;i<numSamples;i++)
+	{
+		if(m_controller.useRayPackets && m_canUsePackets)
+			renderPackets(camera);
+		else
+			renderSingleRays(camera);
+	}
+
+	StopWatch::get(timer).stop();
+
+	// only primary rays are counted
+	float time = StopWatch::get(timer).getTime();
+	m_raysPerSecond = time > 0.0f ? (float)m_width * m_height * numSamples / (time * 0.001f) : 0.0f;
+}
+
+void CPURayTracer::flushImage(Image *image)
+{
+	m_accumulationBuffer.flush(image);
+}
+
+void CPURayTracer::getJitter(int x, int y, int sampleIndex, float &jitterX, float &jitterY)
+{
+	if(sampleIndex == 0)
+	{
+		jitterX = jitterY = 0.0f;
+		return;
+	}
+
+	// the first sample is the center, the others follow the scrambled Sobol sequence of the pixel
+	Sampler::get2D((unsigned int)(x + y*m_width), (unsigned int)(sampleIndex - 1), 0, jitterX, jitterY);
+	jitterX -= 0.5f;
+	jitterY -= 0.5f;
+}
 
-		Ray ray;
-		RGB4f outColor;
+void CPURayTracer::renderRegion(Camera *camera, int startX, int startY, int endX, int endY)
+{
+	// normale single ray tracing:
+	float deltaX = 1.0f / (float)m_width;
+	float deltaY = 1.0f / (float)m_height;
 
-		float ypos = deltaY/2.0f + startY*deltaY,
-			xpos = deltaX/2.0f + startX*deltaX;
+	Ray ray;
+	RGB4f outColor;
+	float jitterX, jitterY;
 
-		for (int y = 0; y < tileHeight; y++) 
-		{				
-			xpos = deltaX/2.0f + startX*deltaX;
-			for (int x = 0; x < tileWidth; x++) {									
+	for (int y = startY; y < endY; y++) 
+	{				
+		int imageY = m_height - y - 1;
+		for (int x = startX; x < endX; x++) {									
 
-				camera->getRayWithOrigin(ray, xpos, ypos);
+			getJitter(x, imageY, m_accumulationBuffer.getNumSamples(x, imageY), jitterX, jitterY);
 
-				//to visualize normal, position, and principal directions.
+			camera->getRayWithOrigin(ray, (x + 0.5f + jitterX)*deltaX, (y + 0.5f + jitterY)*deltaY);
 
-				m_scene->trace(ray, outColor);
+			//to visualize normal, position, and principal directions.
 
-				image->setPixel(startX + x, (image->height - (startY + y) - 1), RGBf(outColor.e));
+			m_scene->trace(ray, outColor, 0, 0, 0.0f, 0, m_intersectionStream);
 
-				xpos += deltaX;
-			}
-			ypos += deltaY;
+			m_accumulationBuffer.addSample(x, imageY, outColor);
 		}
 	}
-	StopWatch::get(timer).stop();
-#	else
-	static int timer = StopWatch::create();
-	
+}
+
+double CPURayTracer::renderTileCallBack(const TileScheduler::Tile &tile, void *data)
+{
+	RenderTileData *renderData = (RenderTileData*)data;
+	renderData->renderer->renderRegion(renderData->camera, tile.startX, tile.startY, tile.endX, tile.endY);
+	return (double)(tile.endX - tile.startX) * (tile.endY - tile.startY);
+}
+
+void CPURayTracer::renderSingleRays(Camera *camera)
+{
+	m_tileScheduler.setup(m_width, m_height, m_controller.tileSize, m_controller.tileOrderingType);
+
+	RenderTileData data;
+	data.renderer = this;
+	data.camera = camera;
+	m_tileScheduler.run(renderTileCallBack, &data);
+}
+
+double CPURayTracer::renderPacketTileCallBack(const TileScheduler::Tile &tile, void *data)
+{
+	RenderTileData *renderData = (RenderTileData*)data;
+	renderData->renderer->renderPacketRegion(renderData->camera, tile.startX, tile.startY, tile.endX, tile.endY);
+	return (double)(tile.endX - tile.startX) * (tile.endY - tile.startY);
+}
+
+void CPURayTracer::renderPackets(Camera *camera)
+{
+	// tiles start on the grid of packets, so every pixel is traced as without tiles
+	m_tileScheduler.setup(m_width, m_height, m_controller.tileSize, m_controller.tileOrderingType, TILE_SIZE);
+
+	RenderTileData data;
+	data.renderer = this;
+	data.camera = camera;
+	m_tileScheduler.run(renderPacketTileCallBack, &data);
+}
+
+void CPURayTracer::renderPacketRegion(Camera *camera, int startX, int startY, int endX, int endY)
+{
+	int coveredX = startX + (endX - startX) / TILE_SIZE * TILE_SIZE;
+	int coveredY = startY + (endY - startY) / TILE_SIZE * TILE_SIZE;
+
+	for(int y = startY; y < coveredY; y += TILE_SIZE)
+		for(int x = startX; x < coveredX; x += TILE_SIZE)
+			renderPacket(camera, x, y);
+
+	// pixels which are not covered by packets (right and top borders of the image)
+	if(coveredX < endX) renderRegion(camera, coveredX, startY, endX, coveredY);
+	if(coveredY < endY) renderRegion(camera, startX, coveredY, endX, endY);
+}
+
+void CPURayTracer::renderPacket(Camera *camera, int startX, int startY)
+{
 	static const int nRaysPerSide = TILE_SIZE/2;
 	static const int nRealRaysPerSide = TILE_SIZE;
 	static const int nRays = nRaysPerSide*nRaysPerSide;
 	static const int nRealRays = nRealRaysPerSide*nRealRaysPerSide;
-	int numSubPixelsX = image->width;
-	int numSubPixelsY = image->height;
-	int numPacketsX = numSubPixelsX / nRealRaysPerSide;
-	int numPacketsY = numSubPixelsY / nRealRaysPerSide;
-	int numPackets = numPacketsX * numPacketsY;
 
-	Vector3 corner2 = camera->getCorner2();
+	Vector3 eye = camera->getEye();
+	Vector3 corner = camera->getCorner();
+	Vector3 right = camera->getScaledRight();
+	Vector3 up = camera->getScaledUp();
 
-	float deltax = 1.0f / (float)numSubPixelsX;
-	float deltay = 1.0f / (float)numSubPixelsY;
+	float deltaX = 1.0f / (float)m_width;
+	float deltaY = 1.0f / (float)m_height;
 
-	//static int numThreads = omp_get_max_threads();
+	RayPacket<nRays, true, true, true> rayPacket;
+	RayPacket<nRays, false, true, true> *rayPacketNonCoherent = (RayPacket<nRays, false, true, true> *)((void *)&rayPacket);
 
-////#	define USE_SINGLE_THREAD
-//#	ifdef USE_SINGLE_THREAD
-//	omp_set_num_threads(1);
-//#	else
-//	omp_set_num_threads(max(1, numThreads-1));
-//#	endif
+	__declspec(align(16)) RGB4f colors[nRealRays];
 
-	StopWatch::get(timer).reset();
-	StopWatch::get(timer).start();
-#	pragma omp parallel for schedule(dynamic)
-	for (int curPacket = 0; curPacket < numPackets; curPacket++) 
-	{		
-		RayPacket<nRays, true, true, true> rayPacket;
-		RayPacket<nRays, false, true, true> *rayPacketNonCoherent = (RayPacket<nRays, false, true, true> *)((void *)&rayPacket);
-
-		__declspec(align(16)) RGB4f colors[nRealRays];
-		//__declspec(align(16)) RGB4f colors2[nRealRays];
-
-		for(int i=0;i<nRealRays;i++) colors[i].set(RGBf(), 1.0f);
-
-		unsigned int start_x = (curPacket % numPacketsX)*nRealRaysPerSide;
-		unsigned int start_y = (curPacket / numPacketsX)*nRealRaysPerSide;
-		
-		float ypos = start_y*deltay,
-			xpos = start_x*deltax;
-
-		__declspec(align(16)) float jitter[nRealRays][2] = {0, };
-
-		// initialize beam with real eye-rays:
-		rayPacket.setupForPrimaryRays(camera->getEye(), corner2, camera->getScaledRight(), camera->getScaledUp(), nRaysPerSide, nRaysPerSide, xpos, ypos, deltax, deltay, jitter);
-		
-		//if (rayPacket.hasMatchingDirections())
-			//m_scene->trace(rayPacket, colors, 0, m_intersectionStream);
-		//else
-			m_scene->trace(*rayPacketNonCoherent, colors, 0, m_intersectionStream);
-
-		// fill ray & hit information from packet
-		for(int i=0;i<nRealRays;i++)
-		{
-			unsigned int sX = i % nRealRaysPerSide;
-			unsigned int sY = i / nRealRaysPerSide;
-			unsigned int offset = (sY/2)*nRaysPerSide+(sX/2);
-			unsigned int offset2 = (sY%2)*2+(sX%2);
-
-			unsigned int x = start_x + sX;
-			unsigned int y = image->height - (start_y + sY) - 1;
-
-			/*
-			RGBf color = colors[offset*4 + offset2];
-			float temp = color.e[2];
-			color.e[2] = color.e[0];
-			color.e[0] = temp;
-			*/
-
-			RGB4f color = colors[offset*4 + offset2];
-			
-			image->setPixel(x, y, color);
-		}
+	// same samples as in single ray tracing, rays are ordered by 2x2 blocks in a packet
+	__declspec(align(16)) float jitter[nRealRays][2];
+	for(int i=0;i<nRealRays;i++)
+	{
+		unsigned int sX = i % nRealRaysPerSide;
+		unsigned int sY = i / nRealRaysPerSide;
+		unsigned int offset = (sY/2)*nRaysPerSide+(sX/2);
+		unsigned int offset2 = (sY%2)*2+(sX%2);
+
+		unsigned int x = startX + sX;
+		unsigned int y = m_height - (startY + sY) - 1;
+
+		getJitter(x, y, m_accumulationBuffer.getNumSamples(x, y), jitter[offset*4 + offset2][0], jitter[offset*4 + offset2][1]);
+	}
+
+	rayPacket.setupForPrimaryRays(eye, corner, right, up, nRaysPerSide, nRaysPerSide, 
+		deltaX/2.0f + startX*deltaX, deltaY/2.0f + startY*deltaY, deltaX, deltaY, jitter);
+
+	// boxes are culled by the frustum of corner rays when all the rays have same direction signs
+	if (rayPacket.hasMatchingDirections())
+		m_scene->trace(rayPacket, colors, 0, m_intersectionStream);
+	else
+		m_scene->trace(*rayPacketNonCoherent, colors, 0, m_intersectionStream);
+
+	// fill ray & hit information from packet
+	for(int i=0;i<nRealRays;i++)
+	{
+		unsigned int sX = i % nRealRaysPerSide;
+		unsigned int sY = i / nRealRaysPerSide;
+		unsigned int offset = (sY/2)*nRaysPerSide+(sX/2);
+		unsigned int offset2 = (sY%2)*2+(sX%2);
+
+		unsigned int x = startX + sX;
+		unsigned int y = m_height - (startY + sY) - 1;
+
+		m_accumulationBuffer.addSample(x, y, colors[offset*4 + offset2]);
 	}
-	StopWatch::get(timer).stop();
-	//printf("numHits = %d\n", numHits);
-#	endif
 }
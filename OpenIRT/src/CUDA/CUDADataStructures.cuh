@@ -819,6 +819,8 @@ typedef struct Controller_t
 	float AODistance;
 	float envMapWeight;
 	float envColWeight;
+	bool useRayPackets;		// trace coherent primary rays in packets (CPU ray tracer)
+	float convergenceThreshold;	// relative error of the pixels for adaptive sampling (CPU path tracer), 0 to disable
 } Controller;
 
 typedef struct StatData_t {
@@ -161,6 +161,8 @@ void CUDAPathTracer::render(Camera *camera, Image *image, unsigned int seed)
 	//adaptDataStructures(m_scene, camera, &sceneCUDA, &cameraCUDA);
 
 	extern int g_frame;
+	// no seed given, a new one for each frame
+	if(seed == UINT_MAX) seed = (unsigned int)g_frame;
 
 	if(m_materialUpdated)
 	{
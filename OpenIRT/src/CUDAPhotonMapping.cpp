@@ -108,5 +108,7 @@ void CUDAPhotonMapping::render(Camera *camera, Image *image, unsigned int seed)
 	//adaptDataStructures(m_scene, camera, &sceneCUDA, &cameraCUDA);
 
 	extern int g_frame;
+	// no seed given, a new one for each frame
+	if(seed == UINT_MAX) seed = (unsigned int)g_frame;
 	renderCUDAPhotonMapping((CUDA::Camera*)camera, (CUDA::Image*)&image->width, (CUDA::Controller *)&m_controller, g_frame++, seed);
 }
\ No newline at end of file
@@ -20,6 +20,16 @@ unsigned __stdcall initCUDAContext(void *arg)
 	return 0;
 }
 
+// finest level of a texture in float RGBA, textures are not kept in memory (see BitmapTexture)
+static void convertTextureTo4DFloat(float *dst, BitmapTexture *tex)
+{
+	int numFloat = tex->getWidth()*tex->getHeight()*4;
+	std::vector<unsigned char> texels(numFloat);
+	tex->readLevel(0, &texels[0]);
+	for(int j=0;j<numFloat;j++)
+		dst[j] = texels[j] / 255.0f;
+}
+
 CUDARayTracer::CUDARayTracer(void)
 {
 	m_dstScene = 0;
@@ -90,6 +100,7 @@ int CUDARayTracer::adaptScene(void *srcScene, void *dstScene)
 		modelCUDA.numTris = modelCPU.getNumTriangles();
 		modelCUDA.numNodes = modelCPU.getNumNodes();
 
+		modelCPU.decodeVertices();
 		modelCUDA.verts = (CUDA::Vertex*)modelCPU.getVertex(0);
 		modelCUDA.tris = (CUDA::Triangle*)modelCPU.getTriangle(0);
 		modelCUDA.nodes = (CUDA::BVHNode*)modelCPU.getBV(0);
@@ -112,8 +123,7 @@ int CUDARayTracer::adaptScene(void *srcScene, void *dstScene)
 				mapCUDA->width = (unsigned short)mapCPU->getWidth();
 				mapCUDA->height = (unsigned short)mapCPU->getHeight();
 				mapCUDA->data = new float[mapCUDA->width*mapCUDA->height*4];
-				if(mapCPU->getBpp() == 3) convert3DByteTo4DFloat(mapCUDA->data, mapCPU->getData(), mapCUDA->width*mapCUDA->height*4);
-				if(mapCPU->getBpp() == 4) convert4DByteTo4DFloat(mapCUDA->data, mapCPU->getData(), mapCUDA->width*mapCUDA->height*4);
+				convertTextureTo4DFloat(mapCUDA->data, mapCPU);
 			}
 
 			mapCPU = matCPU.getMapKd();
@@ -124,8 +134,7 @@ int CUDARayTracer::adaptScene(void *srcScene, void *dstScene)
 				mapCUDA->width = (unsigned short)mapCPU->getWidth();
 				mapCUDA->height = (unsigned short)mapCPU->getHeight();
 				mapCUDA->data = new float[mapCUDA->width*mapCUDA->height*4];
-				if(mapCPU->getBpp() == 3) convert3DByteTo4DFloat(mapCUDA->data, mapCPU->getData(), mapCUDA->width*mapCUDA->height*4);
-				if(mapCPU->getBpp() == 4) convert4DByteTo4DFloat(mapCUDA->data, mapCPU->getData(), mapCUDA->width*mapCUDA->height*4);
+				convertTextureTo4DFloat(mapCUDA->data, mapCPU);
 			}
 
 			mapCPU = matCPU.getMapBump();
@@ -136,8 +145,7 @@ int CUDARayTracer::adaptScene(void *srcScene, void *dstScene)
 				mapCUDA->width = (unsigned short)mapCPU->getWidth();
 				mapCUDA->height = (unsigned short)mapCPU->getHeight();
 				mapCUDA->data = new float[mapCUDA->width*mapCUDA->height*4];
-				if(mapCPU->getBpp() == 3) convert3DByteTo4DFloat(mapCUDA->data, mapCPU->getData(), mapCUDA->width*mapCUDA->height*4);
-				if(mapCPU->getBpp() == 4) convert4DByteTo4DFloat(mapCUDA->data, mapCPU->getData(), mapCUDA->width*mapCUDA->height*4);
+				convertTextureTo4DFloat(mapCUDA->data, mapCPU);
 			}
 		}
 
@@ -185,8 +193,7 @@ int CUDARayTracer::adaptScene(void *srcScene, void *dstScene)
 
 			mapCUDA.data = new float[numTexel];
 
-			if(mapCPU.tex[i]->getBpp() == 3) convert3DByteTo4DFloat(mapCUDA.data, mapCPU.tex[i]->getData(), numTexel);
-			if(mapCPU.tex[i]->getBpp() == 4) convert4DByteTo4DFloat(mapCUDA.data, mapCPU.tex[i]->getData(), numTexel);
+			convertTextureTo4DFloat(mapCUDA.data, mapCPU.tex[i]);
 			/*
 			// convert 3D byte color -> 4D float color
 			mapCUDA.data = new float[numTexel];
@@ -1,3 +1,4 @@
 #include "FileMapper.h"
 
-stdext::hash_map<void *, std::pair<HANDLE, HANDLE> > FileMapper::s_handles;
+std::map<void *, FileMapper::Mapping> FileMapper::s_mappings;
+FileMapper::Lock FileMapper::s_lock;
@@ -613,9 +613,9 @@ void GLDebugging::render(SceneNode *sceneNode)
 			glColor4f(matAmbient[0] + matDiffuse[0], matAmbient[1] + matDiffuse[1], matAmbient[2] + matDiffuse[2], (matAmbient[3] + matDiffuse[3])/2);
 
 			glBegin(GL_LINE_LOOP);
-			glVertex3f(model->getVertex(tri->p[0])->v.x(), model->getVertex(tri->p[0])->v.y(), model->getVertex(tri->p[0])->v.z());
-			glVertex3f(model->getVertex(tri->p[1])->v.x(), model->getVertex(tri->p[1])->v.y(), model->getVertex(tri->p[1])->v.z());
-			glVertex3f(model->getVertex(tri->p[2])->v.x(), model->getVertex(tri->p[2])->v.y(), model->getVertex(tri->p[2])->v.z());
+			glVertex3f(model->getPosition(tri->p[0]).x(), model->getPosition(tri->p[0]).y(), model->getPosition(tri->p[0]).z());
+			glVertex3f(model->getPosition(tri->p[1]).x(), model->getPosition(tri->p[1]).y(), model->getPosition(tri->p[1]).z());
+			glVertex3f(model->getPosition(tri->p[2]).x(), model->getPosition(tri->p[2]).y(), model->getPosition(tri->p[2]).z());
 			glEnd();
 		}
 #		endif
@@ -1,39 +1,94 @@
 #include "LRUManager.h"
 #include <string>
-
-template class LRUManager<unsigned char*>;
+#include <process.h>
 
 template <class ElemPtr>
-LRUManager<ElemPtr>::LRUManager(int numElems, int sizeElem, ProcessCacheMissCallBack function, __int64 allowedMem)
+LRUManager<ElemPtr>::LRUManager(int numElems, int sizeElem, ProcessCacheMissCallBack function, __int64 allowedMem, int numShards, int numIOThreads)
 {
 	m_numElems = numElems;
 	m_sizeElem = sizeElem;
 	m_processCacheMissCallBack = function;
 
 	m_cacheSize = allowedMem / sizeElem;
+	if(m_cacheSize < 1) m_cacheSize = 1;
 
-	m_cachedData = new unsigned char[(__int64)m_cacheSize*sizeElem];
+	m_cachedData = (ElemPtr)new unsigned char[(__int64)m_cacheSize*sizeElem];
 
-	m_loaded = new int[numElems];
-	memset(m_loaded, -1, sizeof(int)*numElems);
+	m_loaded = new LONG[numElems];
+	for(int i=0;i<numElems;i++)
+		m_loaded[i] = NOT_LOADED;
 
 	m_assigned = new int[m_cacheSize];
 	memset(m_assigned, -1, sizeof(int)*m_cacheSize);
 
-	m_numUsedCache = 0;
+	m_slotLoading = new char[m_cacheSize];
+	memset((void*)m_slotLoading, 0, m_cacheSize);
+
+	m_clockCount = new char[m_cacheSize];
+	memset((void*)m_clockCount, 0, m_cacheSize);
+
+	m_pinCount = new LONG[m_cacheSize];
+	memset((void*)m_pinCount, 0, sizeof(LONG)*m_cacheSize);
+
+	// each shard needs at least one slot
+	if(numShards < 1) numShards = 1;
+	if(numShards > m_cacheSize) numShards = (int)m_cacheSize;
+	m_numShards = numShards;
+
+	m_shards = new Shard[m_numShards];
+	int firstSlot = 0;
+	for(int i=0;i<m_numShards;i++)
+	{
+		Shard &shard = m_shards[i];
+		shard.firstSlot = firstSlot;
+		shard.numSlots = (int)(m_cacheSize / m_numShards) + (i < m_cacheSize % m_numShards ? 1 : 0);
+		shard.numUsedSlots = 0;
+		shard.curClock = 0;
+		firstSlot += shard.numSlots;
+	}
 
-	m_clockCount = new int[m_cacheSize];
-	memset(m_clockCount, 0, sizeof(int)*m_cacheSize);
-	m_curClock = 0;
+	m_tlsStats = TlsAlloc();
+	m_baseHits = m_baseWaitTicks = 0;
+	resetStats();
+
+	QueryPerformanceFrequency(&m_tickFrequency);
+
+	// I/O threads for prefetch
+	m_exit = false;
+	m_maxPrefetchQueue = m_cacheSize < 4096 ? (int)m_cacheSize : 4096;
+	m_numIOThreads = numIOThreads > 0 ? numIOThreads : 0;
+	m_hQueueSemaphore = CreateSemaphore(NULL, 0, m_maxPrefetchQueue + m_numIOThreads, NULL);
+	m_hIOThreads = m_numIOThreads ? new HANDLE[m_numIOThreads] : NULL;
+	for(int i=0;i<m_numIOThreads;i++)
+		m_hIOThreads[i] = (HANDLE)_beginthreadex(NULL, 0, ioThread, this, 0, NULL);
 }
 
 template <class ElemPtr>
 LRUManager<ElemPtr>::~LRUManager()
 {
-	delete[] m_cachedData;
+	m_exit = true;
+
+	if(m_numIOThreads)
+	{
+		ReleaseSemaphore(m_hQueueSemaphore, m_numIOThreads, NULL);
+		WaitForMultipleObjects(m_numIOThreads, m_hIOThreads, TRUE, INFINITE);
+		for(int i=0;i<m_numIOThreads;i++)
+			CloseHandle(m_hIOThreads[i]);
+		delete[] m_hIOThreads;
+	}
+	CloseHandle(m_hQueueSemaphore);
+
+	delete[] (unsigned char*)m_cachedData;
 	delete[] m_loaded;
 	delete[] m_assigned;
+	delete[] m_slotLoading;
 	delete[] m_clockCount;
+	delete[] m_pinCount;
+	delete[] m_shards;
+
+	TlsFree(m_tlsStats);
+	for(size_t i=0;i<m_threadStats.size();i++)
+		_aligned_free(m_threadStats[i]);
 }
 
 template <class ElemPtr>
@@ -43,34 +98,250 @@ ElemPtr LRUManager<ElemPtr>::operator[](unsigned int idx)
 	if(tablePos < 0)
 	{
 		// Cache miss
-		//printf("%d\t", idx);
-		m_lock.lock();
-		if(m_loaded[idx] < 0)
+		tablePos = load(idx, false);
+	}
+	else
+	{
+		getThreadStats()->hits++;
+	}
+	m_clockCount[tablePos] = 1;
+	return getAddress(tablePos);
+}
+
+template <class ElemPtr>
+ElemPtr LRUManager<ElemPtr>::pin(unsigned int idx, int &slot)
+{
+	while(true)
+	{
+		int tablePos = m_loaded[idx];
+		bool hit = tablePos >= 0;
+		if(!hit)
 		{
-			if(m_numUsedCache < m_cacheSize)
-			{
-				// Cache is not full
-				tablePos = m_numUsedCache++;
-			}
-			else
+			// Cache miss
+			tablePos = load(idx, false);
+		}
+
+		// the pin is seen by claimSlot() unless the element was evicted before (see claimSlot())
+		InterlockedIncrement(&m_pinCount[tablePos]);
+		if(m_loaded[idx] == tablePos)
+		{
+			if(hit) getThreadStats()->hits++;
+			m_clockCount[tablePos] = 1;
+			slot = tablePos;
+			return getAddress(tablePos);
+		}
+
+		// evicted in the meantime
+		InterlockedDecrement(&m_pinCount[tablePos]);
+	}
+}
+
+template <class ElemPtr>
+void LRUManager<ElemPtr>::prefetch(unsigned int idx)
+{
+	if(!m_numIOThreads || m_loaded[idx] != NOT_LOADED) return;
+
+	m_lockQueue.lock();
+	bool queued = (int)m_prefetchQueue.size() < m_maxPrefetchQueue;
+	if(queued) m_prefetchQueue.push_back(idx);
+	m_lockQueue.unlock();
+
+	if(queued) ReleaseSemaphore(m_hQueueSemaphore, 1, NULL);
+}
+
+template <class ElemPtr>
+int LRUManager<ElemPtr>::claimSlot(Shard &shard)
+{
+	if(shard.numUsedSlots < shard.numSlots)
+	{
+		// Cache is not full
+		return shard.firstSlot + shard.numUsedSlots++;
+	}
+
+	// Cache is full, two rounds are enough to clear all the reference bits
+	for(int i=0;i<2*shard.numSlots;i++)
+	{
+		int slot = shard.firstSlot + shard.curClock;
+		shard.curClock = (shard.curClock + 1) % shard.numSlots;
+
+		if(m_slotLoading[slot] || m_pinCount[slot]) continue;
+
+		if(m_clockCount[slot] > 0)
+		{
+			m_clockCount[slot]--;
+			continue;
+		}
+
+		if(m_assigned[slot] >= 0)
+		{
+			// pin() increments the pin count before it checks m_loaded, so either it sees
+			// the element is not loaded any more or the pin is seen here
+			InterlockedExchange(&m_loaded[m_assigned[slot]], NOT_LOADED);
+			if(m_pinCount[slot])
 			{
-				// Cache is full
-				while(m_clockCount[m_curClock] > 0)
-				{
-					m_clockCount[m_curClock]--;
-					m_curClock = (m_curClock + 1) % m_cacheSize;
-				}
-				m_loaded[m_assigned[m_curClock]] = -1;
-				tablePos = m_curClock;
-				m_curClock = (m_curClock + 1) % m_cacheSize;
+				InterlockedExchange(&m_loaded[m_assigned[slot]], slot);
+				continue;
 			}
+			shard.evictions++;
+		}
+		return slot;
+	}
+	return -1;
+}
+
+template <class ElemPtr>
+int LRUManager<ElemPtr>::load(unsigned int idx, bool isPrefetch)
+{
+	Shard &shard = m_shards[idx % m_numShards];
+	LARGE_INTEGER waitStart, waitEnd;
+	bool waited = false;
+	int tablePos;
+
+	while(true)
+	{
+		shard.lock.lock();
+
+		tablePos = m_loaded[idx];
+		if(tablePos >= 0)
+		{
+			// loaded by another thread in the meantime
+			shard.lock.unlock();
+			if(!isPrefetch) getThreadStats()->hits++;
+			break;
+		}
+
+		if(tablePos == NOT_LOADED && (tablePos = claimSlot(shard)) >= 0)
+		{
 			m_assigned[tablePos] = idx;
-			ElemPtr address = (ElemPtr)(((unsigned char*)m_cachedData) + tablePos * m_sizeElem);
-			m_processCacheMissCallBack(idx, address);
-			m_loaded[idx] = tablePos;
+			m_slotLoading[tablePos] = 1;
+			m_loaded[idx] = LOADING;
+			if(isPrefetch)
+				shard.prefetches++;
+			else
+				shard.misses++;
+			shard.lock.unlock();
+
+			// disk I/O without any lock
+			m_processCacheMissCallBack(idx, getAddress(tablePos));
+
+			// publish after the data is written, the slot can be evicted from now on
+			m_clockCount[tablePos] = 1;
+			InterlockedExchange(&m_loaded[idx], tablePos);
+			m_slotLoading[tablePos] = 0;
+			break;
 		}
-		m_lock.unlock();
+
+		shard.lock.unlock();
+
+		// another thread is loading this element (or every slot of the shard)
+		if(isPrefetch) return -1;
+
+		if(!waited)
+		{
+			QueryPerformanceCounter(&waitStart);
+			waited = true;
+		}
+		SwitchToThread();
 	}
-	m_clockCount[tablePos] = 1;
-	return (ElemPtr)(((unsigned char*)m_cachedData) + tablePos * m_sizeElem);
-}
\ No newline at end of file
+
+	if(waited)
+	{
+		QueryPerformanceCounter(&waitEnd);
+		getThreadStats()->waitTicks += waitEnd.QuadPart - waitStart.QuadPart;
+	}
+
+	return tablePos;
+}
+
+template <class ElemPtr>
+unsigned __stdcall LRUManager<ElemPtr>::ioThread(void *arg)
+{
+	LRUManager<ElemPtr> *m = (LRUManager<ElemPtr>*)arg;
+	while(true)
+	{
+		WaitForSingleObject(m->m_hQueueSemaphore, INFINITE);
+		if(m->m_exit) break;
+
+		m->m_lockQueue.lock();
+		unsigned int idx = m->m_prefetchQueue.front();
+		m->m_prefetchQueue.pop_front();
+		m->m_lockQueue.unlock();
+
+		if(m->m_loaded[idx] == NOT_LOADED)
+			m->load(idx, true);
+	}
+	return 0;
+}
+
+template <class ElemPtr>
+typename LRUManager<ElemPtr>::ThreadStats *LRUManager<ElemPtr>::getThreadStats()
+{
+	ThreadStats *stats = (ThreadStats*)TlsGetValue(m_tlsStats);
+	if(stats) return stats;
+
+	stats = (ThreadStats*)_aligned_malloc(sizeof(ThreadStats), 64);
+	memset(stats, 0, sizeof(ThreadStats));
+	TlsSetValue(m_tlsStats, stats);
+
+	m_lockStats.lock();
+	m_threadStats.push_back(stats);
+	m_lockStats.unlock();
+	return stats;
+}
+
+template <class ElemPtr>
+typename LRUManager<ElemPtr>::Stats LRUManager<ElemPtr>::getStats()
+{
+	Stats stats;
+	__int64 waitTicks = 0;
+	stats.hits = stats.misses = stats.prefetches = stats.evictions = 0;
+	for(int i=0;i<m_numShards;i++)
+	{
+		Shard &shard = m_shards[i];
+		shard.lock.lock();
+		stats.misses += shard.misses;
+		stats.prefetches += shard.prefetches;
+		stats.evictions += shard.evictions;
+		shard.lock.unlock();
+	}
+
+	// counters of running threads are read without synchronization, they may be slightly behind
+	m_lockStats.lock();
+	for(size_t i=0;i<m_threadStats.size();i++)
+	{
+		stats.hits += m_threadStats[i]->hits;
+		waitTicks += m_threadStats[i]->waitTicks;
+	}
+	m_lockStats.unlock();
+
+	stats.hits -= m_baseHits;
+	waitTicks -= m_baseWaitTicks;
+	stats.waitTime = (float)(waitTicks * 1000.0 / m_tickFrequency.QuadPart);
+	return stats;
+}
+
+template <class ElemPtr>
+void LRUManager<ElemPtr>::resetStats()
+{
+	for(int i=0;i<m_numShards;i++)
+	{
+		Shard &shard = m_shards[i];
+		shard.lock.lock();
+		shard.misses = 0;
+		shard.prefetches = 0;
+		shard.evictions = 0;
+		shard.lock.unlock();
+	}
+
+	// counters of threads are only written by their threads, remember the current sums instead
+	m_lockStats.lock();
+	m_baseHits = m_baseWaitTicks = 0;
+	for(size_t i=0;i<m_threadStats.size();i++)
+	{
+		m_baseHits += m_threadStats[i]->hits;
+		m_baseWaitTicks += m_threadStats[i]->waitTicks;
+	}
+	m_lockStats.unlock();
+}
+
+template class LRUManager<unsigned char*>;
@@ -24,11 +24,19 @@
 using namespace irt;
 
 Model::Model(void) : 
+m_ID(-1),
 m_vertList(0),
+m_posList(0),
+m_attribList(0),
 m_triList(0),
 m_nodeList(0),
 m_numVerts(0),
 m_numTris(0),
+m_numNodes(0),
+m_wideBVH(0),
+m_packedTris(0),
+m_posStream(0),
+m_posStride(0),
 m_useMTL(0),
 m_visible(true),
 m_enabled(true)
@@ -59,11 +67,30 @@ bool Model::load(const char *fileName)
 {
 	strcpy_s(m_fileName, 256, fileName);
 	char vertFileName[MAX_PATH];
+	char attribFileName[MAX_PATH];
 	char triFileName[MAX_PATH];
 	char nodeFileName[MAX_PATH];
 	char matFileName[MAX_PATH];
 
+	// split vertex streams (GeometryConverter::splitVert() of the Builder) if they exist
+	// and have the same number of vertices as each other and as vertex.ooc
+	sprintf_s(vertFileName, MAX_PATH, "%s\\vertex_pos.ooc", fileName);
+	sprintf_s(attribFileName, MAX_PATH, "%s\\vertex_attrib.ooc", fileName);
+	__int64 sizePos = FileMapper::sizei64(vertFileName);
+	__int64 sizeAttrib = FileMapper::sizei64(attribFileName);
+	bool splitVerts = sizePos >= 0 && sizeAttrib >= 0;
 	sprintf_s(vertFileName, MAX_PATH, "%s\\vertex.ooc", fileName);
+	if(splitVerts)
+	{
+		__int64 numVerts = sizePos / sizeof(VertexPosition);
+		__int64 sizeInterleaved = FileMapper::sizei64(vertFileName);
+		splitVerts = sizePos % sizeof(VertexPosition) == 0 && sizeAttrib == numVerts * sizeof(VertexAttrib) &&
+			(sizeInterleaved < 0 || sizeInterleaved == numVerts * sizeof(Vertex));
+		if(splitVerts)
+			sprintf_s(vertFileName, MAX_PATH, "%s\\vertex_pos.ooc", fileName);
+		else
+			printf("Sizes of vertex_pos.ooc and vertex_attrib.ooc do not match, vertex.ooc is used : %s\n", fileName);
+	}
 	sprintf_s(triFileName, MAX_PATH, "%s\\tris.ooc", fileName);
 	sprintf_s(nodeFileName, MAX_PATH, "%s\\BVH.node", fileName);
 	sprintf_s(matFileName, MAX_PATH, "%s\\material.mtl", fileName);
@@ -99,7 +126,7 @@ bool Model::load(const char *fileName)
 	sizeVert = _filelengthi64(_fileno(fpVert));
 	sizeTri = _filelengthi64(_fileno(fpTri));
 	sizeNode = _filelengthi64(_fileno(fpNode));
-	m_numVerts = (int)(sizeVert / sizeof(Vertex));
+	m_numVerts = (int)(sizeVert / (splitVerts ? sizeof(VertexPosition) : sizeof(Vertex)));
 	m_numTris = (int)(sizeTri / sizeof(Triangle));
 	m_numNodes = (int)(sizeNode / sizeof(BVHNode));
 
@@ -107,13 +134,40 @@ bool Model::load(const char *fileName)
 	fclose(fpVert);
 	fclose(fpTri);
 	fclose(fpNode);
-	m_vertList = (Vertex*)FileMapper::map(vertFileName);
-	m_triList = (Triangle*)FileMapper::map(triFileName);
-	m_nodeList = (BVHNode*)FileMapper::map(nodeFileName);
+	// traversal fetches nodes, triangles and vertices in random order
+	bool mapped;
+	if(splitVerts)
+	{
+		mapped = (m_posList = (VertexPosition*)FileMapper::map(vertFileName, true, FileMapper::HINT_RANDOM)) &&
+			(m_attribList = (VertexAttrib*)FileMapper::map(attribFileName, true, FileMapper::HINT_RANDOM));
+	}
+	else
+		mapped = (m_vertList = (Vertex*)FileMapper::map(vertFileName, true, FileMapper::HINT_RANDOM)) != NULL;
+
+	mapped = mapped &&
+		(m_triList = (Triangle*)FileMapper::map(triFileName, true, FileMapper::HINT_RANDOM)) &&
+		(m_nodeList = (BVHNode*)FileMapper::map(nodeFileName, true, FileMapper::HINT_RANDOM));
+
+	if(!mapped)
+	{
+		// unmaps the files mapped so far
+		unload();
+		return false;
+	}
 #	else
 
 	// allocate memory space
-	if(!(m_vertList = new Vertex[m_numVerts]))
+	if(splitVerts)
+	{
+		m_posList = new VertexPosition[m_numVerts];
+		m_attribList = new VertexAttrib[m_numVerts];
+	}
+	else
+	{
+		m_vertList = new Vertex[m_numVerts];
+	}
+
+	if(!m_posList && !m_vertList)
 	{
 		printf("Memory allocation error : %s\n", vertFileName);
 		return false;
@@ -136,12 +190,30 @@ bool Model::load(const char *fileName)
 	prog.setText(vertFileName);
 
 	// load files
-	if(!fread(m_vertList, (size_t)sizeVert, 1, fpVert))
+	if(!fread(splitVerts ? (void*)m_posList : (void*)m_vertList, (size_t)sizeVert, 1, fpVert))
 	{
 		printf("Read file error : %s\n", vertFileName);
 		return false;
 	}
 
+	if(splitVerts)
+	{
+		FILE *fpAttrib;
+		if(err = fopen_s(&fpAttrib, attribFileName, "rb"))
+		{
+			printf("File open error [%d] : %s", err, attribFileName);
+			return false;
+		}
+
+		if(!fread(m_attribList, sizeof(VertexAttrib)*m_numVerts, 1, fpAttrib))
+		{
+			printf("Read file error : %s\n", attribFileName);
+			fclose(fpAttrib);
+			return false;
+		}
+		fclose(fpAttrib);
+	}
+
 	prog.step();
 	prog.setText(triFileName);
 
@@ -193,6 +265,11 @@ bool Model::load(const char *fileName)
 
 	m_BB.min = getBV(getRootIdx())->min;
 	m_BB.max = getBV(getRootIdx())->max;
+
+	setPositionStream();
+
+	buildWideBVH();
+	buildPackedTriangles();
 	
 	return true;
 }
@@ -208,6 +285,7 @@ bool Model::load(Vertex *vertList, int numVerts, Face *faceList, int numFaces, c
 	if(m_triList) delete[] m_triList;
 
 	m_vertList = new Vertex[numVerts];
+	setPositionStream();
 
 	m_BB.min.set(FLT_MAX);
 	m_BB.max.set(-FLT_MAX);
@@ -279,25 +357,110 @@ bool Model::load(Vertex *vertList, int numVerts, Face *faceList, int numFaces, c
 
 void Model::unload()
 {
+	// vertices decoded from the split streams are never mapped
+	if(m_posList && m_vertList)
+	{
+		delete[] m_vertList;
+		m_vertList = NULL;
+	}
+
 #	ifdef USE_MM
 	if(m_vertList) FileMapper::unmap(m_vertList);
+	if(m_posList) FileMapper::unmap(m_posList);
+	if(m_attribList) FileMapper::unmap(m_attribList);
 	if(m_triList) FileMapper::unmap(m_triList);
 	if(m_nodeList) FileMapper::unmap(m_nodeList);
 #	else
 	if(m_vertList) delete[] m_vertList;
+	if(m_posList) delete[] m_posList;
+	if(m_attribList) delete[] m_attribList;
 	if(m_triList) delete[] m_triList;
 	if(m_nodeList) delete[] m_nodeList;
 #	endif
 
+	if(m_wideBVH) delete m_wideBVH;
+	if(m_packedTris) delete m_packedTris;
+
 	m_vertList = NULL;
+	m_posList = NULL;
+	m_attribList = NULL;
+	m_posStream = NULL;
 	m_triList = NULL;
 	m_nodeList = NULL;
+	m_wideBVH = NULL;
+	m_packedTris = NULL;
 	m_numVerts = m_numTris = m_numNodes = 0;
 }
 
+void Model::buildWideBVH()
+{
+#	ifdef USE_WIDE_BVH
+	if(m_wideBVH) delete m_wideBVH;
+
+	m_wideBVH = new WideBVH<WIDE_BVH_WIDTH>;
+	if(!m_wideBVH->build(m_nodeList, m_numNodes))
+	{
+		delete m_wideBVH;
+		m_wideBVH = NULL;
+	}
+#	endif
+}
+
+void Model::buildPackedTriangles()
+{
+#	ifdef USE_PACKED_TRIANGLES
+	if(m_packedTris) delete m_packedTris;
+
+	m_packedTris = new PackedTriangles<PACKED_TRIANGLE_WIDTH>;
+	if(!m_packedTris->build(this))
+	{
+		delete m_packedTris;
+		m_packedTris = NULL;
+	}
+#	endif
+}
+
+void Model::setPositionStream()
+{
+	if(m_posList)
+	{
+		m_posStream = (const unsigned char*)m_posList;
+		m_posStride = sizeof(VertexPosition);
+	}
+	else
+	{
+		m_posStream = (const unsigned char*)m_vertList;
+		m_posStride = sizeof(Vertex);
+	}
+}
+
+bool Model::decodeVertices()
+{
+	if(m_vertList) return true;
+	if(!m_posList || !m_attribList) return false;
+
+	if(!(m_vertList = new Vertex[m_numVerts]))
+	{
+		printf("Memory allocation error : decoded vertices of %s\n", m_fileName);
+		return false;
+	}
+
+#	pragma omp parallel for
+	for(int i=0;i<m_numVerts;i++)
+	{
+		Vertex &vert = m_vertList[i];
+		vert.v = m_posList[i].v;
+		vert.n = m_attribList[i].getNormal();
+		vert.c = Vector3(0.0f, 0.0f, 0.0f);
+		vert.uv = m_attribList[i].getUV();
+		vert.dummy1 = vert.dummy2 = vert.dummy3 = 0.0f;
+	}
+	return true;
+}
+
 Vertex *Model::getVertex(const Index_t n)
 {
-	return &m_vertList[n];
+	return m_vertList ? &m_vertList[n] : NULL;
 }
 Triangle *Model::getTriangle(const Index_t n)
 {
@@ -405,52 +568,63 @@ bool Model::getIntersection(const Ray &oriRay, HitPointInfo &hitPointInfo, float
 	Ray ray = oriRay;
 	ray.transform(m_invTransfMatrix);
 
-	stack[0].index = getRootIdx();
-	stackPtr = 1;
+	if(m_wideBVH)
+	{
+		hasHit = m_wideBVH->getIntersection(this, ray, hitPointInfo, tLimit);
+		if(tLimit > 0.0f && hasHit)
+		{
+			if(hitPointInfo.t < tLimit) return true;
+		}
+	}
+	else
+	{
+		stack[0].index = getRootIdx();
+		stackPtr = 1;
 
-	currentNode = getBV(stack[0].index);
+		currentNode = getBV(stack[0].index);
 
-	float error_bound = 0.000005f;
+		float error_bound = 0.000005f;
 
-	Index_t lChild;//, rChild;
-	int axis;
-	bool hitTest;
+		Index_t lChild;//, rChild;
+		int axis;
+		bool hitTest;
 
-	// traverse BVH tree:
-	while (true) {
-		// is current node intersected and also closer than previous hit?
-		hitTest = getIntersection(ray, &currentNode->min, tmin, tmax);
+		// traverse BVH tree:
+		while (true) {
+			// is current node intersected and also closer than previous hit?
+			hitTest = getIntersection(ray, &currentNode->min, tmin, tmax);
 
-		if ( hitTest && tmin < hitPointInfo.t && tmax > error_bound) {
+			if ( hitTest && tmin < hitPointInfo.t && tmax > error_bound) {
 
 
-			// is inner node?
-			if (!isLeaf(currentNode)) {
-				// Store ordered children
-				lChild = getLeftChildIdx(currentNode);
+				// is inner node?
+				if (!isLeaf(currentNode)) {
+					// Store ordered children
+					lChild = getLeftChildIdx(currentNode);
 
-				axis = getAxis(currentNode);
+					axis = getAxis(currentNode);
 
-				stack[stackPtr].index = (ray.posneg[axis]) + lChild;
-				currentNode =  getBV(((ray.posneg[axis]^1)) + lChild);
+					stack[stackPtr].index = (ray.posneg[axis]) + lChild;
+					currentNode =  getBV(((ray.posneg[axis]^1)) + lChild);
 
-				++stackPtr;
-				continue;
-			}
-			else {				
-				// is leaf node:
-				// intersect with current node's members
-				hasHit = getIntersection(ray, currentNode, hitPointInfo, min(tmax, hitPointInfo.t)) || hasHit;
-				if(tLimit > 0.0f && hasHit)
-				{
-					if(hitPointInfo.t < tLimit) return true;
+					++stackPtr;
+					continue;
+				}
+				else {				
+					// is leaf node:
+					// intersect with current node's members
+					hasHit = getIntersection(ray, currentNode, hitPointInfo, min(tmax, hitPointInfo.t)) || hasHit;
+					if(tLimit > 0.0f && hasHit)
+					{
+						if(hitPointInfo.t < tLimit) return true;
+					}
 				}
 			}
-		}
-		if (--stackPtr == 0) break;
+			if (--stackPtr == 0) break;
 
-		// fetch next node from stack
-		currentNode = getBV(stack[stackPtr].index);
+			// fetch next node from stack
+			currentNode = getBV(stack[stackPtr].index);
+		}
 	}
 
 	if(hasHit)
@@ -480,64 +654,80 @@ bool Model::getIntersection(const Ray &ray, BVHNode *node, HitPointInfo &hitPoin
 
 	Vector3 triN;
 
-	for(int i=0;i<count;i++, idxList++)
+	if(m_packedTris)
 	{
-		Index_t triID = idxList;
-
-		const Triangle &tri = *getTriangle(triID);
-
-		if(tri.p[0] == tri.p[1] || tri.p[1] == tri.p[2] || tri.p[2] == tri.p[0]) continue;
-
-		assert(tri.i1 <= 2);
-		assert(tri.i2 <= 2);
+		// whole leaf with SIMD, only the hit triangle is fetched
+		foundTri = m_packedTris->getIntersection(ray, idxList, count, tmax, t, alpha, beta);
+		if(foundTri >= 0)
+		{
+			hitPointInfo.alpha = alpha;
+			hitPointInfo.beta = beta;
+			hitPointInfo.t = t;
+			fvdot = dot(ray.direction(), getTriangle(foundTri)->n);
+			tmax = t;
+		}
+	}
+	else
+	{
+		for(int i=0;i<count;i++, idxList++)
+		{
+			Index_t triID = idxList;
 
-		// is ray parallel to plane or a back face ?
-		vdot = dot(ray.direction(), tri.n);
+			const Triangle &tri = *getTriangle(triID);
 
-		if(vdot == 0.0f) continue;
+			if(tri.p[0] == tri.p[1] || tri.p[1] == tri.p[2] || tri.p[2] == tri.p[0]) continue;
 
-		// find parameter t of ray -> intersection point
-		vdot2 = dot(ray.origin(),tri.n);
-		t = (tri.d - vdot2) / vdot;
+			assert(tri.i1 <= 2);
+			assert(tri.i2 <= 2);
 
-		// if either too near or further away than a previous hit, we stop
-		if (t < INTERSECT_EPSILON || t > tmax + INTERSECT_EPSILON)
-			continue;
+			// is ray parallel to plane or a back face ?
+			vdot = dot(ray.direction(), tri.n);
 
-		// intersection point with plane
-		point[0] = ray.data[0].e[tri.i1] + ray.data[1].e[tri.i1] * t;
-		point[1] = ray.data[0].e[tri.i2] + ray.data[1].e[tri.i2] * t;
+			if(vdot == 0.0f) continue;
 
-		// begin barycentric intersection algorithm 
-		const Vector3 &tri_p0 = (*getVertex(tri.p[0])).v; 
-		const Vector3 &tri_p1 = (*getVertex(tri.p[1])).v; 
-		const Vector3 &tri_p2 = (*getVertex(tri.p[2])).v;
+			// find parameter t of ray -> intersection point
+			vdot2 = dot(ray.origin(),tri.n);
+			t = (tri.d - vdot2) / vdot;
 
-		float p0_1 = tri_p0.e[tri.i1], p0_2 = tri_p0.e[tri.i2]; 
-		u0 = point[0] - p0_1; 
-		v0 = point[1] - p0_2; 
-		u1 = tri_p1[tri.i1] - p0_1; 
-		v1 = tri_p1[tri.i2] - p0_2; 
-		u2 = tri_p2[tri.i1] - p0_1; 
-		v2 = tri_p2[tri.i2] - p0_2;
+			// if either too near or further away than a previous hit, we stop
+			if (t < INTERSECT_EPSILON || t > tmax + INTERSECT_EPSILON)
+				continue;
 
-		beta = (v0 * u1 - u0 * v1) / (v2 * u1 - u2 * v1);
-		//if (beta < 0 || beta > 1)
-		if (beta < 0.0f || beta > 1.0f)
-			continue;
-		alpha = (u0 - beta * u2) / u1;	
+			// intersection point with plane
+			point[0] = ray.data[0].e[tri.i1] + ray.data[1].e[tri.i1] * t;
+			point[1] = ray.data[0].e[tri.i2] + ray.data[1].e[tri.i2] * t;
+
+			// begin barycentric intersection algorithm 
+			const Vector3 &tri_p0 = getPosition(tri.p[0]); 
+			const Vector3 &tri_p1 = getPosition(tri.p[1]); 
+			const Vector3 &tri_p2 = getPosition(tri.p[2]);
+
+			float p0_1 = tri_p0.e[tri.i1], p0_2 = tri_p0.e[tri.i2]; 
+			u0 = point[0] - p0_1; 
+			v0 = point[1] - p0_2; 
+			u1 = tri_p1[tri.i1] - p0_1; 
+			v1 = tri_p1[tri.i2] - p0_2; 
+			u2 = tri_p2[tri.i1] - p0_1; 
+			v2 = tri_p2[tri.i2] - p0_2;
+
+			beta = (v0 * u1 - u0 * v1) / (v2 * u1 - u2 * v1);
+			//if (beta < 0 || beta > 1)
+			if (beta < 0.0f || beta > 1.0f)
+				continue;
+			alpha = (u0 - beta * u2) / u1;	
 
-		// not in triangle ?	
-		if (alpha < 0.0f || (alpha + beta) > 1.0f)
-			continue;
+			// not in triangle ?	
+			if (alpha < 0.0f || (alpha + beta) > 1.0f)
+				continue;
 
-		// we have a hit:	
-		hitPointInfo.alpha = alpha;  // .. and barycentric coords
-		hitPointInfo.beta  = beta;
-		hitPointInfo.t = t;
-		fvdot = vdot;
-		foundTri = triID;
-		tmax = t;
+			// we have a hit:	
+			hitPointInfo.alpha = alpha;  // .. and barycentric coords
+			hitPointInfo.beta  = beta;
+			hitPointInfo.t = t;
+			fvdot = vdot;
+			foundTri = triID;
+			tmax = t;
+		}
 	}
 
 	if(foundTri >= 0)
@@ -550,10 +740,6 @@ bool Model::getIntersection(const Ray &ray, BVHNode *node, HitPointInfo &hitPoin
 		//
 		const Triangle &tri = *getTriangle(foundTri);
 
-		const Vertex &v0 = *getVertex(tri.p[0]); 
-		const Vertex &v1 = *getVertex(tri.p[1]); 
-		const Vertex &v2 = *getVertex(tri.p[2]);
-
 		hitPointInfo.m = tri.material;
 
 		hitPointInfo.modelPtr = this;
@@ -565,7 +751,8 @@ bool Model::getIntersection(const Ray &ray, BVHNode *node, HitPointInfo &hitPoin
 		//}
 		//else hitPointInfo.n = *((Vector3*)&tri.n);
 #		ifdef USE_VERTEX_NORMALS
-		hitPointInfo.n = v0.n + hitPointInfo.alpha * (v1.n-v0.n) + hitPointInfo.beta * (v2.n-v0.n);
+		Vector3 n0 = getNormal(tri.p[0]), n1 = getNormal(tri.p[1]), n2 = getNormal(tri.p[2]);
+		hitPointInfo.n = n0 + hitPointInfo.alpha * (n1-n0) + hitPointInfo.beta * (n2-n0);
 #		else
 		hitPointInfo.n = *((Vector3*)&tri.n);
 #		endif
@@ -574,7 +761,8 @@ bool Model::getIntersection(const Ray &ray, BVHNode *node, HitPointInfo &hitPoin
 			hitPointInfo.n *= -1.0f;
 
 		// interpolate tex coords..
-		hitPointInfo.uv = v0.uv + hitPointInfo.alpha * (v1.uv-v0.uv) + hitPointInfo.beta * (v2.uv-v0.uv);
+		Vector2 uv0 = getUV(tri.p[0]), uv1 = getUV(tri.p[1]), uv2 = getUV(tri.p[2]);
+		hitPointInfo.uv = uv0 + hitPointInfo.alpha * (uv1-uv0) + hitPointInfo.beta * (uv2-uv0);
 
 		hitPointInfo.n.makeUnitVector();
 
@@ -586,13 +774,39 @@ bool Model::getIntersection(const Ray &ray, BVHNode *node, HitPointInfo &hitPoin
 
 }
 
+float Model::getTextureFootprint(const HitPointInfo &hit, const Vector3 &rayDir, float coneWidth)
+{
+	// only the triangle list of this class is known here
+	if(getType() != OOC_FILE || hit.tri < 0 || hit.tri >= m_numTris) return 0.0f;
+
+	const Triangle &tri = *getTriangle(hit.tri);
+
+	const Vector3 &p0 = getPosition(tri.p[0]); 
+	const Vector3 &p1 = getPosition(tri.p[1]); 
+	const Vector3 &p2 = getPosition(tri.p[2]);
+	Vector2 uv0 = getUV(tri.p[0]);
+
+	// ratio of the areas in texture and world space (both doubled)
+	float worldArea = cross(p1 - p0, p2 - p0).length();
+	Vector2 t1 = getUV(tri.p[1]) - uv0, t2 = getUV(tri.p[2]) - uv0;
+	float texArea = fabs(t1.e[0]*t2.e[1] - t1.e[1]*t2.e[0]);
+
+	if(worldArea <= 0.0f) return 0.0f;
+
+	// the cone is stretched on grazing angles
+	float cosTheta = fabs(dot(rayDir, hit.n));
+	if(cosTheta < 0.01f) cosTheta = 0.01f;
+
+	return coneWidth * sqrtf(texArea / worldArea) / cosTheta;
+}
+
 void Model::updateTransformedBB(AABB &bb, const Matrix &mat)
 {
 	bb.min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
 	bb.max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	for(int i=0;i<m_numVerts;i++)
 	{
-		const Vector3 &vert = mat * m_vertList[i].v;
+		const Vector3 &vert = mat * getPosition(i);
 		bb.min.setX(min(bb.min.x(), vert.x()));
 		bb.min.setY(min(bb.min.y(), vert.y()));
 		bb.min.setZ(min(bb.min.z(), vert.z()));
@@ -1,7 +1,9 @@
 #include <stdlib.h>
 #include <string>
 #include <direct.h>
+#include <omp.h>
 #include "defines.h"
+#include "FileMapper.h"
 #include "OBJLoader.h"
 
 using namespace irt;
@@ -211,284 +213,495 @@ void OBJLoader::getMaterialName(int subMesh, char *fileName, char *materialName)
 	memcpy_s(materialName, 256, m_groupList[subMesh].materialName.c_str(), m_groupList[subMesh].materialName.length()+1);
 }
 
-void OBJLoader::addSubMesh(GroupInfo &group, vector<FaceStr> &subFaceList)
+void OBJLoader::addSubMesh(GroupInfo &group, FaceRefList &subFaceList)
 {
-	if(subFaceList.size()) 
+	if(subFaceList.size())
 	{
-		m_fList.push_back(subFaceList);
-		subFaceList.clear();
+		m_fList.push_back(FaceRefList());
+		m_fList.back().n.swap(subFaceList.n);
+		m_fList.back().refs.swap(subFaceList.refs);
 		m_groupList.push_back(group);
 	}
 }
 
-bool OBJLoader::load(const char *fileName, bool localizeVertices)
+static inline bool isBlank(char c)
 {
-	FILE *fp;
-	errno_t err;
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
-	if((err = fopen_s(&fp, fileName, "r")) != 0)
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char *skipBlanks(const char *p, const char *end)
+{
+	while(p < end && isBlank(*p)) p++;
+	return p;
+}
+
+static inline const char *skipToken(const char *p, const char *end)
+{
+	while(p < end && !isBlank(*p) && *p != '\n') p++;
+	return p;
+}
+
+static inline const char *parseInt(const char *p, const char *end, int &value)
+{
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+	int v = 0;
+	while(p < end && isDigit(*p)) v = v*10 + (*p++ - '0');
+
+	value = negative ? -v : v;
+	return p;
+}
+
+// Parses a decimal float without strtod(), the mapped file is not null terminated.
+// Accurate to the last bit of a float except for more than 19 significant digits.
+static const char *parseFloat(const char *p, const char *end, float &value)
+{
+	static const double powersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+	const char *start = p;
+
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+	unsigned __int64 mantissa = 0;
+	int numDigits = 0;
+	int exponent = 0;
+	bool hasDigits = false;
+
+	for(;p < end && isDigit(*p);p++, hasDigits = true)
 	{
-		printf("The file '%s' was not opened!\n", fileName);
-		return false;
+		if(numDigits < 19)
+		{
+			mantissa = mantissa*10 + (*p - '0');
+			if(mantissa) numDigits++;
+		}
+		else exponent++;
 	}
 
-	char oldDir[MAX_PATH];
-	_getcwd(oldDir, MAX_PATH-1);
-	_chdir(fileName);		
+	if(p < end && *p == '.')
+	{
+		for(p++;p < end && isDigit(*p);p++, hasDigits = true)
+		{
+			if(numDigits < 19)
+			{
+				mantissa = mantissa*10 + (*p - '0');
+				if(mantissa) numDigits++;
+				exponent--;
+			}
+		}
+	}
 
-	// read raw file
-	char currentLine[1024];
-	char *mainContext;
+	if(!hasDigits)
+	{
+		// inf, nan, ...
+		char buf[64];
+		int len = 0;
+		for(p = start;p < end && len < 63 && !isBlank(*p) && *p != '\n';p++) buf[len++] = *p;
+		buf[len] = 0;
+		value = (float)atof(buf);
+		return p;
+	}
 
-	vector<FaceStr> *pSubFaceList = new vector<FaceStr>;
-	vector<FaceStr> &subFaceList = *pSubFaceList;
-	GroupInfo curGroup;
+	if(p+1 < end && (*p == 'e' || *p == 'E') && (isDigit(p[1]) || ((p[1] == '-' || p[1] == '+') && p+2 < end && isDigit(p[2]))))
+	{
+		int e;
+		p = parseInt(p+1, end, e);
+		exponent += e;
+	}
 
-	vector<string> tempStrVector;
-	while(fgets(currentLine, 1024, fp))
+	double v = (double)mantissa;
+	if(exponent < 0)
+		v = exponent >= -22 ? v / powersOf10[-exponent] : v * pow(10.0, exponent);
+	else if(exponent > 0)
+		v = exponent <= 22 ? v * powersOf10[exponent] : v * pow(10.0, exponent);
+
+	value = (float)(negative ? -v : v);
+	return p;
+}
+
+// reads up to 3 components, missing ones are 0
+static inline const char *parseVector(const char *p, const char *end, Vector3 &v)
+{
+	v.set(0.0f);
+	for(int i=0;i<3;i++)
 	{
-		trim(currentLine);
-		char *type = strtok_s(currentLine, " ", &mainContext);
-		
-		if(type == NULL || type[0] == 0 || type[0] == '#') continue;
+		p = skipBlanks(p, end);
+		if(p == end || *p == '\n' || *p == '#') break;
+		p = skipToken(parseFloat(p, end, v.e[i]), end);
+	}
+	return p;
+}
 
-		if(!strncmp("mtllib", type, 1024))
-		{
-			const char *matFileName = strtok_s(NULL, " ", &mainContext);
-			curGroup.materialFileName = matFileName;
+// v, v/vt, v//vn or v/vt/vn
+static inline const char *parseVertexRef(const char *p, const char *end, OBJLoader::VertexRef &ref)
+{
+	int idx;
+	ref.v = ref.vt = ref.vn = -1;
 
-			char fullMatFileName[256];
-			strncpy_s(fullMatFileName, 256, fileName, strlen(fileName));
-			for(int i=(int)strlen(fullMatFileName)-1;i>=0;i--)
+	p = parseInt(p, end, idx);
+	ref.v = idx-1;
+
+	if(p < end && *p == '/')
+	{
+		p++;
+		if(p < end && *p != '/' && !isBlank(*p) && *p != '\n')
+		{
+			p = parseInt(p, end, idx);
+			ref.vt = idx-1;
+		}
+		if(p < end && *p == '/')
+		{
+			p++;
+			if(p < end && !isBlank(*p) && *p != '\n')
 			{
-				if(fullMatFileName[i] == '/' || fullMatFileName[i] == '\\')
-				{
-					memcpy_s(&fullMatFileName[i+1], 256, matFileName, strlen(matFileName)+1);
-					break;
-				}
-				else if(i == 0)
-				{
-					memcpy_s(fullMatFileName, 256, matFileName, strlen(matFileName)+1);
-				}
+				p = parseInt(p, end, idx);
+				ref.vn = idx-1;
 			}
-			loadMTLMaterial(fullMatFileName);
 		}
+	}
+	return skipToken(p, end);
+}
+
+void OBJLoader::parseChunk(Chunk &chunk)
+{
+	const char *p = chunk.begin;
+	const char *end = chunk.end;
+
+	chunk.BBMin.set(FLT_MAX);
+	chunk.BBMax.set(-FLT_MAX);
+
+	while(p < end)
+	{
+		p = skipBlanks(p, end);
 
-		if(!strncmp("v", type, 1024))
+		const char *type = p;
+		p = skipToken(p, end);
+		size_t typeLen = p - type;
+
+		if(typeLen == 1 && type[0] == 'v')
 		{
 			Vector3 v;
-			for(int i=0;i<3;i++)
-			{
-				char *elem = strtok_s(NULL, " ", &mainContext);
-				if(!elem) break;
-				v.e[i] = (float)atof(elem);
-			}
+			p = parseVector(p, end, v);
 
-			for(int i=0;i<3;i++) m_BBMin.e[i] = min(m_BBMin.e[i], v.e[i]);
-			for(int i=0;i<3;i++) m_BBMax.e[i] = max(m_BBMax.e[i], v.e[i]);
+			for(int i=0;i<3;i++) chunk.BBMin.e[i] = min(chunk.BBMin.e[i], v.e[i]);
+			for(int i=0;i<3;i++) chunk.BBMax.e[i] = max(chunk.BBMax.e[i], v.e[i]);
 
-			m_vList.push_back(v);
+			chunk.v.push_back(v);
 		}
-
-		if(!strncmp("vt", type, 1024))
+		else if(typeLen == 2 && type[0] == 'v' && (type[1] == 't' || type[1] == 'n' || type[1] == 'p'))
 		{
 			Vector3 v;
-			for(int i=0;i<3;i++)
+			p = parseVector(p, end, v);
+
+			switch(type[1])
 			{
-				char *elem = strtok_s(NULL, " ", &mainContext);
-				if(!elem) break;
-				v.e[i] = (float)atof(elem);
+			case 't' : chunk.vt.push_back(v); break;
+			case 'n' : chunk.vn.push_back(v); break;
+			case 'p' : chunk.vp.push_back(v); break;
 			}
-			m_vtList.push_back(v);
 		}
-
-		if(!strncmp("vn", type, 1024))
+		else if(typeLen == 1 && type[0] == 'f')
 		{
-			Vector3 v;
-			for(int i=0;i<3;i++)
+			// the number of vertices of a face is a byte, a larger polygon is split into
+			// pieces sharing its first vertex, which triangulate as the whole polygon
+			size_t first = chunk.faces.refs.size();
+			int n = 0;
+			for(;;n++)
 			{
-				char *elem = strtok_s(NULL, " ", &mainContext);
-				if(!elem) break;
-				v.e[i] = (float)atof(elem);
+				p = skipBlanks(p, end);
+				if(p == end || *p == '\n' || *p == '#') break;
+
+				if(n == 255)
+				{
+					chunk.faces.n.push_back((unsigned char)n);
+
+					// next piece starts with the first and the last vertex of this one
+					VertexRef firstRef = chunk.faces.refs[first];
+					VertexRef lastRef = chunk.faces.refs.back();
+					first = chunk.faces.refs.size();
+					chunk.faces.refs.push_back(firstRef);
+					chunk.faces.refs.push_back(lastRef);
+					n = 2;
+				}
+
+				VertexRef ref;
+				p = parseVertexRef(p, end, ref);
+				chunk.faces.refs.push_back(ref);
 			}
-			m_vnList.push_back(v);
+			chunk.faces.n.push_back((unsigned char)n);
 		}
-
-		if(!strncmp("vp", type, 1024))
+		else if(typeLen > 0 && type[0] != '#')
 		{
-			Vector3 v;
-			for(int i=0;i<3;i++)
+			Command command;
+
+			if(typeLen == 6 && !strncmp(type, "mtllib", 6)) command.type = Command::MTLLIB;
+			else if(typeLen == 6 && !strncmp(type, "usemtl", 6)) command.type = Command::USEMTL;
+			else if(typeLen == 1 && type[0] == 'o') command.type = Command::OBJECT;
+			else if(typeLen == 1 && type[0] == 'g') command.type = Command::GROUP;
+			else if(typeLen == 1 && type[0] == 's') command.type = Command::SMOOTH;
+			else typeLen = 0;
+
+			if(typeLen)
 			{
-				char *elem = strtok_s(NULL, " ", &mainContext);
-				if(!elem) break;
-				v.e[i] = (float)atof(elem);
+				const char *arg = skipBlanks(p, end);
+				p = skipToken(arg, end);
+
+				command.numFacesBefore = chunk.faces.size();
+				command.arg.assign(arg, p - arg);
+				chunk.commands.push_back(command);
 			}
-			m_vpList.push_back(v);
 		}
 
-		if(!strncmp("f", type, 1024))
+		// next line
+		while(p < end && *p != '\n') p++;
+		if(p < end) p++;
+	}
+}
+
+void OBJLoader::runCommand(const Command &command, const char *fileName, GroupInfo &curGroup, FaceRefList &subFaceList)
+{
+	switch(command.type)
+	{
+	case Command::MTLLIB :
 		{
-			FaceStr face;
-			tempStrVector.clear();
-			for(face.n=0;;face.n++)
-			{
-				char *elem = strtok_s(NULL, " ", &mainContext);
-				if(!elem) break;
-				//face.f[face.n] = elem;
-				tempStrVector.push_back(elem);
-			}
+			const char *matFileName = command.arg.c_str();
+			curGroup.materialFileName = matFileName;
 
-			face.f = new string[face.n];
-			for(int i=0;i<face.n;i++)
+			char fullMatFileName[256];
+			strncpy_s(fullMatFileName, 256, fileName, strlen(fileName));
+			for(int i=(int)strlen(fullMatFileName)-1;i>=0;i--)
 			{
-				face.f[i] = tempStrVector[i];
+				if(fullMatFileName[i] == '/' || fullMatFileName[i] == '\\')
+				{
+					memcpy_s(&fullMatFileName[i+1], 256, matFileName, strlen(matFileName)+1);
+					break;
+				}
+				else if(i == 0)
+				{
+					memcpy_s(fullMatFileName, 256, matFileName, strlen(matFileName)+1);
+				}
 			}
-
-			subFaceList.push_back(face);
+			loadMTLMaterial(fullMatFileName);
 		}
+		break;
+	case Command::USEMTL :
+		addSubMesh(curGroup, subFaceList);
+
+		curGroup.materialName = command.arg;
+		break;
+	case Command::OBJECT :
+		//addSubMesh(curGroup, subFaceList);
+		break;
+	case Command::GROUP :
+		//addSubMesh(curGroup, subFaceList);
+
+		//curGroup.name = command.arg;
+		break;
+	case Command::SMOOTH :
+		//addSubMesh(curGroup, subFaceList);
+		break;
+	}
+}
 
-		if(!strncmp("usemtl", type, 1024))
-		{
-			addSubMesh(curGroup, subFaceList);
+static inline void appendFaces(OBJLoader::FaceRefList &dst, const OBJLoader::FaceRefList &src, size_t &face, size_t &ref, size_t lastFace)
+{
+	size_t firstRef = ref;
+	for(size_t i=face;i<lastFace;i++) ref += src.n[i];
 
-			curGroup.materialName = strtok_s(NULL, " ", &mainContext);
-		}
+	dst.n.insert(dst.n.end(), src.n.begin() + face, src.n.begin() + lastFace);
+	dst.refs.insert(dst.refs.end(), src.refs.begin() + firstRef, src.refs.begin() + ref);
+	face = lastFace;
+}
 
-		if(!strncmp("o", type, 1024))
-		{
-			//addSubMesh(curGroup, subFaceList);
-		}
+bool OBJLoader::load(const char *fileName, bool localizeVertices)
+{
+	// an empty file cannot be mapped, it is loaded as an empty model
+	long long size = FileMapper::sizei64(fileName);
+	const char *data = size > 0 ? (const char *)FileMapper::map(fileName, true, FileMapper::HINT_SEQUENTIAL) : NULL;
+	if(!data && size != 0)
+	{
+		printf("The file '%s' was not opened!\n", fileName);
+		return false;
+	}
+	size_t fileSize = data ? (size_t)FileMapper::getMappedSize((void*)data) : 0;
 
-		if(!strncmp("g", type, 1024))
-		{
-			//addSubMesh(curGroup, subFaceList);
+	char oldDir[MAX_PATH];
+	_getcwd(oldDir, MAX_PATH-1);
+	_chdir(fileName);
+
+	//
+	// split the file into line aligned chunks, chunks are parsed in parallel
+	//
+	static const size_t minChunkSize = 1 << 20;
+	int numChunks = omp_get_max_threads() * 4;
+	if(fileSize / minChunkSize + 1 < (size_t)numChunks) numChunks = (int)(fileSize / minChunkSize + 1);
+
+	vector<Chunk> chunks(numChunks);
+	const char *fileEnd = data + fileSize;
+	for(int i=0;i<numChunks;i++)
+	{
+		const char *begin = i == 0 ? data : chunks[i-1].end;
+		const char *end = i == numChunks-1 ? fileEnd : data + fileSize / numChunks * (i+1);
+		if(end < begin) end = begin;
+		while(end < fileEnd && end[-1] != '\n') end++;
 
-			//curGroup.name = strtok_s(NULL, " ", &mainContext);
-		}
+		chunks[i].begin = begin;
+		chunks[i].end = end;
+	}
+
+#	pragma omp parallel for schedule(dynamic)
+	for(int i=0;i<numChunks;i++)
+		parseChunk(chunks[i]);
+
+	//
+	// merge chunks in file order
+	//
+	size_t numV = 0, numVt = 0, numVn = 0, numVp = 0;
+	for(int i=0;i<numChunks;i++)
+	{
+		numV += chunks[i].v.size();
+		numVt += chunks[i].vt.size();
+		numVn += chunks[i].vn.size();
+		numVp += chunks[i].vp.size();
+	}
+	m_vList.reserve(numV);
+	m_vtList.reserve(numVt);
+	m_vnList.reserve(numVn);
+	m_vpList.reserve(numVp);
+
+	FaceRefList subFaceList;
+	GroupInfo curGroup;
+
+	for(int i=0;i<numChunks;i++)
+	{
+		Chunk &chunk = chunks[i];
+
+		m_vList.insert(m_vList.end(), chunk.v.begin(), chunk.v.end());
+		m_vtList.insert(m_vtList.end(), chunk.vt.begin(), chunk.vt.end());
+		m_vnList.insert(m_vnList.end(), chunk.vn.begin(), chunk.vn.end());
+		m_vpList.insert(m_vpList.end(), chunk.vp.begin(), chunk.vp.end());
 
-		if(!strncmp("s", type, 1024))
+		for(int j=0;j<3;j++) m_BBMin.e[j] = min(m_BBMin.e[j], chunk.BBMin.e[j]);
+		for(int j=0;j<3;j++) m_BBMax.e[j] = max(m_BBMax.e[j], chunk.BBMax.e[j]);
+
+		size_t face = 0, ref = 0;
+		for(size_t j=0;j<chunk.commands.size();j++)
 		{
-			//addSubMesh(curGroup, subFaceList);
+			appendFaces(subFaceList, chunk.faces, face, ref, chunk.commands[j].numFacesBefore);
+			runCommand(chunk.commands[j], fileName, curGroup, subFaceList);
 		}
+		appendFaces(subFaceList, chunk.faces, face, ref, chunk.faces.size());
+
+		// release memory of the chunk as early as possible
+		vector<Vector3>().swap(chunk.v);
+		vector<Vector3>().swap(chunk.vt);
+		vector<Vector3>().swap(chunk.vn);
+		vector<Vector3>().swap(chunk.vp);
+		vector<unsigned char>().swap(chunk.faces.n);
+		vector<VertexRef>().swap(chunk.faces.refs);
 	}
 
 	addSubMesh(curGroup, subFaceList);
 
-	delete pSubFaceList;
-
-	fclose(fp);
-
-	map<string, int> *pVertMap = new map<string, int>;
-	map<string, int> &vertMap = *pVertMap;
-	char *context;
-	char str[1024];
-	char *elem;
+	if(data) FileMapper::unmap((void*)data);
 
+	//
+	// unify vertices, a vertex has position, normal, and texture coordinate together
+	//
 	m_hasTextureCoordinates = true;
 	m_hasNormals = true;
 
 	if(localizeVertices) m_groupedVertList.resize(m_fList.size());
-	
+
+	// unified vertices having same position index are chained
+	vector<int> firstOfV(m_vList.size(), -1);
+	vector<int> nextOfVert;
+	vector<int> usedV;
+	size_t oriBase = 0;		// first entry of m_v*OriIndex for the current vertex list
+
+	m_faceList.resize(m_fList.size());
+
 	for(size_t i=0;i<m_fList.size();i++)
 	{
-		vector<Face> *pSubFaceList = new vector<Face>;
-		vector<Face> &subFaceList = *pSubFaceList;
+		FaceRefList &refList = m_fList[i];
 
-		vector<Vertex> *pVertList = &m_vertList;
+		vector<Vertex> &vertList = localizeVertices ? m_groupedVertList[i] : m_vertList;
 
 		if(localizeVertices)
 		{
-			vertMap.clear();
-			pVertList = &m_groupedVertList[i];
+			for(size_t j=0;j<usedV.size();j++) firstOfV[usedV[j]] = -1;
+			usedV.clear();
+			nextOfVert.clear();
+			oriBase = m_vOriIndex.size();
 		}
-		vector<Vertex> &vertList = *pVertList;
 
-		//int idx = 0;
-		for(size_t j=0, k=0;j<m_fList[i].size();j++)
+		vector<Face> &subFaceList = m_faceList[i];
+		subFaceList.resize(refList.size());
+
+		for(size_t j=0, r=0;j<refList.size();j++)
 		{
-			const FaceStr &faceStr = m_fList[i][j];
-			Face face;
-			face.n = faceStr.n;
+			Face &face = subFaceList[j];
+			face.n = refList.n[j];
 			face.verts = new int[face.n];
-			for(int p=0;p<faceStr.n;p++)
+			for(int p=0;p<face.n;p++, r++)
 			{
-				Vertex vert;
-				int vertIdx;
-				int vIdx, vtIdx, vnIdx;
-				map<string, int>::iterator it = vertMap.find(faceStr.f[p]);
-				if(it == vertMap.end())
-				{
-					strncpy_s(str, 1024, faceStr.f[p].c_str(), faceStr.f[p].length());
-					str[faceStr.f[p].length()] = 0;
+				const VertexRef &ref = refList.refs[r];
+				bool hasV = ref.v >= 0 && ref.v < (int)m_vList.size();
+				bool hasVt = ref.vt >= 0 && ref.vt < (int)m_vtList.size();
+				bool hasVn = ref.vn >= 0 && ref.vn < (int)m_vnList.size();
+
+				if(!hasVt) m_hasTextureCoordinates = false;
+				if(!hasVn) m_hasNormals = false;
 
-					if(strstr(str, "//"))
+				int vertIdx = -1;
+				if(hasV)
+				{
+					for(int k=firstOfV[ref.v];k>=0;k=nextOfVert[k])
 					{
-						m_hasTextureCoordinates = false;
-						if(elem = strtok_s(str, " /", &context))
-						{
-							vIdx = atoi(elem)-1;
-							//CONVERT_V4_to_V3(m_vList[vIdx], vert.v);
-							vert.v = m_vList[vIdx];
-						}
-						if(elem = strtok_s(NULL, " /", &context))
+						if(m_vtOriIndex[oriBase+k] == ref.vt && m_vnOriIndex[oriBase+k] == ref.vn)
 						{
-							vnIdx = atoi(elem)-1;
-							vert.n = m_vnList[vnIdx];
+							vertIdx = k;
+							break;
 						}
-						else
-							m_hasNormals = false;
 					}
-					else
-					{
-						if(elem = strtok_s(str, " /", &context))
-						{
-							vIdx = atoi(elem)-1;
-							//CONVERT_V4_to_V3(m_vList[vIdx], vert.v);
-							vert.v = m_vList[vIdx];
-						}
-						if(elem = strtok_s(NULL, " /", &context))
-						{
-							vtIdx = atoi(elem)-1;
-							CONVERT_V3_to_V2(m_vtList[vtIdx], vert.uv);
-						}
-						else
-							m_hasTextureCoordinates = false;
+				}
 
-						if(elem = strtok_s(NULL, " /", &context))
-						{
-							vnIdx = atoi(elem)-1;
-							vert.n = m_vnList[vnIdx];
-						}
-						else
-							m_hasNormals = false;
+				if(vertIdx < 0)
+				{
+					Vertex vert;
+					if(hasV) vert.v = m_vList[ref.v];
+					if(hasVt) CONVERT_V3_to_V2(m_vtList[ref.vt], vert.uv);
+					if(hasVn) vert.n = m_vnList[ref.vn];
 
-					}
 					vertIdx = (int)vertList.size();
-					vertMap[faceStr.f[p]] = vertIdx;
 					vertList.push_back(vert);
 
+					nextOfVert.push_back(hasV ? firstOfV[ref.v] : -1);
+					if(hasV)
+					{
+						if(firstOfV[ref.v] < 0) usedV.push_back(ref.v);
+						firstOfV[ref.v] = vertIdx;
+					}
+
 					// keep original index of each vertex component
-					m_vOriIndex.push_back(vIdx);
-					m_vtOriIndex.push_back(vtIdx);
-					m_vnOriIndex.push_back(vnIdx);
-				}
-				else
-				{
-					vert = vertList[it->second];
-					vertIdx = it->second;
+					m_vOriIndex.push_back(ref.v);
+					m_vtOriIndex.push_back(ref.vt);
+					m_vnOriIndex.push_back(ref.vn);
 				}
 				face.verts[p] = vertIdx;
 			}
-
-			subFaceList.push_back(face);
-
-			delete[] faceStr.f;
 		}
-		m_faceList.push_back(subFaceList);
-		delete pSubFaceList;
-	}
 
-	delete pVertMap;
+		vector<VertexRef>().swap(refList.refs);
+	}
 
 	_chdir(oldDir);
 	return true;
@@ -9,6 +9,7 @@
 #include <stopwatch.h>
 #include "OpenIRT.h"
 #include "Renderer.h"
+#include "FileMapper.h"
 
 #ifndef fminf
 #define fminf(a,b) (((a) < (b)) ? (a) : (b))
@@ -23,6 +24,7 @@
 using namespace irt;
 
 OOCVoxelManager::OOCVoxelManager(Octree *highOctree, const char *fileBase, int oriNumVoxels, const Vector3 &thresholdSize, int allowedMemMB)
+	: m_voxelFile(NULL), m_photonVoxelFile(NULL)
 {
 #	ifndef USE_OOCVOXEL
 	return;
@@ -62,31 +64,21 @@ OOCVoxelManager::OOCVoxelManager(Octree *highOctree, const char *fileBase, int o
 	m_requestCountListSize = numOOCVoxels;
 	m_requestCountList = new float[m_requestCountListSize];
 
-	BY_HANDLE_FILE_INFORMATION fileInfo;
-	// map voxel file
+	// map voxel file, voxels of requested subtrees are fetched in random order
 	sprintf_s(fileName, 255, "%s_OOCVoxel.ooc", fileBase);
-	m_hVoxelFile = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	if(!m_hVoxelFile)
+	if(!(m_voxelFile = (Voxel*)FileMapper::map(fileName, true, FileMapper::HINT_RANDOM)))
 	{
 		printf("Cannot find %s\n", fileName);
 		return;
 	}
-	GetFileInformationByHandle(m_hVoxelFile, &fileInfo);
-	m_hVoxelMap = CreateFileMapping(m_hVoxelFile, NULL, PAGE_READONLY, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	m_voxelFile = (Voxel*)MapViewOfFile(m_hVoxelMap, FILE_MAP_READ, 0, 0, 0);
 
 	// map photon voxel file
-
 	sprintf_s(fileName, 255, "%s_photonVoxel.ooc", fileBase);
-	m_hPhotonVoxelFile = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
-	if(!m_hPhotonVoxelFile)
+	if(!(m_photonVoxelFile = (PhotonVoxel*)FileMapper::map(fileName, true, FileMapper::HINT_RANDOM)))
 	{
 		printf("Cannot find %s\n", fileName);
 		return;
 	}
-	GetFileInformationByHandle(m_hPhotonVoxelFile, &fileInfo);
-	m_hPhotonVoxelMap = CreateFileMapping(m_hPhotonVoxelFile, NULL, PAGE_READONLY, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow, NULL);
-	m_photonVoxelFile = (PhotonVoxel*)MapViewOfFile(m_hPhotonVoxelMap, FILE_MAP_READ, 0, 0, 0);
 
 	m_in = new int[numOOCVoxels*2];
 	m_out = new int[numOOCVoxels*4];
@@ -112,13 +104,9 @@ OOCVoxelManager::~OOCVoxelManager()
 		m_hLoadingThread = NULL;
 	}
 
-	UnmapViewOfFile(m_voxelFile);
-	CloseHandle(m_hVoxelMap);
-	CloseHandle(m_hVoxelFile);
+	if(m_voxelFile) FileMapper::unmap(m_voxelFile);
+	if(m_photonVoxelFile) FileMapper::unmap(m_photonVoxelFile);
 
-	UnmapViewOfFile(m_photonVoxelFile);
-	CloseHandle(m_hPhotonVoxelMap);
-	CloseHandle(m_hPhotonVoxelFile);
 	delete[] m_in;
 	delete[] m_out;
 	delete[] m_requestCountList;
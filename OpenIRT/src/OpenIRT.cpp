@@ -9,6 +9,8 @@
 #include "handler.h"
 
 #include "CPURayTracer.h"
+#include "CPUPathTracer.h"
+#include "CPUPhotonMapping.h"
 #include "GLDebugging.h"
 #include "SimpleRasterizer.h"
 #include "CUDARayTracer.h"
@@ -135,6 +137,12 @@ void OpenIRT::resetRenderer(RendererType::Type rendererType, void *renderingCont
 	case RendererType::CPU_RAY_TRACER :
 		m_renderer = new CPURayTracer();
 		break;
+	case RendererType::CPU_PATH_TRACER :
+		m_renderer = new CPUPathTracer();
+		break;
+	case RendererType::CPU_PHOTON_MAPPING :
+		m_renderer = new CPUPhotonMapping();
+		break;
 	case RendererType::DEBUGGING :
 		m_renderer = new GLDebugging();
 		((GLDebugging*)m_renderer)->initGL(m_width, m_height, renderingContext, renderingDC);
@@ -201,7 +209,7 @@ void OpenIRT::prepareRender()
 	if(m_renderer) m_renderer->prepareRender();
 }
 
-void OpenIRT::render(Image *image, unsigned int seed)
+void OpenIRT::render(Image *image, unsigned int seed, int numSamples)
 {
 	if(!m_isInitialized)
 	{
@@ -218,14 +226,19 @@ void OpenIRT::render(Image *image, unsigned int seed)
 			m_renderer->resized(image->width, image->height);
 	}
 
-	if(seed == UINT_MAX)
+	// UINT_MAX is passed on, the renderer chooses the seed of each frame.
+	// Samples of an explicit seed use the following seeds.
+	StopWatch::get(m_timer).start();
+	if(m_renderer->canAccumulate())
 	{
-		static unsigned int iter = 0;
-		seed = iter++;
+		m_renderer->accumulate(m_currentCamera, numSamples, seed);
+		if(image) m_renderer->flushImage(image);
+	}
+	else
+	{
+		for(int i=0;i<numSamples;i++)
+			m_renderer->render(m_currentCamera, image, seed == UINT_MAX ? UINT_MAX : seed + i);
 	}
-
-	StopWatch::get(m_timer).start();
-	m_renderer->render(m_currentCamera, image, seed);
 	StopWatch::get(m_timer).stop();
 
 
@@ -256,6 +269,7 @@ void OpenIRT::resized(int width, int height)
 
 void OpenIRT::materialChanged()
 {
+	if(m_currentScene) m_currentScene->buildShadingMaterials();
 	m_renderer->materialChanged();
 }
 
@@ -295,6 +309,11 @@ float OpenIRT::getCurrentFrameTime()
 	return m_currentFrameTime;
 }
 
+bool OpenIRT::isConverged()
+{
+	return m_renderer ? m_renderer->isConverged() : false;
+}
+
 float OpenIRT::getCurrentFPS()
 {
 	return m_currentFPS;
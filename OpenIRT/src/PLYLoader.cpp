@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <string>
 #include <direct.h>
+#include <xmmintrin.h>
 #include "defines.h"
 #include "PLYLoader.h"
+#include "FileMapper.h"
 #include "ply.h"
 
 using namespace irt;
@@ -27,7 +29,7 @@ static PlyProperty face_props[] = { /* list of property information for a face *
 using namespace irt;
 
 PLYLoader::PLYLoader(void)
-	: m_hasTextureCoordinates(0), m_hasNormals(0)
+	: m_hasTextureCoordinates(0), m_hasNormals(0), m_indexPool(0)
 {
 	m_BBMin.set(FLT_MAX);
 	m_BBMax.set(-FLT_MAX);
@@ -40,9 +42,17 @@ PLYLoader::~PLYLoader(void)
 
 void PLYLoader::clear(void)
 {
-	for(size_t i=0;i<m_faceList.size();i++)
+	if(m_indexPool)
 	{
-		if(m_faceList[i].verts) delete[] m_faceList[i].verts;
+		delete[] m_indexPool;
+		m_indexPool = NULL;
+	}
+	else
+	{
+		for(size_t i=0;i<m_faceList.size();i++)
+		{
+			if(m_faceList[i].verts) delete[] m_faceList[i].verts;
+		}
 	}
 
 	m_faceList.clear();
@@ -53,6 +63,7 @@ void PLYLoader::clear(void)
 }
 
 PLYLoader::PLYLoader(const char *fileName)
+	: m_hasTextureCoordinates(0), m_hasNormals(0), m_indexPool(0)
 {
 	load(fileName);
 }
@@ -89,6 +100,10 @@ int PLYLoader::getNumFaces()
 
 bool PLYLoader::load(const char *fileName)
 {
+	clear();
+
+	if(loadBinary(fileName)) return true;
+
 	PlyFile *plyFile = open_ply_for_read((char*)fileName);
 
 	if(!plyFile)
@@ -173,9 +188,289 @@ bool PLYLoader::load(const char *fileName)
 	/* close the PLY file */
 	close_ply (plyFile);
 	free_ply (plyFile);
+
+	computeBB();
+	return true;
+}
+
+// size in bytes of a scalar type of PLY, 0 if unknown
+static int getPlyTypeSize(const char *typeName)
+{
+	static const char *names[] = {"char", "int8", "uchar", "uint8", "short", "int16", "ushort", "uint16",
+		"int", "int32", "uint", "uint32", "float", "float32", "double", "float64"};
+	static const int sizes[] = {1, 1, 1, 1, 2, 2, 2, 2, 4, 4, 4, 4, 4, 4, 8, 8};
+
+	for(int i=0;i<16;i++)
+		if(!strcmp(typeName, names[i])) return sizes[i];
+	return 0;
+}
+
+bool PLYLoader::loadBinary(const char *fileName)
+{
+	// vertex properties converted by the fast path
+	static const char *propNames[] = {"x", "y", "z", "nx", "ny", "nz", "s", "t"};
+	enum {X, Y, Z, NX, NY, NZ, S, T, NUM_PROPS};
+
+	const char *data = (const char *)FileMapper::map(fileName, true, FileMapper::HINT_SEQUENTIAL);
+	if(!data) return false;
+
+	long long fileSize = FileMapper::getMappedSize((void*)data);
+
+	//
+	// parse header
+	//
+	long long headerSize = 0;
+	for(long long i=0;i+10<=fileSize && i<65536 && !headerSize;i++)
+	{
+		if(data[i] == 'e' && !strncmp(&data[i], "end_header", 10) && (i == 0 || data[i-1] == '\n'))
+		{
+			for(i+=10;i<fileSize && data[i] != '\n';i++) ;
+			headerSize = i+1;
+		}
+	}
+
+	if(!headerSize || strncmp(data, "ply", 3))
+	{
+		FileMapper::unmap((void*)data);
+		return false;
+	}
+
+	char *header = new char[(size_t)headerSize+1];
+	memcpy(header, data, (size_t)headerSize);
+	header[headerSize] = 0;
+
+	bool supported = true;
+	bool isBinaryLE = false;
+	int element = -1;		// 0 : vertex, 1 : face
+	int numVerts = 0, numFaces = 0, numFaceProps = 0;
+	int vertexSize = 0;
+	int offsets[NUM_PROPS];
+	for(int i=0;i<NUM_PROPS;i++) offsets[i] = -1;
+
+	char *lineContext, *context;
+	for(char *line = strtok_s(header, "\r\n", &lineContext);line;line = strtok_s(NULL, "\r\n", &lineContext))
+	{
+		char *keyword = strtok_s(line, " ", &context);
+		if(!keyword) continue;
+
+		if(!strcmp(keyword, "format"))
+		{
+			char *format = strtok_s(NULL, " ", &context);
+			isBinaryLE = format && !strcmp(format, "binary_little_endian");
+		}
+		else if(!strcmp(keyword, "element"))
+		{
+			char *name = strtok_s(NULL, " ", &context);
+			char *count = strtok_s(NULL, " ", &context);
+			if(!name || !count) {supported = false; break;}
+
+			// vertices then faces, nothing else
+			element++;
+			if(element == 0 && !strcmp(name, "vertex")) numVerts = atoi(count);
+			else if(element == 1 && !strcmp(name, "face")) numFaces = atoi(count);
+			else {supported = false; break;}
+		}
+		else if(!strcmp(keyword, "property"))
+		{
+			char *type = strtok_s(NULL, " ", &context);
+			if(!type) {supported = false; break;}
+
+			if(element == 0)
+			{
+				char *name = strtok_s(NULL, " ", &context);
+				int size = getPlyTypeSize(type);
+				if(!name || !size) {supported = false; break;}
+
+				for(int i=0;i<NUM_PROPS;i++)
+				{
+					if(strcmp(name, propNames[i])) continue;
+
+					// converted properties should be floats, others are skipped
+					if(strcmp(type, "float") && strcmp(type, "float32")) supported = false;
+					offsets[i] = vertexSize;
+				}
+				vertexSize += size;
+			}
+			else if(element == 1)
+			{
+				char *countType = strtok_s(NULL, " ", &context);
+				char *indexType = strtok_s(NULL, " ", &context);
+				char *name = strtok_s(NULL, " ", &context);
+
+				if(strcmp(type, "list") || !countType || !indexType || !name || getPlyTypeSize(countType) != 1 || 
+					(strcmp(indexType, "int") && strcmp(indexType, "int32") && strcmp(indexType, "uint") && strcmp(indexType, "uint32")) ||
+					(strcmp(name, "vertex_indices") && strcmp(name, "vertex_index")))
+				{
+					supported = false;
+				}
+				numFaceProps++;
+			}
+			else supported = false;
+		}
+		if(!supported) break;
+	}
+	delete[] header;
+
+	if(!supported || !isBinaryLE || element < 0 || numVerts <= 0 || numFaces < 0 || (element == 1 && numFaceProps != 1) ||
+		offsets[X] < 0 || offsets[Y] < 0 || offsets[Z] < 0 || headerSize + (long long)numVerts * vertexSize > fileSize)
+	{
+		FileMapper::unmap((void*)data);
+		return false;
+	}
+
+	const char *vertData = data + headerSize;
+	const unsigned char *faceData = (const unsigned char *)vertData + (long long)numVerts * vertexSize;
+	long long faceDataSize = fileSize - (headerSize + (long long)numVerts * vertexSize);
+
+	//
+	// locate index lists, faces are usually all triangles
+	//
+	int numNonTriangles = 0;
+	if(faceDataSize >= (long long)numFaces * 13)
+	{
+#		pragma omp parallel for reduction(+:numNonTriangles)
+		for(int i=0;i<numFaces;i++)
+			if(faceData[(long long)i * 13] != 3) numNonTriangles++;
+	}
+	else numNonTriangles = numFaces;
+
+	// byte offset of each face if the faces are not all triangles
+	vector<long long> faceOffsets;
+	long long numIndices = (long long)numFaces * 3;
+	if(numNonTriangles)
+	{
+		faceOffsets.resize(numFaces);
+
+		long long offset = 0;
+		int i = 0;
+		for(;i<numFaces && offset<faceDataSize;i++)
+		{
+			faceOffsets[i] = offset;
+			offset += 1 + faceData[offset] * 4;
+		}
+
+		// truncated file
+		if(i < numFaces || offset > faceDataSize)
+		{
+			FileMapper::unmap((void*)data);
+			return false;
+		}
+
+		// index i of a face starts at (offset - i) / 4 in the index pool
+		numIndices = (offset - numFaces) / 4;
+	}
+
+	//
+	// convert vertices
+	//
+	m_vertList.resize(numVerts);
+
+	m_hasNormals = offsets[NX] >= 0;
+	m_hasTextureCoordinates = offsets[S] >= 0;
+
+	bool xyzPacked = offsets[Y] == offsets[X] + 4 && offsets[Z] == offsets[X] + 8;
+	bool normalPacked = m_hasNormals && offsets[NY] == offsets[NX] + 4 && offsets[NZ] == offsets[NX] + 8;
+	bool uvPacked = m_hasTextureCoordinates && offsets[T] == offsets[S] + 4;
+
+	static const int dstOffsets[NUM_PROPS] = {
+		offsetof(Vertex,v) / 4 + 0, offsetof(Vertex,v) / 4 + 1, offsetof(Vertex,v) / 4 + 2,
+		offsetof(Vertex,n) / 4 + 0, offsetof(Vertex,n) / 4 + 1, offsetof(Vertex,n) / 4 + 2,
+		offsetof(Vertex,uv) / 4 + 0, offsetof(Vertex,uv) / 4 + 1};
+
+#	pragma omp parallel for schedule(static, 4096)
+	for(int i=0;i<numVerts;i++)
+	{
+		const char *src = vertData + (long long)i * vertexSize;
+		Vertex &vert = m_vertList[i];
+		float *dst = (float *)&vert;
+
+		// 16 bytes are loaded for 12, the last vertex is converted one by one
+		bool canOverRead = i+1 < numVerts;
+
+		if(xyzPacked && canOverRead)
+			_mm_storeu_ps(vert.v.e, _mm_loadu_ps((const float *)(src + offsets[X])));
+		else
+			for(int j=X;j<=Z;j++) dst[dstOffsets[j]] = *(const float *)(src + offsets[j]);
+
+		if(normalPacked && canOverRead)
+			_mm_storeu_ps(vert.n.e, _mm_loadu_ps((const float *)(src + offsets[NX])));
+		else if(m_hasNormals)
+			for(int j=NX;j<=NZ;j++) if(offsets[j] >= 0) dst[dstOffsets[j]] = *(const float *)(src + offsets[j]);
+
+		if(uvPacked)
+			_mm_storel_pi((__m64 *)vert.uv.e, _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(src + offsets[S])));
+		else if(m_hasTextureCoordinates)
+			for(int j=S;j<=T;j++) if(offsets[j] >= 0) dst[dstOffsets[j]] = *(const float *)(src + offsets[j]);
+	}
+
+	//
+	// convert faces, index lists point into one pool
+	//
+	m_faceList.resize(numFaces);
+	m_indexPool = numIndices ? new int[(size_t)numIndices] : NULL;
+
+	if(!numNonTriangles)
+	{
+#		pragma omp parallel for schedule(static, 4096)
+		for(int i=0;i<numFaces;i++)
+		{
+			Face &face = m_faceList[i];
+			face.n = 3;
+			face.verts = &m_indexPool[(long long)i * 3];
+			memcpy(face.verts, &faceData[(long long)i * 13 + 1], sizeof(int) * 3);
+		}
+	}
+	else
+	{
+#		pragma omp parallel for schedule(static, 4096)
+		for(int i=0;i<numFaces;i++)
+		{
+			Face &face = m_faceList[i];
+			face.n = faceData[faceOffsets[i]];
+			face.verts = &m_indexPool[(faceOffsets[i] - i) / 4];
+			memcpy(face.verts, &faceData[faceOffsets[i] + 1], sizeof(int) * face.n);
+		}
+	}
+
+	FileMapper::unmap((void*)data);
+
+	computeBB();
 	return true;
 }
 
+void PLYLoader::computeBB()
+{
+	m_BBMin.set(FLT_MAX);
+	m_BBMax.set(-FLT_MAX);
+
+	int numVerts = (int)m_vertList.size();
+
+#	pragma omp parallel
+	{
+		__m128 bbMin = _mm_set1_ps(FLT_MAX);
+		__m128 bbMax = _mm_set1_ps(-FLT_MAX);
+
+#		pragma omp for schedule(static, 4096)
+		for(int i=0;i<numVerts;i++)
+		{
+			// fourth component is a padding of Vertex
+			__m128 v = _mm_loadu_ps(m_vertList[i].v.e);
+			bbMin = _mm_min_ps(bbMin, v);
+			bbMax = _mm_max_ps(bbMax, v);
+		}
+
+		__declspec(align(16)) float localMin[4], localMax[4];
+		_mm_store_ps(localMin, bbMin);
+		_mm_store_ps(localMax, bbMax);
+
+#		pragma omp critical
+		{
+			for(int i=0;i<3;i++) m_BBMin.e[i] = min(m_BBMin.e[i], localMin[i]);
+			for(int i=0;i<3;i++) m_BBMax.e[i] = max(m_BBMax.e[i], localMax[i]);
+		}
+	}
+}
+
 bool PLYLoader::hasTextureCoordinates(void)
 {
 	return m_hasTextureCoordinates;
@@ -0,0 +1,288 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include <float.h>
+#include <vector>
+#include <xmmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include <stopwatch.h>
+#include "Model.h"
+#include "PackedTriangles.h"
+
+using namespace irt;
+
+template <int N>
+PackedTriangles<N>::PackedTriangles(void)
+	: m_packets(0), m_numPackets(0), m_leafPacket(0), m_numTris(0)
+{
+}
+
+template <int N>
+PackedTriangles<N>::~PackedTriangles(void)
+{
+	clear();
+}
+
+template <int N>
+void PackedTriangles<N>::clear()
+{
+	if(m_packets) _aligned_free(m_packets);
+	if(m_leafPacket) delete[] m_leafPacket;
+	m_packets = NULL;
+	m_leafPacket = NULL;
+	m_numPackets = m_numTris = 0;
+}
+
+template <int N>
+bool PackedTriangles<N>::build(Model *model)
+{
+	clear();
+
+	int numNodes = model->getNumNodes();
+	int numTris = model->getNumTriangles();
+	if(numNodes <= 0 || numTris <= 0) return false;
+
+	const BVHNode *nodes = model->getBV(model->getRootIdx());
+
+	static int timer = StopWatch::create();
+	StopWatch::get(timer).reset();
+	StopWatch::get(timer).start();
+
+	m_numTris = numTris;
+	m_leafPacket = new unsigned int[numTris];
+	for(int i=0;i<numTris;i++)
+		m_leafPacket[i] = EMPTY;
+
+	// leaves in the order of the node list, each gets ceil(count / N) packets
+	std::vector<int> leaves;
+	for(int i=0;i<numNodes;i++)
+	{
+		const BVHNode &node = nodes[i];
+		if((node.left & 3) != 3) continue;
+
+		unsigned int count = node.left >> 2;
+		unsigned int first = node.right;
+		if(count == 0 || first >= (unsigned int)numTris || first + count > (unsigned int)numTris) continue;
+		if(m_leafPacket[first] != EMPTY) continue;
+
+		m_leafPacket[first] = m_numPackets;
+		m_numPackets += (count + N - 1) / N;
+		leaves.push_back(i);
+	}
+
+	m_packets = (Packet*)_aligned_malloc(m_numPackets*sizeof(Packet), 32);
+
+	int numLeaves = (int)leaves.size();
+#	pragma omp parallel for schedule(dynamic, 256)
+	for(int i=0;i<numLeaves;i++)
+	{
+		const BVHNode &node = nodes[leaves[i]];
+		int count = node.left >> 2;
+		unsigned int first = node.right;
+
+		Packet *packet = &m_packets[m_leafPacket[first]];
+		for(int j=0;j<count;j+=N, packet++)
+		{
+			for(int k=0;k<N;k++)
+			{
+				unsigned int triID = first + j + k;
+				const Triangle *tri = j + k < count ? model->getTriangle(triID) : NULL;
+
+				// padding and degenerate triangles have zero edges
+				if(tri && (tri->p[0] == tri->p[1] || tri->p[1] == tri->p[2] || tri->p[2] == tri->p[0])) tri = NULL;
+
+				packet->tri[k] = tri ? triID : EMPTY;
+				for(int a=0;a<3;a++)
+				{
+					float p0 = tri ? model->getPosition(tri->p[0]).e[a] : 0.0f;
+					packet->v0[a][k] = p0;
+					packet->e1[a][k] = tri ? model->getPosition(tri->p[1]).e[a] - p0 : 0.0f;
+					packet->e2[a][k] = tri ? model->getPosition(tri->p[2]).e[a] - p0 : 0.0f;
+				}
+			}
+		}
+	}
+
+	StopWatch::get(timer).stop();
+
+	printf("Packed triangles (%d-wide) : %d packets for %d triangles in %d leaves, %f ms\n", N, m_numPackets, numTris, numLeaves, StopWatch::get(timer).getTime());
+
+	return true;
+}
+
+// nearest lane among the hit lanes in mask
+static inline int selectNearest(int mask, int n, const float *tLane, const float *uLane, const float *vLane, float &t, float &alpha, float &beta)
+{
+	int nearest = -1;
+	for(int i=0;i<n;i++)
+	{
+		if(!(mask & (1 << i))) continue;
+		if(nearest < 0 || tLane[i] < tLane[nearest]) nearest = i;
+	}
+
+	if(nearest >= 0)
+	{
+		t = tLane[nearest];
+		alpha = uLane[nearest];
+		beta = vLane[nearest];
+	}
+	return nearest;
+}
+
+template <int N>
+int PackedTriangles<N>::intersectPacket(const Packet *packet, const Ray &ray, float tmax, float &t, float &alpha, float &beta)
+{
+	const Vector3 &org = ray.data[0];
+	const Vector3 &dir = ray.data[1];
+
+	float tLane[N], uLane[N], vLane[N];
+	int mask = 0;
+	for(int i=0;i<N;i++)
+	{
+		Vector3 e1(packet->e1[0][i], packet->e1[1][i], packet->e1[2][i]);
+		Vector3 e2(packet->e2[0][i], packet->e2[1][i], packet->e2[2][i]);
+		Vector3 tvec = org - Vector3(packet->v0[0][i], packet->v0[1][i], packet->v0[2][i]);
+
+		Vector3 pvec = cross(dir, e2);
+		float det = dot(e1, pvec);
+		if(det == 0.0f) continue;
+
+		float invDet = 1.0f / det;
+		Vector3 qvec = cross(tvec, e1);
+
+		uLane[i] = dot(tvec, pvec) * invDet;
+		vLane[i] = dot(dir, qvec) * invDet;
+		tLane[i] = dot(e2, qvec) * invDet;
+
+		if(uLane[i] >= 0.0f && vLane[i] >= 0.0f && uLane[i] + vLane[i] <= 1.0f && tLane[i] >= INTERSECT_EPSILON && tLane[i] <= tmax)
+			mask |= 1 << i;
+	}
+	return selectNearest(mask, N, tLane, uLane, vLane, t, alpha, beta);
+}
+
+// 4 triangles with SSE
+template <>
+int PackedTriangles<4>::intersectPacket(const Packet *packet, const Ray &ray, float tmax, float &t, float &alpha, float &beta)
+{
+	__m128 dirX = _mm_set1_ps(ray.data[1].e[0]);
+	__m128 dirY = _mm_set1_ps(ray.data[1].e[1]);
+	__m128 dirZ = _mm_set1_ps(ray.data[1].e[2]);
+
+	__m128 e1X = _mm_load_ps(packet->e1[0]), e1Y = _mm_load_ps(packet->e1[1]), e1Z = _mm_load_ps(packet->e1[2]);
+	__m128 e2X = _mm_load_ps(packet->e2[0]), e2Y = _mm_load_ps(packet->e2[1]), e2Z = _mm_load_ps(packet->e2[2]);
+
+	// p = dir x e2, det = e1 . p
+	__m128 pX = _mm_sub_ps(_mm_mul_ps(dirY, e2Z), _mm_mul_ps(dirZ, e2Y));
+	__m128 pY = _mm_sub_ps(_mm_mul_ps(dirZ, e2X), _mm_mul_ps(dirX, e2Z));
+	__m128 pZ = _mm_sub_ps(_mm_mul_ps(dirX, e2Y), _mm_mul_ps(dirY, e2X));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, pX), _mm_mul_ps(e1Y, pY)), _mm_mul_ps(e1Z, pZ));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// s = org - v0, q = s x e1
+	__m128 sX = _mm_sub_ps(_mm_set1_ps(ray.data[0].e[0]), _mm_load_ps(packet->v0[0]));
+	__m128 sY = _mm_sub_ps(_mm_set1_ps(ray.data[0].e[1]), _mm_load_ps(packet->v0[1]));
+	__m128 sZ = _mm_sub_ps(_mm_set1_ps(ray.data[0].e[2]), _mm_load_ps(packet->v0[2]));
+	__m128 qX = _mm_sub_ps(_mm_mul_ps(sY, e1Z), _mm_mul_ps(sZ, e1Y));
+	__m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, e1X), _mm_mul_ps(sX, e1Z));
+	__m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, e1Y), _mm_mul_ps(sY, e1X));
+
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, pX), _mm_mul_ps(sY, pY)), _mm_mul_ps(sZ, pZ)), invDet);
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, qX), _mm_mul_ps(dirY, qY)), _mm_mul_ps(dirZ, qZ)), invDet);
+	__m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2X, qX), _mm_mul_ps(e2Y, qY)), _mm_mul_ps(e2Z, qZ)), invDet);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 hit = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(tt, _mm_set1_ps(INTERSECT_EPSILON)), _mm_cmple_ps(tt, _mm_set1_ps(tmax))));
+
+	int mask = _mm_movemask_ps(hit);
+	if(!mask) return -1;
+
+	__declspec(align(16)) float tLane[4], uLane[4], vLane[4];
+	_mm_store_ps(tLane, tt);
+	_mm_store_ps(uLane, u);
+	_mm_store_ps(vLane, v);
+	return selectNearest(mask, 4, tLane, uLane, vLane, t, alpha, beta);
+}
+
+#ifdef __AVX__
+// 8 triangles with AVX
+template <>
+int PackedTriangles<8>::intersectPacket(const Packet *packet, const Ray &ray, float tmax, float &t, float &alpha, float &beta)
+{
+	__m256 dirX = _mm256_set1_ps(ray.data[1].e[0]);
+	__m256 dirY = _mm256_set1_ps(ray.data[1].e[1]);
+	__m256 dirZ = _mm256_set1_ps(ray.data[1].e[2]);
+
+	__m256 e1X = _mm256_load_ps(packet->e1[0]), e1Y = _mm256_load_ps(packet->e1[1]), e1Z = _mm256_load_ps(packet->e1[2]);
+	__m256 e2X = _mm256_load_ps(packet->e2[0]), e2Y = _mm256_load_ps(packet->e2[1]), e2Z = _mm256_load_ps(packet->e2[2]);
+
+	// p = dir x e2, det = e1 . p
+	__m256 pX = _mm256_sub_ps(_mm256_mul_ps(dirY, e2Z), _mm256_mul_ps(dirZ, e2Y));
+	__m256 pY = _mm256_sub_ps(_mm256_mul_ps(dirZ, e2X), _mm256_mul_ps(dirX, e2Z));
+	__m256 pZ = _mm256_sub_ps(_mm256_mul_ps(dirX, e2Y), _mm256_mul_ps(dirY, e2X));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, pX), _mm256_mul_ps(e1Y, pY)), _mm256_mul_ps(e1Z, pZ));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+	// s = org - v0, q = s x e1
+	__m256 sX = _mm256_sub_ps(_mm256_set1_ps(ray.data[0].e[0]), _mm256_load_ps(packet->v0[0]));
+	__m256 sY = _mm256_sub_ps(_mm256_set1_ps(ray.data[0].e[1]), _mm256_load_ps(packet->v0[1]));
+	__m256 sZ = _mm256_sub_ps(_mm256_set1_ps(ray.data[0].e[2]), _mm256_load_ps(packet->v0[2]));
+	__m256 qX = _mm256_sub_ps(_mm256_mul_ps(sY, e1Z), _mm256_mul_ps(sZ, e1Y));
+	__m256 qY = _mm256_sub_ps(_mm256_mul_ps(sZ, e1X), _mm256_mul_ps(sX, e1Z));
+	__m256 qZ = _mm256_sub_ps(_mm256_mul_ps(sX, e1Y), _mm256_mul_ps(sY, e1X));
+
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, pX), _mm256_mul_ps(sY, pY)), _mm256_mul_ps(sZ, pZ)), invDet);
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, qX), _mm256_mul_ps(dirY, qY)), _mm256_mul_ps(dirZ, qZ)), invDet);
+	__m256 tt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2X, qX), _mm256_mul_ps(e2Y, qY)), _mm256_mul_ps(e2Z, qZ)), invDet);
+
+	__m256 zero = _mm256_setzero_ps();
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(det, zero, _CMP_NEQ_OQ), _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(tt, _mm256_set1_ps(INTERSECT_EPSILON), _CMP_GE_OQ), _mm256_cmp_ps(tt, _mm256_set1_ps(tmax), _CMP_LE_OQ)));
+
+	int mask = _mm256_movemask_ps(hit);
+	if(!mask) return -1;
+
+	__declspec(align(32)) float tLane[8], uLane[8], vLane[8];
+	_mm256_store_ps(tLane, tt);
+	_mm256_store_ps(uLane, u);
+	_mm256_store_ps(vLane, v);
+	return selectNearest(mask, 8, tLane, uLane, vLane, t, alpha, beta);
+}
+#endif
+
+template <int N>
+int PackedTriangles<N>::getIntersection(const Ray &ray, unsigned int firstTri, int count, float tmax, float &t, float &alpha, float &beta) const
+{
+	if(!m_packets || firstTri >= (unsigned int)m_numTris) return -1;
+
+	unsigned int first = m_leafPacket[firstTri];
+	if(first == EMPTY) return -1;
+
+	// same tolerance as Model::getIntersection() for the first hit, nearer ones afterwards
+	float limit = tmax + INTERSECT_EPSILON;
+	int foundTri = -1;
+
+	int numPackets = (count + N - 1) / N;
+	for(int i=0;i<numPackets;i++)
+	{
+		const Packet *packet = &m_packets[first + i];
+
+		float packetT, packetAlpha, packetBeta;
+		int lane = intersectPacket(packet, ray, limit, packetT, packetAlpha, packetBeta);
+		if(lane < 0) continue;
+
+		foundTri = (int)packet->tri[lane];
+		t = packetT;
+		alpha = packetAlpha;
+		beta = packetBeta;
+		limit = packetT;
+	}
+	return foundTri;
+}
+
+template class PackedTriangles<4>;
+template class PackedTriangles<8>;
@@ -0,0 +1,425 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include <float.h>
+#include <algorithm>
+#include <vector>
+#include <emmintrin.h>
+#include "PhotonKDTree.h"
+
+using namespace irt;
+
+PhotonKDTree::PhotonKDTree(void)
+	: m_numPhotons(0), m_depth(0), m_photons(0), m_posX(0), m_posY(0), m_posZ(0), m_nodes(0), m_numBlocks(0)
+{
+}
+
+PhotonKDTree::~PhotonKDTree(void)
+{
+	clear();
+}
+
+void PhotonKDTree::clear()
+{
+	if(m_photons) _aligned_free(m_photons);
+	if(m_posX) _aligned_free(m_posX);
+	if(m_posY) _aligned_free(m_posY);
+	if(m_posZ) _aligned_free(m_posZ);
+	if(m_nodes) _aligned_free(m_nodes);
+
+	m_photons = NULL;
+	m_posX = m_posY = m_posZ = NULL;
+	m_nodes = NULL;
+	m_numBlocks = 0;
+	m_numPhotons = 0;
+	m_depth = 0;
+	m_BB = AABB();
+}
+
+struct PhotonAxisLess
+{
+	int axis;
+	PhotonAxisLess(int axis) : axis(axis) {}
+	bool operator()(const Photon &a, const Photon &b) const {return a.pos.e[axis] < b.pos.e[axis];}
+};
+
+void PhotonKDTree::build(const Photon *photons, int numPhotons)
+{
+	clear();
+
+	if(numPhotons <= 0) return;
+
+	m_numPhotons = numPhotons;
+	m_photons = (Photon*)_aligned_malloc(sizeof(Photon)*numPhotons, 16);
+	memcpy(m_photons, photons, sizeof(Photon)*numPhotons);
+
+	// inner levels are added in whole blocks until the leaves are small enough
+	while((((__int64)numPhotons + ((__int64)1 << m_depth) - 1) >> m_depth) > MAX_LEAF_SIZE)
+		m_depth += BLOCK_DEPTH;
+
+	m_numBlocks = 0;
+	for(int i=0, n=1;i<m_depth/BLOCK_DEPTH;i++, n*=16)
+		m_numBlocks += n;
+
+	if(m_numBlocks)
+	{
+		m_nodes = (NodeBlock*)_aligned_malloc(sizeof(NodeBlock)*m_numBlocks, 64);
+		memset(m_nodes, 0, sizeof(NodeBlock)*m_numBlocks);
+	}
+
+	// bounding box, per thread then merged
+	std::vector<AABB> threadBB(omp_get_max_threads());
+
+#	pragma omp parallel for schedule(static)
+	for(int i=0;i<numPhotons;i++)
+		threadBB[omp_get_thread_num()].update(m_photons[i].pos);
+
+	for(size_t i=0;i<threadBB.size();i++)
+	{
+		m_BB.update(threadBB[i].min);
+		m_BB.update(threadBB[i].max);
+	}
+
+	// boundaries and boxes of the nodes of the current level
+	std::vector<int> bounds(2), nextBounds;
+	std::vector<AABB> boxes(1, m_BB), nextBoxes;
+	std::vector<int> axes;
+	bounds[0] = 0;
+	bounds[1] = numPhotons;
+
+	for(int depth=0;depth<m_depth;depth++)
+	{
+		int numNodes = 1 << depth;
+		int blockLevelBase = 0;
+		for(int i=0, n=1;i<depth/BLOCK_DEPTH;i++, n*=16)
+			blockLevelBase += n;
+		int localDepth = depth % BLOCK_DEPTH;
+
+		nextBounds.resize(2*numNodes + 1);
+		nextBoxes.resize(2*numNodes);
+		axes.resize(numNodes);
+
+#		pragma omp parallel for schedule(dynamic)
+		for(int k=0;k<numNodes;k++)
+		{
+			int lo = bounds[k], hi = bounds[k+1];
+			int mid = lo + (hi - lo) / 2;
+
+			const AABB &bb = boxes[k];
+			int axis = (bb.max - bb.min).indexOfMaxComponent();
+
+			float split;
+			if(hi > lo)
+			{
+				std::nth_element(m_photons + lo, m_photons + mid, m_photons + hi, PhotonAxisLess(axis));
+				split = mid < hi ? m_photons[mid].pos.e[axis] : bb.max.e[axis];
+			}
+			else
+			{
+				split = bb.min.e[axis];
+			}
+
+			NodeBlock &block = m_nodes[blockLevelBase + (k >> localDepth)];
+			int local = (1 << localDepth) - 1 + (k & ((1 << localDepth) - 1));
+			block.split[local] = split;
+			axes[k] = axis;
+
+			nextBounds[2*k] = lo;
+			nextBounds[2*k+1] = mid;
+			nextBoxes[2*k] = bb;
+			nextBoxes[2*k].max.e[axis] = split;
+			nextBoxes[2*k+1] = bb;
+			nextBoxes[2*k+1].min.e[axis] = split;
+		}
+		nextBounds[2*numNodes] = numPhotons;
+
+		// axes of the nodes of a block share one word, set after the parallel loop
+		for(int k=0;k<numNodes;k++)
+		{
+			int local = (1 << localDepth) - 1 + (k & ((1 << localDepth) - 1));
+			m_nodes[blockLevelBase + (k >> localDepth)].axes |= axes[k] << (2*local);
+		}
+
+		bounds.swap(nextBounds);
+		boxes.swap(nextBoxes);
+	}
+
+	// SoA positions, padded so that leaves can be read 4 at a time
+	int paddedSize = (numPhotons + 3) & ~3;
+	m_posX = (float*)_aligned_malloc(sizeof(float)*(paddedSize+4), 16);
+	m_posY = (float*)_aligned_malloc(sizeof(float)*(paddedSize+4), 16);
+	m_posZ = (float*)_aligned_malloc(sizeof(float)*(paddedSize+4), 16);
+
+#	pragma omp parallel for schedule(static)
+	for(int i=0;i<paddedSize+4;i++)
+	{
+		bool valid = i < numPhotons;
+		m_posX[i] = valid ? m_photons[i].pos.e[0] : FLT_MAX;
+		m_posY[i] = valid ? m_photons[i].pos.e[1] : FLT_MAX;
+		m_posZ[i] = valid ? m_photons[i].pos.e[2] : FLT_MAX;
+	}
+}
+
+template <class LeafVisitor>
+void PhotonKDTree::traverse(const Vector3 &pos, float &maxDist2, LeafVisitor &visitor) const
+{
+	if(!m_numPhotons) return;
+
+	typedef struct StackElem_t
+	{
+		int block, local, depth;
+		int lo, hi;
+		float dist2;		// to the splitting plane
+	} StackElem;
+
+	StackElem stack[MAX_DEPTH*2];
+	int stackPtr = 0;
+
+	StackElem cur;
+	cur.block = 0;
+	cur.local = 0;
+	cur.depth = 0;
+	cur.lo = 0;
+	cur.hi = m_numPhotons;
+	cur.dist2 = 0.0f;
+
+	while(true)
+	{
+		if(cur.dist2 <= maxDist2)
+		{
+			// descend to the leaf on the side of pos, farther children are pushed
+			while(cur.depth < m_depth)
+			{
+				const NodeBlock &block = m_nodes[cur.block];
+				int axis = (block.axes >> (2*cur.local)) & 3;
+				float diff = pos.e[axis] - block.split[cur.local];
+				int mid = cur.lo + (cur.hi - cur.lo) / 2;
+
+				StackElem child[2];
+				for(int c=0;c<2;c++)
+				{
+					child[c].depth = cur.depth + 1;
+					if(cur.local < 7)
+					{
+						child[c].block = cur.block;
+						child[c].local = 2*cur.local + 1 + c;
+					}
+					else
+					{
+						// bottom level of the block
+						child[c].block = 16*cur.block + 1 + 2*(cur.local - 7) + c;
+						child[c].local = 0;
+					}
+				}
+				child[0].lo = cur.lo;
+				child[0].hi = mid;
+				child[1].lo = mid;
+				child[1].hi = cur.hi;
+
+				int nearChild = diff < 0.0f ? 0 : 1;
+				float dist2 = diff*diff;
+				if(dist2 <= maxDist2)
+				{
+					stack[stackPtr] = child[1-nearChild];
+					stack[stackPtr].dist2 = dist2;
+					stackPtr++;
+				}
+				cur = child[nearChild];
+			}
+
+			if(cur.hi > cur.lo) visitor(cur.lo, cur.hi, maxDist2);
+		}
+
+		if(stackPtr == 0) break;
+		cur = stack[--stackPtr];
+	}
+}
+
+// squared distances of 4 photons from i, as a mask of those within maxDist2 (lanes >= hi are cleared)
+static inline int within4(const float *posX, const float *posY, const float *posZ, int i, int hi,
+	const __m128 &qx, const __m128 &qy, const __m128 &qz, float maxDist2, __m128 &dist2)
+{
+	__m128 dx = _mm_sub_ps(_mm_loadu_ps(&posX[i]), qx);
+	__m128 dy = _mm_sub_ps(_mm_loadu_ps(&posY[i]), qy);
+	__m128 dz = _mm_sub_ps(_mm_loadu_ps(&posZ[i]), qz);
+	dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+	int mask = _mm_movemask_ps(_mm_cmple_ps(dist2, _mm_set1_ps(maxDist2)));
+	if(hi - i < 4) mask &= (1 << (hi - i)) - 1;
+	return mask;
+}
+
+class RadiusGatherer
+{
+public:
+	const float *posX, *posY, *posZ;
+	__m128 qx, qy, qz;
+	int *outIndices;
+	int maxPhotons;
+	int count;
+
+	void operator()(int lo, int hi, float &maxDist2)
+	{
+		for(int i=lo;i<hi && count<maxPhotons;i+=4)
+		{
+			__m128 d2;
+			int mask = within4(posX, posY, posZ, i, hi, qx, qy, qz, maxDist2, d2);
+			for(int j=0;mask && count<maxPhotons;j++, mask >>= 1)
+				if(mask & 1) outIndices[count++] = i + j;
+		}
+	}
+};
+
+int PhotonKDTree::gatherRadius(const Vector3 &pos, float radius, int *outIndices, int maxPhotons) const
+{
+	RadiusGatherer gatherer;
+	gatherer.posX = m_posX;
+	gatherer.posY = m_posY;
+	gatherer.posZ = m_posZ;
+	gatherer.qx = _mm_set1_ps(pos.e[0]);
+	gatherer.qy = _mm_set1_ps(pos.e[1]);
+	gatherer.qz = _mm_set1_ps(pos.e[2]);
+	gatherer.outIndices = outIndices;
+	gatherer.maxPhotons = maxPhotons;
+	gatherer.count = 0;
+
+	float maxDist2 = radius*radius;
+	traverse(pos, maxDist2, gatherer);
+	return gatherer.count;
+}
+
+class PowerGatherer
+{
+public:
+	const float *posX, *posY, *posZ;
+	const Photon *photons;
+	__m128 qx, qy, qz;
+	RGBf power;
+	int count;
+
+	void operator()(int lo, int hi, float &maxDist2)
+	{
+		for(int i=lo;i<hi;i+=4)
+		{
+			__m128 d2;
+			int mask = within4(posX, posY, posZ, i, hi, qx, qy, qz, maxDist2, d2);
+			for(int j=0;mask;j++, mask >>= 1)
+			{
+				if(mask & 1)
+				{
+					power += photons[i + j].power;
+					count++;
+				}
+			}
+		}
+	}
+};
+
+int PhotonKDTree::gatherPower(const Vector3 &pos, float radius, RGBf &outPower) const
+{
+	PowerGatherer gatherer;
+	gatherer.posX = m_posX;
+	gatherer.posY = m_posY;
+	gatherer.posZ = m_posZ;
+	gatherer.photons = m_photons;
+	gatherer.qx = _mm_set1_ps(pos.e[0]);
+	gatherer.qy = _mm_set1_ps(pos.e[1]);
+	gatherer.qz = _mm_set1_ps(pos.e[2]);
+	gatherer.power = RGBf(0.0f, 0.0f, 0.0f);
+	gatherer.count = 0;
+
+	float maxDist2 = radius*radius;
+	traverse(pos, maxDist2, gatherer);
+
+	outPower = gatherer.power;
+	return gatherer.count;
+}
+
+class KNearestGatherer
+{
+public:
+	const float *posX, *posY, *posZ;
+	__m128 qx, qy, qz;
+	int *heapIndex;
+	float *heapDist2;
+	int k;
+	int count;
+
+	void insert(int idx, float dist2, float &maxDist2)
+	{
+		if(count < k)
+		{
+			// sift up
+			int i = count++;
+			while(i > 0)
+			{
+				int parent = (i - 1) / 2;
+				if(heapDist2[parent] >= dist2) break;
+				heapDist2[i] = heapDist2[parent];
+				heapIndex[i] = heapIndex[parent];
+				i = parent;
+			}
+			heapDist2[i] = dist2;
+			heapIndex[i] = idx;
+
+			if(count == k) maxDist2 = heapDist2[0];
+			return;
+		}
+
+		// replace the farthest, sift down
+		int i = 0;
+		while(true)
+		{
+			int child = 2*i + 1;
+			if(child >= k) break;
+			if(child + 1 < k && heapDist2[child+1] > heapDist2[child]) child++;
+			if(heapDist2[child] <= dist2) break;
+			heapDist2[i] = heapDist2[child];
+			heapIndex[i] = heapIndex[child];
+			i = child;
+		}
+		heapDist2[i] = dist2;
+		heapIndex[i] = idx;
+
+		maxDist2 = heapDist2[0];
+	}
+
+	void operator()(int lo, int hi, float &maxDist2)
+	{
+		__declspec(align(16)) float dist2[4];
+		for(int i=lo;i<hi;i+=4)
+		{
+			__m128 d2;
+			int mask = within4(posX, posY, posZ, i, hi, qx, qy, qz, maxDist2, d2);
+			if(!mask) continue;
+
+			_mm_store_ps(dist2, d2);
+			for(int j=0;j<4;j++)
+			{
+				// maxDist2 may shrink by the previous lanes
+				if((mask & (1 << j)) && dist2[j] < (count < k ? FLT_MAX : maxDist2))
+					insert(i + j, dist2[j], maxDist2);
+			}
+		}
+	}
+};
+
+int PhotonKDTree::gatherKNearest(const Vector3 &pos, int k, float maxRadius, int *outIndices, float *outDist2) const
+{
+	if(k <= 0) return 0;
+
+	KNearestGatherer gatherer;
+	gatherer.posX = m_posX;
+	gatherer.posY = m_posY;
+	gatherer.posZ = m_posZ;
+	gatherer.qx = _mm_set1_ps(pos.e[0]);
+	gatherer.qy = _mm_set1_ps(pos.e[1]);
+	gatherer.qz = _mm_set1_ps(pos.e[2]);
+	gatherer.heapIndex = outIndices;
+	gatherer.heapDist2 = outDist2;
+	gatherer.k = k;
+	gatherer.count = 0;
+
+	float maxDist2 = maxRadius*maxRadius;
+	traverse(pos, maxDist2, gatherer);
+	return gatherer.count;
+}
@@ -4,6 +4,7 @@
 #include "handler.h"
 
 #include "Scene.h"
+#include "OpenIRT.h"
 #include <tinyxml.h>
 #include <direct.h>
 #include <stopwatch.h>
@@ -18,6 +19,7 @@
 #include "PLYLoader.h"
 #include "OBJLoader.h"
 #include "BVHBuilder.h"
+#include "Sampler.h"
 
 using namespace irt;
 
@@ -89,8 +91,12 @@ void Scene::unload()
 		if(m_modelsToBeDeleted[i]) delete m_modelsToBeDeleted[i];
 	m_modelsToBeDeleted.clear();
 
+	m_sceneBVH.clear();
+
 	m_modelList.clear();
 	m_emitList.clear();
+
+	m_shadingMaterials.clear();
 }
 
 #define ASSIGN_ATTRIBUTE_INT(dst, node, name) if(node) {if((node)->ToElement()->Attribute(name)) (dst) = atoi((node)->ToElement()->Attribute(name));}
@@ -576,6 +582,10 @@ bool Scene::loadScene(const char *fileName)
 	m_sceneBB = m_sceneGraph.nodeBB;
 	//m_sceneGraph.updateBB();
 
+	buildSceneBVH();
+
+	buildShadingMaterials();
+
 	_chdir(oldDir);
 
 	return true;
@@ -619,8 +629,10 @@ bool Scene::loadOOC(const char *fileName)
 
 	for(int i=0;i<newModel->getNumVertexs();i++)
 	{
-		const Vertex &v = *newModel->getVertex(i);
-		fprintf(fp, "%f %f %f %f %f %f %f %f\n", v.v.e[0], v.v.e[1], v.v.e[2], v.n.e[0], v.n.e[1], v.n.e[2], v.uv.e[0], v.uv.e[1]);
+		const Vector3 &v = newModel->getPosition(i);
+		Vector3 n = newModel->getNormal(i);
+		Vector2 uv = newModel->getUV(i);
+		fprintf(fp, "%f %f %f %f %f %f %f %f\n", v.e[0], v.e[1], v.e[2], n.e[0], n.e[1], n.e[2], uv.e[0], uv.e[1]);
 	}
 
 	for(int i=0;i<newModel->getNumTriangles();i++)
@@ -803,6 +815,7 @@ void Scene::generateSceneStructure()
 	m_sceneBB.min.set(FLT_MAX);
 	m_sceneBB.max.set(-FLT_MAX);
 	
+	m_sceneBVH.clear();
 	m_sceneGraph.clear();
 	m_sceneGraph.set("_scene_graph", NULL, 0);
 
@@ -823,6 +836,10 @@ void Scene::generateSceneStructure()
 		m_sceneGraph.addChild(modelName, m_modelList[i]);
 	}
 
+	buildSceneBVH();
+
+	buildShadingMaterials();
+
 	if(getNumEmitters() == 0)
 	{
 		// use single emitter
@@ -832,6 +849,16 @@ void Scene::generateSceneStructure()
 	m_hasSceneStructure = true;
 }
 
+void Scene::buildSceneBVH()
+{
+	m_sceneBVH.build(&m_sceneGraph);
+}
+
+void Scene::buildShadingMaterials()
+{
+	m_shadingMaterials.build(m_modelList);
+}
+
 void Scene::trace(const Ray &ray, RGB4f &color, Material *outMat, int depth, float traveledDist, HitPointInfo *outHit, int stream)
 {
 	HitPointInfo hit;
@@ -845,6 +872,11 @@ void Scene::trace(const Ray &ray, RGB4f &color, Material *outMat, int depth, flo
 	if(outHit)
 		*outHit = hit;
 
+	shadeHit(ray, color, hit, hasHit, outMat);
+}
+
+void Scene::shadeHit(const Ray &ray, RGB4f &color, HitPointInfo &hit, bool hasHit, Material *outMat)
+{
 	if(!hasHit)
 	{
 		RGBf col;
@@ -855,20 +887,17 @@ void Scene::trace(const Ray &ray, RGB4f &color, Material *outMat, int depth, flo
 
 	Model *hitModel = hit.modelPtr;
 
-	Material mat;
-	if(hitModel) mat = hitModel->getMaterial(hit.m);
-
-	if(mat.getMapKd())
-	{
-		RGBf texValue;
-		mat.getMapKd()->getTexValue(texValue, hit.uv.x(), hit.uv.y());
-		mat.setMatKd(mat.getMatKd() * texValue);
-	}
+	// only the diffuse reflectance is needed
+	RGBf matKd = m_shadingMaterials.getKd(m_shadingMaterials.getIndex(hit), hit.uv);
 
 	Vector3 hitPosition = ray.origin() + hit.t * ray.direction();
 	Vector3 shadowDir;
 	hit.x = hitPosition;
-	if(outMat) *outMat = mat;
+	if(outMat)
+	{
+		*outMat = hitModel ? hitModel->getMaterial(hit.m) : Material();
+		outMat->setMatKd(matKd);
+	}
 
 	// for each emitter
 	for(size_t i=0;i<m_emitList.size();i++)
@@ -900,7 +929,7 @@ void Scene::trace(const Ray &ray, RGB4f &color, Material *outMat, int depth, flo
 
 			if(!getIntersection(shadowRay, shadowHit, m_intersectionStream))
 			*/
-				color += mat.getMatKd() * emitColor * cosFactor;
+				color += matKd * emitColor * cosFactor;
 		}
 	}
 }
@@ -915,17 +944,7 @@ void Scene::shade(const Ray &ray, RGB4f &color, HitPointInfo &hit, bool hasHit)
 		return;
 	}
 
-	Model *hitModel = hit.modelPtr;
-
-	Material mat;
-	if(hitModel) mat = hitModel->getMaterial(hit.m);
-
-	if(mat.getMapKd())
-	{
-		RGBf texValue;
-		mat.getMapKd()->getTexValue(texValue, hit.uv.x(), hit.uv.y());
-		mat.setMatKd(mat.getMatKd() * texValue);
-	}
+	RGBf matKd = m_shadingMaterials.getKd(m_shadingMaterials.getIndex(hit), hit.uv);
 
 	Vector3 hitPosition = ray.origin() + hit.t * ray.direction();
 	Vector3 shadowDir;
@@ -957,7 +976,7 @@ void Scene::shade(const Ray &ray, RGB4f &color, HitPointInfo &hit, bool hasHit)
 
 			if(!getIntersection(shadowRay, shadowHit, m_intersectionStream))
 			*/
-				color += mat.getMatKd() * emitColor * cosFactor;
+				color += matKd * emitColor * cosFactor;
 		}
 	}
 }
@@ -1009,45 +1028,52 @@ void Scene::EnvironmentMap::clear()
 #include <typeinfo>
 bool Scene::getIntersection(const Ray &ray, HitPointInfo &hitPointInfo, float tLimit, int stream)
 {
-	int threadID = omp_get_thread_num();
-	StackElem *stack = m_stacks[threadID+MAX_NUM_THREADS*stream];
+	if(m_sceneBVH.isEmpty()) return false;
 
+	unsigned int stack[SceneBVH::STACK_SIZE];
 	unsigned int stackPtr;
-	SceneNode *currentNode;
+	const BVHNode *currentNode;
 	float minT, maxT;
 	bool hasHit = false;
 
 	stack[0] = 0;
 	stackPtr = 1;
 
-	currentNode = &(m_sceneGraph);
+	currentNode = m_sceneBVH.getNode(0);
 
 	for(;;)
 	{
-		if(ray.boxIntersect(currentNode->nodeBB.min, currentNode->nodeBB.max, minT, maxT) && minT < hitPointInfo.t && maxT > 0.000005f)
+		if(ray.boxIntersect(currentNode->min, currentNode->max, minT, maxT) && minT < hitPointInfo.t && maxT > 0.000005f)
 		{
-			if(currentNode->model && 
-				(m_modelTypeSelector == Model::NONE ? true : m_modelTypeSelector == currentNode->model->getType()))
+			if(!SceneBVH::isLeaf(currentNode))
 			{
-				hasHit = currentNode->model->getIntersection(ray, hitPointInfo, tLimit, stream) | hasHit;
-				if(tLimit > 0.0f && hasHit)
-				{
-					if(hitPointInfo.t < tLimit) return true;
-				}
+				// visit nearer child first
+				unsigned int lChild = SceneBVH::getLeftChildIdx(currentNode);
+				int axis = SceneBVH::getAxis(currentNode);
+
+				stack[stackPtr++] = ray.posneg[axis] + lChild;
+				currentNode = m_sceneBVH.getNode((ray.posneg[axis]^1) + lChild);
+				continue;
 			}
 
-			if(currentNode->hasChilds())
+			unsigned int first = SceneBVH::getFirstInstanceIdx(currentNode);
+			unsigned int last = first + SceneBVH::getNumInstances(currentNode);
+			for(unsigned int i=first;i<last;i++)
 			{
-				for(size_t i=0;i<currentNode->childs->size();i++)
+				Model *model = m_sceneBVH.getInstance(i)->model;
+				if(m_modelTypeSelector != Model::NONE && m_modelTypeSelector != model->getType()) continue;
+
+				hasHit = model->getIntersection(ray, hitPointInfo, tLimit, stream) | hasHit;
+				if(tLimit > 0.0f && hasHit)
 				{
-					stack[stackPtr++] = currentNode->childs->at(i);
+					if(hitPointInfo.t < tLimit) return true;
 				}
 			}
 		}
 
 		if (--stackPtr == 0) break;
 
-		currentNode = stack[stackPtr];
+		currentNode = m_sceneBVH.getNode(stack[stackPtr]);
 	}
 	return hasHit;
 }
@@ -1062,21 +1088,24 @@ int Scene::getNumMaxPhotons()
 	return numTotalPhotons;
 }
 
-void Scene::tracePhotons(int emitterIndex, Photon *outPhotons, int idx, int &numTotalPhotons, void (*funcProcessPhoton)(const Photon &photon))
+bool Scene::tracePhoton(int emitterIndex, int numPhotons, int idx, Photon &photon, int pass)
 {
 	const Emitter &emitter = getEmitter(emitterIndex);
 	const Parallelogram &target = emitter.spotTarget;
 
-	const unsigned int numPhotons = emitter.numScatteringPhotons;
+	// depends only on the emitter, the photon index and the pass
+	unsigned int seed = tea<16>(idx, emitterIndex + pass*MAX_NUM_EMITTERS);
 
-	unsigned int seed = tea<16>(idx, emitterIndex);
+	// origin and direction are stratified over the photons of all passes of the emitter
+	unsigned int sampleIndex = (unsigned int)(pass*numPhotons + idx);
+	float u, v;
 
 	Ray ray;
-	Vector3 ori = emitter.sample(seed);
-	lcg(seed);
+	Sampler::get2D(emitterIndex, sampleIndex, 0, u, v);
+	Vector3 ori = emitter.sample(u, v);
 	//Vector3 dir = (target.sample(seed) - ori);
-	Vector3 dir = emitter.sampleEmitDirection(ori, seed);
-	lcg(seed);
+	Sampler::get2D(emitterIndex, sampleIndex, 2, u, v);
+	Vector3 dir = emitter.sampleEmitDirection(ori, u, v);
 	dir.makeUnitVector();
 
 	ray.set(ori, dir);
@@ -1094,7 +1123,7 @@ void Scene::tracePhotons(int emitterIndex, Photon *outPhotons, int idx, int &num
 	Material material;
 	while(++depth < maxDepth)
 	{
-		if(!getIntersection(ray, hit, 0.0f)) return;
+		if(!getIntersection(ray, hit, 0.0f)) return false;
 		material = hit.modelPtr->getMaterial(hit);
 		material.recalculateRanges();
 		if(material.hasDiffuse())
@@ -1106,45 +1135,102 @@ void Scene::tracePhotons(int emitterIndex, Photon *outPhotons, int idx, int &num
 	}
 
 	float cosFac = -dot(ray.direction(), hit.n);
-	if(cosFac > 0.0f)
-	{
-		Photon *photon;
-#		pragma omp critical
-		{
-			photon = &outPhotons[numTotalPhotons++];
-		}
-		photon->pos = ray.origin() + hit.t * ray.direction();
+	if(cosFac <= 0.0f) return false;
 
-		//photon->power = (emitter.color_Ka * material.getMatKa() + emitter.color_Kd * material.getMatKd() * cosFac) * (emitter.intensity / numPhotons);
-		photon->power = (emitter.color_Ka + emitter.color_Kd * cosFac) * (emitter.intensity / numPhotons);
-		photon->setDirection(ray.direction());
+	photon.pos = ray.origin() + hit.t * ray.direction();
 
-		if(funcProcessPhoton) funcProcessPhoton(*photon);
-	}
+	//photon.power = (emitter.color_Ka * material.getMatKa() + emitter.color_Kd * material.getMatKd() * cosFac) * (emitter.intensity / numPhotons);
+	photon.power = (emitter.color_Ka + emitter.color_Kd * cosFac) * (emitter.intensity / numPhotons);
+	photon.setDirection(ray.direction());
+	return true;
 }
 
-int Scene::tracePhotons(int size, Photon *outPhotons, void (*funcProcessPhoton)(const Photon &photon))
+int Scene::tracePhotons(int size, Photon *outPhotons, void (*funcProcessPhoton)(const Photon &photon), int pass)
 {
 	if(!g_timerPhotonTracing)
 		g_timerPhotonTracing = StopWatch::create();
 	StopWatch::get(g_timerPhotonTracing).start();
 
-	int numTotalPhotons = 0;
+	// Emitted photons are split into fixed blocks. A block stores its photons from the
+	// slot of its first emitted photon on (a photon is emitted at most once), and the
+	// blocks are compacted afterwards by a prefix sum of their counts. The result does
+	// not depend on the number of threads.
+	const int blockSize = 4096;
 
-	for(int i=0;i<getNumEmitters();i++)
+	typedef struct Block_t
+	{
+		int emitter;
+		int numPhotons;		// emitted by the emitter
+		int begin, end;		// photon index in the emitter
+		int firstSlot;		// in outPhotons
+		int count;			// stored photons
+	} Block;
+
+	std::vector<Block> blocks;
+
+	int numEmitted = 0;
+	for(int i=0;i<getNumEmitters() && numEmitted < size;i++)
 	{
+		// exactly numScatteringPhotons per emitter, the last ones are cut to fit in outPhotons
 		int numPhotons = getEmitter(i).numScatteringPhotons;
+		if(numPhotons > size - numEmitted) numPhotons = size - numEmitted;
 
-		if(numPhotons == 0) continue;
+		for(int j=0;j<numPhotons;j+=blockSize)
+		{
+			Block block;
+			block.emitter = i;
+			block.numPhotons = numPhotons;
+			block.begin = j;
+			block.end = j + blockSize < numPhotons ? j + blockSize : numPhotons;
+			block.firstSlot = numEmitted + j;
+			block.count = 0;
+			blocks.push_back(block);
+		}
+		numEmitted += numPhotons;
+	}
 
-#		pragma omp parallel for shared(numTotalPhotons) schedule(dynamic)
-		for(int j=0;j<numPhotons;j++)
+	int numBlocks = (int)blocks.size();
+
+	// progress is reported from this thread once per batch of blocks
+	const int batchSize = 64;
+	int numBatches = (numBlocks + batchSize - 1) / batchSize;
+
+	Progress &prog = OpenIRT::getSingletonPtr()->getProgress();
+	prog.reset(numBatches);
+	prog.setText("Tracing photons");
+
+	for(int batch=0;batch<numBatches;batch++)
+	{
+		int endBlock = (batch+1)*batchSize < numBlocks ? (batch+1)*batchSize : numBlocks;
+
+#		pragma omp parallel for schedule(dynamic)
+		for(int i=batch*batchSize;i<endBlock;i++)
 		{
-			if(j % 10000 == 0) printf("%d photons are processed.\n", j);
-			tracePhotons(i, outPhotons, j, numTotalPhotons, funcProcessPhoton);
+			Block &block = blocks[i];
+			Photon *out = &outPhotons[block.firstSlot];
+			for(int j=block.begin;j<block.end;j++)
+				if(tracePhoton(block.emitter, block.numPhotons, j, out[block.count], pass))
+					block.count++;
 		}
+
+		prog.step();
 	}
 
+	// compaction, destination is never after the source
+	int numTotalPhotons = 0;
+	for(int i=0;i<numBlocks;i++)
+	{
+		const Block &block = blocks[i];
+		if(numTotalPhotons != block.firstSlot)
+			memmove(&outPhotons[numTotalPhotons], &outPhotons[block.firstSlot], sizeof(Photon)*block.count);
+		numTotalPhotons += block.count;
+	}
+
+	if(funcProcessPhoton)
+	{
+		for(int i=0;i<numTotalPhotons;i++)
+			funcProcessPhoton(outPhotons[i]);
+	}
 
 #	if 0
 	int numTotalPhotons = 0;
@@ -0,0 +1,272 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include <float.h>
+#include <algorithm>
+#include "SceneBVH.h"
+#include "SceneNode.h"
+
+using namespace irt;
+
+SceneBVH::SceneBVH(void)
+{
+}
+
+SceneBVH::~SceneBVH(void)
+{
+	clear();
+}
+
+void SceneBVH::clear()
+{
+	for(size_t i=0;i<m_instances.size();i++)
+	{
+		if(m_instances[i]->sceneBVH != this) continue;
+		m_instances[i]->sceneBVH = NULL;
+		m_instances[i]->sceneBVHLeaf = -1;
+	}
+
+	m_instances.clear();
+	m_nodes.clear();
+	m_parents.clear();
+	m_centroids.clear();
+}
+
+void SceneBVH::collectInstances(SceneNode *node)
+{
+	if(node->model)
+		m_instances.push_back(node);
+
+	if(node->hasChilds())
+	{
+		for(size_t i=0;i<node->childs->size();i++)
+			collectInstances(node->childs->at(i));
+	}
+}
+
+void SceneBVH::build(SceneNode *root)
+{
+	clear();
+
+	collectInstances(root);
+
+	if(m_instances.empty()) return;
+
+	m_centroids.resize(m_instances.size());
+	for(size_t i=0;i<m_instances.size();i++)
+	{
+		const AABB &bb = m_instances[i]->modelBB;
+		m_centroids[i] = (bb.min + bb.max) * 0.5f;
+	}
+
+	m_nodes.reserve(m_instances.size()*2);
+	m_parents.reserve(m_instances.size()*2);
+
+	// root
+	m_nodes.resize(1);
+	m_parents.push_back(-1);
+
+	subDivide(0, 0, (unsigned int)m_instances.size()-1, 0);
+
+	// no longer needed after build
+	std::vector<Vector3>().swap(m_centroids);
+}
+
+void SceneBVH::makeLeaf(unsigned int myIndex, unsigned int left, unsigned int right)
+{
+	BVHNode *node = &m_nodes[myIndex];
+	node->left = ((right - left + 1) << 2) | 3;
+	node->right = left;
+
+	for(unsigned int i=left;i<=right;i++)
+	{
+		m_instances[i]->sceneBVH = this;
+		m_instances[i]->sceneBVHLeaf = (int)myIndex;
+	}
+
+	computeLeafBB(node);
+}
+
+void SceneBVH::computeLeafBB(BVHNode *node)
+{
+	node->min.set(FLT_MAX);
+	node->max.set(-FLT_MAX);
+
+	unsigned int first = getFirstInstanceIdx(node);
+	unsigned int count = getNumInstances(node);
+	for(unsigned int i=first;i<first+count;i++)
+	{
+		const AABB &bb = m_instances[i]->modelBB;
+		for(int j=0;j<3;j++)
+		{
+			node->min.e[j] = node->min.e[j] < bb.min.e[j] ? node->min.e[j] : bb.min.e[j];
+			node->max.e[j] = node->max.e[j] > bb.max.e[j] ? node->max.e[j] : bb.max.e[j];
+		}
+	}
+}
+
+void SceneBVH::subDivide(unsigned int myIndex, unsigned int left, unsigned int right, int depth)
+{
+	if(left == right || depth >= MAX_DEPTH)
+	{
+		makeLeaf(myIndex, left, right);
+		return;
+	}
+
+	// split along the longest axis of centroid bounds
+	Vector3 cMin(FLT_MAX), cMax(-FLT_MAX);
+	for(unsigned int i=left;i<=right;i++)
+	{
+		for(int j=0;j<3;j++)
+		{
+			cMin.e[j] = cMin.e[j] < m_centroids[i].e[j] ? cMin.e[j] : m_centroids[i].e[j];
+			cMax.e[j] = cMax.e[j] > m_centroids[i].e[j] ? cMax.e[j] : m_centroids[i].e[j];
+		}
+	}
+
+	Vector3 extent = cMax - cMin;
+	int axis = extent.indexOfMaxComponent();
+
+	// all the instances are at the same position
+	if(extent.e[axis] <= 0.0f)
+	{
+		makeLeaf(myIndex, left, right);
+		return;
+	}
+
+	// binned SAH
+	Vector3 binMin[NUM_BINS], binMax[NUM_BINS];
+	int binCount[NUM_BINS];
+	for(int i=0;i<NUM_BINS;i++)
+	{
+		binMin[i].set(FLT_MAX);
+		binMax[i].set(-FLT_MAX);
+		binCount[i] = 0;
+	}
+
+	float scale = NUM_BINS / extent.e[axis];
+	for(unsigned int i=left;i<=right;i++)
+	{
+		int bin = (int)((m_centroids[i].e[axis] - cMin.e[axis]) * scale);
+		bin = bin < NUM_BINS-1 ? bin : NUM_BINS-1;
+
+		const AABB &bb = m_instances[i]->modelBB;
+		for(int j=0;j<3;j++)
+		{
+			binMin[bin].e[j] = binMin[bin].e[j] < bb.min.e[j] ? binMin[bin].e[j] : bb.min.e[j];
+			binMax[bin].e[j] = binMax[bin].e[j] > bb.max.e[j] ? binMax[bin].e[j] : bb.max.e[j];
+		}
+		binCount[bin]++;
+	}
+
+	// sweep from right to get areas of right sides
+	float rightArea[NUM_BINS];
+	int rightCount[NUM_BINS];
+	Vector3 accMin(FLT_MAX), accMax(-FLT_MAX);
+	int accCount = 0;
+	for(int i=NUM_BINS-1;i>0;i--)
+	{
+		for(int j=0;j<3;j++)
+		{
+			accMin.e[j] = accMin.e[j] < binMin[i].e[j] ? accMin.e[j] : binMin[i].e[j];
+			accMax.e[j] = accMax.e[j] > binMax[i].e[j] ? accMax.e[j] : binMax[i].e[j];
+		}
+		accCount += binCount[i];
+		rightArea[i-1] = accCount ? getArea(accMin, accMax) : 0.0f;
+		rightCount[i-1] = accCount;
+	}
+
+	// sweep from left, the split is between bin i and bin i+1
+	int bestSplit = -1;
+	float bestCost = FLT_MAX;
+	accMin.set(FLT_MAX);
+	accMax.set(-FLT_MAX);
+	accCount = 0;
+	for(int i=0;i<NUM_BINS-1;i++)
+	{
+		for(int j=0;j<3;j++)
+		{
+			accMin.e[j] = accMin.e[j] < binMin[i].e[j] ? accMin.e[j] : binMin[i].e[j];
+			accMax.e[j] = accMax.e[j] > binMax[i].e[j] ? accMax.e[j] : binMax[i].e[j];
+		}
+		accCount += binCount[i];
+
+		if(accCount == 0 || rightCount[i] == 0) continue;
+
+		float cost = accCount * getArea(accMin, accMax) + rightCount[i] * rightArea[i];
+		if(cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = i;
+		}
+	}
+
+	// first and last bins are never empty, so there is always a valid split
+	unsigned int mid = left;
+	for(unsigned int i=left;i<=right;i++)
+	{
+		int bin = (int)((m_centroids[i].e[axis] - cMin.e[axis]) * scale);
+		bin = bin < NUM_BINS-1 ? bin : NUM_BINS-1;
+		if(bin <= bestSplit)
+		{
+			std::swap(m_instances[i], m_instances[mid]);
+			std::swap(m_centroids[i], m_centroids[mid]);
+			mid++;
+		}
+	}
+
+	// siblings are stored next to each other, lower side first
+	unsigned int childIndex = (unsigned int)m_nodes.size();
+	m_nodes.resize(childIndex + 2);
+	m_parents.push_back((int)myIndex);
+	m_parents.push_back((int)myIndex);
+
+	m_nodes[myIndex].left = (childIndex << 2) | axis;
+	m_nodes[myIndex].right = (childIndex + 1) << 2;
+
+	subDivide(childIndex, left, mid-1, depth+1);
+	subDivide(childIndex+1, mid, right, depth+1);
+
+	BVHNode *node = &m_nodes[myIndex];
+	const BVHNode *lChild = &m_nodes[childIndex];
+	const BVHNode *rChild = &m_nodes[childIndex+1];
+	for(int j=0;j<3;j++)
+	{
+		node->min.e[j] = lChild->min.e[j] < rChild->min.e[j] ? lChild->min.e[j] : rChild->min.e[j];
+		node->max.e[j] = lChild->max.e[j] > rChild->max.e[j] ? lChild->max.e[j] : rChild->max.e[j];
+	}
+}
+
+void SceneBVH::refit(SceneNode *instance)
+{
+	if(instance->sceneBVH != this || instance->sceneBVHLeaf < 0) return;
+
+	int index = instance->sceneBVHLeaf;
+	computeLeafBB(&m_nodes[index]);
+
+	// propagate to the root, stop as soon as a box does not change
+	for(int parent = m_parents[index];parent >= 0;parent = m_parents[parent])
+	{
+		BVHNode *node = &m_nodes[parent];
+		const BVHNode *lChild = &m_nodes[getLeftChildIdx(node)];
+		const BVHNode *rChild = lChild + 1;
+
+		Vector3 newMin, newMax;
+		for(int j=0;j<3;j++)
+		{
+			newMin.e[j] = lChild->min.e[j] < rChild->min.e[j] ? lChild->min.e[j] : rChild->min.e[j];
+			newMax.e[j] = lChild->max.e[j] > rChild->max.e[j] ? lChild->max.e[j] : rChild->max.e[j];
+		}
+
+		if(newMin == node->min && newMax == node->max) break;
+
+		node->min = newMin;
+		node->max = newMax;
+	}
+}
+
+float SceneBVH::getArea(const Vector3 &min, const Vector3 &max)
+{
+	Vector3 d = max - min;
+	return d.e[0]*d.e[1] + d.e[1]*d.e[2] + d.e[2]*d.e[0];
+}
@@ -1,6 +1,7 @@
 #include <string>
 #include <float.h>
 #include "SceneNode.h"
+#include "SceneBVH.h"
 
 using namespace irt;
 
@@ -36,6 +37,9 @@ void SceneNode::clear()
 	model = NULL;
 	nodeBB.min.set(FLT_MAX, FLT_MAX, FLT_MAX);
 	nodeBB.max.set(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	modelBB = nodeBB;
+	sceneBVH = NULL;
+	sceneBVHLeaf = -1;
 	name[0] = 0;
 
 	matrix = identityMatrix();
@@ -68,6 +72,7 @@ void SceneNode::set(const char *name, SceneNode *parent, Model* model, Matrix *m
 		}
 
 		model->setName(name);
+		modelBB = bb;
 		updateBB(bb, true);
 	}
 
@@ -90,18 +95,68 @@ Matrix SceneNode::getTransformedMatrix()
 	return parent->getTransformedMatrix() * matrix;
 }
 
-void SceneNode::updateBB()
+void SceneNode::setMatrix(const Matrix &matrix)
+{
+	this->matrix = matrix;
+
+	updateBB();
+}
+
+void SceneNode::updateTransform()
 {
+	Matrix transMat = getTransformedMatrix();
+
+	if(model)
+	{
+		AABB bb = model->getModelBB();
+		Matrix invTransMat = transMat;
+		invTransMat.invert();
+
+		model->setTransfMatrix(transMat);
+		model->setInvTransfMatrix(invTransMat);
+
+		if(transMat != identityMatrix())
+		{
+			model->updateTransformedBB(bb, transMat);
+		}
+
+		modelBB = bb;
+	}
+
+	if(hasChilds())
+	{
+		for(size_t i=0;i<childs->size();i++)
+			childs->at(i)->updateTransform();
+	}
+
+	refitBB();
+
+	if(sceneBVH) sceneBVH->refit(this);
+}
+
+void SceneNode::refitBB()
+{
+	// unlike updateBB(), the box can shrink
+	nodeBB = modelBB;
+
 	if(hasChilds())
 	{
 		for(size_t i=0;i<childs->size();i++)
 		{
-			childs->at(i)->updateBB();
-			updateBB(childs->at(i)->nodeBB, false);
+			updateBBWithVertex(nodeBB, childs->at(i)->nodeBB.min);
+			updateBBWithVertex(nodeBB, childs->at(i)->nodeBB.max);
 		}
 	}
 }
 
+void SceneNode::updateBB()
+{
+	updateTransform();
+
+	for(SceneNode *node = parent;node;node = node->parent)
+		node->refitBB();
+}
+
 void SceneNode::updateBB(const AABB &bb, bool updateParents)
 {
 	nodeBB.min.setX(min(nodeBB.min.x(), bb.min.x()));
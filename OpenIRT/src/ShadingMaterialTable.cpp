@@ -0,0 +1,88 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include "ShadingMaterialTable.h"
+
+using namespace irt;
+
+ShadingMaterialTable::ShadingMaterialTable(void)
+{
+	clear();
+}
+
+void ShadingMaterialTable::clear()
+{
+	m_firstMaterial.clear();
+	m_numModelMaterials.clear();
+
+	m_Ka.clear();
+	m_Kd.clear();
+	m_Ks.clear();
+	m_d.clear();
+	m_Ns.clear();
+	m_rangeKd.clear();
+	m_rangeKs.clear();
+	m_sumKs.clear();
+	m_mapKa.clear();
+	m_mapKd.clear();
+
+	// entry 0 : default material
+	push(Material());
+}
+
+void ShadingMaterialTable::push(const Material &mat)
+{
+	const RGBf &Ks = mat.getMatKs();
+
+	m_Ka.push_back(mat.getMatKa());
+	m_Kd.push_back(mat.getMatKd());
+	m_Ks.push_back(Ks);
+	m_d.push_back(mat.getMat_d());
+	m_Ns.push_back(mat.getMat_Ns());
+	m_rangeKd.push_back(mat.rangeKd);
+	m_rangeKs.push_back(mat.rangeKs);
+	m_sumKs.push_back(Ks.r() + Ks.g() + Ks.b());
+	m_mapKa.push_back(mat.getMapKa());
+	m_mapKd.push_back(mat.getMapKd());
+}
+
+void ShadingMaterialTable::build(const std::vector<Model*> &models)
+{
+	clear();
+
+	int numMaterials = 1;
+	for(size_t i=0;i<models.size();i++)
+		numMaterials += models[i]->getNumMaterials() > 0 ? models[i]->getNumMaterials() : 1;
+
+	m_Ka.reserve(numMaterials);
+	m_Kd.reserve(numMaterials);
+	m_Ks.reserve(numMaterials);
+	m_d.reserve(numMaterials);
+	m_Ns.reserve(numMaterials);
+	m_rangeKd.reserve(numMaterials);
+	m_rangeKs.reserve(numMaterials);
+	m_sumKs.reserve(numMaterials);
+	m_mapKa.reserve(numMaterials);
+	m_mapKd.reserve(numMaterials);
+
+	for(size_t i=0;i<models.size();i++)
+	{
+		Model *model = models[i];
+		model->setID((int)i);
+
+		m_firstMaterial.push_back(getNumMaterials());
+
+		int numModelMaterials = model->getNumMaterials();
+		if(numModelMaterials == 0)
+		{
+			// Model::getMaterial() would not work either, use the default material
+			push(Material());
+			numModelMaterials = 1;
+		}
+
+		for(int j=0;j<numModelMaterials && j<model->getNumMaterials();j++)
+			push(model->getMaterial(j));
+
+		m_numModelMaterials.push_back(numModelMaterials);
+	}
+}
@@ -196,6 +196,9 @@ void SimpleRasterizer::init(Scene *scene)
 		int numTris = model->getNumTriangles();
 		m_indexList[i] = new unsigned int[numTris*3];
 
+		// vertex buffers are interleaved
+		model->decodeVertices();
+
 		for(int j=0;j<numTris;j++)
 		{
 			Triangle *tri = model->getTriangle(j);
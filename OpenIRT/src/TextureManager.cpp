@@ -1,3 +1,4 @@
+#include "CommonOptions.h"
 #include "defines.h"
 #include "BitmapTexture.h"
 #include "TextureManager.h"
@@ -6,6 +7,8 @@ using namespace irt;
 
 TextureManager::TextureManager() {
 	lastError[0] = 0;
+	m_tileCache = NULL;
+	m_cacheBudget = TEXTURE_CACHE_SIZE;
 }
 
 TextureManager::~TextureManager() {
@@ -42,6 +45,8 @@ BitmapTexture* TextureManager::loadTexture(const char *name) {
 		
 		m_Textures[name2] = texPtr;
 
+		resetTileCache();
+
 		return texPtr;
 	}
 	else { // error loading bitmap:
@@ -62,6 +67,7 @@ void TextureManager::unloadTexture(const char *name){
 
 		// if this is the last used reference, also delete the texture
 		if (texPtr->refCount == 0) {
+			resetTileCache();
 			delete texPtr;
 			m_Textures.erase(name);
 		}
@@ -84,6 +90,7 @@ void TextureManager::unloadTexture(BitmapTexture *texPtr)
 
 			// if this is the last used reference, also delete the texture
 			if (texPtr->refCount == 0) {
+				resetTileCache();
 
 				delete texPtr;
 				m_Textures.erase(it);
@@ -95,6 +102,7 @@ void TextureManager::unloadTexture(BitmapTexture *texPtr)
 }
 
 void TextureManager::clear() {
+	resetTileCache();
 
 	// go through texture list
 	for (TextureList::iterator it = m_Textures.begin(); it != m_Textures.end(); ++it)
@@ -113,4 +121,72 @@ TextureManager* TextureManager::getSingletonPtr()
 {
 	static TextureManager manager;
 	return &manager;
+}
+
+void TextureManager::setCacheBudget(__int64 bytes)
+{
+	m_cacheBudget = bytes;
+	resetTileCache();
+}
+
+LRUManager<unsigned char*>::Stats TextureManager::getCacheStats()
+{
+	if(m_tileCache) return m_tileCache->getStats();
+
+	LRUManager<unsigned char*>::Stats stats;
+	memset(&stats, 0, sizeof(stats));
+	return stats;
+}
+
+void TextureManager::createTileCache()
+{
+	m_lockTileCache.lock();
+
+	if(!m_tileCache)
+	{
+		// global tile index space over all loaded textures
+		m_tileOwners.clear();
+		for(TextureList::iterator it = m_Textures.begin(); it != m_Textures.end(); ++it)
+		{
+			BitmapTexture *texPtr = it->second;
+			texPtr->firstCacheTile = (int)m_tileOwners.size();
+			m_tileOwners.insert(m_tileOwners.end(), texPtr->numTiles, texPtr);
+		}
+
+		int numTiles = (int)m_tileOwners.size();
+		int sizeTile = TEXTURE_TILE_SIZE*TEXTURE_TILE_SIZE*4;
+
+		// no need for more than all tiles, but keep enough slots for the tiles pinned
+		// by all threads, a shard without a free slot waits for a tile to be released
+		__int64 budget = m_cacheBudget;
+		if(budget > (__int64)numTiles*sizeTile) budget = (__int64)numTiles*sizeTile;
+		if(budget < (__int64)256*sizeTile) budget = (__int64)256*sizeTile;
+
+		// no prefetch, no I/O threads
+		m_tileCache = new LRUManager<unsigned char*>(numTiles > 0 ? numTiles : 1, sizeTile, loadTile, budget, 16, 0);
+	}
+
+	m_lockTileCache.unlock();
+}
+
+void TextureManager::resetTileCache()
+{
+	if(m_tileCache) delete m_tileCache;
+	m_tileCache = NULL;
+}
+
+const unsigned char *TextureManager::getTile(BitmapTexture *texPtr, int tileIdx, int &slot)
+{
+	if(!m_tileCache) createTileCache();
+
+	return m_tileCache->pin(texPtr->firstCacheTile + tileIdx, slot);
+}
+
+void TextureManager::loadTile(unsigned int idx, unsigned char *address)
+{
+	TextureManager *manager = getSingletonPtr();
+	BitmapTexture *texPtr = manager->m_tileOwners[idx];
+
+	// runs outside the locks of the cache, misses of other threads are read at the same time
+	texPtr->readTiles(idx - texPtr->firstCacheTile, 1, address);
 }
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include "TileScheduler.h"
+#include "HSaliency.h"
+#include "random.h"
+
+// cursor position, in handler.cpp
+extern int g_mouseX;
+extern int g_mouseY;
+
+using namespace irt;
+
+TileScheduler::TileScheduler(void)
+	: m_width(0), m_height(0), m_tileSize(0), m_align(1), m_ordering(Controller::ROW_BY_ROW), m_hasTimes(false),
+	m_saliencyWidth(0), m_saliencyHeight(0), m_frame(0), m_queues(0), m_numQueues(0), m_numStolen(0)
+{
+}
+
+TileScheduler::~TileScheduler(void)
+{
+	if(m_queues) _aligned_free(m_queues);
+}
+
+void TileScheduler::setup(int width, int height, int tileSize, Controller::TileOrderingType ordering, int align)
+{
+	if(tileSize <= 0) tileSize = 16;
+	if(align < 1) align = 1;
+	tileSize = (tileSize + align - 1) / align * align;
+
+	m_ordering = ordering;
+
+	if(width == m_width && height == m_height && tileSize == m_tileSize && align == m_align) return;
+
+	m_width = width;
+	m_height = height;
+	m_tileSize = tileSize;
+	m_align = align;
+
+	resetTiles();
+
+	m_saliency.clear();
+	m_saliencyWidth = m_saliencyHeight = 0;
+}
+
+void TileScheduler::resetTiles()
+{
+	m_tiles.clear();
+	m_hasTimes = false;
+
+	// tiles on the right and top borders can be smaller
+	for(int startY=0;startY<m_height;startY+=m_tileSize)
+	{
+		for(int startX=0;startX<m_width;startX+=m_tileSize)
+		{
+			Tile tile;
+			tile.startX = startX;
+			tile.startY = startY;
+			tile.endX = startX + m_tileSize < m_width ? startX + m_tileSize : m_width;
+			tile.endY = startY + m_tileSize < m_height ? startY + m_tileSize : m_height;
+			tile.time = 0.0f;
+			tile.priority = 0.0;
+			m_tiles.push_back(tile);
+		}
+	}
+}
+
+void TileScheduler::updateSaliency(Image *image)
+{
+	if(!image || m_tileSize <= 0) return;
+
+	int width = (image->width + m_tileSize - 1) / m_tileSize;
+	int height = (image->height + m_tileSize - 1) / m_tileSize;
+
+	static HSaliency saliency;
+	if(saliency.m_width != width || saliency.m_height != height)
+		saliency.reset(width, height);
+	saliency.clear();
+	saliency.set(image);
+	saliency.calculate();
+
+	m_saliencyWidth = width;
+	m_saliencyHeight = height;
+	m_saliency.resize(width*height);
+	for(int y=0;y<height;y++)
+		for(int x=0;x<width;x++)
+			m_saliency[x + y*width] = saliency.getSaliency(x, y);
+}
+
+void TileScheduler::splitSlowTiles()
+{
+	if(!m_hasTimes || m_tiles.empty()) return;
+
+	double sumTime = 0.0;
+	for(size_t i=0;i<m_tiles.size();i++)
+		sumTime += m_tiles[i].time;
+
+	// per pixel, as the tiles have different sizes
+	float avgTime = (float)(sumTime / ((double)m_width * m_height));
+
+	// at most 4 times as many tiles as the initial ones
+	size_t maxTiles = 4 * (size_t)((m_width + m_tileSize - 1) / m_tileSize) * ((m_height + m_tileSize - 1) / m_tileSize);
+
+	size_t numTiles = m_tiles.size();
+	for(size_t i=0;i<numTiles && m_tiles.size() + 3 <= maxTiles;i++)
+	{
+		Tile tile = m_tiles[i];
+		int w = tile.endX - tile.startX;
+		int h = tile.endY - tile.startY;
+
+		// halves are rounded down to the alignment
+		int halfW = w / 2 / m_align * m_align;
+		int halfH = h / 2 / m_align * m_align;
+
+		if(w < 2*MIN_SPLIT_TILE_SIZE || h < 2*MIN_SPLIT_TILE_SIZE || !halfW || !halfH) continue;
+		if(tile.time <= TILE_SPLIT_THRESHOLD * avgTime * w * h) continue;
+
+		// into 4 quadrants, each has a quarter of the time
+		int midX = tile.startX + halfW;
+		int midY = tile.startY + halfH;
+
+		Tile sub = tile;
+		sub.time = tile.time * 0.25f;
+
+		sub.startX = tile.startX; sub.endX = midX; sub.startY = tile.startY; sub.endY = midY;
+		m_tiles[i] = sub;
+		sub.startX = midX; sub.endX = tile.endX;
+		m_tiles.push_back(sub);
+		sub.startX = tile.startX; sub.endX = midX; sub.startY = midY; sub.endY = tile.endY;
+		m_tiles.push_back(sub);
+		sub.startX = midX; sub.endX = tile.endX;
+		m_tiles.push_back(sub);
+	}
+}
+
+static unsigned int interleaveBits(unsigned int x)
+{
+	x &= 0x0000ffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+void TileScheduler::computePriorities()
+{
+	unsigned int seed = tea<16>(m_frame, 0);
+
+	for(size_t i=0;i<m_tiles.size();i++)
+	{
+		Tile &tile = m_tiles[i];
+		double priority = 0.0;
+
+		switch(m_ordering)
+		{
+		case Controller::RANDOM :
+			priority = rnd(seed);
+			break;
+		case Controller::ROW_BY_ROW :
+			priority = -((double)tile.startY * m_width + tile.startX);
+			break;
+		case Controller::Z_CURVE :
+			priority = -(double)(interleaveBits(tile.startX) | (interleaveBits(tile.startY) << 1));
+			break;
+		case Controller::CURSOR_GUIDED :
+			{
+				// same distance as TReX::TileElem::cursorGuided()
+				double dx = g_mouseX - tile.startX;
+				double dy = g_mouseY - tile.startY;
+				priority = -(dx*dx + dy*dy);
+			}
+			break;
+		case Controller::HIGHEST_SALIENT_TILE_FIRST :
+			if(m_saliencyWidth > 0)
+			{
+				// tiles are bottom-up, the saliency is on rows of the image
+				int x = (tile.startX + tile.endX) / 2 / m_tileSize;
+				int y = (m_height - 1 - (tile.startY + tile.endY) / 2) / m_tileSize;
+				x = x < m_saliencyWidth ? x : m_saliencyWidth - 1;
+				y = y < m_saliencyHeight ? y : m_saliencyHeight - 1;
+				priority = m_saliency[x + y*m_saliencyWidth];
+			}
+			break;
+		}
+		tile.priority = priority;
+	}
+}
+
+struct TilePriorityGreater
+{
+	const std::vector<TileScheduler::Tile> &tiles;
+	TilePriorityGreater(const std::vector<TileScheduler::Tile> &tiles) : tiles(tiles) {}
+	bool operator()(int a, int b) const {return tiles[a].priority > tiles[b].priority;}
+};
+
+void TileScheduler::distribute(int numThreads)
+{
+	splitSlowTiles();
+	computePriorities();
+	m_frame++;
+
+	int numTiles = (int)m_tiles.size();
+
+	std::vector<int> order(numTiles);
+	for(int i=0;i<numTiles;i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), TilePriorityGreater(m_tiles));
+
+	if(m_numQueues != numThreads)
+	{
+		if(m_queues) _aligned_free(m_queues);
+		m_queues = (TileQueue*)_aligned_malloc(sizeof(TileQueue)*numThreads, 64);
+		m_numQueues = numThreads;
+	}
+
+	// round-robin, so that every queue starts with high priority tiles
+	m_queuedTiles.resize(numTiles);
+	int next = 0;
+	for(int i=0;i<numThreads;i++)
+	{
+		int count = 0;
+		m_queues[i].first = next;
+		for(int j=i;j<numTiles;j+=numThreads)
+		{
+			m_queuedTiles[next++] = order[j];
+			count++;
+		}
+		m_queues[i].range = (__int64)count << 32;
+	}
+
+	m_numStolen = 0;
+}
+
+int TileScheduler::popFront(int queue)
+{
+	TileQueue &q = m_queues[queue];
+	while(true)
+	{
+		// atomic read also on 32 bit
+		__int64 range = InterlockedCompareExchange64(&q.range, 0, 0);
+		int front = (int)(range & 0xffffffff);
+		int back = (int)(range >> 32);
+		if(front >= back) return -1;
+
+		__int64 newRange = ((__int64)back << 32) | (unsigned int)(front + 1);
+		if(InterlockedCompareExchange64(&q.range, newRange, range) == range)
+			return m_queuedTiles[q.first + front];
+	}
+}
+
+int TileScheduler::popBack(int queue)
+{
+	TileQueue &q = m_queues[queue];
+	while(true)
+	{
+		// atomic read also on 32 bit
+		__int64 range = InterlockedCompareExchange64(&q.range, 0, 0);
+		int front = (int)(range & 0xffffffff);
+		int back = (int)(range >> 32);
+		if(front >= back) return -1;
+
+		__int64 newRange = ((__int64)(back - 1) << 32) | (unsigned int)front;
+		if(InterlockedCompareExchange64(&q.range, newRange, range) == range)
+			return m_queuedTiles[q.first + back - 1];
+	}
+}
+
+int TileScheduler::nextTile(int thread)
+{
+	int tileIndex = popFront(thread);
+	if(tileIndex >= 0) return tileIndex;
+
+	// steal the lowest priority tile of another queue
+	for(int i=1;i<m_numQueues;i++)
+	{
+		tileIndex = popBack((thread + i) % m_numQueues);
+		if(tileIndex >= 0)
+		{
+			InterlockedIncrement(&m_numStolen);
+			return tileIndex;
+		}
+	}
+	return -1;
+}
+
+double TileScheduler::run(RenderTileCallBack func, void *data)
+{
+	int numThreads = omp_get_max_threads();
+
+	distribute(numThreads);
+
+	// a cache line per thread
+	std::vector<double> sum(numThreads*8, 0.0);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+#	pragma omp parallel num_threads(numThreads)
+	{
+		// fewer threads can be given, their queues are stolen then
+		int thread = omp_get_thread_num();
+		int tileIndex;
+		while((tileIndex = nextTile(thread)) >= 0)
+		{
+			Tile &tile = m_tiles[tileIndex];
+
+			LARGE_INTEGER start, end;
+			QueryPerformanceCounter(&start);
+			sum[thread*8] += func(tile, data);
+			QueryPerformanceCounter(&end);
+
+			tile.time = (float)((end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
+		}
+	}
+
+	m_hasTimes = true;
+
+	double total = 0.0;
+	for(int i=0;i<numThreads;i++)
+		total += sum[i*8];
+	return total;
+}
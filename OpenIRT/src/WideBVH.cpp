@@ -0,0 +1,362 @@
+#include "CommonOptions.h"
+#include "defines.h"
+
+#include <io.h>
+#include <float.h>
+#include <xmmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include <stopwatch.h>
+#include "Model.h"
+#include "WideBVH.h"
+
+using namespace irt;
+
+template <int N>
+WideBVH<N>::WideBVH(void)
+	: m_nodes(0), m_numNodes(0), m_maxNumNodes(0), m_maxDepth(0)
+{
+}
+
+template <int N>
+WideBVH<N>::~WideBVH(void)
+{
+	clear();
+}
+
+template <int N>
+void WideBVH<N>::clear()
+{
+	if(m_nodes) _aligned_free(m_nodes);
+	m_nodes = NULL;
+	m_numNodes = m_maxNumNodes = m_maxDepth = 0;
+}
+
+template <int N>
+unsigned int WideBVH<N>::allocNode()
+{
+	if(m_numNodes == m_maxNumNodes)
+	{
+		int newMaxNumNodes = m_maxNumNodes ? m_maxNumNodes*2 : 1024;
+		Node *newNodes = (Node*)_aligned_malloc(newMaxNumNodes*sizeof(Node), 32);
+		if(m_nodes)
+		{
+			memcpy(newNodes, m_nodes, m_numNodes*sizeof(Node));
+			_aligned_free(m_nodes);
+		}
+		m_nodes = newNodes;
+		m_maxNumNodes = newMaxNumNodes;
+	}
+
+	Node &node = m_nodes[m_numNodes];
+	for(int i=0;i<N;i++)
+	{
+		for(int j=0;j<3;j++)
+		{
+			node.bounds[j][i] = FLT_MAX;
+			node.bounds[j+3][i] = -FLT_MAX;
+		}
+		node.child[i] = EMPTY;
+		node.count[i] = 0;
+	}
+	return m_numNodes++;
+}
+
+template <int N>
+float WideBVH<N>::getArea(const BVHNode *node)
+{
+	Vector3 d = node->max - node->min;
+	return d.e[0]*d.e[1] + d.e[1]*d.e[2] + d.e[2]*d.e[0];
+}
+
+template <int N>
+unsigned int WideBVH<N>::collapse(const BVHNode *nodes, unsigned int binaryIndex, int depth)
+{
+	if(depth > m_maxDepth) m_maxDepth = depth;
+
+	unsigned int myIndex = allocNode();
+
+	unsigned int children[N];
+	int numChildren = 0;
+
+	const BVHNode *root = &nodes[binaryIndex];
+	if((root->left & 3) == 3)
+	{
+		children[numChildren++] = binaryIndex;
+	}
+	else
+	{
+		children[numChildren++] = root->left >> 2;
+		children[numChildren++] = root->right >> 2;
+	}
+
+	// open the inner child having the largest surface area until we have N children
+	while(numChildren < N)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+		for(int i=0;i<numChildren;i++)
+		{
+			const BVHNode *child = &nodes[children[i]];
+			if((child->left & 3) == 3) continue;
+
+			float area = getArea(child);
+			if(area > bestArea)
+			{
+				bestArea = area;
+				best = i;
+			}
+		}
+
+		if(best < 0) break;
+
+		const BVHNode *child = &nodes[children[best]];
+		children[best] = child->left >> 2;
+		children[numChildren++] = child->right >> 2;
+	}
+
+	for(int i=0;i<numChildren;i++)
+	{
+		const BVHNode *child = &nodes[children[i]];
+		unsigned int childIndex, count;
+
+		if((child->left & 3) == 3)
+		{
+			count = child->left >> 2;
+			childIndex = child->right;
+			if(count == 0) continue;
+		}
+		else
+		{
+			childIndex = collapse(nodes, children[i], depth+1);
+			count = 0;
+		}
+
+		// m_nodes can be reallocated by the recursion
+		Node &node = m_nodes[myIndex];
+		for(int j=0;j<3;j++)
+		{
+			node.bounds[j][i] = child->min.e[j];
+			node.bounds[j+3][i] = child->max.e[j];
+		}
+		node.child[i] = childIndex;
+		node.count[i] = count;
+	}
+
+	return myIndex;
+}
+
+template <int N>
+bool WideBVH<N>::build(const BVHNode *nodes, int numNodes)
+{
+	clear();
+
+	if(!nodes || numNodes <= 0) return false;
+
+	static int timer = StopWatch::create();
+	StopWatch::get(timer).reset();
+	StopWatch::get(timer).start();
+
+	collapse(nodes, 0, 1);
+
+	StopWatch::get(timer).stop();
+
+	// every level can leave N-1 entries on the traversal stack
+	if(m_maxDepth*(N-1) + 1 > STACK_SIZE)
+	{
+		printf("Wide BVH (%d-ary) : too deep (%d levels), use binary BVH\n", N, m_maxDepth);
+		clear();
+		return false;
+	}
+
+	printf("Wide BVH (%d-ary) : %d nodes from %d binary nodes, %d levels, %f ms\n", N, m_numNodes, numNodes, m_maxDepth, StopWatch::get(timer).getTime());
+
+	return true;
+}
+
+template <int N>
+bool WideBVH<N>::build(const char *nodeFileName)
+{
+	errno_t err;
+	FILE *fpNode;
+
+	if(err = fopen_s(&fpNode, nodeFileName, "rb"))
+	{
+		printf("File open error [%d] : %s\n", err, nodeFileName);
+		return false;
+	}
+
+	__int64 sizeNode = _filelengthi64(_fileno(fpNode));
+	int numNodes = (int)(sizeNode / sizeof(BVHNode));
+
+	BVHNode *nodes = new BVHNode[numNodes];
+
+	if(!fread(nodes, (size_t)sizeNode, 1, fpNode))
+	{
+		printf("Read file error : %s\n", nodeFileName);
+		fclose(fpNode);
+		delete[] nodes;
+		return false;
+	}
+	fclose(fpNode);
+
+	bool ret = build(nodes, numNodes);
+
+	delete[] nodes;
+
+	return ret;
+}
+
+template <int N>
+int WideBVH<N>::intersectChildren(const Node *node, const Ray &ray, float tHit, float *tNear, float *tFar)
+{
+	int mask = 0;
+	for(int i=0;i<N;i++)
+	{
+		float t0 = -FLT_MAX, t1 = FLT_MAX;
+		for(int a=0;a<3;a++)
+		{
+			int nearIdx = ray.posneg[a] ? a : a+3;
+			int farIdx = ray.posneg[a] ? a+3 : a;
+			float tn = (node->bounds[nearIdx][i] - ray.data[0].e[a]) * ray.data[2].e[a];
+			float tf = (node->bounds[farIdx][i] - ray.data[0].e[a]) * ray.data[2].e[a];
+			t0 = tn > t0 ? tn : t0;
+			t1 = tf < t1 ? tf : t1;
+		}
+		tNear[i] = t0;
+		tFar[i] = t1;
+		if(t0 <= t1 && t0 < tHit && t1 > 0.000005f) mask |= 1 << i;
+	}
+	return mask;
+}
+
+// 4 children with SSE
+template <>
+int WideBVH<4>::intersectChildren(const Node *node, const Ray &ray, float tHit, float *tNear, float *tFar)
+{
+	__m128 t0 = _mm_set1_ps(-FLT_MAX);
+	__m128 t1 = _mm_set1_ps(FLT_MAX);
+	for(int a=0;a<3;a++)
+	{
+		int nearIdx = ray.posneg[a] ? a : a+3;
+		int farIdx = ray.posneg[a] ? a+3 : a;
+		__m128 org = _mm_set1_ps(ray.data[0].e[a]);
+		__m128 invDir = _mm_set1_ps(ray.data[2].e[a]);
+		t0 = _mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node->bounds[nearIdx]), org), invDir));
+		t1 = _mm_min_ps(t1, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node->bounds[farIdx]), org), invDir));
+	}
+	_mm_store_ps(tNear, t0);
+	_mm_store_ps(tFar, t1);
+
+	__m128 hit = _mm_and_ps(_mm_cmple_ps(t0, t1),
+		_mm_and_ps(_mm_cmplt_ps(t0, _mm_set1_ps(tHit)), _mm_cmpgt_ps(t1, _mm_set1_ps(0.000005f))));
+	return _mm_movemask_ps(hit);
+}
+
+#ifdef __AVX__
+// 8 children with AVX
+template <>
+int WideBVH<8>::intersectChildren(const Node *node, const Ray &ray, float tHit, float *tNear, float *tFar)
+{
+	__m256 t0 = _mm256_set1_ps(-FLT_MAX);
+	__m256 t1 = _mm256_set1_ps(FLT_MAX);
+	for(int a=0;a<3;a++)
+	{
+		int nearIdx = ray.posneg[a] ? a : a+3;
+		int farIdx = ray.posneg[a] ? a+3 : a;
+		__m256 org = _mm256_set1_ps(ray.data[0].e[a]);
+		__m256 invDir = _mm256_set1_ps(ray.data[2].e[a]);
+		t0 = _mm256_max_ps(t0, _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node->bounds[nearIdx]), org), invDir));
+		t1 = _mm256_min_ps(t1, _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node->bounds[farIdx]), org), invDir));
+	}
+	_mm256_store_ps(tNear, t0);
+	_mm256_store_ps(tFar, t1);
+
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ),
+		_mm256_and_ps(_mm256_cmp_ps(t0, _mm256_set1_ps(tHit), _CMP_LT_OQ), _mm256_cmp_ps(t1, _mm256_set1_ps(0.000005f), _CMP_GT_OQ)));
+	return _mm256_movemask_ps(hit);
+}
+#endif
+
+template <int N>
+bool WideBVH<N>::getIntersection(Model *model, const Ray &ray, HitPointInfo &hitPointInfo, float tLimit)
+{
+	if(!m_nodes) return false;
+
+	typedef struct
+	{
+		unsigned int index;
+		float tNear;
+	} StackElem;
+
+	StackElem stack[STACK_SIZE];
+	int stackPtr = 0;
+	bool hasHit = false;
+
+	__declspec(align(32)) float tNear[N];
+	__declspec(align(32)) float tFar[N];
+
+	stack[stackPtr].index = 0;
+	stack[stackPtr++].tNear = -FLT_MAX;
+
+	while(stackPtr > 0)
+	{
+		// fetch next node from stack, skip it if a closer hit was found after it was pushed
+		--stackPtr;
+		if(stack[stackPtr].tNear >= hitPointInfo.t) continue;
+
+		const Node *node = &m_nodes[stack[stackPtr].index];
+
+		int mask = intersectChildren(node, ray, hitPointInfo.t, tNear, tFar);
+		if(!mask) continue;
+
+		// inner children sorted by distance
+		unsigned int inner[N];
+		float innerT[N];
+		int numInner = 0;
+
+		for(int i=0;i<N;i++)
+		{
+			if(!(mask & (1 << i))) continue;
+
+			if(node->count[i])
+			{
+				// intersect with triangles of the leaf
+				BVHNode leaf;
+				leaf.left = (node->count[i] << 2) | 3;
+				leaf.right = node->child[i];
+
+				float tmax = tFar[i] < hitPointInfo.t ? tFar[i] : hitPointInfo.t;
+				hasHit = model->getIntersection(ray, &leaf, hitPointInfo, tmax) || hasHit;
+				if(tLimit > 0.0f && hasHit)
+				{
+					if(hitPointInfo.t < tLimit) return true;
+				}
+				continue;
+			}
+
+			int pos = numInner++;
+			while(pos > 0 && innerT[pos-1] > tNear[i])
+			{
+				inner[pos] = inner[pos-1];
+				innerT[pos] = innerT[pos-1];
+				pos--;
+			}
+			inner[pos] = node->child[i];
+			innerT[pos] = tNear[i];
+		}
+
+		// push far children first so that the nearest one is visited next
+		for(int i=numInner-1;i>=0;i--)
+		{
+			stack[stackPtr].index = inner[i];
+			stack[stackPtr++].tNear = innerT[i];
+		}
+	}
+
+	return hasHit;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -1,21 +1,173 @@
+#include <stdio.h>
+#include <string.h>
 #include "OpenIRT.h"
 #include "ImageIL.h"
+#include "CPUPathTracer.h"
+#include "Scene.h"
+#include "stopwatch.h"
 
-void main(void)
+// reports primary rays per second of the CPU ray tracer in single ray and packet modes
+void benchmarkCPURayTracer(OpenIRT *renderer, irt::Image *img, int numFrames)
+{
+	renderer->init(RendererType::CPU_RAY_TRACER, img->width, img->height);
+	Controller &control = *renderer->getController();
+
+	for(int mode=0;mode<2;mode++)
+	{
+		control.useRayPackets = mode == 1;
+
+		// warm up
+		renderer->render(img);
+
+		float totalTime = 0.0f;
+		for(int i=0;i<numFrames;i++)
+		{
+			renderer->render(img);
+			totalTime += renderer->getCurrentFrameTime();
+		}
+
+		float rays = (float)img->width * img->height * numFrames;
+		printf("CPU ray tracer [%s] : %f ms/frame, %f MRays/s\n", control.useRayPackets ? "packet" : "single ray",
+			totalTime / numFrames, rays / (totalTime * 1000.0f));
+	}
+}
+
+// reports paths (samples) and rays per second of the CPU path tracer
+void benchmarkCPUPathTracer(OpenIRT *renderer, irt::Image *img, int numFrames, int samplesPerFrame)
+{
+	renderer->init(RendererType::CPU_PATH_TRACER, img->width, img->height);
+	Controller &control = *renderer->getController();
+	control.pathLength = 2;
+	control.numShadowRays = 1;
+	renderer->controllerUpdated();
+
+	irt::CPUPathTracer *pathTracer = (irt::CPUPathTracer*)renderer->getRenderer();
+
+	// warm up
+	renderer->render(img);
+
+	float totalTime = 0.0f;
+	float totalRays = 0.0f;
+	for(int i=0;i<numFrames;i++)
+	{
+		renderer->render(NULL, UINT_MAX, samplesPerFrame);
+		totalTime += renderer->getCurrentFrameTime();
+		totalRays += pathTracer->getRaysPerSecond() * renderer->getCurrentFrameTime() * 0.001f;
+	}
+	renderer->flushImage(img);
+	img->writeToFile("result_pt.png");
+
+	float samples = (float)img->width * img->height * samplesPerFrame * numFrames;
+	printf("CPU path tracer : %f ms/frame (%d spp), %f MSamples/s, %f MRays/s\n", totalTime / numFrames, samplesPerFrame,
+		samples / (totalTime * 1000.0f), totalRays / (totalTime * 1000.0f));
+}
+
+// reports material lookups per second of the hits of primary rays,
+// Model::getMaterial(hit) (copy of Material per hit) versus ShadingMaterialTable.
+// Both look up the textured Ka and Kd.
+void benchmarkShading(OpenIRT *renderer, irt::Image *img, int numRounds)
+{
+	irt::Scene *scene = renderer->getCurrentScene();
+	irt::Camera *camera = renderer->getCurrentCamera();
+	int width = img->width, height = img->height;
+
+	std::vector<irt::HitPointInfo> hits(width*height);
+	std::vector<char> hasHit(width*height);
+	int stream = scene->getIntersectionStream();
+
+#	pragma omp parallel for schedule(dynamic)
+	for(int y=0;y<height;y++)
+	{
+		irt::Ray ray;
+		for(int x=0;x<width;x++)
+		{
+			irt::HitPointInfo &hit = hits[x+y*width];
+			camera->getRayWithOrigin(ray, (x + 0.5f) / width, (y + 0.5f) / height);
+			hit.t = FLT_MAX;
+			hasHit[x+y*width] = scene->getIntersection(ray, hit, 0.0f, stream) && hit.modelPtr;
+		}
+	}
+
+	const irt::ShadingMaterialTable &mats = scene->getShadingMaterials();
+	int timer = StopWatch::create();
+
+	for(int mode=0;mode<2;mode++)
+	{
+		float sum = 0.0f;
+		__int64 numLookups = 0;
+
+		StopWatch::get(timer).reset();
+		StopWatch::get(timer).start();
+
+		for(int round=0;round<numRounds;round++)
+		{
+#			pragma omp parallel for schedule(static) reduction(+:sum, numLookups)
+			for(int i=0;i<width*height;i++)
+			{
+				if(!hasHit[i]) continue;
+
+				const irt::HitPointInfo &hit = hits[i];
+				RGBf Ka, Kd;
+				if(mode == 0)
+				{
+					irt::Material mat = hit.modelPtr->getMaterial(hit);
+					Ka = mat.getMatKa();
+					Kd = mat.getMatKd();
+				}
+				else
+				{
+					int idx = mats.getIndex(hit);
+					Ka = mats.getKa(idx, hit.uv);
+					Kd = mats.getKd(idx, hit.uv);
+				}
+				sum += Ka.r() + Ka.g() + Ka.b() + Kd.r() + Kd.g() + Kd.b();
+				numLookups++;
+			}
+		}
+
+		StopWatch::get(timer).stop();
+		float time = StopWatch::get(timer).getTime();
+		printf("shading material [%s] : %f ms, %f MLookups/s (checksum %f)\n", mode == 0 ? "Model::getMaterial" : "ShadingMaterialTable",
+			time, numLookups / (time * 1000.0f), sum);
+	}
+}
+
+void main(int argc, char **argv)
 {
 	int width = 512, height = 512;
 
 	OpenIRT *renderer = OpenIRT::getSingletonPtr();
-	renderer->pushCamera("Camera1", 
-			220.0f, 380.0f, -10.0f, 
+	renderer->pushCamera("Camera1",
+			220.0f, 380.0f, -10.0f,
 			0.0f, 380.0f, -10.0f,
 			0.0f, 1.0f, 0.0f,
 			72.0f, 1.0f, 1.0f, 100000.0f);
 	renderer->loadScene("..\\media\\sponza.scene");
+	irt::ImageIL img(width, height, 4);
+
+	if(argc > 1 && strcmp(argv[1], "-bench") == 0)
+	{
+		benchmarkCPURayTracer(renderer, &img, 10);
+		renderer->doneRenderer();
+		return;
+	}
+
+	if(argc > 1 && strcmp(argv[1], "-benchshade") == 0)
+	{
+		benchmarkShading(renderer, &img, 20);
+		return;
+	}
+
+	if(argc > 1 && strcmp(argv[1], "-benchpt") == 0)
+	{
+		benchmarkCPUPathTracer(renderer, &img, 10, 4);
+		renderer->doneRenderer();
+		return;
+	}
+
 	renderer->init(RendererType::CUDA_PATH_TRACER, width, height);
 	Controller &control = *renderer->getController();
 	control.drawBackground = true;
-	irt::ImageIL img(width, height, 4);
 	renderer->render(&img);
 	img.writeToFile("result.png");
 	renderer->doneRenderer();